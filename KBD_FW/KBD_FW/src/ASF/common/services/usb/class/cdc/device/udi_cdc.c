@@ -1005,6 +1005,59 @@ iram_size_t udi_cdc_read_no_polling(void* buf, iram_size_t size)
 	return udi_cdc_multi_read_no_polling(0, buf, size);
 }
 
+const uint8_t* udi_cdc_multi_get_rx_buffer(uint8_t port, iram_size_t* size)
+{
+	uint16_t pos;
+	uint8_t buf_sel;
+	irqflags_t flags;
+
+#if UDI_CDC_PORT_NB == 1 // To optimize code
+	port = 0;
+#endif
+
+	*size = 0;
+	if (!udi_cdc_data_running) {
+		return NULL;
+	}
+	flags = cpu_irq_save(); // to protect udi_cdc_rx_pos & udi_cdc_rx_buf_sel
+	pos = udi_cdc_rx_pos[port];
+	buf_sel = udi_cdc_rx_buf_sel[port];
+	*size = udi_cdc_rx_buf_nb[port][buf_sel] - pos;
+	cpu_irq_restore(flags);
+	if (!*size) {
+		return NULL;
+	}
+	// The bank is not given back to the endpoint until all of it is consumed
+	return &udi_cdc_rx_buf[port][buf_sel][pos];
+}
+
+const uint8_t* udi_cdc_get_rx_buffer(iram_size_t* size)
+{
+	return udi_cdc_multi_get_rx_buffer(0, size);
+}
+
+void udi_cdc_multi_rx_consume(uint8_t port, iram_size_t size)
+{
+	irqflags_t flags;
+
+#if UDI_CDC_PORT_NB == 1 // To optimize code
+	port = 0;
+#endif
+
+	if (!size) {
+		return;
+	}
+	flags = cpu_irq_save(); // to protect udi_cdc_rx_pos
+	udi_cdc_rx_pos[port] += size;
+	cpu_irq_restore(flags);
+	udi_cdc_rx_start(port);
+}
+
+void udi_cdc_rx_consume(iram_size_t size)
+{
+	udi_cdc_multi_rx_consume(0, size);
+}
+
 iram_size_t udi_cdc_read_buf(void* buf, iram_size_t size)
 {
 	return udi_cdc_multi_read_buf(0, buf, size);
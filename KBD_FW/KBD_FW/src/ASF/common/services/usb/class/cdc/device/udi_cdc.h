@@ -420,6 +420,25 @@ iram_size_t udi_cdc_read_buf(void* buf, iram_size_t size);
  */
 iram_size_t udi_cdc_read_no_polling(void* buf, iram_size_t size);
 
+/**
+ * \brief Gives access to the received data without copying it
+ *
+ * The data stays valid until udi_cdc_rx_consume() is called. Values are
+ * bytes, 9-bit data is not decoded.
+ *
+ * \param size      Number of bytes available at the returned address
+ *
+ * \return the received data, NULL if none
+ */
+const uint8_t* udi_cdc_get_rx_buffer(iram_size_t* size);
+
+/**
+ * \brief Releases data returned by udi_cdc_get_rx_buffer()
+ *
+ * \param size      Number of bytes used, at most the size returned
+ */
+void udi_cdc_rx_consume(iram_size_t size);
+
 /**
  * \brief Gets the number of free byte in TX buffer
  *
@@ -536,6 +555,27 @@ int udi_cdc_multi_getc(uint8_t port);
  */
 iram_size_t udi_cdc_multi_read_buf(uint8_t port, void* buf, iram_size_t size);
 
+/**
+ * \brief Gives access to the received data without copying it
+ *
+ * The data stays valid until udi_cdc_multi_rx_consume() is called. Values
+ * are bytes, 9-bit data is not decoded.
+ *
+ * \param port      Communication port number to manage
+ * \param size      Number of bytes available at the returned address
+ *
+ * \return the received data, NULL if none
+ */
+const uint8_t* udi_cdc_multi_get_rx_buffer(uint8_t port, iram_size_t* size);
+
+/**
+ * \brief Releases data returned by udi_cdc_multi_get_rx_buffer()
+ *
+ * \param port      Communication port number to manage
+ * \param size      Number of bytes used, at most the size returned
+ */
+void udi_cdc_multi_rx_consume(uint8_t port, iram_size_t size);
+
 /**
  * \brief Gets the number of free byte in TX buffer
  *
@@ -93,6 +93,24 @@ UDC_DESC_STORAGE udi_api_t udi_api_hid_kbd = {
 //! Size of report for standard HID keyboard
 #define UDI_HID_KBD_REPORT_SIZE  8
 
+//! Size of keyboard state: modifier byte followed by one bit per key usage,
+//! or the boot report itself without N-key rollover
+#ifdef UDI_HID_KBD_NKRO
+#  define UDI_HID_KBD_STATE_SIZE  (1 + UDI_HID_KBD_KEY_COUNT / 8)
+#else
+#  define UDI_HID_KBD_STATE_SIZE  UDI_HID_KBD_REPORT_SIZE
+#endif
+
+//! Size of a bitmap holding one bit for each of the 256 usages
+#define UDI_HID_KBD_USAGE_MAP_SIZE  (256 / 8)
+
+//! Values of udi_hid_kbd_protocol selected by SET_PROTOCOL
+#define UDI_HID_KBD_PROTOCOL_BOOT    0
+#define UDI_HID_KBD_PROTOCOL_REPORT  1
+
+//! Usage reported in all key slots of the boot report when too many keys are pressed
+#define UDI_HID_KBD_ERROR_ROLLOVER   0x01
+
 
 //! To store current rate of HID keyboard
 COMPILER_WORD_ALIGNED
@@ -103,19 +121,68 @@ COMPILER_WORD_ALIGNED
 //! To store report feedback from USB host
 COMPILER_WORD_ALIGNED
 		static uint8_t udi_hid_kbd_report_set;
-//! To signal if a valid report is ready to send
+//! To signal if the keyboard state changed since it was last queued
 static bool udi_hid_kbd_b_report_valid;
-//! Report ready to send
-static uint8_t udi_hid_kbd_report[UDI_HID_KBD_REPORT_SIZE];
+//! Current keyboard state, updated by the application
+static uint8_t udi_hid_kbd_report[UDI_HID_KBD_STATE_SIZE];
+//! Usages changed since the keyboard state was last queued, one bit each
+static uint8_t udi_hid_kbd_usage_changed[UDI_HID_KBD_USAGE_MAP_SIZE];
+//! Keyboard states waiting to be sent, head entry is the one in transfer
+static uint8_t udi_hid_kbd_report_queue[UDI_HID_KBD_REPORT_QUEUE_SIZE]
+		[UDI_HID_KBD_STATE_SIZE];
+//! Index of the oldest keyboard state in the queue
+static uint8_t udi_hid_kbd_report_queue_head;
+//! Number of keyboard states in the queue
+static uint8_t udi_hid_kbd_report_queue_count;
+//! Largest number of keyboard states held by the queue
+static uint8_t udi_hid_kbd_report_queue_high_water;
 //! Signal if a report transfer is on going
 static bool udi_hid_kbd_b_report_trans_ongoing;
+//! Number of frames where a changed state could not be armed
+static uint32_t udi_hid_kbd_missed_frames;
 //! Buffer used to send report
 COMPILER_WORD_ALIGNED
 		static uint8_t
-		udi_hid_kbd_report_trans[UDI_HID_KBD_REPORT_SIZE];
+		udi_hid_kbd_report_trans[UDI_HID_KBD_EP_SIZE];
 
 //@}
 
+#ifdef UDI_HID_KBD_NKRO
+//! HID report descriptor for N-key rollover HID keyboard
+UDC_DESC_STORAGE udi_hid_kbd_report_desc_t udi_hid_kbd_report_desc = {
+	{
+				0x05, 0x01,	/* Usage Page (Generic Desktop)      */
+				0x09, 0x06,	/* Usage (Keyboard)                  */
+				0xA1, 0x01,	/* Collection (Application)          */
+				0x05, 0x07,	/* Usage Page (Keyboard)             */
+				0x19, 224,	/* Usage Minimum (224)               */
+				0x29, 231,	/* Usage Maximum (231)               */
+				0x15, 0x00,	/* Logical Minimum (0)               */
+				0x25, 0x01,	/* Logical Maximum (1)               */
+				0x75, 0x01,	/* Report Size (1)                   */
+				0x95, 0x08,	/* Report Count (8)                  */
+				0x81, 0x02,	/* Input (Data, Variable, Absolute)  */
+				0x19, 0x00,	/* Usage Minimum (0)                 */
+				0x29, UDI_HID_KBD_KEY_COUNT - 1,
+						/* Usage Maximum (119)               */
+				0x15, 0x00,	/* Logical Minimum (0)               */
+				0x25, 0x01,	/* Logical Maximum (1)               */
+				0x75, 0x01,	/* Report Size (1)                   */
+				0x95, UDI_HID_KBD_KEY_COUNT,
+						/* Report Count (120)                */
+				0x81, 0x02,	/* Input (Data, Variable, Absolute)  */
+				0x05, 0x08,	/* Usage Page (LED)                  */
+				0x19, 0x01,	/* Usage Minimum (1)                 */
+				0x29, 0x05,	/* Usage Maximum (5)                 */
+				0x75, 0x01,	/* Report Size (1)                   */
+				0x95, 0x05,	/* Report Count (5)                  */
+				0x91, 0x02,	/* Output (Data, Variable, Absolute) */
+				0x95, 0x03,	/* Report Count (3)                  */
+				0x91, 0x01,	/* Output (Constant)                 */
+				0xC0	/* End Collection                    */
+			}
+};
+#else
 //! HID report descriptor for standard HID keyboard
 UDC_DESC_STORAGE udi_hid_kbd_report_desc_t udi_hid_kbd_report_desc = {
 	{
@@ -132,9 +199,11 @@ UDC_DESC_STORAGE udi_hid_kbd_report_desc_t udi_hid_kbd_report_desc = {
 				0x81, 0x02,	/* Input (Data, Variable, Absolute)  */
 				0x81, 0x01,	/* Input (Constant)                  */
 				0x19, 0x00,	/* Usage Minimum (0)                 */
-				0x29, 101,	/* Usage Maximum (101)               */
+				0x29, UDI_HID_KBD_KEY_COUNT - 1,
+						/* Usage Maximum (119)               */
 				0x15, 0x00,	/* Logical Minimum (0)               */
-				0x25, 101,	/* Logical Maximum (101)             */
+				0x25, UDI_HID_KBD_KEY_COUNT - 1,
+						/* Logical Maximum (119)             */
 				0x75, 0x08,	/* Report Size (8)                   */
 				0x95, 0x06,	/* Report Count (6)                  */
 				0x81, 0x00,	/* Input (Data, Array)               */
@@ -151,6 +220,7 @@ UDC_DESC_STORAGE udi_hid_kbd_report_desc_t udi_hid_kbd_report_desc = {
 				0xC0	/* End Collection                    */
 			}
 };
+#endif
 
 /**
  * \name Internal routines
@@ -165,6 +235,61 @@ UDC_DESC_STORAGE udi_hid_kbd_report_desc_t udi_hid_kbd_report_desc = {
  */
 static bool udi_hid_kbd_setreport(void);
 
+/**
+ * \brief Applies a change to the keyboard state
+ *
+ * Changes are gathered in the current state until one of them touches a usage
+ * already changed since the state was last queued. The current state is then
+ * queued first, so the host sees both transitions.
+ *
+ * \param index    Group of 8 usages to change, usage / 8
+ * \param mask     Usages of the group to change, bit usage % 8
+ * \param b_set    \c 1 to press the usages, \c 0 to release them
+ *
+ * \return \c 1 if function was successfully done, \c 0 if the queue or the
+ * key array of the boot report is full.
+ */
+static bool udi_hid_kbd_change(uint8_t index, uint8_t mask, bool b_set);
+
+/**
+ * \brief Gets the usages of a group pressed in the current keyboard state
+ *
+ * \param index    Group of 8 usages, usage / 8
+ *
+ * \return one bit per usage pressed, bit usage % 8.
+ */
+static uint8_t udi_hid_kbd_state_get(uint8_t index);
+
+/**
+ * \brief Presses or releases usages of a group in the current keyboard state
+ *
+ * \param index    Group of 8 usages, usage / 8
+ * \param mask     Usages to change, all in the other state
+ * \param b_set    \c 1 to press the usages, \c 0 to release them
+ *
+ * \return \c 1 if function was successfully done, \c 0 if the key array of the
+ * boot report is full.
+ */
+static bool udi_hid_kbd_state_set(uint8_t index, uint8_t mask, bool b_set);
+
+/**
+ * \brief Appends the current keyboard state to the report queue
+ *
+ * \return \c 1 if the state is queued, \c 0 if the queue is full.
+ */
+static bool udi_hid_kbd_queue_push(void);
+
+#ifdef UDI_HID_KBD_NKRO
+/**
+ * \brief Encodes a keyboard state into an 8-byte boot report
+ *
+ * \param report    Buffer receiving the report
+ * \param state     Keyboard state to encode
+ */
+static void udi_hid_kbd_encode_boot_report(uint8_t *report,
+		const uint8_t *state);
+#endif
+
 /**
  * \brief Send the report
  *
@@ -200,10 +325,15 @@ bool udi_hid_kbd_enable(void)
 {
 	// Initialize internal values
 	udi_hid_kbd_rate = 0;
-	udi_hid_kbd_protocol = 0;
+	udi_hid_kbd_protocol = UDI_HID_KBD_PROTOCOL_REPORT;
 	udi_hid_kbd_b_report_trans_ongoing = false;
-	memset(udi_hid_kbd_report, 0, UDI_HID_KBD_REPORT_SIZE);
+	memset(udi_hid_kbd_report, 0, UDI_HID_KBD_STATE_SIZE);
+	memset(udi_hid_kbd_usage_changed, 0, UDI_HID_KBD_USAGE_MAP_SIZE);
 	udi_hid_kbd_b_report_valid = false;
+	udi_hid_kbd_report_queue_head = 0;
+	udi_hid_kbd_report_queue_count = 0;
+	udi_hid_kbd_report_queue_high_water = 0;
+	udi_hid_kbd_missed_frames = 0;
 	return UDI_HID_KBD_ENABLE_EXT();
 }
 
@@ -249,124 +379,240 @@ static bool udi_hid_kbd_setreport(void)
 
 bool udi_hid_kbd_modifier_up(uint8_t modifier_id)
 {
-	irqflags_t flags = cpu_irq_save();
+	return udi_hid_kbd_change(UDI_HID_KBD_MODIFIER_USAGE_MIN / 8,
+			modifier_id, false);
+}
 
-	// Fill report
-	udi_hid_kbd_report[0] &= ~(unsigned)modifier_id;
-	udi_hid_kbd_b_report_valid = true;
 
-	// Send report
-	udi_hid_kbd_send_report();
+bool udi_hid_kbd_modifier_down(uint8_t modifier_id)
+{
+	return udi_hid_kbd_change(UDI_HID_KBD_MODIFIER_USAGE_MIN / 8,
+			modifier_id, true);
+}
 
-	cpu_irq_restore(flags);
-	return true;
+
+bool udi_hid_kbd_up(uint8_t key_id)
+{
+	if (!UDI_HID_KBD_USAGE_IS_VALID(key_id) || (0 == key_id)) {
+		// Never pressed
+		return true;
+	}
+	return udi_hid_kbd_change(key_id / 8, 1 << (key_id % 8), false);
 }
 
 
-bool udi_hid_kbd_modifier_down(uint8_t modifier_id)
+bool udi_hid_kbd_down(uint8_t key_id)
 {
-	irqflags_t flags = cpu_irq_save();
+	if (!UDI_HID_KBD_USAGE_IS_VALID(key_id) || (0 == key_id)) {
+		// No key, or no room for it in the report: dropped
+		return true;
+	}
+	return udi_hid_kbd_change(key_id / 8, 1 << (key_id % 8), true);
+}
 
-	// Fill report
-	udi_hid_kbd_report[0] |= modifier_id;
-	udi_hid_kbd_b_report_valid = true;
 
-	// Send report
-	udi_hid_kbd_send_report();
+void udi_hid_kbd_report_flush(void)
+{
+	irqflags_t flags = cpu_irq_save();
+
+	if ((udi_hid_kbd_b_report_valid || udi_hid_kbd_report_queue_count)
+			&& !udi_hid_kbd_send_report()) {
+		// Previous report not yet polled by the host
+		udi_hid_kbd_missed_frames++;
+	}
 
 	cpu_irq_restore(flags);
-	return true;
 }
 
 
-bool udi_hid_kbd_up(uint8_t key_id)
+uint32_t udi_hid_kbd_get_missed_frames(void)
+{
+	return udi_hid_kbd_missed_frames;
+}
+
+
+uint8_t udi_hid_kbd_get_queue_depth(void)
 {
-	uint8_t i;
+	return udi_hid_kbd_report_queue_count;
+}
+
+
+uint8_t udi_hid_kbd_get_queue_high_water(void)
+{
+	return udi_hid_kbd_report_queue_high_water;
+}
 
+
+//--------------------------------------------
+//------ Internal routines
+
+static bool udi_hid_kbd_change(uint8_t index, uint8_t mask, bool b_set)
+{
 	irqflags_t flags = cpu_irq_save();
 
-	// Fill report
-	for (i = 2; i < UDI_HID_KBD_REPORT_SIZE; i++) {
-		if (0 == udi_hid_kbd_report[i]) {
-			// Already removed
+	mask = b_set ? (mask & ~udi_hid_kbd_state_get(index))
+			: (mask & udi_hid_kbd_state_get(index));
+	if (!mask) {
+		// Already in this state
+		cpu_irq_restore(flags);
+		return true;
+	}
+	if (udi_hid_kbd_usage_changed[index] & mask) {
+		// Second transition since the last queued state, keep the first one
+		if (!udi_hid_kbd_queue_push()) {
 			cpu_irq_restore(flags);
-			return true;
+			return false;
 		}
-		if (key_id == udi_hid_kbd_report[i])
-			break;
 	}
-	if (UDI_HID_KBD_REPORT_SIZE == i) {
-		// Already removed
+
+	// Fill report
+	if (!udi_hid_kbd_state_set(index, mask, b_set)) {
 		cpu_irq_restore(flags);
-		return true;
-	}
-	// Remove key and shift
-	while (i < (UDI_HID_KBD_REPORT_SIZE - 1)) {
-		udi_hid_kbd_report[i] = udi_hid_kbd_report[i + 1];
-		i++;
+		return false;
 	}
-	udi_hid_kbd_report[UDI_HID_KBD_REPORT_SIZE - 1] = 0x00;
+	udi_hid_kbd_usage_changed[index] |= mask;
 	udi_hid_kbd_b_report_valid = true;
 
-	// Send report
-	udi_hid_kbd_send_report();
-
 	cpu_irq_restore(flags);
 	return true;
 }
 
+#ifdef UDI_HID_KBD_NKRO
+static uint8_t udi_hid_kbd_state_get(uint8_t index)
+{
+	if ((UDI_HID_KBD_MODIFIER_USAGE_MIN / 8) == index)
+		return udi_hid_kbd_report[0];
+	return udi_hid_kbd_report[1 + index];
+}
 
-bool udi_hid_kbd_down(uint8_t key_id)
+static bool udi_hid_kbd_state_set(uint8_t index, uint8_t mask, bool b_set)
 {
-	uint8_t i;
+	uint8_t *bits = ((UDI_HID_KBD_MODIFIER_USAGE_MIN / 8) == index)
+			? &udi_hid_kbd_report[0] : &udi_hid_kbd_report[1 + index];
 
-	irqflags_t flags = cpu_irq_save();
+	UNUSED(b_set);
+	*bits ^= mask;
+	return true;
+}
+#else
+static uint8_t udi_hid_kbd_state_get(uint8_t index)
+{
+	uint8_t i, bits = 0;
 
-	// Fill report
+	if ((UDI_HID_KBD_MODIFIER_USAGE_MIN / 8) == index)
+		return udi_hid_kbd_report[0];
+	for (i = 2; (i < UDI_HID_KBD_REPORT_SIZE) && udi_hid_kbd_report[i]; i++) {
+		if (index == (udi_hid_kbd_report[i] / 8))
+			bits |= 1 << (udi_hid_kbd_report[i] % 8);
+	}
+	return bits;
+}
+
+static bool udi_hid_kbd_state_set(uint8_t index, uint8_t mask, bool b_set)
+{
+	uint8_t i, key_id = index * 8 + ctz(mask);
+
+	if ((UDI_HID_KBD_MODIFIER_USAGE_MIN / 8) == index) {
+		udi_hid_kbd_report[0] ^= mask;
+		return true;
+	}
+	// Keys change one at a time
 	for (i = 2; i < UDI_HID_KBD_REPORT_SIZE; i++) {
-		if (0 == udi_hid_kbd_report[i])
+		if ((0 == udi_hid_kbd_report[i]) || (key_id == udi_hid_kbd_report[i]))
 			break;
-		if (key_id == udi_hid_kbd_report[i]) {
-			// Already in array
-			cpu_irq_restore(flags);
-			return true;
+	}
+	if (b_set) {
+		if (UDI_HID_KBD_REPORT_SIZE == i) {
+			// Array full
+			return false;
 		}
+		// Add key at the end of array
+		udi_hid_kbd_report[i] = key_id;
+		return true;
 	}
-
-	if (UDI_HID_KBD_REPORT_SIZE == i) {
-		// Array full
-		// TODO manage more than UDI_HID_KBD_REPORT_SIZE key pressed in same time
-		cpu_irq_restore(flags);
-		return false;
+	// Remove key and shift
+	while (i < (UDI_HID_KBD_REPORT_SIZE - 1)) {
+		udi_hid_kbd_report[i] = udi_hid_kbd_report[i + 1];
+		i++;
 	}
-	// Add key at the end of array
-	udi_hid_kbd_report[i] = key_id;
-	udi_hid_kbd_b_report_valid = true;
+	udi_hid_kbd_report[UDI_HID_KBD_REPORT_SIZE - 1] = 0x00;
+	return true;
+}
+#endif
 
-	// Send report
-	udi_hid_kbd_send_report();
+static bool udi_hid_kbd_queue_push(void)
+{
+	uint8_t tail;
 
-	// Enable IT
-	cpu_irq_restore(flags);
+	if (UDI_HID_KBD_REPORT_QUEUE_SIZE == udi_hid_kbd_report_queue_count)
+		return false;
+	tail = (udi_hid_kbd_report_queue_head + udi_hid_kbd_report_queue_count)
+			% UDI_HID_KBD_REPORT_QUEUE_SIZE;
+	memcpy(udi_hid_kbd_report_queue[tail], udi_hid_kbd_report,
+			UDI_HID_KBD_STATE_SIZE);
+	memset(udi_hid_kbd_usage_changed, 0, UDI_HID_KBD_USAGE_MAP_SIZE);
+	udi_hid_kbd_b_report_valid = false;
+	udi_hid_kbd_report_queue_count++;
+	if (udi_hid_kbd_report_queue_count > udi_hid_kbd_report_queue_high_water) {
+		udi_hid_kbd_report_queue_high_water = udi_hid_kbd_report_queue_count;
+	}
 	return true;
 }
 
-
-//--------------------------------------------
-//------ Internal routines
+#ifdef UDI_HID_KBD_NKRO
+static void udi_hid_kbd_encode_boot_report(uint8_t *report,
+		const uint8_t *state)
+{
+	uint8_t i, nb_key = 0;
+
+	memset(report, 0, UDI_HID_KBD_REPORT_SIZE);
+	report[0] = state[0];
+	for (i = 1; i < UDI_HID_KBD_STATE_SIZE; i++) {
+		uint32_t keys = state[i];
+		while (keys) {
+			if ((2 + nb_key) == UDI_HID_KBD_REPORT_SIZE) {
+				// More keys than slots, report the phantom state
+				memset(&report[2], UDI_HID_KBD_ERROR_ROLLOVER,
+						UDI_HID_KBD_REPORT_SIZE - 2);
+				return;
+			}
+			report[2 + nb_key++] = (i - 1) * 8 + ctz(keys);
+			keys &= keys - 1;
+		}
+	}
+}
+#endif
 
 static bool udi_hid_kbd_send_report(void)
 {
+	iram_size_t report_size = UDI_HID_KBD_REPORT_SIZE;
+	uint8_t *state;
+
 	if (udi_hid_kbd_b_report_trans_ongoing)
 		return false;
-	memcpy(udi_hid_kbd_report_trans, udi_hid_kbd_report,
-			UDI_HID_KBD_REPORT_SIZE);
-	udi_hid_kbd_b_report_valid = false;
+	if (udi_hid_kbd_b_report_valid) {
+		// Latest changes go behind the states already waiting
+		udi_hid_kbd_queue_push();
+	}
+	if (!udi_hid_kbd_report_queue_count)
+		return false;
+	state = udi_hid_kbd_report_queue[udi_hid_kbd_report_queue_head];
+#ifdef UDI_HID_KBD_NKRO
+	if (UDI_HID_KBD_PROTOCOL_REPORT == udi_hid_kbd_protocol) {
+		memcpy(udi_hid_kbd_report_trans, state, UDI_HID_KBD_STATE_SIZE);
+		report_size = UDI_HID_KBD_STATE_SIZE;
+	} else {
+		udi_hid_kbd_encode_boot_report(udi_hid_kbd_report_trans, state);
+	}
+#else
+	// The state is the boot report
+	memcpy(udi_hid_kbd_report_trans, state, UDI_HID_KBD_REPORT_SIZE);
+#endif
 	udi_hid_kbd_b_report_trans_ongoing =
 			udd_ep_run(	UDI_HID_KBD_EP_IN,
 							false,
 							udi_hid_kbd_report_trans,
-							UDI_HID_KBD_REPORT_SIZE,
+							report_size,
 							udi_hid_kbd_report_sent);
 	return udi_hid_kbd_b_report_trans_ongoing;
 }
@@ -377,8 +623,12 @@ static void udi_hid_kbd_report_sent(udd_ep_status_t status, iram_size_t nb_sent,
 	UNUSED(status);
 	UNUSED(nb_sent);
 	UNUSED(ep);
+	// Release the state just sent
+	udi_hid_kbd_report_queue_head = (udi_hid_kbd_report_queue_head + 1)
+			% UDI_HID_KBD_REPORT_QUEUE_SIZE;
+	udi_hid_kbd_report_queue_count--;
 	udi_hid_kbd_b_report_trans_ongoing = false;
-	if (udi_hid_kbd_b_report_valid) {
+	if (udi_hid_kbd_b_report_valid || udi_hid_kbd_report_queue_count) {
 		udi_hid_kbd_send_report();
 	}
 }
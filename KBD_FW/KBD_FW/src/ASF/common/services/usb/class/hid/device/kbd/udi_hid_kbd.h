@@ -81,9 +81,16 @@ typedef struct {
 	usb_ep_desc_t ep;
 } udi_hid_kbd_desc_t;
 
+//! Size of the report descriptor for HID keyboard
+#ifdef UDI_HID_KBD_NKRO
+#  define UDI_HID_KBD_REPORT_DESC_SIZE  53
+#else
+#  define UDI_HID_KBD_REPORT_DESC_SIZE  59
+#endif
+
 //! Report descriptor for HID keyboard
 typedef struct {
-	uint8_t array[59];
+	uint8_t array[UDI_HID_KBD_REPORT_DESC_SIZE];
 } udi_hid_kbd_report_desc_t;
 
 
@@ -92,8 +99,63 @@ typedef struct {
 #define UDI_HID_KBD_STRING_ID 0
 #endif
 
+/**
+ * \name N-key rollover
+ * When UDI_HID_KBD_NKRO is defined in conf_usb.h, the report protocol uses a
+ * modifier byte followed by a bitmap of key usages 0 to
+ * UDI_HID_KBD_KEY_COUNT-1, so any number of keys can be pressed at once.
+ * The interface is then declared boot capable and falls back to the 8-byte
+ * boot report when the host selects the boot protocol.
+ */
+//@{
+//! Number of key usages tracked by the keyboard state
+#define UDI_HID_KBD_KEY_COUNT  120
+
+//! Usages of the modifier keys, reported in the modifier byte
+#define UDI_HID_KBD_MODIFIER_USAGE_MIN  0xE0
+#define UDI_HID_KBD_MODIFIER_USAGE_MAX  0xE7
+
+//! Usages the keyboard state can hold, see udi_hid_kbd_down()
+#define UDI_HID_KBD_USAGE_IS_VALID(usage) \
+		(((usage) < UDI_HID_KBD_KEY_COUNT) \
+		|| (((usage) >= UDI_HID_KBD_MODIFIER_USAGE_MIN) \
+		&& ((usage) <= UDI_HID_KBD_MODIFIER_USAGE_MAX)))
+
 //! HID keyboard endpoints size
-#define UDI_HID_KBD_EP_SIZE  8
+#ifdef UDI_HID_KBD_NKRO
+#  define UDI_HID_KBD_EP_SIZE  (1 + UDI_HID_KBD_KEY_COUNT / 8)
+#  define UDI_HID_KBD_SUB_CLASS  HID_SUB_CLASS_BOOT
+#else
+#  define UDI_HID_KBD_EP_SIZE  8
+#  define UDI_HID_KBD_SUB_CLASS  HID_SUB_CLASS_NOBOOT
+#endif
+//@}
+
+/**
+ * \name Polling interval
+ * Number of frames between two polls of the keyboard endpoint by the host
+ * (1 ms per frame at full speed). Can be overridden in conf_usb.h.
+ */
+//@{
+#ifndef UDI_HID_KBD_INTERVAL
+#  define UDI_HID_KBD_INTERVAL  2
+#endif
+#if (UDI_HID_KBD_INTERVAL < 1) || (UDI_HID_KBD_INTERVAL > 255)
+#  error UDI_HID_KBD_INTERVAL must be between 1 and 255 frames
+#endif
+//@}
+
+/**
+ * \name Report queue
+ * Keyboard states waiting for the host, including the one in transfer.
+ * Changes are merged into one state until a key changes twice, so every
+ * distinct state reaches the host in order. Can be overridden in conf_usb.h.
+ */
+//@{
+#ifndef UDI_HID_KBD_REPORT_QUEUE_SIZE
+#  define UDI_HID_KBD_REPORT_QUEUE_SIZE  8
+#endif
+//@}
 
 //! Content of HID keyboard interface descriptor for all speed
 #define UDI_HID_KBD_DESC    {\
@@ -103,7 +165,7 @@ typedef struct {
 	.iface.bAlternateSetting   = 0,\
 	.iface.bNumEndpoints       = 1,\
 	.iface.bInterfaceClass     = HID_CLASS,\
-	.iface.bInterfaceSubClass  = HID_SUB_CLASS_NOBOOT,\
+	.iface.bInterfaceSubClass  = UDI_HID_KBD_SUB_CLASS,\
 	.iface.bInterfaceProtocol  = HID_PROTOCOL_KEYBOARD,\
 	.iface.iInterface          = UDI_HID_KBD_STRING_ID,\
 	.hid.bLength               = sizeof(usb_hid_descriptor_t),\
@@ -118,7 +180,7 @@ typedef struct {
 	.ep.bEndpointAddress       = UDI_HID_KBD_EP_IN,\
 	.ep.bmAttributes           = USB_EP_TYPE_INTERRUPT,\
 	.ep.wMaxPacketSize         = LE16(UDI_HID_KBD_EP_SIZE),\
-	.ep.bInterval              = 2,\
+	.ep.bInterval              = UDI_HID_KBD_INTERVAL,\
 	}
 //@}
 
@@ -157,18 +219,61 @@ bool udi_hid_kbd_modifier_down(uint8_t modifier_id);
  *
  * \param key_id   ID of key
  *
- * \return \c 1 if function was successfully done, otherwise \c 0.
+ * \return \c 1 if function was successfully done, \c 0 if the report queue
+ * is full.
  */
 bool udi_hid_kbd_up(uint8_t key_id);
 
 /**
  * \brief Send events key pressed
  *
+ * Usages 0xE0 to 0xE7 press the matching bit of the modifier byte. Usage 0
+ * and the usages failing UDI_HID_KBD_USAGE_IS_VALID() are dropped.
+ *
+ * With N-key rollover, more than 6 keys pressed at once are reported as
+ * ErrorRollOver in the boot report, and individually in the N-key rollover
+ * report. Without it, the 6 key slots of the boot report hold the keys in
+ * the order they were pressed.
+ *
  * \param key_id   ID of key
  *
+ * \return \c 1 if function was successfully done, \c 0 if the report queue
+ * is full, or without N-key rollover if 6 keys are already pressed.
  */
 bool udi_hid_kbd_down(uint8_t key_id);
 
+/**
+ * \brief Arms the keyboard endpoint with the state changed since the last report
+ *
+ * The functions above only update the keyboard state. This one must be
+ * called once per frame, from the SOF event after the state is updated, so
+ * that all changes of a frame leave in a single report at the next poll.
+ * A changed state found while the previous report is still waiting for
+ * the host is counted as a missed frame and sent when that report completes.
+ */
+void udi_hid_kbd_report_flush(void);
+
+/**
+ * \brief Gets the number of frames where a changed state missed its report
+ *
+ * \return frames counted since the interface was enabled.
+ */
+uint32_t udi_hid_kbd_get_missed_frames(void);
+
+/**
+ * \brief Gets the number of keyboard states waiting in the report queue
+ *
+ * \return states queued, including the one in transfer.
+ */
+uint8_t udi_hid_kbd_get_queue_depth(void);
+
+/**
+ * \brief Gets the largest number of keyboard states held by the report queue
+ *
+ * \return high-water mark since the interface was enabled.
+ */
+uint8_t udi_hid_kbd_get_queue_high_water(void);
+
 //@}
 
 #ifdef __cplusplus
@@ -261,7 +366,9 @@ bool udi_hid_kbd_down(uint8_t key_id);
 	// Send events key released
 	udi_hid_kbd_up(uint8_t key_id);
 	// Send events key pressed
-	udi_hid_kbd_down(uint8_t key_id); \endcode
+	udi_hid_kbd_down(uint8_t key_id);
+	// Arm the report holding the events above, once per SOF
+	udi_hid_kbd_report_flush(); \endcode
  *
  * \section udi_hid_keyboard_use_cases Advanced use cases
  * For more advanced use of the UDI HID keyboard module, see the following use cases:
@@ -14,10 +14,15 @@
 #include <ioport.h>
 #include <delay.h>
 #include <pdc.h>
+#include <string.h>
 
-#if defined(CONF_ITC_SPI) && 0 // Chip doesn't support DMA
+// Bytes of a row of pixels in the image buffer
+#define ITC_ROW_BYTES          (ITC_DEFAULT_WIDTH / 8)
+
+#if defined(CONF_ITC_SPI) && defined(CONF_ITC_USE_PDC)
 #  define ITC_DMA_ENABLED
-#  define ITC_DMA_CHUNK_SIZE   16
+// Zeros sent per PDC buffer for the red plane, 15 reloads for a whole plane
+#  define ITC_DMA_CHUNK_SIZE   1000
 #endif
 
 /**
@@ -153,9 +158,362 @@ static void itc_send_command(uint8_t command, bool send_data)
 	}
 }
 
+// Frame data transfer running, and the function to call once it is done
+static volatile bool itc_b_data_busy;
+static itc_callback_t itc_data_done;
+
+/**
+ * \internal
+ * \brief Ends a frame data transfer: deselects the controller and calls back
+ */
+static void itc_data_sent(void)
+{
+	itc_callback_t done = itc_data_done;
+
+	itc_deselect_chip();
+	itc_b_data_busy = false;
+	if (done) {
+		done();
+	}
+}
+
+#if defined(ITC_DMA_ENABLED)
+// Bytes not yet given to the PDC, and where they come from (NULL for zeros), one row at a time
+static const uint8_t *itc_dma_data;
+static uint32_t itc_dma_row_len;
+static uint32_t itc_dma_left;
+static uint8_t itc_dma_zeros[ITC_DMA_CHUNK_SIZE];
+
+/**
+ * \internal
+ * \brief Takes the next PDC buffer from the bytes left to send
+ */
+static void itc_dma_next_packet(pdc_packet_t *packet)
+{
+	uint32_t size = itc_dma_left;
+
+	if (itc_dma_data) {
+		// Whole rows are contiguous in the image buffer and go in a single buffer
+		if (itc_dma_row_len != ITC_ROW_BYTES) {
+			size = min(itc_dma_row_len, itc_dma_left);
+		}
+		packet->ul_addr = (uint32_t) itc_dma_data;
+		// Nothing left, e.g. the next buffer of a single row: an empty buffer
+		if (size) {
+			itc_dma_data += ITC_ROW_BYTES;
+		}
+	} else {
+		if (size > ITC_DMA_CHUNK_SIZE) {
+			size = ITC_DMA_CHUNK_SIZE;
+		}
+		packet->ul_addr = (uint32_t) itc_dma_zeros;
+	}
+	packet->ul_size = size;
+	itc_dma_left -= size;
+}
+
+/**
+ * \internal
+ * \brief Refills the PDC while there are bytes left, then waits for the last one to be out
+ *
+ * The PDC moves its next buffer to the current one on its own, so the bus does not stop between
+ * buffers: the interrupt only has to give it another next buffer in the meantime.
+ */
+void CONF_ITC_SPI_Handler(void)
+{
+	Pdc *pdc = spi_get_pdc_base(CONF_ITC_SPI);
+	uint32_t status = spi_read_status(CONF_ITC_SPI) & spi_read_interrupt_mask(CONF_ITC_SPI);
+	pdc_packet_t packet;
+
+	if (status & SPI_SR_ENDTX) {
+		if (itc_dma_left) {
+			// Writing the next buffer clears ENDTX
+			itc_dma_next_packet(&packet);
+			pdc_tx_init(pdc, NULL, &packet);
+		} else {
+			spi_disable_interrupt(CONF_ITC_SPI, SPI_IDR_ENDTX);
+			spi_enable_interrupt(CONF_ITC_SPI, SPI_IER_TXEMPTY);
+		}
+		return;
+	}
+	if ((status & SPI_SR_TXEMPTY) && (spi_read_status(CONF_ITC_SPI) & SPI_SR_TXBUFE)) {
+		spi_disable_interrupt(CONF_ITC_SPI, SPI_IDR_TXEMPTY);
+		pdc_disable_transfer(pdc, PERIPH_PTCR_TXTDIS);
+		itc_data_sent();
+	}
+}
+#endif
+
+/**
+ * \internal
+ * \brief Starts sending frame data, after itc_send_command()
+ *
+ * With the PDC the function returns at once, and the controller is deselected and \p done called
+ * from the SPI interrupt once the last byte is out. Otherwise the bytes are sent before returning.
+ *
+ * \param data The first row of the bytes to send in the image buffer, or NULL to send zeros.
+ *        Must stay unchanged until \p done.
+ * \param row_len Bytes to send of each row
+ * \param rows Number of rows to send
+ * \param done Called once sent, or NULL
+ */
+static void itc_send_data(const uint8_t *data, uint32_t row_len, uint32_t rows, itc_callback_t done)
+{
+	itc_data_done = done;
+	itc_b_data_busy = true;
+#if defined(ITC_DMA_ENABLED)
+	Pdc *pdc = spi_get_pdc_base(CONF_ITC_SPI);
+	pdc_packet_t packet, next_packet;
+
+	// Last command byte out before the PDC writes to the transmit register
+	itc_wait_for_send_done();
+	itc_dma_data = data;
+	itc_dma_row_len = row_len;
+	itc_dma_left = row_len * rows;
+	itc_dma_next_packet(&packet);
+	itc_dma_next_packet(&next_packet);
+	pdc_tx_init(pdc, &packet, &next_packet);
+	spi_enable_interrupt(CONF_ITC_SPI, SPI_IER_ENDTX);
+	pdc_enable_transfer(pdc, PERIPH_PTCR_TXTEN);
+#else
+	for (uint32_t row = 0; row < rows; row++) {
+		for (uint32_t i = 0; i < row_len; i++) {
+			itc_send_byte(data ? data[row * ITC_ROW_BYTES + i] : 0);
+		}
+	}
+	itc_wait_for_send_done();
+	itc_data_sent();
+#endif
+}
+
 static itc_coord_t limit_start_x, limit_start_y;
 static itc_coord_t limit_end_x, limit_end_y;
-uint8_t image_data_buffer[ITC_SCREEN_BUFFER_SIZE] = {0}; // Initialize all to 0
+COMPILER_WORD_ALIGNED uint8_t image_data_buffer[ITC_SCREEN_BUFFER_SIZE] = {0}; // Initialize all to 0
+
+// Rectangle of pixels, inclusive, with the columns aligned to bytes of the image buffer
+typedef struct {
+	itc_coord_t x0, y0, x1, y1;
+} itc_rect_t;
+
+// Rectangles drawn since the last refresh started. When there are more, the closest ones are merged.
+#define ITC_DIRTY_RECT_MAX     4
+static itc_rect_t itc_dirty[ITC_DIRTY_RECT_MAX];
+static uint8_t itc_dirty_count;
+
+/**
+ * \internal
+ * \brief Bytes of the image buffer in a rectangle
+ */
+static uint32_t itc_rect_bytes(const itc_rect_t *rect)
+{
+	return (uint32_t) ((rect->x1 - rect->x0 + 1) / 8) * (rect->y1 - rect->y0 + 1);
+}
+
+/**
+ * \internal
+ * \brief Grows a rectangle to include another one
+ */
+static void itc_rect_union(itc_rect_t *rect, const itc_rect_t *other)
+{
+	rect->x0 = min(rect->x0, other->x0);
+	rect->y0 = min(rect->y0, other->y0);
+	rect->x1 = max(rect->x1, other->x1);
+	rect->y1 = max(rect->y1, other->y1);
+}
+
+/**
+ * \internal
+ * \brief Records a rectangle of pixels drawn, to be sent by the next refresh
+ */
+static void itc_mark_dirty(itc_coord_t x0, itc_coord_t y0, itc_coord_t x1, itc_coord_t y1)
+{
+	itc_rect_t rect = {
+		.x0 = max(x0, 0) & ~7,
+		.y0 = max(y0, 0),
+		.x1 = min(x1, ITC_DEFAULT_WIDTH - 1) | 7,
+		.y1 = min(y1, ITC_DEFAULT_HEIGHT - 1),
+	};
+	uint32_t best_growth = UINT32_MAX;
+	uint8_t best = 0;
+
+	if (rect.x0 > rect.x1 || rect.y0 > rect.y1) {
+		return;
+	}
+	for (uint8_t i = 0; i < itc_dirty_count; i++) {
+		itc_rect_t *dirty = &itc_dirty[i];
+		itc_rect_t merged = *dirty;
+
+		// Touching rectangles, such as the rows of an icon, become one
+		if (rect.x0 <= dirty->x1 + 1 && dirty->x0 <= rect.x1 + 1
+				&& rect.y0 <= dirty->y1 + 1 && dirty->y0 <= rect.y1 + 1) {
+			itc_rect_union(dirty, &rect);
+			return;
+		}
+		itc_rect_union(&merged, &rect);
+		if (itc_rect_bytes(&merged) - itc_rect_bytes(dirty) < best_growth) {
+			best_growth = itc_rect_bytes(&merged) - itc_rect_bytes(dirty);
+			best = i;
+		}
+	}
+	if (itc_dirty_count < ITC_DIRTY_RECT_MAX) {
+		itc_dirty[itc_dirty_count++] = rect;
+	} else {
+		itc_rect_union(&itc_dirty[best], &rect);
+	}
+}
+
+#if defined(CONF_ITC_SHADOW_BUFFER)
+// Frame last sent to the controller. The frame data is sent from it, drawing meanwhile is not.
+static uint32_t itc_shadow[ITC_SCREEN_BUFFER_SIZE / 4];
+#  define ITC_FRAME_DATA       ((const uint8_t *) itc_shadow)
+#elif defined(CONF_ITC_SHADOW_ROW_HASH)
+// Hash of each row of the frame last sent to the controller
+static uint32_t itc_row_hash[ITC_DEFAULT_HEIGHT];
+#endif
+#if !defined(ITC_FRAME_DATA)
+#  define ITC_FRAME_DATA       image_data_buffer
+#endif
+// The screen shows the shadow frame, false until the first refresh
+static bool itc_b_shadow_valid;
+
+#if defined(CONF_ITC_SHADOW_BUFFER)
+#  define ITC_DIFF_GAP_BYTES   2
+
+/**
+ * \internal
+ * \brief Copies the words of the image buffer that differ to the shadow frame, and makes the
+ * rectangles they cover the dirty ones
+ *
+ * Only the changed words are looked at byte per byte. The changed bytes of each row become
+ * rectangles one row high, split where more than ITC_DIFF_GAP_BYTES did not change, such as
+ * between two keys. The touching ones are joined by itc_mark_dirty().
+ */
+static void itc_shadow_diff(void)
+{
+	const uint32_t *image = (const uint32_t *) image_data_buffer;
+	int32_t row = -1;
+	uint32_t col0 = 0, col1 = 0;
+
+	itc_dirty_count = 0;
+	for (uint32_t i = 0; i < ITC_SCREEN_BUFFER_SIZE / 4; i++) {
+		uint32_t diff = image[i] ^ itc_shadow[i];
+
+		if (!diff) {
+			continue;
+		}
+		itc_shadow[i] = image[i];
+		// Little endian: the first byte of the word is the lowest
+		for (uint32_t b = 0; b < 4; b++, diff >>= 8) {
+			uint32_t offset = 4 * i + b;
+
+			if (!(diff & 0xFF)) {
+				continue;
+			}
+			if ((int32_t) (offset / ITC_ROW_BYTES) != row
+					|| offset % ITC_ROW_BYTES > col1 + ITC_DIFF_GAP_BYTES + 1) {
+				if (row >= 0) {
+					itc_mark_dirty(col0 * 8, row, col1 * 8 + 7, row);
+				}
+				row = offset / ITC_ROW_BYTES;
+				col0 = offset % ITC_ROW_BYTES;
+			}
+			col1 = offset % ITC_ROW_BYTES;
+		}
+	}
+	if (row >= 0) {
+		itc_mark_dirty(col0 * 8, row, col1 * 8 + 7, row);
+	}
+}
+#elif defined(CONF_ITC_SHADOW_ROW_HASH)
+/**
+ * \internal
+ * \brief FNV-1a hash of a row of the image buffer, rows are half word aligned
+ */
+static uint32_t itc_row_hash_compute(itc_coord_t y)
+{
+	const uint16_t *data = (const uint16_t *) &image_data_buffer[y * ITC_ROW_BYTES];
+	uint32_t hash = 2166136261UL;
+
+	for (uint8_t i = 0; i < ITC_ROW_BYTES / 2; i++) {
+		hash = (hash ^ data[i]) * 16777619UL;
+	}
+	return hash;
+}
+
+/**
+ * \internal
+ * \brief Trims the dirty rectangles to the rows whose hash changed, and drops the unchanged ones
+ *
+ * Only the rows of the dirty rectangles can have changed, the others are not hashed.
+ */
+static void itc_shadow_diff(void)
+{
+	uint8_t hashed[(ITC_DEFAULT_HEIGHT + 7) / 8] = {0};
+	uint8_t changed[(ITC_DEFAULT_HEIGHT + 7) / 8] = {0};
+	uint8_t count = 0;
+
+	// All the rows first: a row in two rectangles changed for both
+	for (uint8_t i = 0; i < itc_dirty_count; i++) {
+		for (itc_coord_t y = itc_dirty[i].y0; y <= itc_dirty[i].y1; y++) {
+			uint32_t hash;
+
+			if (hashed[y / 8] & (1 << (y % 8))) {
+				continue;
+			}
+			hashed[y / 8] |= 1 << (y % 8);
+			hash = itc_row_hash_compute(y);
+			if (hash != itc_row_hash[y]) {
+				itc_row_hash[y] = hash;
+				changed[y / 8] |= 1 << (y % 8);
+			}
+		}
+	}
+	for (uint8_t i = 0; i < itc_dirty_count; i++) {
+		itc_rect_t rect = itc_dirty[i];
+
+		while (rect.y0 <= rect.y1 && !(changed[rect.y0 / 8] & (1 << (rect.y0 % 8)))) {
+			rect.y0++;
+		}
+		while (rect.y1 >= rect.y0 && !(changed[rect.y1 / 8] & (1 << (rect.y1 % 8)))) {
+			rect.y1--;
+		}
+		if (rect.y0 <= rect.y1) {
+			itc_dirty[count++] = rect;
+		}
+	}
+	itc_dirty_count = count;
+}
+#endif
+
+/**
+ * \internal
+ * \brief Records that the refresh starting sends the whole frame
+ */
+static void itc_shadow_sent_all(void)
+{
+#if defined(CONF_ITC_SHADOW_ROW_HASH) && !defined(CONF_ITC_SHADOW_BUFFER)
+	// Rows drawn outside the dirty rectangles, if any, are caught up with
+	for (itc_coord_t y = 0; y < ITC_DEFAULT_HEIGHT; y++) {
+		itc_row_hash[y] = itc_row_hash_compute(y);
+	}
+#endif
+	itc_b_shadow_valid = true;
+}
+
+/**
+ * \internal
+ * \brief Records the pixels a write of count pixels from the top left limit covers
+ */
+static void itc_mark_dirty_pixels(uint32_t count)
+{
+	uint32_t width = limit_end_x - limit_start_x + 1;
+
+	if (count <= width) {
+		itc_mark_dirty(limit_start_x, limit_start_y, limit_start_x + count - 1, limit_start_y);
+	} else {
+		itc_mark_dirty(limit_start_x, limit_start_y, limit_end_x, limit_start_y + (count - 1) / width);
+	}
+}
 	
 /**
  * Helper function that returns the index in the image buffer 
@@ -311,6 +669,7 @@ itc_color_t itc_read_gram(void)
 void itc_write_gram(itc_color_t color)
 {
 	itc_set_image_bit(limit_start_x, limit_start_y, color);
+	itc_mark_dirty_pixels(1);
 }
 
 /**
@@ -334,6 +693,7 @@ void itc_copy_pixels_to_screen(const itc_color_t *pixels, uint32_t count)
 
 	/* Sanity check to make sure that the pixel count is not zero */
 	Assert(count > 0);
+	itc_mark_dirty_pixels(count);
 	
 	// Loop through the pixels to write
 	itc_coord_t x = limit_start_x;
@@ -374,6 +734,7 @@ void itc_duplicate_pixel(const itc_color_t color, uint32_t count)
 {
 	/* Sanity check to make sure that the pixel count is not zero */
 	Assert(count > 0);
+	itc_mark_dirty_pixels(count);
 	
 	// Loop through the pixels to write
 	itc_coord_t x = limit_start_x;
@@ -466,8 +827,18 @@ static void itc_interface_init(void)
 	/* Send one dummy byte for the spi_is_tx_ok() to work as expected */
 	spi_write_single(CONF_ITC_SPI, 0);
 #endif
+
+#if defined(ITC_DMA_ENABLED)
+	pdc_disable_transfer(spi_get_pdc_base(CONF_ITC_SPI), PERIPH_PTCR_TXTDIS | PERIPH_PTCR_RXTDIS);
+	NVIC_ClearPendingIRQ(CONF_ITC_SPI_IRQn);
+	NVIC_SetPriority(CONF_ITC_SPI_IRQn, CONF_ITC_SPI_INT_LEVEL);
+	NVIC_EnableIRQ(CONF_ITC_SPI_IRQn);
+#endif
 }
 
+// Panel temperature in degrees celsius, sent with the registers
+static int8_t itc_temperature = 25;
+
 /**
  * \internal
  * \brief Initialize all the display registers
@@ -478,7 +849,7 @@ static void itc_interface_init(void)
 static void itc_controller_init_registers(void)
 {
 	itc_send_command(ITC_CMD_INPUT_TEMP, true);
-	itc_send_byte(0x19); // Expect 25 degrees celsius
+	itc_send_byte((uint8_t) itc_temperature);
 	itc_wait_for_send_done();
 	itc_deselect_chip();
 
@@ -522,44 +893,314 @@ static void itc_controller_init_registers(void)
 			ITC_DEFAULT_HEIGHT);
 }
 
+// Steps of a refresh, each one runs once the waits set by the previous one are over
+typedef enum {
+	ITC_STEP_IDLE,
+	ITC_STEP_RESET,
+	ITC_STEP_RESET_PANEL_OFF,
+	ITC_STEP_RESET_PANEL_ON,
+	ITC_STEP_RESET_RELEASE,
+	ITC_STEP_INIT,
+	ITC_STEP_BLACK_FRAME,
+	ITC_STEP_RED_FRAME,
+	ITC_STEP_PARTIAL_BLACK,
+	ITC_STEP_PARTIAL_RED,
+	ITC_STEP_PARTIAL_OUT,
+	ITC_STEP_POWER_ON,
+	ITC_STEP_REFRESH,
+	ITC_STEP_POWER_OFF,
+	ITC_STEP_POWER_OFF_PINS,
+} itc_refresh_step_t;
+
+static itc_refresh_step_t itc_step = ITC_STEP_IDLE;
+static itc_callback_t itc_refresh_done;
+
+// The controller keeps its registers while the panel is powered: with CONF_ITC_KEEP_POWERED the
+// panel stays on between refreshes, and the reset and init steps only run when this is false.
+static bool itc_b_configured;
+// Power the panel off once no refresh is in progress, set from interrupts
+static volatile bool itc_b_power_down;
+
+#if defined(CONF_ITC_PARTIAL_REFRESH)
+#  if !defined(CONF_ITC_KEEP_POWERED)
+#    error The partial refresh needs the controller to keep the frame of the last refresh
+#  endif
+// A partial refresh sends the dirty rectangles when they are less than this part of the frame
+#  define ITC_PARTIAL_MAX_BYTES        (ITC_SCREEN_BUFFER_SIZE / 2)
+// Partial refreshes in a row before a full one clears their ghosting
+#  define ITC_PARTIAL_MAX_IN_ROW       8
+static uint8_t itc_partials_in_row;
+#endif
+// Rectangles the partial refresh in progress sends, and the window refreshed around them
+static bool itc_b_partial;
+static itc_rect_t itc_partial[ITC_DIRTY_RECT_MAX];
+static uint8_t itc_partial_count;
+static uint8_t itc_partial_index;
+static itc_rect_t itc_partial_window;
+
+// Phase of the steps, and the time each phase of the refresh in progress started
+static const uint8_t itc_step_phase[] = {
+	[ITC_STEP_RESET]			= ITC_PHASE_RESET,
+	[ITC_STEP_RESET_PANEL_OFF]	= ITC_PHASE_RESET,
+	[ITC_STEP_RESET_PANEL_ON]	= ITC_PHASE_RESET,
+	[ITC_STEP_RESET_RELEASE]	= ITC_PHASE_RESET,
+	[ITC_STEP_INIT]				= ITC_PHASE_INIT,
+	[ITC_STEP_BLACK_FRAME]		= ITC_PHASE_DATA,
+	[ITC_STEP_RED_FRAME]		= ITC_PHASE_DATA,
+	[ITC_STEP_PARTIAL_BLACK]	= ITC_PHASE_DATA,
+	[ITC_STEP_PARTIAL_RED]		= ITC_PHASE_DATA,
+	[ITC_STEP_PARTIAL_OUT]		= ITC_PHASE_DATA,
+	[ITC_STEP_POWER_ON]			= ITC_PHASE_POWER_ON,
+	[ITC_STEP_REFRESH]			= ITC_PHASE_REFRESH,
+	[ITC_STEP_POWER_OFF]		= ITC_PHASE_POWER_OFF,
+	[ITC_STEP_POWER_OFF_PINS]	= ITC_PHASE_POWER_OFF,
+};
+static uint8_t itc_phase;
+static uint32_t itc_phase_start_ms;
+static uint32_t itc_refresh_start_ms;
+static itc_refresh_stats_t itc_stats;
+// Waits before the next step: a time, and the busy line going high
+static uint32_t itc_wait_start_ms;
+static uint32_t itc_wait_ms;
+static bool itc_b_wait_busy;
+
 /**
  * \internal
- * \brief Reset the display using the digital control interface
- *
- * Controls the reset pin of the display controller to reset the display.
+ * \brief Cuts the panel supply, the controller forgets its registers
  */
-static void itc_reset_display(void)
+static void itc_panel_off(void)
 {
-	gpio_configure_pin(SPI_MOSI_GPIO, SPI_MOSI_FLAGS);
-	
-	ioport_set_pin_level(CONF_ITC_DISCHARGE_PIN, true);
-	delay_ms(5);
-	ioport_set_pin_level(CONF_ITC_DISCHARGE_PIN, false);
 	ioport_set_pin_level(CONF_ITC_PANEL_ON_PIN, false);
 	ioport_set_pin_level(CONF_ITC_RESET_PIN, false);
 	ioport_set_pin_level(CONF_ITC_DC_PIN, false);
-	delay_ms(10);
-	ioport_set_pin_level(CONF_ITC_PANEL_ON_PIN, true);
-	delay_ms(5);
-	ioport_set_pin_level(CONF_ITC_RESET_PIN, true);
-	delay_ms(1);
-	itc_deselect_chip();
+	ioport_set_pin_level(CONF_ITC_DISCHARGE_PIN, true);
+	itc_select_chip();
+	gpio_configure_pin(SPI_MOSI_GPIO, SPI_MOSI_FORCE_OUT_FLAGS);
+	itc_b_configured = false;
 }
 
-static void itc_power_off(void) {
-	itc_send_command(ITC_CMD_DC_TOGGLE, false);
+/**
+ * \internal
+ * \brief Selects the part of the frame the next frame data or refresh command applies to
+ */
+static void itc_send_partial_window(const itc_rect_t *rect)
+{
+	itc_send_command(ITC_CMD_PARTIAL_IN, false);
 	itc_wait_for_send_done();
 	itc_deselect_chip();
-	
-	itc_wait_for_busy_done();
-	
-	ioport_set_pin_level(CONF_ITC_PANEL_ON_PIN, false);
-	ioport_set_pin_level(CONF_ITC_RESET_PIN, false);
-	ioport_set_pin_level(CONF_ITC_DC_PIN, false);
-	ioport_set_pin_level(CONF_ITC_DISCHARGE_PIN, true);
-	itc_select_chip();
-	gpio_configure_pin(SPI_MOSI_GPIO, SPI_MOSI_FORCE_OUT_FLAGS);
-	
+
+	itc_send_command(ITC_CMD_PARTIAL_WINDOW, true);
+	itc_send_byte(rect->x0 >> 8);
+	itc_send_byte(rect->x0 & 0xFF);
+	itc_send_byte(rect->x1 >> 8);
+	itc_send_byte(rect->x1 & 0xFF);
+	itc_send_byte(rect->y0 >> 8);
+	itc_send_byte(rect->y0 & 0xFF);
+	itc_send_byte(rect->y1 >> 8);
+	itc_send_byte(rect->y1 & 0xFF);
+	itc_send_byte(0x01); // Gates scan inside and outside the window
+	itc_wait_for_send_done();
+	itc_deselect_chip();
+}
+
+/**
+ * \internal
+ * \brief Takes the dirty rectangles for the refresh starting, and tells whether it can be partial
+ */
+static bool itc_take_dirty(void)
+{
+	bool b_partial = false;
+#if defined(CONF_ITC_PARTIAL_REFRESH)
+	uint32_t bytes = 0;
+
+	for (uint8_t i = 0; i < itc_dirty_count; i++) {
+		bytes += itc_rect_bytes(&itc_dirty[i]);
+	}
+	// The controller frame is lost with the panel power
+	b_partial = itc_b_configured && itc_dirty_count && bytes < ITC_PARTIAL_MAX_BYTES
+			&& itc_partials_in_row < ITC_PARTIAL_MAX_IN_ROW;
+	itc_partials_in_row = b_partial ? itc_partials_in_row + 1 : 0;
+	if (b_partial) {
+		memcpy(itc_partial, itc_dirty, itc_dirty_count * sizeof(itc_rect_t));
+		itc_partial_count = itc_dirty_count;
+		itc_partial_window = itc_partial[0];
+		for (uint8_t i = 1; i < itc_partial_count; i++) {
+			itc_rect_union(&itc_partial_window, &itc_partial[i]);
+		}
+	}
+#endif
+	// Drawing during the refresh is sent by the next one
+	itc_dirty_count = 0;
+	return b_partial;
+}
+
+/**
+ * \internal
+ * \brief Makes the next refresh step wait at least the given time
+ */
+static void itc_wait_ms_async(uint32_t ms)
+{
+	itc_wait_start_ms = CONF_ITC_GET_TIME_MS();
+	// The time base may be about to tick, one more makes it at least ms
+	itc_wait_ms = ms + 1;
+}
+
+/**
+ * \internal
+ * \brief Runs one refresh step and sets what the next one waits for
+ */
+static void itc_refresh_step(void)
+{
+	uint32_t now_ms = CONF_ITC_GET_TIME_MS();
+	const itc_rect_t *rect;
+
+	// A phase lasts until the first step of the next one, its waits included
+	if (itc_step_phase[itc_step] != itc_phase) {
+		itc_stats.phase_ms[itc_phase] = now_ms - itc_phase_start_ms;
+		itc_phase = itc_step_phase[itc_step];
+		itc_phase_start_ms = now_ms;
+	}
+
+	switch (itc_step) {
+	case ITC_STEP_RESET:
+		// Reset the display using the digital control interface
+		gpio_configure_pin(SPI_MOSI_GPIO, SPI_MOSI_FLAGS);
+		ioport_set_pin_level(CONF_ITC_DISCHARGE_PIN, true);
+		itc_wait_ms_async(5);
+		itc_step = ITC_STEP_RESET_PANEL_OFF;
+		break;
+
+	case ITC_STEP_RESET_PANEL_OFF:
+		ioport_set_pin_level(CONF_ITC_DISCHARGE_PIN, false);
+		ioport_set_pin_level(CONF_ITC_PANEL_ON_PIN, false);
+		ioport_set_pin_level(CONF_ITC_RESET_PIN, false);
+		ioport_set_pin_level(CONF_ITC_DC_PIN, false);
+		itc_wait_ms_async(10);
+		itc_step = ITC_STEP_RESET_PANEL_ON;
+		break;
+
+	case ITC_STEP_RESET_PANEL_ON:
+		ioport_set_pin_level(CONF_ITC_PANEL_ON_PIN, true);
+		itc_wait_ms_async(5);
+		itc_step = ITC_STEP_RESET_RELEASE;
+		break;
+
+	case ITC_STEP_RESET_RELEASE:
+		ioport_set_pin_level(CONF_ITC_RESET_PIN, true);
+		itc_wait_ms_async(1);
+		itc_deselect_chip();
+		itc_step = ITC_STEP_INIT;
+		break;
+
+	case ITC_STEP_INIT:
+		/* Write all the controller registers with correct values */
+		itc_controller_init_registers();
+		itc_b_configured = true;
+		itc_stats.inits++;
+		itc_b_wait_busy = true;
+		itc_step = ITC_STEP_BLACK_FRAME;
+		break;
+
+	case ITC_STEP_BLACK_FRAME:
+		// Send the actual data to the display controllers frame data register
+		itc_send_command(ITC_CMD_BLACK_FRAME_DATA, true);
+		itc_send_data(ITC_FRAME_DATA, ITC_ROW_BYTES, ITC_DEFAULT_HEIGHT, NULL);
+		itc_step = ITC_STEP_RED_FRAME;
+		break;
+
+	case ITC_STEP_RED_FRAME:
+		// Send the red frame (all 0s)
+		itc_send_command(ITC_CMD_RED_FRAME_DATA, true);
+		itc_send_data(NULL, ITC_ROW_BYTES, ITC_DEFAULT_HEIGHT, NULL);
+		itc_b_wait_busy = true;
+		itc_step = ITC_STEP_POWER_ON;
+		break;
+
+	case ITC_STEP_PARTIAL_BLACK:
+		// Only the bytes of a dirty rectangle, the controller keeps the rest of the frame
+		rect = &itc_partial[itc_partial_index];
+		itc_send_partial_window(rect);
+		itc_send_command(ITC_CMD_BLACK_FRAME_DATA, true);
+		itc_send_data(&ITC_FRAME_DATA[itc_image_buffer_idx(rect->x0, rect->y0)],
+				(rect->x1 - rect->x0 + 1) / 8, rect->y1 - rect->y0 + 1, NULL);
+		itc_step = ITC_STEP_PARTIAL_RED;
+		break;
+
+	case ITC_STEP_PARTIAL_RED:
+		rect = &itc_partial[itc_partial_index];
+		itc_send_command(ITC_CMD_RED_FRAME_DATA, true);
+		itc_send_data(NULL, (rect->x1 - rect->x0 + 1) / 8, rect->y1 - rect->y0 + 1, NULL);
+		itc_step = ITC_STEP_PARTIAL_OUT;
+		break;
+
+	case ITC_STEP_PARTIAL_OUT:
+		itc_send_command(ITC_CMD_PARTIAL_OUT, false);
+		itc_wait_for_send_done();
+		itc_deselect_chip();
+		if (++itc_partial_index < itc_partial_count) {
+			itc_step = ITC_STEP_PARTIAL_BLACK;
+		} else {
+			itc_b_wait_busy = true;
+			itc_step = ITC_STEP_POWER_ON;
+		}
+		break;
+
+	case ITC_STEP_POWER_ON:
+		// Process for sending an update command
+		itc_send_command(ITC_CMD_POWER_ON, false);
+		itc_wait_for_send_done();
+		itc_deselect_chip();
+		itc_b_wait_busy = true;
+		itc_step = ITC_STEP_REFRESH;
+		break;
+
+	case ITC_STEP_REFRESH:
+		if (itc_b_partial) {
+			// Only the window around the rectangles is updated
+			itc_send_partial_window(&itc_partial_window);
+		}
+		itc_send_command(ITC_CMD_REFRESH, false);
+		itc_wait_for_send_done();
+		itc_deselect_chip();
+		itc_b_wait_busy = true;
+		itc_step = ITC_STEP_POWER_OFF;
+		break;
+
+	case ITC_STEP_POWER_OFF:
+		if (itc_b_partial) {
+			itc_send_command(ITC_CMD_PARTIAL_OUT, false);
+			itc_wait_for_send_done();
+			itc_deselect_chip();
+		}
+		itc_send_command(ITC_CMD_DC_TOGGLE, false);
+		itc_wait_for_send_done();
+		itc_deselect_chip();
+		itc_b_wait_busy = true;
+		itc_step = ITC_STEP_POWER_OFF_PINS;
+		break;
+
+	case ITC_STEP_POWER_OFF_PINS:
+#if defined(CONF_ITC_KEEP_POWERED)
+		if (itc_b_power_down) {
+			itc_b_power_down = false;
+			itc_panel_off();
+		}
+#else
+		itc_b_power_down = false;
+		itc_panel_off();
+#endif
+		itc_step = ITC_STEP_IDLE;
+		itc_stats.phase_ms[itc_phase] = now_ms - itc_phase_start_ms;
+		itc_stats.total_ms = now_ms - itc_refresh_start_ms;
+		itc_stats.refreshes++;
+		if (itc_refresh_done) {
+			itc_refresh_done();
+		}
+		break;
+
+	default:
+		break;
+	}
 }
 
 /**
@@ -575,55 +1216,145 @@ void itc_init(void)
 	/* Initialize the communication interface */
 	itc_interface_init();
 }
-/** 
- * Sens an update to the display screen, pushing any changes made since the last refresh.
+
+/**
+ * \brief Starts sending an update to the display screen, pushing any changes made since the last refresh
+ *
+ * Returns at once, itc_refresh_process() then runs the refresh. Without CONF_ITC_SHADOW_BUFFER the
+ * frame data is read from the buffer while the refresh is in progress: changes made meanwhile may
+ * or may not be shown.
+ *
+ * With a shadow frame, a refresh with nothing changed since the last one is skipped and \p done
+ * is called before returning.
+ *
+ * \param done Called from itc_refresh_process() once the display is powered off again, or NULL
  */
-void itc_refresh_screen(void)
+void itc_refresh_screen_async(itc_callback_t done)
 {
+	if (itc_step != ITC_STEP_IDLE) {
+		return;
+	}
+	// A power down asked for meanwhile comes first
+	itc_refresh_process();
+#if defined(CONF_ITC_SHADOW_BUFFER) || defined(CONF_ITC_SHADOW_ROW_HASH)
+	itc_shadow_diff();
+	if (itc_b_shadow_valid && !itc_dirty_count) {
+		// The screen already shows the frame
+		itc_stats.skipped++;
+		if (done) {
+			done();
+		}
+		return;
+	}
+#endif
+	itc_refresh_done = done;
+	itc_wait_ms = 0;
+	itc_b_wait_busy = false;
+	itc_b_partial = itc_take_dirty();
+	itc_partial_index = 0;
+	if (itc_b_partial) {
+		itc_step = ITC_STEP_PARTIAL_BLACK;
+	} else {
+		itc_shadow_sent_all();
+		itc_step = itc_b_configured ? ITC_STEP_BLACK_FRAME : ITC_STEP_RESET;
+	}
 
-	/* Reset the display */
-	itc_reset_display();
+	// Phases skipped by this refresh report 0
+	memset(itc_stats.phase_ms, 0, sizeof(itc_stats.phase_ms));
+	itc_phase = itc_step_phase[itc_step];
+	itc_refresh_start_ms = itc_phase_start_ms = CONF_ITC_GET_TIME_MS();
+	itc_refresh_process();
+}
 
-	/* Write all the controller registers with correct values */
-	itc_controller_init_registers();
-	
-	
-	itc_wait_for_busy_done();
-	// Send the actual data to the display controllers frame data register
-	itc_send_command(ITC_CMD_BLACK_FRAME_DATA, true);
-	// Send each byte from our buffer
-	for (int i = 0; i < ITC_SCREEN_BUFFER_SIZE; i++)
-	{
-		itc_send_byte((uint8_t) image_data_buffer[i]);
+/**
+ * \brief Runs the refresh steps that are not waiting, to be called from the main loop
+ */
+void itc_refresh_process(void)
+{
+	while (itc_step != ITC_STEP_IDLE) {
+		if (itc_b_data_busy) {
+			return;
+		}
+		if (itc_b_wait_busy) {
+			if (!ioport_get_pin_level(CONF_ITC_BUSY_PIN)) {
+				return;
+			}
+			itc_b_wait_busy = false;
+		}
+		if (itc_wait_ms) {
+			if (CONF_ITC_GET_TIME_MS() - itc_wait_start_ms < itc_wait_ms) {
+				return;
+			}
+			itc_wait_ms = 0;
+		}
+		itc_refresh_step();
 	}
-	itc_wait_for_send_done();
-	itc_deselect_chip();
-	
-	// Send the red frame (all 0s)
-	itc_send_command(ITC_CMD_RED_FRAME_DATA, true);
-	// Send each byte from our buffer
-	for (int i = 0; i < ITC_SCREEN_BUFFER_SIZE; i++)
-	{
-		itc_send_byte((uint8_t) 0);
+	if (itc_b_power_down) {
+		itc_b_power_down = false;
+		if (itc_b_configured) {
+			itc_panel_off();
+		}
+	}
+}
+
+/**
+ * \brief Sets the panel temperature, the registers are sent again on the next refresh if it changed
+ *
+ * \param celsius Temperature in degrees celsius
+ */
+void itc_set_temperature(int8_t celsius)
+{
+	if (celsius != itc_temperature) {
+		itc_temperature = celsius;
+		itc_b_configured = false;
+	}
+}
+
+/**
+ * \brief Makes the next refresh reset the controller and send the registers again
+ */
+void itc_reset_controller(void)
+{
+	itc_b_configured = false;
+}
+
+/**
+ * \brief Powers the panel off, e.g. while the USB bus is suspended
+ *
+ * May be called from an interrupt: the panel is powered off by the next itc_refresh_process(),
+ * once the refresh in progress if any completes. The next refresh then resets the controller.
+ */
+void itc_power_down(void)
+{
+	itc_b_power_down = true;
+}
+
+/**
+ * \brief Gets the counters and the time spent in each phase of the last refresh
+ */
+const itc_refresh_stats_t *itc_get_refresh_stats(void)
+{
+	return &itc_stats;
+}
+
+/**
+ * \brief Tells whether a refresh is in progress
+ */
+bool itc_refresh_in_progress(void)
+{
+	return itc_step != ITC_STEP_IDLE;
+}
+
+/** 
+ * Sens an update to the display screen, pushing any changes made since the last refresh.
+ * Waits until the display is powered off again.
+ */
+void itc_refresh_screen(void)
+{
+	itc_refresh_screen_async(NULL);
+	while (itc_refresh_in_progress()) {
+		itc_refresh_process();
 	}
-	itc_wait_for_send_done();
-	itc_deselect_chip();
-	
-	// Process for sending an update command
-	itc_wait_for_busy_done();
-	itc_send_command(ITC_CMD_POWER_ON, false);
-	itc_wait_for_send_done();
-	itc_deselect_chip();
-	
-	itc_wait_for_busy_done();
-	itc_send_command(ITC_CMD_REFRESH, false);
-	itc_wait_for_send_done();
-	itc_deselect_chip();
-	
-	itc_wait_for_busy_done();
-	itc_power_off();
-	
-	return;
 }
 
 /**
@@ -79,6 +79,36 @@ typedef uint8_t itc_color_t;
  */
 typedef int16_t itc_coord_t;
 
+/**
+ * \brief Function called once a transfer to the display is done
+ *
+ * May be called from an interrupt.
+ */
+typedef void (*itc_callback_t)(void);
+
+/** \brief Phases of a display refresh */
+typedef enum {
+	ITC_PHASE_RESET,		//!< Panel power up and controller reset
+	ITC_PHASE_INIT,			//!< Controller registers
+	ITC_PHASE_DATA,			//!< Black and red frame data
+	ITC_PHASE_POWER_ON,
+	ITC_PHASE_REFRESH,		//!< Panel update
+	ITC_PHASE_POWER_OFF,
+	ITC_PHASE_COUNT,
+} itc_refresh_phase_t;
+
+/** \brief Refresh counters, see itc_get_refresh_stats() */
+typedef struct {
+	uint32_t refreshes;
+	//! Refreshes that reset the controller and sent the registers
+	uint32_t inits;
+	//! Milliseconds spent in each phase of the last refresh, 0 for the skipped ones
+	uint32_t phase_ms[ITC_PHASE_COUNT];
+	uint32_t total_ms;
+	//! Refreshes skipped as the frame was the same as the last one
+	uint32_t skipped;
+} itc_refresh_stats_t;
+
 /**
  * \name Display orientation flags
  * @{
@@ -138,6 +168,20 @@ void itc_duplicate_pixel(const itc_color_t color, uint32_t count);
 
 void itc_refresh_screen(void);
 
+void itc_refresh_screen_async(itc_callback_t done);
+
+void itc_refresh_process(void);
+
+bool itc_refresh_in_progress(void);
+
+void itc_set_temperature(int8_t celsius);
+
+void itc_reset_controller(void);
+
+void itc_power_down(void);
+
+const itc_refresh_stats_t *itc_get_refresh_stats(void);
+
 /** @} */
 
 /**
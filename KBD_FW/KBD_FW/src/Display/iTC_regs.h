@@ -38,6 +38,15 @@
 # define ITC_CMD_VCOM_DATA_INTERVAL			0x50
 # define ITC_VCOM_DATA_INTERVAL_SIZE		0x01
 
+# define ITC_CMD_PARTIAL_WINDOW				0x90
+# define ITC_PARTIAL_WINDOW_SIZE			0x09
+
+# define ITC_CMD_PARTIAL_IN					0x91
+# define ITC_PARTIAL_IN_SIZE				0x00
+
+# define ITC_CMD_PARTIAL_OUT				0x92
+# define ITC_PARTIAL_OUT_SIZE				0x00
+
 # define ITC_CMD_RES_SETTINGS				0x61
 # define ITC_RES_SETTINGS_SIZE				0x04
 
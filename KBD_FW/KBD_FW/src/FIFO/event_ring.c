@@ -0,0 +1,21 @@
+/*
+ * event_ring.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */ 
+
+#include "event_ring.h"
+
+void event_ring_init(event_ring_t *ring, uint32_t *buffer, uint32_t size)
+{
+	// The size must be a non-zero power of 2
+	Assert(size);
+	Assert(!(size & (size - 1)));
+	
+	ring->buffer = buffer;
+	ring->mask = size - 1;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->dropped = 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * event_ring.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */ 
+
+
+#ifndef EVENT_RING_H_
+#define EVENT_RING_H_
+
+#include "compiler.h"
+
+/**
+ * Single-producer/single-consumer ring of packed 32-bit key events.
+ *
+ * The producer (scan interrupt) only writes \c head and the consumer (report
+ * task) only writes \c tail, so neither side has to disable interrupts.
+ * The indexes run freely and are masked on access, which lets the ring hold
+ * \c size events when full.
+ */
+
+//! Packed key event: bits 31-8 timestamp in us (wraps every 16.7s), bit 7 edge, bits 6-0 key index
+#define KEY_EVENT_PACK(key_idx, down, time_us) \
+	(((uint32_t)(time_us) << 8) | ((down) ? 0x80u : 0u) | ((uint32_t)(key_idx) & 0x7Fu))
+#define KEY_EVENT_KEY(event)		((uint8_t)((event) & 0x7Fu))
+#define KEY_EVENT_IS_DOWN(event)	(((event) & 0x80u) != 0)
+#define KEY_EVENT_TIME_US(event)	((event) >> 8)
+
+//! Elapsed time in us between two 24-bit event timestamps
+#define KEY_EVENT_TIME_DIFF_US(later, earlier)	(((later) - (earlier)) & 0x00FFFFFFu)
+
+typedef struct event_ring {
+	uint32_t *buffer;
+	uint32_t mask;               //!< Size - 1, the size is a power of 2
+	volatile uint32_t head;      //!< Written by the producer only
+	volatile uint32_t tail;      //!< Written by the consumer only
+	uint32_t dropped;            //!< Events lost because the ring was full, producer side
+} event_ring_t;
+
+/**
+ *  \brief Initializes an empty ring.
+ *
+ *  \param ring    Pointer on the ring descriptor.
+ *  \param buffer  Storage for \c size events.
+ *  \param size    Number of events, must be a power of 2.
+ */
+void event_ring_init(event_ring_t *ring, uint32_t *buffer, uint32_t size);
+
+static inline uint32_t event_ring_get_used_size(event_ring_t *ring)
+{
+	return ring->head - ring->tail;
+}
+
+static inline bool event_ring_is_empty(event_ring_t *ring)
+{
+	return ring->head == ring->tail;
+}
+
+/**
+ *  \brief Pushes an event. Producer side only.
+ *
+ *  \return false if the ring was full and the event was dropped.
+ */
+static inline bool event_ring_push(event_ring_t *ring, uint32_t event)
+{
+	uint32_t head = ring->head;
+	
+	if ((head - ring->tail) > ring->mask) {
+		ring->dropped++;
+		return false;
+	}
+	ring->buffer[head & ring->mask] = event;
+	
+	// Make sure the event is stored before it is published to the consumer
+	__DMB();
+	ring->head = head + 1;
+	return true;
+}
+
+/**
+ *  \brief Reads the oldest event without removing it. Consumer side only.
+ *
+ *  \return false if the ring is empty.
+ */
+static inline bool event_ring_peek(event_ring_t *ring, uint32_t *event)
+{
+	uint32_t tail = ring->tail;
+	
+	if (tail == ring->head) {
+		return false;
+	}
+	__DMB();
+	*event = ring->buffer[tail & ring->mask];
+	return true;
+}
+
+/**
+ *  \brief Removes the oldest event. Consumer side only.
+ */
+static inline void event_ring_drop(event_ring_t *ring)
+{
+	// Make sure the event has been read before its slot is handed back to the producer
+	__DMB();
+	ring->tail = ring->tail + 1;
+}
+
+/**
+ *  \brief Reads and removes the oldest event. Consumer side only.
+ *
+ *  \return false if the ring is empty.
+ */
+static inline bool event_ring_pop(event_ring_t *ring, uint32_t *event)
+{
+	if (!event_ring_peek(ring, event)) {
+		return false;
+	}
+	event_ring_drop(ring);
+	return true;
+}
+
+#endif /* EVENT_RING_H_ */
@@ -0,0 +1,54 @@
+/*
+ * cobs.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+#include "cobs.h"
+
+uint32_t cobs_encode(const uint8_t *src, uint32_t len, uint8_t *dst)
+{
+	uint32_t code_pos = 0;
+	uint32_t out = 1;
+	uint8_t code = 1;
+
+	while (len--) {
+		if (*src) {
+			dst[out++] = *src;
+			code++;
+		}
+		if (!*src++ || code == 0xFF) {
+			// Close the block, its code is the distance to the next 0x00
+			dst[code_pos] = code;
+			code_pos = out++;
+			code = 1;
+		}
+	}
+	dst[code_pos] = code;
+	return out;
+}
+
+uint32_t cobs_decode(const uint8_t *src, uint32_t len, uint8_t *dst)
+{
+	uint32_t in = 0;
+	uint32_t out = 0;
+
+	while (in < len) {
+		uint8_t code = src[in++];
+
+		if (!code || in + code - 1 > len) {
+			return 0;
+		}
+		for (uint8_t i = 1; i < code; ++i) {
+			if (!src[in]) {
+				return 0;
+			}
+			dst[out++] = src[in++];
+		}
+		if (code != 0xFF && in < len) {
+			dst[out++] = 0;
+		}
+	}
+	return out;
+}
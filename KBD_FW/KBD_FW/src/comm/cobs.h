@@ -0,0 +1,30 @@
+/*
+ * cobs.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+
+#ifndef COBS_H_
+#define COBS_H_
+
+#include <stdint.h>
+
+/**
+ * Consistent Overhead Byte Stuffing: encodes data without any 0x00 byte, so
+ * 0x00 can delimit frames. Encoding adds one byte, plus one per 254 bytes.
+ */
+
+//! Largest encoded size of len bytes
+#define COBS_ENCODED_MAX(len)		((len) + (len) / 254 + 1)
+
+// Encodes len bytes of src into dst, which holds COBS_ENCODED_MAX(len) bytes.
+// Returns the encoded length.
+uint32_t cobs_encode(const uint8_t *src, uint32_t len, uint8_t *dst);
+
+// Decodes len bytes of src, without the delimiters, into dst. dst may be src.
+// Returns the decoded length, or 0 if src is not valid COBS.
+uint32_t cobs_decode(const uint8_t *src, uint32_t len, uint8_t *dst);
+
+#endif /* COBS_H_ */
@@ -9,8 +9,14 @@
 #include "comm.h"
 #include "xmodem.h"
 #include "gfx.h"
+#include "macro.h"
+#include "profile_parser.h"
+#include "link.h"
 
-uint8_t file_read_buf[FILE_READ_BUFFER_SIZE];
+// Macros of the last profile received, bound to their keys
+static uint8_t comm_macro_pool[COMM_MACRO_POOL_SIZE];
+
+static profile_parser_t comm_profile_parser;
 
 /* File Format:
 	1-2:	Start of key identifier
@@ -20,56 +26,85 @@ uint8_t file_read_buf[FILE_READ_BUFFER_SIZE];
 	6:		Icon Height
 	7-n:	Bmp Bytestream
 	n:		Next key, etc.
+
+   Run-length key section, same fields with the icon as 1 bit per pixel runs:
+	1-2:	Run-length key section identifier
+	3-6:	Key location Id, Scancode, Icon Width, Icon Height
+	7-n:	Length of each run of white then black pixels, alternating, starting with white
+			and going on from one row to the next. Runs longer than 255 are sent as 255, 0, rest.
+			The section ends with the last pixel of the icon.
+
+   Macro section:
+	1-2:	Macro section identifier
+	3:		Key location Id
+	4-5:	Bytecode length, big endian
+	6-n:	Bytecode (see macro_ops.h), compiled on the host by tools/kbd_profile
 */
 
-void comm_init() {
-	file_read_buf[0] = 0x00;
+static void comm_key_received(uint8_t key_id, uint8_t scancode, uint8_t width, uint8_t height) {
+	UNUSED(width);
+	UNUSED(height);
+	if (key_id >= KEY_COUNT || !KEY_USAGE_IS_VALID(scancode)) {
+		// The icon rows that follow still apply
+		return;
+	}
+	
+	// Set the scancode for the key
+	ui_set_key_scancode(key_id, scancode);
 }
 
-void comm_process() {
-	uint32_t read_result = xmodem_receive_file(file_read_buf);
+static void comm_icon_row_received(uint8_t key_id, uint8_t width, uint8_t height, uint8_t row,
+		const uint8_t *pixels) {
+	if (key_id >= KEY_COUNT) {
+		return;
+	}
+	
+	// Draw each row as it arrives
+	ui_set_key_icon_row(key_id, width, height, row, (const gfx_color_t *) pixels);
 	
-	if (read_result == 0) {
+	// Set the flag for the ui to update the screen
+	ui_set_needs_refresh();
+}
+
+static void comm_macro_received(uint8_t key_id, const uint8_t *code, uint16_t len) {
+	if ((key_id >= KEY_COUNT) || !macro_validate(code, len)) {
 		return;
 	}
-	else {
-		bool file_handling_finished = false;
-		uint32_t idx = 0;
-		while (!file_handling_finished) {
-			// Read the first two bytes of the section, and make sure it's the start identifier.
-			uint8_t identifier_upper = file_read_buf[idx++];
-			uint8_t identifier_lower = file_read_buf[idx++];
-			int identifier = (((int) identifier_upper) << 8) | ((int) identifier_lower);
-			if (identifier != FILE_SECTION_IDENTIFIER) {
-				// If it's not mathcing the expected identifier, return with an error;
-				return;
-			}
-			
-			// Read physical code, scancode, width, height
-			uint8_t key_id = file_read_buf[idx++];
-			uint8_t scancode = file_read_buf[idx++];
-			uint8_t icon_width = file_read_buf[idx++];
-			uint8_t icon_height = file_read_buf[idx++];
-			
-			// Set the scancode for the key
-			ui_set_key_scancode(key_id, scancode);
-			
-			// Create a bitmap using the byte stream
-			struct gfx_bitmap bmp = {.width = icon_width, 
-										.height = icon_height, 
-										.type = GFX_BITMAP_RAM, 
-										.data.pixmap = (gfx_color_t *) &(file_read_buf[idx])};
-										
-			ui_set_key_icon(key_id, &bmp);
-			idx += BYTES_PER_PIXEL*icon_height*icon_width;
-			
-			// Set the flag for the ui to update the screen
-			ui_set_needs_refresh();
-			
-			// Check if we've read all the data from the file
-			if((idx + 1) >= read_result) {
-				file_handling_finished = true;
-			}
+	ui_set_key_macro(key_id, code, len);
+}
+
+static const profile_parser_callbacks_t comm_profile_callbacks = {
+	.key = comm_key_received,
+	.icon_row = comm_icon_row_received,
+	.macro = comm_macro_received,
+};
+
+// Called by XMODEM with each packet received, YMODEM padding already removed
+static void comm_store_packet(uint8_t *data, uint32_t len, uint32_t offset) {
+	if (offset == 0) {
+		// A new profile replaces all the macros
+		for (uint8_t key_id = 0; key_id < KEY_COUNT; ++key_id) {
+			ui_set_key_macro(key_id, NULL, 0);
 		}
+		profile_parser_init(&comm_profile_parser, &comm_profile_callbacks,
+				comm_macro_pool, sizeof(comm_macro_pool));
+	}
+	profile_parser_feed(&comm_profile_parser, data, len);
+}
+
+void comm_init() {
+	profile_parser_init(&comm_profile_parser, &comm_profile_callbacks,
+			comm_macro_pool, sizeof(comm_macro_pool));
+	xmodem_receive_init(comm_store_packet);
+	link_init();
+}
+
+void comm_process() {
+	// Sections are applied by comm_store_packet() while the file is received.
+	// Only the bytes already received are handled, the main loop never waits on the host.
+	// Configuration frames (see link_protocol.h) are only looked for between transfers.
+	if (!xmodem_is_receiving() && link_process()) {
+		return;
 	}
+	xmodem_receive_process();
 }
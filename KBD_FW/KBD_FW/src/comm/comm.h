@@ -10,8 +10,16 @@
 #define COMM_H_
 
 #define BYTES_PER_PIXEL				1
-#define FILE_READ_BUFFER_SIZE		12*(2+1+1+1+1+BYTES_PER_PIXEL*50*50)
 #define FILE_SECTION_IDENTIFIER		0xDEAD
+#define FILE_MACRO_SECTION_IDENTIFIER	0xDEAE
+#define FILE_RLE_SECTION_IDENTIFIER		0xDEAF
+
+// Run-length icons are 1 bit per pixel, like the panel: anything above ITC_THRES_BLACK is white
+#define FILE_RLE_WHITE				0xFF
+#define FILE_RLE_BLACK				0x00
+
+// Storage for the macros of the last profile received
+#define COMM_MACRO_POOL_SIZE		2048
 
 void comm_init(void);
 
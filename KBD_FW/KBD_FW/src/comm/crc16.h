@@ -0,0 +1,34 @@
+/*
+ * crc16.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+
+#ifndef CRC16_H_
+#define CRC16_H_
+
+#include <stdint.h>
+
+/**
+ * CRC-16/CCITT as used by XMODEM: polynomial 0x1021, initial value 0,
+ * no reflection. The CRC of "123456789" is 0x31C3.
+ */
+
+//! Bits looked up per step: 8 uses a 512 byte table, 4 a 32 byte table at about half the speed
+#ifndef CRC16_TABLE_BITS
+#  define CRC16_TABLE_BITS		8
+#endif
+
+#if CRC16_TABLE_BITS != 8 && CRC16_TABLE_BITS != 4
+#  error CRC16_TABLE_BITS must be 8 or 4
+#endif
+
+//! Initial value of a CRC
+#define CRC16_INIT				0x0000
+
+// Returns crc updated with len bytes of data. Long data can be passed in pieces.
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, uint32_t len);
+
+#endif /* CRC16_H_ */
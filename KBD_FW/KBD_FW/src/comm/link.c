@@ -0,0 +1,254 @@
+/*
+ * link.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+#include <asf.h>
+#include <string.h>
+#include "link.h"
+#include "link_protocol.h"
+#include "cobs.h"
+#include "crc16.h"
+#include "ui.h"
+#include "scan_scheduler.h"
+
+// Largest encoded response with its delimiters
+#define LINK_RESPONSE_FRAME_MAX \
+	(COBS_ENCODED_MAX(LINK_RESPONSE_OVERHEAD + LINK_RESPONSE_PAYLOAD_MAX) + 2)
+
+#if LINK_RESPONSE_FRAME_MAX > UDI_CDC_DATA_EPS_FS_SIZE
+#  error A response must fit in the CDC transmit buffer
+#endif
+
+#if 3 * KEY_COUNT > LINK_RESPONSE_PAYLOAD_MAX
+#  error LINK_CMD_GET_KEY_HASHES answers for every key at once
+#endif
+
+#if 4 * (ITC_PHASE_COUNT + 4) > LINK_RESPONSE_PAYLOAD_MAX
+#  error LINK_CMD_DISPLAY_STATS answers for every refresh phase at once
+#endif
+
+// Encoded request, decoded in place once complete
+static uint8_t link_frame[COBS_ENCODED_MAX(LINK_REQUEST_OVERHEAD + LINK_PAYLOAD_MAX)];
+static uint16_t link_frame_len;
+static bool link_b_in_frame;
+static bool link_b_overflow;
+static uint32_t link_last_ms;
+
+// Sequence number expected in the next request
+static uint8_t link_next_seq;
+
+// Counters read by LINK_CMD_STATS
+static uint32_t link_frames;
+static uint32_t link_crc_errors;
+static uint32_t link_seq_errors;
+
+void link_init(void) {
+	link_b_in_frame = false;
+	link_next_seq = 0;
+}
+
+static void link_put_u32(uint8_t *dst, uint32_t value) {
+	dst[0] = value >> 24;
+	dst[1] = value >> 16;
+	dst[2] = value >> 8;
+	dst[3] = value;
+}
+
+static void link_respond(uint8_t seq, uint8_t command, uint8_t status, const uint8_t *payload, uint8_t len) {
+	uint8_t response[LINK_RESPONSE_OVERHEAD + LINK_RESPONSE_PAYLOAD_MAX];
+	uint8_t frame[LINK_RESPONSE_FRAME_MAX];
+	uint16_t crc;
+	uint32_t frame_len;
+
+	response[0] = seq;
+	response[1] = command | LINK_RESPONSE;
+	response[2] = status;
+	memcpy(&response[3], payload, len);
+	crc = crc16_update(CRC16_INIT, response, 3 + len);
+	response[3 + len] = crc >> 8;
+	response[4 + len] = crc;
+
+	frame[0] = 0;
+	frame_len = 1 + cobs_encode(response, LINK_RESPONSE_OVERHEAD + len, &frame[1]);
+	frame[frame_len++] = 0;
+	// link_process() made sure it fits, this does not wait
+	udi_cdc_write_buf(frame, frame_len);
+}
+
+// Runs a command. Returns the response status, with its payload in response.
+static uint8_t link_execute(uint8_t command, const uint8_t *payload, uint16_t len,
+		uint8_t *response, uint8_t *response_len) {
+	uint8_t key_id, width, height, first_row, rows;
+	const uint8_t *macro;
+	uint16_t macro_len, hash;
+	const itc_refresh_stats_t *display_stats;
+
+	*response_len = 0;
+	switch (command) {
+	case LINK_CMD_SYNC:
+		return LINK_STATUS_OK;
+
+	case LINK_CMD_STATS:
+		link_put_u32(&response[0], link_frames);
+		link_put_u32(&response[4], link_crc_errors);
+		link_put_u32(&response[8], link_seq_errors);
+		link_put_u32(&response[12], udi_hid_kbd_get_missed_frames());
+		response[16] = udi_hid_kbd_get_queue_high_water();
+		*response_len = 17;
+		return LINK_STATUS_OK;
+
+	case LINK_CMD_SET_SCANCODE:
+		if (len != 2 || payload[0] >= KEY_COUNT || !KEY_USAGE_IS_VALID(payload[1])) {
+			return LINK_STATUS_ARGUMENT;
+		}
+		ui_set_key_scancode(payload[0], payload[1]);
+		return LINK_STATUS_OK;
+
+	case LINK_CMD_SET_ICON_ROWS:
+		if (len < 5) {
+			return LINK_STATUS_ARGUMENT;
+		}
+		key_id = payload[0];
+		width = payload[1];
+		height = payload[2];
+		first_row = payload[3];
+		rows = payload[4];
+		if (key_id >= KEY_COUNT || width > KEY_ICON_MAX_DIM || height > KEY_ICON_MAX_DIM
+				|| first_row + rows > height || len != 5 + width * rows) {
+			return LINK_STATUS_ARGUMENT;
+		}
+		for (uint8_t row = 0; row < rows; ++row) {
+			ui_set_key_icon_row(key_id, width, height, first_row + row,
+					(const gfx_color_t *) &payload[5 + row * width]);
+		}
+		ui_set_needs_refresh();
+		return LINK_STATUS_OK;
+
+	case LINK_CMD_GET_KEY:
+		if (len != 1 || payload[0] >= KEY_COUNT) {
+			return LINK_STATUS_ARGUMENT;
+		}
+		macro = ui_get_key_macro(payload[0], &macro_len);
+		response[0] = ui_get_key_scancode(payload[0]);
+		response[1] = macro ? macro_len >> 8 : 0;
+		response[2] = macro ? macro_len : 0;
+		*response_len = 3;
+		return LINK_STATUS_OK;
+
+	case LINK_CMD_GET_KEY_HASHES:
+		for (key_id = 0; key_id < KEY_COUNT; ++key_id) {
+			hash = ui_get_key_icon_hash(key_id);
+			response[3 * key_id] = ui_get_key_scancode(key_id);
+			response[3 * key_id + 1] = hash >> 8;
+			response[3 * key_id + 2] = hash;
+		}
+		*response_len = 3 * KEY_COUNT;
+		return LINK_STATUS_OK;
+
+	case LINK_CMD_DISPLAY_STATS:
+		display_stats = itc_get_refresh_stats();
+		link_put_u32(&response[0], display_stats->refreshes);
+		link_put_u32(&response[4], display_stats->inits);
+		for (uint8_t phase = 0; phase < ITC_PHASE_COUNT; ++phase) {
+			link_put_u32(&response[8 + 4 * phase], display_stats->phase_ms[phase]);
+		}
+		link_put_u32(&response[8 + 4 * ITC_PHASE_COUNT], display_stats->total_ms);
+		link_put_u32(&response[12 + 4 * ITC_PHASE_COUNT], display_stats->skipped);
+		*response_len = 4 * (ITC_PHASE_COUNT + 4);
+		return LINK_STATUS_OK;
+
+	default:
+		return LINK_STATUS_COMMAND;
+	}
+}
+
+// Checks and runs the complete request in link_frame
+static void link_frame_received(void) {
+	uint8_t response[LINK_RESPONSE_PAYLOAD_MAX];
+	uint8_t response_len;
+	uint8_t status;
+	uint32_t len;
+	uint16_t crc;
+	uint8_t seq, command;
+
+	len = link_b_overflow ? 0 : cobs_decode(link_frame, link_frame_len, link_frame);
+	if (len < LINK_REQUEST_OVERHEAD) {
+		link_crc_errors++;
+		return;
+	}
+	crc = (link_frame[len - 2] << 8) | link_frame[len - 1];
+	if (crc != crc16_update(CRC16_INIT, link_frame, len - 2)) {
+		// No response, the host sends it again after its timeout
+		link_crc_errors++;
+		return;
+	}
+	link_frames++;
+
+	seq = link_frame[0];
+	command = link_frame[1];
+	if (command == LINK_CMD_SYNC) {
+		link_next_seq = seq;
+	}
+	if (seq == link_next_seq) {
+		link_next_seq++;
+	} else if ((uint8_t)(link_next_seq - seq) > LINK_WINDOW) {
+		// Requests were lost, the host resends from the expected one
+		link_seq_errors++;
+		link_respond(seq, command, LINK_STATUS_SEQUENCE, &link_next_seq, 1);
+		return;
+	}
+	// Else the host resends a request it did not see the response of: commands can run twice
+
+	status = link_execute(command, &link_frame[2], len - LINK_REQUEST_OVERHEAD, response, &response_len);
+	link_respond(seq, command, status, response, response_len);
+}
+
+bool link_process(void) {
+	uint32_t now_ms = scan_scheduler_get_time_ms();
+	const uint8_t *p_data;
+	iram_size_t avail;
+	iram_size_t used;
+
+	if (link_b_in_frame && !udi_cdc_is_rx_ready() && now_ms - link_last_ms >= LINK_FRAME_TIMEOUT_MS) {
+		link_b_in_frame = false;
+		link_crc_errors++;
+	}
+
+	while ((p_data = udi_cdc_get_rx_buffer(&avail)) != NULL) {
+		link_last_ms = now_ms;
+		for (used = 0; used < avail; ++used) {
+			uint8_t c = p_data[used];
+
+			if (!link_b_in_frame) {
+				if (c) {
+					// Not a frame, left to XMODEM
+					udi_cdc_rx_consume(used);
+					return false;
+				}
+				link_b_in_frame = true;
+				link_b_overflow = false;
+				link_frame_len = 0;
+			} else if (c) {
+				if (link_frame_len < sizeof(link_frame)) {
+					link_frame[link_frame_len++] = c;
+				} else {
+					link_b_overflow = true;
+				}
+			} else if (link_frame_len || link_b_overflow) {
+				if (udi_cdc_get_free_tx_buffer() < LINK_RESPONSE_FRAME_MAX) {
+					// Wait for room for the response, the delimiter is read again
+					udi_cdc_rx_consume(used);
+					return true;
+				}
+				link_frame_received();
+				link_b_in_frame = false;
+			}
+			// Else an empty frame: the host resynchronizing, the frame starts again
+		}
+		udi_cdc_rx_consume(used);
+	}
+	return link_b_in_frame;
+}
@@ -0,0 +1,26 @@
+/*
+ * link.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+
+#ifndef LINK_H_
+#define LINK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Abandons a frame after this much silence, so a stalled host cannot block XMODEM
+#define LINK_FRAME_TIMEOUT_MS		500
+
+// Starts the configuration protocol described in link_protocol.h.
+void link_init(void);
+
+// Handles the frames already received on the CDC interface. Stops at the first
+// byte outside a frame, which is left for XMODEM.
+// Returns true while a frame is in progress: the CDC input belongs to the link.
+bool link_process(void);
+
+#endif /* LINK_H_ */
@@ -0,0 +1,80 @@
+/*
+ * link_protocol.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+
+#ifndef LINK_PROTOCOL_H_
+#define LINK_PROTOCOL_H_
+
+/**
+ * Framed configuration protocol on the CDC interface, next to XMODEM.
+ *
+ * Each frame is COBS encoded (see cobs.h) and sent between two 0x00 bytes.
+ * The leading 0x00 tells it apart from an XMODEM transfer. Decoded frames:
+ *
+ *	Request:	<seq> <command> <payload...> <crc hi> <crc lo>
+ *	Response:	<seq> <command | LINK_RESPONSE> <status> <payload...> <crc hi> <crc lo>
+ *
+ * The CRC is crc16_update() over all the bytes before it. Requests carry
+ * consecutive sequence numbers, and the host may send up to LINK_WINDOW of
+ * them before reading the responses. Every command can be executed twice, so
+ * after a lost frame the host sends everything again from the sequence number
+ * in the LINK_STATUS_SEQUENCE response (go-back-N).
+ *
+ * This header only uses the preprocessor so host tools can include it.
+ */
+
+//! Requests the host may send before the first response
+#define LINK_WINDOW					8
+
+//! Largest request payload, one or more icon rows fit
+#define LINK_PAYLOAD_MAX			256
+//! Largest response payload
+#define LINK_RESPONSE_PAYLOAD_MAX	40
+
+//! Bytes around the payload: sequence, command, CRC
+#define LINK_REQUEST_OVERHEAD		4
+//! Bytes around the payload: sequence, command, status, CRC
+#define LINK_RESPONSE_OVERHEAD		5
+
+//! Bit set in the command of a response
+#define LINK_RESPONSE				0x80
+
+//! Accepts any sequence number, the next request must carry seq + 1: no payload
+#define LINK_CMD_SYNC				0x00
+//! Reads the counters: no payload
+//! Response: <frames> <CRC errors> <sequence errors> <HID missed frames>, 32 bit big endian each,
+//! then <HID queue high water>
+#define LINK_CMD_STATS				0x01
+//! Sets the scancode of a key: <key> <scancode>
+#define LINK_CMD_SET_SCANCODE		0x02
+//! Draws rows of a key icon, one byte per pixel: <key> <width> <height> <first row> <rows> <pixels...>
+#define LINK_CMD_SET_ICON_ROWS		0x03
+//! Reads back a key: <key>
+//! Response: <scancode> <macro length hi> <macro length lo>
+#define LINK_CMD_GET_KEY			0x04
+//! Reads what every key holds, to only send the keys that differ: no payload
+//! Response, for each key: <scancode> <icon hash hi> <icon hash lo>
+//! The icon hash is the CRC of <width> <height>, then of the CRC of each row of pixels, big endian.
+//! Rows not drawn count as 0.
+#define LINK_CMD_GET_KEY_HASHES		0x05
+//! Reads the display refresh counters: no payload
+//! Response: <refreshes> <controller inits>, then the milliseconds of each phase of the last refresh:
+//! <reset> <init> <data> <power on> <refresh> <power off> <total>, then <skipped refreshes>,
+//! 32 bit big endian each
+#define LINK_CMD_DISPLAY_STATS		0x06
+#define LINK_CMD_COUNT				0x07
+
+//! Response status
+#define LINK_STATUS_OK				0x00
+//! Unknown command
+#define LINK_STATUS_COMMAND			0x01
+//! Payload too short or out of range
+#define LINK_STATUS_ARGUMENT		0x02
+//! Requests were lost, resend from: <expected seq>
+#define LINK_STATUS_SEQUENCE		0x03
+
+#endif /* LINK_PROTOCOL_H_ */
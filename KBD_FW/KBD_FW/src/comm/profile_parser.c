@@ -0,0 +1,177 @@
+/*
+ * profile_parser.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+#include <string.h>
+#include "profile_parser.h"
+#include "comm.h"
+
+// Header bytes following the identifier of each section
+#define KEY_HEADER_SIZE		4	// Key id, scancode, width, height
+#define MACRO_HEADER_SIZE	3	// Key id, length (big endian)
+
+#if BYTES_PER_PIXEL != 1
+#  error Icon rows are buffered as one byte per pixel
+#endif
+
+void profile_parser_init(profile_parser_t *parser, const profile_parser_callbacks_t *callbacks,
+		uint8_t *pool, uint16_t pool_size)
+{
+	memset(parser, 0, sizeof(*parser));
+	parser->callbacks = callbacks;
+	parser->state = PROFILE_PARSER_IDENTIFIER;
+	parser->macro_pool = pool;
+	parser->macro_pool_size = pool_size;
+}
+
+// Called when a key header is complete
+static void profile_parser_start_key(profile_parser_t *parser)
+{
+	parser->key_id = parser->header[0];
+	parser->width = parser->header[2];
+	parser->height = parser->header[3];
+	parser->row = 0;
+	parser->col = 0;
+	parser->rle_color = FILE_RLE_WHITE;
+	parser->callbacks->key(parser->key_id, parser->header[1], parser->width, parser->height);
+	if (!parser->width || !parser->height) {
+		parser->state = PROFILE_PARSER_IDENTIFIER;
+	} else {
+		parser->state = parser->b_rle ? PROFILE_PARSER_RLE_ICON : PROFILE_PARSER_ICON;
+	}
+}
+
+// Expands one run of a run-length icon, reporting the rows it completes
+static void profile_parser_rle_run(profile_parser_t *parser, uint8_t run)
+{
+	while (run && parser->state == PROFILE_PARSER_RLE_ICON) {
+		uint8_t chunk = parser->width - parser->col;
+		if (chunk > run) {
+			chunk = run;
+		}
+		memset(&parser->row_buf[parser->col], parser->rle_color, chunk);
+		parser->col += chunk;
+		run -= chunk;
+		if (parser->col == parser->width) {
+			parser->callbacks->icon_row(parser->key_id, parser->width, parser->height,
+					parser->row, parser->row_buf);
+			parser->col = 0;
+			if (++parser->row == parser->height) {
+				parser->state = PROFILE_PARSER_IDENTIFIER;
+			}
+		}
+	}
+	parser->rle_color = (parser->rle_color == FILE_RLE_WHITE) ? FILE_RLE_BLACK : FILE_RLE_WHITE;
+}
+
+// Called when a macro header is complete
+static void profile_parser_start_macro(profile_parser_t *parser)
+{
+	parser->key_id = parser->header[0];
+	parser->macro_len = (parser->header[1] << 8) | parser->header[2];
+	parser->macro_pos = 0;
+	if ((uint32_t)parser->macro_pool_used + parser->macro_len > parser->macro_pool_size) {
+		parser->state = PROFILE_PARSER_ERROR;
+		return;
+	}
+	parser->state = PROFILE_PARSER_MACRO;
+	if (!parser->macro_len) {
+		parser->callbacks->macro(parser->key_id, &parser->macro_pool[parser->macro_pool_used], 0);
+		parser->state = PROFILE_PARSER_IDENTIFIER;
+	}
+}
+
+void profile_parser_feed(profile_parser_t *parser, const uint8_t *data, uint32_t len)
+{
+	while (len) {
+		uint32_t chunk;
+
+		switch (parser->state) {
+		case PROFILE_PARSER_IDENTIFIER:
+			parser->header[parser->header_len++] = *data++;
+			len--;
+			if (parser->header_len == 2) {
+				uint16_t identifier = (parser->header[0] << 8) | parser->header[1];
+				parser->header_len = 0;
+				if (identifier == FILE_SECTION_IDENTIFIER || identifier == FILE_RLE_SECTION_IDENTIFIER) {
+					parser->state = PROFILE_PARSER_KEY_HEADER;
+					parser->b_rle = (identifier == FILE_RLE_SECTION_IDENTIFIER);
+				} else if (identifier == FILE_MACRO_SECTION_IDENTIFIER) {
+					parser->state = PROFILE_PARSER_MACRO_HEADER;
+				} else {
+					parser->state = PROFILE_PARSER_END;
+				}
+			}
+			break;
+
+		case PROFILE_PARSER_KEY_HEADER:
+		case PROFILE_PARSER_MACRO_HEADER:
+			parser->header[parser->header_len++] = *data++;
+			len--;
+			if (parser->state == PROFILE_PARSER_KEY_HEADER && parser->header_len == KEY_HEADER_SIZE) {
+				parser->header_len = 0;
+				profile_parser_start_key(parser);
+			} else if (parser->state == PROFILE_PARSER_MACRO_HEADER && parser->header_len == MACRO_HEADER_SIZE) {
+				parser->header_len = 0;
+				profile_parser_start_macro(parser);
+			}
+			break;
+
+		case PROFILE_PARSER_ICON:
+			// Copy as much of the current row as available
+			chunk = parser->width - parser->col;
+			if (chunk > len) {
+				chunk = len;
+			}
+			memcpy(&parser->row_buf[parser->col], data, chunk);
+			parser->col += chunk;
+			data += chunk;
+			len -= chunk;
+			if (parser->col == parser->width) {
+				parser->callbacks->icon_row(parser->key_id, parser->width, parser->height,
+						parser->row, parser->row_buf);
+				parser->col = 0;
+				if (++parser->row == parser->height) {
+					parser->state = PROFILE_PARSER_IDENTIFIER;
+				}
+			}
+			break;
+
+		case PROFILE_PARSER_RLE_ICON:
+			profile_parser_rle_run(parser, *data++);
+			len--;
+			break;
+
+		case PROFILE_PARSER_MACRO:
+			chunk = parser->macro_len - parser->macro_pos;
+			if (chunk > len) {
+				chunk = len;
+			}
+			memcpy(&parser->macro_pool[parser->macro_pool_used + parser->macro_pos], data, chunk);
+			parser->macro_pos += chunk;
+			data += chunk;
+			len -= chunk;
+			if (parser->macro_pos == parser->macro_len) {
+				const uint8_t *code = &parser->macro_pool[parser->macro_pool_used];
+				parser->macro_pool_used += parser->macro_len;
+				parser->state = PROFILE_PARSER_IDENTIFIER;
+				parser->callbacks->macro(parser->key_id, code, parser->macro_len);
+			}
+			break;
+
+		case PROFILE_PARSER_END:
+		case PROFILE_PARSER_ERROR:
+		default:
+			return;
+		}
+	}
+}
+
+bool profile_parser_is_complete(const profile_parser_t *parser)
+{
+	return (parser->state == PROFILE_PARSER_END)
+			|| (parser->state == PROFILE_PARSER_IDENTIFIER && parser->header_len == 0);
+}
@@ -0,0 +1,77 @@
+/*
+ * profile_parser.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+
+#ifndef PROFILE_PARSER_H_
+#define PROFILE_PARSER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Resumable parser of the profile format described in comm.c.
+ *
+ * Data is fed in fragments of any size as it arrives. Each part of a section
+ * is reported as soon as it is complete: the key header, each icon row and
+ * each macro. Nothing is staged beyond one icon row and the macro bytecode.
+ * Run-length icons are expanded into the same row buffer, with no window.
+ */
+
+//! Largest icon width, one row is buffered
+#define PROFILE_PARSER_ROW_MAX		255
+
+typedef struct profile_parser_callbacks {
+	//! Key section header: scancode and icon size, the icon rows follow
+	void (*key)(uint8_t key_id, uint8_t scancode, uint8_t width, uint8_t height);
+	//! One complete icon row
+	void (*icon_row)(uint8_t key_id, uint8_t width, uint8_t height, uint8_t row, const uint8_t *pixels);
+	//! Complete macro bytecode, stored in the pool given to profile_parser_init()
+	void (*macro)(uint8_t key_id, const uint8_t *code, uint16_t len);
+} profile_parser_callbacks_t;
+
+typedef enum {
+	PROFILE_PARSER_IDENTIFIER,       //!< Between sections
+	PROFILE_PARSER_KEY_HEADER,
+	PROFILE_PARSER_ICON,
+	PROFILE_PARSER_RLE_ICON,
+	PROFILE_PARSER_MACRO_HEADER,
+	PROFILE_PARSER_MACRO,
+	PROFILE_PARSER_END,              //!< Data after the last section (XMODEM padding) is ignored
+	PROFILE_PARSER_ERROR,            //!< Macro larger than the pool
+} profile_parser_state_t;
+
+typedef struct profile_parser {
+	const profile_parser_callbacks_t *callbacks;
+	profile_parser_state_t state;
+	uint8_t header[4];               //!< Bytes of the identifier or section header
+	uint8_t header_len;
+	uint8_t key_id;
+	uint8_t width;
+	uint8_t height;
+	uint8_t row;
+	uint8_t col;
+	bool b_rle;                      //!< Key header of a run-length section
+	uint8_t rle_color;               //!< Color of the next run
+	uint8_t row_buf[PROFILE_PARSER_ROW_MAX];
+	uint8_t *macro_pool;
+	uint16_t macro_pool_size;
+	uint16_t macro_pool_used;
+	uint16_t macro_len;
+	uint16_t macro_pos;
+} profile_parser_t;
+
+// Starts parsing a new profile. Macros are stored in pool, which is reused from its start.
+void profile_parser_init(profile_parser_t *parser, const profile_parser_callbacks_t *callbacks,
+		uint8_t *pool, uint16_t pool_size);
+
+// Parses the next len bytes of the profile.
+void profile_parser_feed(profile_parser_t *parser, const uint8_t *data, uint32_t len);
+
+// Returns true if the data fed so far ends on a section boundary.
+bool profile_parser_is_complete(const profile_parser_t *parser);
+
+#endif /* PROFILE_PARSER_H_ */
@@ -42,8 +42,11 @@
  */
 
 #include <asf.h>
+#include <string.h>
 #include "xmodem.h"
 #include "sysclk.h"
+#include "scan_scheduler.h"
+#include "crc16.h"
 
 /// @cond 0
 /**INDENT-OFF**/
@@ -55,164 +58,441 @@ extern "C" {
 
 /** The definitions are followed by the XMODEM protocol */
 #define XMDM_SOH     0x01 /**< Start of heading */
+#define XMDM_STX     0x02 /**< Start of 1K heading (XMODEM-1K / YMODEM) */
 #define XMDM_EOT     0x04 /**< End of text */
 #define XMDM_ACK     0x06 /**< Acknowledge  */
 #define XMDM_NAK     0x15 /**< negative acknowledge */
 #define XMDM_CAN     0x18 /**< Cancel */
 #define XMDM_ESC     0x1b /**< Escape */
 
-#define CRC16POLY   0x1021  /**< CRC 16 polynom */
 #define PKTLEN_128  128u    /**< Packet length */
+#define PKTLEN_1K   1024u   /**< Packet length after STX */
 
-// Blocking version of UDC Get Character 
-char xgetc() {
-	while ( !(udi_cdc_is_rx_ready()) );
-	return udi_cdc_getc();	
-}
+/** Receiver timing */
+#define XMODEM_START_PERIOD_MS    1000 /**< Period of 'C' while waiting for a sender */
+#define XMODEM_TIMEOUT_MS         1000 /**< Silence in a transfer before a NAK */
+#define XMODEM_PURGE_MS           100  /**< Silence after a bad packet before its NAK */
+#define XMODEM_MAX_RETRIES        10   /**< NAKs in a row before the transfer is cancelled */
+/** Host not reading before the transfer is dropped, as long as a silent sender is waited for */
+#define XMODEM_REPLY_TIMEOUT_MS   (XMODEM_TIMEOUT_MS * XMODEM_MAX_RETRIES)
+
+/** Largest packet following SOH or STX: sequence, complement, data, CRC */
+#define XMODEM_PACKET_SIZE        (2 + PKTLEN_1K + 2)
+
+/** Longest YMODEM file name kept */
+#define XMODEM_FILE_NAME_SIZE     64
+
+/** Longest reply to one packet or control byte: ACK then 'C', or CAN CAN */
+#define XMODEM_REPLY_SIZE         2
+
+/** Receiver states */
+enum xmodem_rx_state {
+	XMODEM_RX_IDLE,       /**< Sending 'C' until the sender starts */
+	XMODEM_RX_HEADER,     /**< Waiting for SOH, EOT or CAN */
+	XMODEM_RX_PACKET,     /**< Receiving the bytes following SOH */
+	XMODEM_RX_PURGE,      /**< Dropping the rest of a bad packet */
+};
 
 /* Global Variables */
-int8_t	ul_buffer[PKTLEN_128+1];
+static void (*xmodem_store_fn)(uint8_t *, uint32_t, uint32_t);
+static enum xmodem_rx_state xmodem_state;
+static uint8_t xmodem_packet[XMODEM_PACKET_SIZE];
+static uint32_t xmodem_packet_len;
+static uint32_t xmodem_packet_data_len;
+static uint8_t xmodem_sno;
+static uint8_t xmodem_retries;
+static uint32_t xmodem_size;
+static uint32_t xmodem_last_ms;
+/** YMODEM batch: a block 0 header may come next */
+static bool xmodem_b_header_allowed;
+/** YMODEM batch: exact file length from the header, 0 when unknown */
+static uint32_t xmodem_file_len;
+/** First EOT already NAKed */
+static bool xmodem_b_eot_nak;
+static bool xmodem_b_batch;
+static char xmodem_file_name[XMODEM_FILE_NAME_SIZE];
+/** Reply not yet taken by the CDC interface, and since when */
+static uint8_t xmodem_reply[XMODEM_REPLY_SIZE];
+static uint8_t xmodem_reply_len;
+static uint32_t xmodem_reply_ms;
 
 /**
- * \brief Get bytes through XMODEM protocol.
+ * \brief Queue a reply byte, sent by xmodem_reply_flush().
  *
- * \param usart  Base address of the USART instance.
- * \param p_data  Pointer to the data buffer.
- * \param ul_length Length of data expected.
+ * udi_cdc_putc() would wait for the host to read, blocking the main loop.
+ */
+static void xmodem_reply_put(uint8_t c_char)
+{
+	Assert(xmodem_reply_len < XMODEM_REPLY_SIZE);
+	if (!xmodem_reply_len) {
+		xmodem_reply_ms = scan_scheduler_get_time_ms();
+	}
+	xmodem_reply[xmodem_reply_len++] = c_char;
+}
+
+/**
+ * \brief Hand the queued reply to the CDC interface if it has room, without waiting.
  *
- * \return Calculated CRC value
+ * \return true once no reply is queued
  */
-static uint16_t xmodem_get_bytes(int8_t *p_data,
-		uint32_t ul_length)
+static bool xmodem_reply_flush(void)
 {
-	uint16_t us_crc = 0;
-	uint32_t i, j;
-	uint8_t c_char;
+	if (xmodem_reply_len && udi_cdc_get_free_tx_buffer() >= xmodem_reply_len) {
+		udi_cdc_write_buf(xmodem_reply, xmodem_reply_len);
+		xmodem_reply_len = 0;
+	}
+	return !xmodem_reply_len;
+}
 
-	for (i = 0; i < ul_length; ++i) {
-		c_char = xgetc();
-		us_crc = us_crc ^ (int32_t) c_char << 8;
-		for (j = 0; j < 8; j++) {
-			if (us_crc & 0x8000) {
-				us_crc = us_crc << 1 ^ CRC16POLY;
-			} else {
-				us_crc = us_crc << 1;
-			}
-		}
-		us_crc = us_crc & 0xFFFF;
-		*p_data++ = c_char;
+/**
+ * \brief Ask the sender to repeat the current packet, or give up.
+ *
+ * \return XMODEM_RECEIVING, or XMODEM_ERROR after too many retries
+ */
+static xmodem_status_t xmodem_nak(void)
+{
+	xmodem_state = XMODEM_RX_HEADER;
+	xmodem_last_ms = scan_scheduler_get_time_ms();
+	if (++xmodem_retries > XMODEM_MAX_RETRIES) {
+		xmodem_reply_put(XMDM_CAN);
+		xmodem_reply_put(XMDM_CAN);
+		xmodem_state = XMODEM_RX_IDLE;
+		return XMODEM_ERROR;
 	}
-	return us_crc;
+	xmodem_reply_put(XMDM_NAK);
+	return XMODEM_RECEIVING;
 }
 
 /**
- * \brief Get a packet through XMODEM protocol
+ * \brief Drop the input until the line is quiet, then NAK.
  *
- * \param usart  Base address of the USART instance.
- * \param p_data  Pointer to the data buffer.
- * \param uc_sno  Sequnce number.
+ * The rest of a bad packet is not read as control bytes: an EOT or CAN in
+ * its data would end the transfer.
  *
- * \return 0 for sucess and other value for XMODEM error
+ * \return XMODEM_RECEIVING
  */
-static int32_t xmodem_get_packet(int8_t *p_data,
-		uint8_t uc_sno)
+static xmodem_status_t xmodem_purge(void)
 {
-	uint8_t uc_cp_seq[2], uc_temp[2];
-	uint16_t us_crc, us_xcrc;
-
-	xmodem_get_bytes((int8_t *)uc_cp_seq, 2);
-
-	us_xcrc = xmodem_get_bytes(p_data, PKTLEN_128);
-
-	/* An "endian independent way to combine the CRC bytes. */
-	uc_temp[0] = xgetc();
-	uc_temp[1] = xgetc();
+	xmodem_state = XMODEM_RX_PURGE;
+	return XMODEM_RECEIVING;
+}
 
-	us_crc = uc_temp[0] << 8;
-	us_crc += uc_temp[1];
+/**
+ * \brief Read the YMODEM block 0: file name, then length in decimal.
+ *
+ * \return XMODEM_RECEIVING for a new file, XMODEM_DONE for the empty
+ * header ending the batch
+ */
+static xmodem_status_t xmodem_header_received(void)
+{
+	const char *p_data = (const char *)&xmodem_packet[2];
+	uint32_t i;
+
+	xmodem_reply_put(XMDM_ACK);
+	if (!p_data[0]) {
+		/* End of batch */
+		xmodem_state = XMODEM_RX_IDLE;
+		return XMODEM_DONE;
+	}
 
-	if( (us_crc != us_xcrc) || (uc_cp_seq[0] != uc_sno) || (uc_cp_seq[1] != (uc_sno ^ 0xFF)) ) {
-		udi_cdc_putc(XMDM_CAN);
-		return (-1);
+	for (i = 0; i < XMODEM_FILE_NAME_SIZE - 1 && p_data[i]; i++) {
+		xmodem_file_name[i] = p_data[i];
+	}
+	xmodem_file_name[i] = '\0';
+	while (i < xmodem_packet_data_len && p_data[i]) {
+		i++;
+	}
+	xmodem_file_len = 0;
+	for (i++; i < xmodem_packet_data_len && p_data[i] >= '0' && p_data[i] <= '9'; i++) {
+		xmodem_file_len = xmodem_file_len * 10 + (p_data[i] - '0');
 	}
 
-	return 0;
+	/* Start the file, the sender waits for 'C' before the data */
+	xmodem_b_batch = true;
+	xmodem_b_header_allowed = false;
+	xmodem_b_eot_nak = false;
+	xmodem_sno = 0x01;
+	xmodem_size = 0;
+	xmodem_reply_put('C');
+	return XMODEM_RECEIVING;
 }
 
 /**
- * \brief Receive the files through XMODEM protocol
+ * \brief Check and store a complete packet.
  *
- * \param usart  Base address of the USART instance.
- * \param p_buffer  Pointer to receive buffer
- *
- * \return received file size
- * \return 0: no data
- * \return -1: error encountered during file receive 
+ * \return XMODEM_RECEIVING, XMODEM_DONE at the end of a YMODEM batch,
+ * or XMODEM_ERROR if the sender lost sync
  */
-uint32_t xmodem_receive_file(int8_t *p_buffer)
-//uint32_t xmodem_receive_file( usart_if usart, void (*store_fn)( uint8_t*, uint32_t, uint32_t ) )
+static xmodem_status_t xmodem_packet_received(void)
 {
-	uint32_t ul_timeout;
-	uint8_t c_char;
-	int32_t l_done;
-	uint8_t uc_sno = 0x01;
-	uint32_t ul_size = 0;
+	uint8_t uc_sno = xmodem_packet[0];
+	uint16_t us_crc;
+	uint32_t ul_len;
 
-	/* Disable all interrupts */
-	// cpu_irq_disable();
+	/* An "endian independent way to combine the CRC bytes. */
+	us_crc = xmodem_packet[2 + xmodem_packet_data_len] << 8;
+	us_crc += xmodem_packet[2 + xmodem_packet_data_len + 1];
+
+	if ((us_crc != crc16_update(CRC16_INIT, &xmodem_packet[2], xmodem_packet_data_len))
+			|| ((uint8_t)(xmodem_packet[1] ^ uc_sno) != 0xFF)) {
+		/* Corrupted, the sender repeats it */
+		return xmodem_purge();
+	}
 
-	/* Wait and put 'C' till start XMODEM transfer */
-	if (udi_cdc_is_tx_ready()) {
-		udi_cdc_putc('C');
-	} else {
-		return 0;
+	xmodem_state = XMODEM_RX_HEADER;
+	xmodem_retries = 0;
+	xmodem_b_eot_nak = false;
+	if (uc_sno == 0x00 && xmodem_b_header_allowed) {
+		return xmodem_header_received();
+	}
+	if (uc_sno == (uint8_t)(xmodem_sno - 1)) {
+		/* Our ACK was lost, the packet is already stored */
+		xmodem_reply_put(XMDM_ACK);
+		return XMODEM_RECEIVING;
 	}
-	
-	ul_timeout = (sysclk_get_peripheral_hz() / 100);
-	while (!(udi_cdc_is_rx_ready())) {
-		if (ul_timeout-- == 0) {
-			return 0;
+	if (uc_sno != xmodem_sno) {
+		xmodem_reply_put(XMDM_CAN);
+		xmodem_reply_put(XMDM_CAN);
+		xmodem_state = XMODEM_RX_IDLE;
+		return XMODEM_ERROR;
+	}
+
+	/* Got a packet, without the padding past a known file length */
+	ul_len = xmodem_packet_data_len;
+	if (xmodem_file_len) {
+		if (xmodem_size >= xmodem_file_len) {
+			ul_len = 0;
+		} else if (ul_len > xmodem_file_len - xmodem_size) {
+			ul_len = xmodem_file_len - xmodem_size;
 		}
 	}
+	if (ul_len) {
+		xmodem_store_fn(&xmodem_packet[2], ul_len, xmodem_size);
+	}
+	xmodem_b_header_allowed = false;
+	xmodem_sno++;
+	xmodem_size += ul_len;
+	xmodem_reply_put(XMDM_ACK);
+	return XMODEM_RECEIVING;
+}
 
-	/* Begin to receive the data */
-	l_done = 0;
-	while (l_done == 0) {
-		c_char = xgetc();
+void xmodem_receive_init(void (*store_fn)(uint8_t *, uint32_t, uint32_t))
+{
+	xmodem_store_fn = store_fn;
+	xmodem_state = XMODEM_RX_IDLE;
+	xmodem_reply_len = 0;
+	xmodem_last_ms = scan_scheduler_get_time_ms() - XMODEM_START_PERIOD_MS;
+}
 
+/**
+ * \brief Handle a byte received between packets.
+ *
+ * \return XMODEM_DONE or XMODEM_ERROR at the end of the transfer,
+ * XMODEM_RECEIVING otherwise
+ */
+static xmodem_status_t xmodem_control_received(uint8_t c_char)
+{
+	switch (xmodem_state) {
+	case XMODEM_RX_IDLE:
+		if (c_char != XMDM_SOH && c_char != XMDM_STX) {
+			/* Not a sender */
+			break;
+		}
+		xmodem_sno = 0x01;
+		xmodem_size = 0;
+		xmodem_retries = 0;
+		xmodem_file_len = 0;
+		xmodem_file_name[0] = '\0';
+		xmodem_b_batch = false;
+		xmodem_b_eot_nak = false;
+		/* A YMODEM sender starts with its block 0 */
+		xmodem_b_header_allowed = true;
+		/* No break */
+	case XMODEM_RX_HEADER:
+	default:
 		switch (c_char) {
-		/* Start of transfer */
+		/* Start of packet */
 		case XMDM_SOH:
-			l_done = xmodem_get_packet(p_buffer+ul_size, uc_sno);
-			if (l_done == 0) {
-				/* Got a packet */
-				//store_fn( (uint8_t *)ul_buffer, PKTLEN_128, ul_size );
-				uc_sno++;
-				ul_size += PKTLEN_128;
-			}
-			if( l_done != -1 ) {
-				udi_cdc_putc(XMDM_ACK);
-			}
+		case XMDM_STX:
+			xmodem_state = XMODEM_RX_PACKET;
+			xmodem_packet_len = 0;
+			xmodem_packet_data_len = (c_char == XMDM_STX) ? PKTLEN_1K : PKTLEN_128;
 			break;
 
 		/* End of transfer */
 		case XMDM_EOT:
-			udi_cdc_putc(XMDM_ACK);
-			l_done = ul_size;
+			if (!xmodem_b_eot_nak) {
+				/* The sender confirms the end of file with a second EOT,
+				 * a corrupted byte does not end it */
+				xmodem_b_eot_nak = true;
+				xmodem_reply_put(XMDM_NAK);
+				break;
+			}
+			xmodem_reply_put(XMDM_ACK);
+			if (!xmodem_b_batch) {
+				xmodem_state = XMODEM_RX_IDLE;
+				return XMODEM_DONE;
+			}
+			/* Ask for the next header, an empty one ends the batch */
+			xmodem_reply_put('C');
+			xmodem_b_header_allowed = true;
+			xmodem_sno = 0x00;
 			break;
 
 		case XMDM_CAN:
 		case XMDM_ESC:
+			xmodem_state = XMODEM_RX_IDLE;
+			return XMODEM_ERROR;
+
 		default:
-			l_done = -1;
-			break;
+			/* Line noise between packets, or the rest of a packet whose header was lost */
+			return xmodem_purge();
+		}
+		break;
+	}
+	return XMODEM_RECEIVING;
+}
+
+/**
+ * \brief Look for a sender in the bytes received while idle.
+ *
+ * The input is only claimed for the header of a first packet: SOH or STX,
+ * then block 0 (YMODEM) or 1 (XMODEM) and its complement, in the same USB
+ * bank. Other bytes are dropped up to the next 0x00, which starts a link
+ * frame (see link_protocol.h). A sender whose header was split by the bank
+ * sends its packet again after its timeout.
+ *
+ * \return true with the SOH or STX next in the CDC buffer
+ */
+static bool xmodem_sender_found(void)
+{
+	const uint8_t *p_data;
+	iram_size_t ul_avail;
+	iram_size_t ul_used;
+
+	p_data = udi_cdc_get_rx_buffer(&ul_avail);
+	if (p_data == NULL) {
+		return false;
+	}
+	for (ul_used = 0; ul_used < ul_avail && p_data[ul_used]; ul_used++) {
+		if ((p_data[ul_used] == XMDM_SOH || p_data[ul_used] == XMDM_STX)
+				&& ul_avail - ul_used >= 3 && p_data[ul_used + 1] <= 0x01
+				&& (uint8_t)(p_data[ul_used + 1] ^ p_data[ul_used + 2]) == 0xFF) {
+			udi_cdc_rx_consume(ul_used);
+			return true;
+		}
+	}
+	/* Line noise, the link gets the 0x00 */
+	udi_cdc_rx_consume(ul_used);
+	return false;
+}
+
+/**
+ * \brief Receive the files through XMODEM protocol
+ *
+ * Handles the bytes already received on the CDC interface and returns
+ * without waiting. Packet data is copied straight out of the CDC buffer.
+ *
+ * \return XMODEM_IDLE: no transfer
+ * \return XMODEM_RECEIVING: transfer on going
+ * \return XMODEM_DONE: file received, see xmodem_get_size()
+ * \return XMODEM_ERROR: transfer cancelled
+ */
+xmodem_status_t xmodem_receive_process(void)
+{
+	uint32_t now_ms = scan_scheduler_get_time_ms();
+	xmodem_status_t status = XMODEM_RECEIVING;
+	const uint8_t *p_data;
+	iram_size_t ul_avail;
+	iram_size_t ul_used;
+	uint32_t ul_chunk;
+
+	if (!xmodem_reply_flush()) {
+		/* The sender waits for the reply: leave the input, and the timeouts, until it is sent */
+		xmodem_last_ms = now_ms;
+		if (now_ms - xmodem_reply_ms < XMODEM_REPLY_TIMEOUT_MS) {
+			return (xmodem_state == XMODEM_RX_IDLE) ? XMODEM_IDLE : XMODEM_RECEIVING;
+		}
+		/* The host stopped reading */
+		xmodem_reply_len = 0;
+		if (xmodem_state != XMODEM_RX_IDLE) {
+			xmodem_state = XMODEM_RX_IDLE;
+			return XMODEM_ERROR;
+		}
+		return XMODEM_IDLE;
+	}
+
+	if (xmodem_state == XMODEM_RX_IDLE && !udi_cdc_is_rx_ready()) {
+		/* Wait and put 'C' till start XMODEM transfer */
+		if ((now_ms - xmodem_last_ms >= XMODEM_START_PERIOD_MS) && udi_cdc_is_tx_ready()) {
+			xmodem_reply_put('C');
+			xmodem_reply_flush();
+			xmodem_last_ms = now_ms;
+		}
+		return XMODEM_IDLE;
+	}
+
+	if (!udi_cdc_is_rx_ready()) {
+		if ((xmodem_state == XMODEM_RX_PURGE && now_ms - xmodem_last_ms >= XMODEM_PURGE_MS)
+				|| now_ms - xmodem_last_ms >= XMODEM_TIMEOUT_MS) {
+			/* The sender stopped after a bad packet, or went silent: ask again */
+			status = xmodem_nak();
+			xmodem_reply_flush();
+		}
+		return status;
+	}
+
+	if (xmodem_state == XMODEM_RX_IDLE && !xmodem_sender_found()) {
+		return XMODEM_IDLE;
+	}
+
+	/* Begin to receive the data */
+	xmodem_last_ms = now_ms;
+	while ((p_data = udi_cdc_get_rx_buffer(&ul_avail)) != NULL) {
+		ul_used = 0;
+		while (ul_used < ul_avail) {
+			if (xmodem_state == XMODEM_RX_PURGE) {
+				ul_used = ul_avail;
+			} else if (xmodem_state == XMODEM_RX_PACKET) {
+				ul_chunk = xmodem_packet_data_len + 4 - xmodem_packet_len;
+				if (ul_chunk > ul_avail - ul_used) {
+					ul_chunk = ul_avail - ul_used;
+				}
+				memcpy(&xmodem_packet[xmodem_packet_len], &p_data[ul_used], ul_chunk);
+				xmodem_packet_len += ul_chunk;
+				ul_used += ul_chunk;
+				if (xmodem_packet_len == xmodem_packet_data_len + 4) {
+					status = xmodem_packet_received();
+				}
+			} else {
+				status = xmodem_control_received(p_data[ul_used++]);
+			}
+			if (status != XMODEM_RECEIVING || xmodem_reply_len) {
+				/* Nothing more is read before the reply is sent */
+				udi_cdc_rx_consume(ul_used);
+				xmodem_reply_flush();
+				return status;
+			}
 		}
+		udi_cdc_rx_consume(ul_used);
 	}
 
-	/* Enable interrupts */
-	// cpu_irq_enable();
+	return (xmodem_state == XMODEM_RX_IDLE) ? XMODEM_IDLE : XMODEM_RECEIVING;
+}
+
+uint32_t xmodem_get_size(void)
+{
+	return xmodem_size;
+}
 
-	return ul_size;
+bool xmodem_is_receiving(void)
+{
+	return xmodem_state != XMODEM_RX_IDLE;
+}
+
+const char *xmodem_get_file_name(void)
+{
+	return xmodem_file_name;
 }
 
 #if 0	// For now, no sending
@@ -63,8 +63,37 @@ extern "C" {
  *
  * @{
  */
-uint32_t xmodem_receive_file(int8_t *p_buffer);
-//uint32_t xmodem_receive_file( usart_if usart, void (*store_fn)( uint8_t*, uint32_t, uint32_t ) );
+typedef enum {
+	XMODEM_IDLE,        /**< Waiting for a sender */
+	XMODEM_RECEIVING,   /**< Transfer on going */
+	XMODEM_DONE,        /**< File or YMODEM batch received */
+	XMODEM_ERROR,       /**< Transfer cancelled */
+} xmodem_status_t;
+
+/**
+ * \brief Prepare the receiver.
+ *
+ * \param store_fn  Called with each packet received: data, length and offset in the file
+ */
+void xmodem_receive_init(void (*store_fn)(uint8_t *, uint32_t, uint32_t));
+xmodem_status_t xmodem_receive_process(void);
+
+/**
+ * \brief Whether a transfer is in progress: the CDC input belongs to XMODEM.
+ */
+bool xmodem_is_receiving(void);
+
+/**
+ * \brief Bytes received in the current or last file.
+ *
+ * Exact for YMODEM files, a multiple of the packet size for XMODEM.
+ */
+uint32_t xmodem_get_size(void);
+
+/**
+ * \brief Name of the current or last YMODEM file, empty for XMODEM.
+ */
+const char *xmodem_get_file_name(void);
 
 /// @cond 0
 /**INDENT-OFF**/
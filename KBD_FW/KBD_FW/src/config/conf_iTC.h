@@ -9,12 +9,43 @@
 #ifndef CONF_ITC_H_
 #define CONF_ITC_H_
 
+#include <stdint.h>
+
 #define CONF_GFX_ITC
 
 #define CONF_ITC_SPI SPI
 
 #define CONF_ITC_CLOCK_SPEED 1000000UL
 
+// Send the frame data with the SPI PDC channel, the CPU is free during the transfer.
+// Comment out to send it byte per byte.
+#define CONF_ITC_USE_PDC
+
+// Keep the panel powered between refreshes, so the controller keeps its registers and a refresh
+// starts with the frame data. Comment out to power the panel off after each refresh.
+#define CONF_ITC_KEEP_POWERED
+
+// Only send and update the parts of the screen drawn since the last refresh, when they are small.
+// Needs CONF_ITC_KEEP_POWERED.
+#define CONF_ITC_PARTIAL_REFRESH
+
+// Keep a copy of the frame last sent (15000 bytes of RAM): a refresh only sends the bytes that
+// differ from it, and is skipped when none do.
+#define CONF_ITC_SHADOW_BUFFER
+// For builds short of RAM, keep a hash of each row instead (1200 bytes): the drawn rows that did
+// not change are not sent. Used when CONF_ITC_SHADOW_BUFFER is not defined.
+//#define CONF_ITC_SHADOW_ROW_HASH
+
+// Millisecond time base timing the display refresh steps, provided by main.c
+extern uint32_t main_get_time_ms(void);
+#define CONF_ITC_GET_TIME_MS()   main_get_time_ms()
+
+// Interrupt telling the PDC transfer is done
+#define CONF_ITC_SPI_IRQn        SPI_IRQn
+#define CONF_ITC_SPI_Handler     SPI_Handler
+// Below the USB interrupt
+#define CONF_ITC_SPI_INT_LEVEL   6
+
 
 /** \brief Define what MCU pin the ILI9341 chip select pin is connected to */
 #define CONF_ITC_CS_PIN        DISPLAY_CS
@@ -0,0 +1,29 @@
+/*
+ * conf_keyboard.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+#ifndef CONF_KEYBOARD_H_
+#define CONF_KEYBOARD_H_
+
+#include "debounce.h"
+
+/** \brief Full key matrix scans per second while the USB bus is active.
+ * One column is stepped per SysTick, so the tick rate is this times KEY_COL_NUM.
+ */
+#define KEYBOARD_SCAN_RATE_HZ			1000
+
+/** \brief Full key matrix scans per second while the USB bus is suspended */
+#define KEYBOARD_SCAN_SUSPEND_RATE_HZ	100
+
+/** \brief Debounce algorithm applied to the raw key matrix, see \ref debounce_mode_t */
+#define KEYBOARD_DEBOUNCE_MODE		DEBOUNCE_MODE_EAGER
+
+/** \brief Debounce time in full matrix scans (5ms at KEYBOARD_SCAN_RATE_HZ).
+ * Used by the eager and deferred modes. The integrator always takes 4 scans.
+ */
+#define KEYBOARD_DEBOUNCE_SCANS		5
+
+#endif /* CONF_KEYBOARD_H_ */
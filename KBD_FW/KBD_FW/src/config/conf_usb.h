@@ -202,6 +202,12 @@
 //! Enable id string of interface to add an extra USB string
 #define  UDI_HID_KBD_STRING_ID            5
 
+//! Report every pressed key with a bitmap report (boot report when the host selects boot protocol)
+#define  UDI_HID_KBD_NKRO
+
+//! Poll the keyboard endpoint every frame (1 ms at full speed)
+#define  UDI_HID_KBD_INTERVAL             1
+
 /**
  * USB HID Keyboard low level configuration
  * In standalone these configurations are defined by the HID Keyboard module.
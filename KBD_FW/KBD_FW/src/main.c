@@ -52,12 +52,16 @@
 #include "spi_master.h"
 #include "conf_iTC.h"
 #include "comm.h"
+#include "scan_scheduler.h"
+#include "conf_keyboard.h"
 
 #define MAIN_LOOP_DELAY_TIME	10
 #define SCREEN_UPDATE_CHECK_PERIOD	1
 
 static volatile bool main_b_keyboard_enable = false;
 static volatile bool main_b_cdc_enable = false;
+// Set while the suspend keeps the sleep mode that lets SysTick run
+static bool main_b_suspend_lock = false;
 
 // [main_tc_configure]
 
@@ -124,12 +128,14 @@ int main(void)
 			cycles_since_update_req++;
 		}
 		
-		// If the cycle count hits the required number, refresh the screen
-		if (cycles_since_update_req == SCREEN_UPDATE_CHECK_PERIOD) {
+		// If the cycle count hits the required number, refresh the screen once the previous refresh is done
+		if (cycles_since_update_req >= SCREEN_UPDATE_CHECK_PERIOD && !ui_refresh_in_progress()) {
 			ui_refresh_screen();
 			cycles_since_update_req = 0;
 			
 		}
+		// The refresh waits on the display without blocking the loop
+		ui_refresh_process();
 		comm_process();
 		sleepmgr_enter_sleep();
 	}
@@ -139,19 +145,39 @@ int main(void)
 void main_suspend_action(void)
 {
 	ui_powerdown();
+	// SOFs stop while suspended, the scan keeps running on SysTick at a reduced rate.
+	// The UDP driver releases its sleep lock on suspend, wait mode would stop SysTick.
+	if (!main_b_suspend_lock) {
+		sleepmgr_lock_mode(SLEEPMGR_SLEEP_WFI);
+		main_b_suspend_lock = true;
+	}
+	scan_scheduler_set_rate(KEYBOARD_SCAN_SUSPEND_RATE_HZ);
 }
 
 void main_resume_action(void)
 {
+	scan_scheduler_set_rate(KEYBOARD_SCAN_RATE_HZ);
+	if (main_b_suspend_lock) {
+		sleepmgr_unlock_mode(SLEEPMGR_SLEEP_WFI);
+		main_b_suspend_lock = false;
+	}
 	ui_wakeup();
 }
 
+uint32_t main_get_time_ms(void)
+{
+	// The scan ticks keep running while the USB bus is suspended, unlike the SOFs
+	return scan_scheduler_get_time_ms();
+}
+
 void main_sof_action(void)
 {
 	if ((!main_b_keyboard_enable) ||
 		(!main_b_cdc_enable))
 		return;
 	ui_process(udd_get_frame_number());
+	// Arm the keyboard report with every change made during this frame
+	udi_hid_kbd_report_flush();
 }
 
 void main_remotewakeup_enable(void)
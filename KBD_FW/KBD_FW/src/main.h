@@ -116,6 +116,11 @@ void main_remotewakeup_disable(void);
  */
 bool main_extra_string(void);
 
+/*! \brief Millisecond time base of the application
+ * Used by the display driver, see CONF_ITC_GET_TIME_MS() in conf_iTC.h.
+ */
+uint32_t main_get_time_ms(void);
+
 /*! \brief Initialize the memories used by examples
  */
 void memories_initialization(void);
@@ -0,0 +1,139 @@
+/*
+ * debounce.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */ 
+
+#include <asf.h>
+#include <string.h>
+#include "debounce.h"
+#include "ui.h"
+
+static debounce_mode_t debounce_mode = DEBOUNCE_MODE_NONE;
+static uint8_t debounce_scans = 0;
+
+// Debounced key state: bit n is set while key n is pressed.
+static uint32_t debounce_state = 0;
+
+// Per-key sample counters for the eager and deferred modes,
+// with a bit set in debounce_counting for every key whose counter is running.
+static uint8_t debounce_counters[KEY_COUNT];
+static uint32_t debounce_counting = 0;
+
+// Vertical counter bits for the integrator mode
+static uint32_t debounce_ct0 = ~0u;
+static uint32_t debounce_ct1 = ~0u;
+
+void debounce_init(debounce_mode_t mode, uint8_t scans)
+{
+	debounce_mode = mode;
+	debounce_scans = scans;
+	debounce_state = 0;
+	debounce_counting = 0;
+	debounce_ct0 = ~0u;
+	debounce_ct1 = ~0u;
+	memset(debounce_counters, 0, sizeof(debounce_counters));
+}
+
+/**
+ * Eager mode: accept a change immediately unless the key is still locked out
+ * from its previous change, then lock it out for debounce_scans samples.
+ */
+static void debounce_update_eager(uint32_t raw, uint32_t mask)
+{
+	uint32_t changed = (debounce_state ^ raw) & mask & ~debounce_counting;
+	debounce_state ^= changed;
+	
+	// Count down the lockout of the sampled keys
+	uint32_t counting = debounce_counting & mask;
+	while (counting) {
+		uint8_t key_idx = ctz(counting);
+		counting &= counting - 1;
+		
+		if (--debounce_counters[key_idx] == 0) {
+			debounce_counting &= ~(1u << key_idx);
+		}
+	}
+	
+	if (debounce_scans == 0) {
+		return;
+	}
+	debounce_counting |= changed;
+	while (changed) {
+		uint8_t key_idx = ctz(changed);
+		changed &= changed - 1;
+		
+		debounce_counters[key_idx] = debounce_scans;
+	}
+}
+
+/**
+ * Deferred mode: accept a change once the key has differed from its debounced
+ * state for debounce_scans samples in a row.
+ */
+static void debounce_update_defer(uint32_t raw, uint32_t mask)
+{
+	uint32_t diff = (debounce_state ^ raw) & mask;
+	
+	// Keys that bounced back restart their count
+	debounce_counting &= diff | ~mask;
+	
+	uint32_t accepted = 0;
+	while (diff) {
+		uint8_t key_idx = ctz(diff);
+		uint32_t key_bit = 1u << key_idx;
+		diff &= diff - 1;
+		
+		if (!(debounce_counting & key_bit)) {
+			debounce_counting |= key_bit;
+			debounce_counters[key_idx] = 0;
+		}
+		if (++debounce_counters[key_idx] >= debounce_scans) {
+			debounce_counting &= ~key_bit;
+			accepted |= key_bit;
+		}
+	}
+	debounce_state ^= accepted;
+}
+
+/**
+ * Integrator mode: 2-bit vertical counter per key. Each differing sample counts
+ * up, a matching sample resets the counter, and the 4th differing sample in a
+ * row toggles the debounced state.
+ */
+static void debounce_update_integrator(uint32_t raw, uint32_t mask)
+{
+	uint32_t delta = (debounce_state ^ raw) & mask;
+	uint32_t ct0 = ~(debounce_ct0 & delta);
+	uint32_t ct1 = ct0 ^ (debounce_ct1 & delta);
+	
+	// Only the sampled keys advance their counters
+	debounce_ct0 = (ct0 & mask) | (debounce_ct0 & ~mask);
+	debounce_ct1 = (ct1 & mask) | (debounce_ct1 & ~mask);
+	
+	debounce_state ^= delta & ct0 & ct1;
+}
+
+uint32_t debounce_update(uint32_t raw, uint32_t mask)
+{
+	switch (debounce_mode) {
+	case DEBOUNCE_MODE_EAGER:
+		debounce_update_eager(raw, mask);
+		break;
+		
+	case DEBOUNCE_MODE_DEFER:
+		debounce_update_defer(raw, mask);
+		break;
+		
+	case DEBOUNCE_MODE_INTEGRATOR:
+		debounce_update_integrator(raw, mask);
+		break;
+		
+	case DEBOUNCE_MODE_NONE:
+	default:
+		debounce_state = (debounce_state & ~mask) | (raw & mask);
+		break;
+	}
+	return debounce_state;
+}
@@ -0,0 +1,38 @@
+/*
+ * debounce.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */ 
+
+
+#ifndef DEBOUNCE_H_
+#define DEBOUNCE_H_
+
+#include <compiler.h>
+
+// Debounce algorithms. All of them work on the packed key matrix bitmap (bit n = key n pressed).
+typedef enum {
+	// Report a change on the first differing sample, then ignore the key for the debounce time.
+	// Lowest press latency.
+	DEBOUNCE_MODE_EAGER,
+	// Report a change once the key has differed for the debounce time in a row.
+	// Filters noise on switches that glitch while idle.
+	DEBOUNCE_MODE_DEFER,
+	// Bit-parallel 2-bit vertical counter: a change is reported after 4 differing samples in a row.
+	// Processes all keys with a few bitwise operations.
+	DEBOUNCE_MODE_INTEGRATOR,
+	// No software debounce
+	DEBOUNCE_MODE_NONE,
+} debounce_mode_t;
+
+// Resets the debounced state to all keys released and selects the algorithm.
+// debounce_scans is the debounce time in samples per key for the eager and deferred modes.
+void debounce_init(debounce_mode_t mode, uint8_t debounce_scans);
+
+// Feeds one raw sample of the keys selected by mask (bit set = pressed).
+// Keys outside the mask keep their state and counters.
+// Returns the debounced state of all keys.
+uint32_t debounce_update(uint32_t raw, uint32_t mask);
+
+#endif /* DEBOUNCE_H_ */
@@ -0,0 +1,36 @@
+/*
+ * key_layout.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+
+#ifndef KEY_LAYOUT_H_
+#define KEY_LAYOUT_H_
+
+/**
+ * Size of the key matrix, key icons and the usages a key can send.
+ *
+ * This header only uses the preprocessor so host tools can include it and
+ * agree with the firmware on the number of keys and the icon limits.
+ */
+
+#define KEY_ROW_NUM				4
+#define KEY_COL_NUM				3
+#define KEY_COUNT				(KEY_ROW_NUM*KEY_COL_NUM)
+#define KEY_ICON_MAX_DIM		50
+
+//! Icon pixels brighter than this are white, the panel being 1 bit per pixel
+#define KEY_ICON_THRES_BLACK	10
+
+//! HID usages the keyboard report holds: 0 (no key) to KEY_USAGE_COUNT-1,
+//! and the modifiers KEY_USAGE_MODIFIER_FIRST to KEY_USAGE_MODIFIER_LAST
+#define KEY_USAGE_COUNT				120
+#define KEY_USAGE_MODIFIER_FIRST	0xE0
+#define KEY_USAGE_MODIFIER_LAST		0xE7
+
+#define KEY_USAGE_IS_VALID(usage) \
+	((usage) < KEY_USAGE_COUNT || ((usage) >= KEY_USAGE_MODIFIER_FIRST && (usage) <= KEY_USAGE_MODIFIER_LAST))
+
+#endif /* KEY_LAYOUT_H_ */
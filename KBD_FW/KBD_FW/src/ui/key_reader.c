@@ -7,12 +7,12 @@
 
 #include <asf.h>
 #include "key_reader.h"
-#include "delay.h"
+#include "debounce.h"
+#include "conf_keyboard.h"
 
-static int wait_time = 1000;
-
-// key_info is a structure that holds the current status and key code for each of the keys.
-// Held in order in the array starting top left and proceeding right along the row, looping back at each new row.
+// Port (0 = PIOA, 1 = PIOB) and PIO_PDSR bit of an IO pin index
+#define PIN_PORT(pin)	((pin) >> 5)
+#define PIN_MASK(pin)	(1u << ((pin) & 0x1F))
 
 static uint8_t row_io_pins[KEY_ROW_NUM] = {
 	GPIO_ROW_0,
@@ -27,40 +27,71 @@ static uint8_t col_io_pins[KEY_COL_NUM] = {
 	GPIO_COL_2
 	};
 
-void keyboard_read(fifo_desc_t *fifo, key_info_t key_arr[KEY_ROW_NUM][KEY_COL_NUM])
-{	
-	// Write 1 to all cols
-	for (int i = 0; i < KEY_COL_NUM; i++) {
-		gpio_set_pin_high(col_io_pins[i]);
-	}
-	
-	// Poll all columns
+// Packed debounced key matrix state: bit n is set while the key with index n is pressed.
+static uint32_t key_matrix_state = 0;
+
+// Key matrix bits belonging to each column
+static uint32_t col_key_masks[KEY_COL_NUM];
+
+// Column currently driven low. Its rows are sampled on the next call to keyboard_scan_step().
+static uint8_t scan_col_idx = 0;
+
+void keyboard_scan_init(void)
+{
+	// Write 1 to all cols and build the key mask of each column
 	for (int col_idx = 0; col_idx < KEY_COL_NUM; col_idx++) {
-		// Write 0 to the polled column and wait
-		gpio_set_pin_low(col_io_pins[col_idx]);
-		delay_us(wait_time);
+		gpio_set_pin_high(col_io_pins[col_idx]);
 		
-		// Check rows status: 1 = unpressed, 0 = pressed
+		col_key_masks[col_idx] = 0;
 		for (int row_idx = 0; row_idx < KEY_ROW_NUM; row_idx++) {
-			int key_status_idx = ROW_COL_TO_IDX(row_idx, col_idx);
-			
-			// Check if the switch status id different than the stored previous status
-			bool row_status = gpio_pin_is_high(row_io_pins[row_idx]);
-			if (row_status ^ key_arr[row_idx][col_idx].pressed) {
-				// Add key event up/down and key code to key event queue.
-				if (row_status) {
-					fifo_push_uint8(fifo, key_event_up);
-				} else {
-					fifo_push_uint8(fifo, key_event_down);
-				}
-				fifo_push_uint8(fifo, key_status_idx);
-				
-				// Update the status of the key in key_info
-				key_arr[row_idx][col_idx].pressed = !key_arr[row_idx][col_idx].pressed;
-			}
-			
-			// Write 1 back to the polled column
-			gpio_set_pin_high(col_io_pins[col_idx]);
+			col_key_masks[col_idx] |= 1u << (ROW_COL_TO_IDX(row_idx, col_idx));
+		}
+	}
+	key_matrix_state = 0;
+	debounce_init(KEYBOARD_DEBOUNCE_MODE, KEYBOARD_DEBOUNCE_SCANS);
+	
+	// Drive the first column so its rows have settled by the first step
+	scan_col_idx = 0;
+	gpio_set_pin_low(col_io_pins[scan_col_idx]);
+}
+
+void keyboard_scan_step(event_ring_t *ring, uint32_t time_us)
+{
+	int col_idx = scan_col_idx;
+	
+	// Sample both ports at once. Rows of the column driven on the previous step: 1 = unpressed, 0 = pressed
+	uint32_t port_levels[2] = {PIOA->PIO_PDSR, PIOB->PIO_PDSR};
+	
+	// Gather the rows into the key matrix bits of this column
+	uint32_t col_state = 0;
+	for (int row_idx = 0; row_idx < KEY_ROW_NUM; row_idx++) {
+		uint8_t pin = row_io_pins[row_idx];
+		if (!(port_levels[PIN_PORT(pin)] & PIN_MASK(pin))) {
+			col_state |= 1u << (ROW_COL_TO_IDX(row_idx, col_idx));
 		}
 	}
-}
\ No newline at end of file
+	
+	// Write 1 back to the polled column and drive the next one.
+	// Its rows settle until the next step instead of being waited on here.
+	gpio_set_pin_high(col_io_pins[col_idx]);
+	scan_col_idx = (col_idx + 1) % KEY_COL_NUM;
+	gpio_set_pin_low(col_io_pins[scan_col_idx]);
+	
+	// Debounce the sampled column, then find the keys that changed with a single XOR and update the stored state
+	uint32_t debounced = debounce_update(col_state, col_key_masks[col_idx]);
+	uint32_t changed = (key_matrix_state ^ debounced) & col_key_masks[col_idx];
+	key_matrix_state ^= changed;
+	
+	// Add a timestamped key event up/down to the key event queue for each changed key.
+	while (changed) {
+		uint8_t key_idx = ctz(changed);
+		changed &= changed - 1;
+		
+		event_ring_push(ring, KEY_EVENT_PACK(key_idx, key_matrix_state & (1u << key_idx), time_us));
+	}
+}
+
+uint32_t keyboard_get_key_state(void)
+{
+	return key_matrix_state;
+}
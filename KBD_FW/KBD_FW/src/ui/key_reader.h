@@ -11,13 +11,18 @@
 
 #include "board.h"
 #include "ASF/common/services/gpio/gpio.h"
-#include "fifo.h"
+#include "event_ring.h"
 #include "ui.h"
 
-static uint8_t key_event_up = 1;
-static uint8_t key_event_down = 0;
+// Sets all columns high and drives the first column to be scanned.
+void keyboard_scan_init(void);
 
-// Runs the key polling algorithm and returns the character for the key.
-void keyboard_read(fifo_desc_t *fifo, key_info_t key_arr[KEY_ROW_NUM][KEY_COL_NUM]);
+// Runs one step of the key polling algorithm: samples the rows of the column driven on
+// the previous step, pushes any key events stamped with time_us to the ring, then drives the next column.
+// Never waits for the column to settle, so it can be called from a periodic interrupt.
+void keyboard_scan_step(event_ring_t *ring, uint32_t time_us);
+
+// Returns the packed key matrix state: bit n is set while the key with index n is pressed.
+uint32_t keyboard_get_key_state(void);
 
 #endif /* KEY_READER_H_ */
\ No newline at end of file
@@ -0,0 +1,261 @@
+/*
+ * macro.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+#include <string.h>
+#include "macro.h"
+#include "key_layout.h"
+
+// Releases everything the macro holds. Returns false if the sink refused a release.
+static bool macro_release_all(macro_vm_t *vm, const macro_sink_t *sink)
+{
+	if (vm->mods_held) {
+		if (!sink->modifier_up(vm->mods_held)) {
+			return false;
+		}
+		vm->mods_held = 0;
+	}
+	for (uint8_t word = 0; word < sizeof(vm->keys_held) / sizeof(vm->keys_held[0]); ++word) {
+		while (vm->keys_held[word]) {
+			uint8_t bit = 0;
+			while (!(vm->keys_held[word] & (1ul << bit))) {
+				++bit;
+			}
+			if (!sink->key_up(word * 32 + bit)) {
+				return false;
+			}
+			vm->keys_held[word] &= ~(1ul << bit);
+		}
+	}
+	return true;
+}
+
+// Size of the opcode at pc with all its operands, 0 if unknown or truncated
+static uint16_t macro_op_size(const uint8_t *code, uint16_t len, uint16_t pc)
+{
+	uint16_t size = MACRO_OP_SIZE(code[pc]);
+
+	if (size && code[pc] == MACRO_OP_TYPE && (uint32_t)pc + 1 < len) {
+		size += code[pc + 1];
+	}
+	if (!size || (uint32_t)pc + size > len) {
+		return 0;
+	}
+	return size;
+}
+
+bool macro_validate(const uint8_t *code, uint16_t len)
+{
+	uint16_t pc = 0;
+	uint8_t depth = 0;
+
+	while (pc < len) {
+		uint8_t op = code[pc];
+		uint16_t size = macro_op_size(code, len, pc);
+
+		if (!size) {
+			return false;
+		}
+		if (op == MACRO_OP_KEY_DOWN || op == MACRO_OP_KEY_UP) {
+			// The keyboard report would drop the key
+			if (!KEY_USAGE_IS_VALID(code[pc + 1])) {
+				return false;
+			}
+		} else if (op == MACRO_OP_TYPE) {
+			for (uint16_t i = 2; i < size; ++i) {
+				if ((code[pc + i] & MACRO_TYPE_USAGE_MASK) >= KEY_USAGE_COUNT) {
+					return false;
+				}
+			}
+		} else if (op == MACRO_OP_REPEAT) {
+			if (++depth > MACRO_REPEAT_DEPTH) {
+				return false;
+			}
+		} else if (op == MACRO_OP_REPEAT_END) {
+			if (!depth--) {
+				return false;
+			}
+		}
+		pc += size;
+	}
+	return depth == 0;
+}
+
+void macro_start(macro_vm_t *vm, const uint8_t *code, uint16_t len)
+{
+	memset(vm, 0, sizeof(*vm));
+	vm->code = code;
+	vm->len = len;
+	vm->b_running = true;
+	vm->b_held = true;
+}
+
+void macro_release(macro_vm_t *vm)
+{
+	vm->b_held = false;
+}
+
+bool macro_stop(macro_vm_t *vm, const macro_sink_t *sink)
+{
+	if (!vm->b_running) {
+		return true;
+	}
+	// No more code runs, macro_step() only retries the releases
+	vm->pc = vm->len;
+	vm->delay_ms = 0;
+	if (!macro_release_all(vm, sink)) {
+		return false;
+	}
+	vm->b_running = false;
+	return true;
+}
+
+bool macro_is_running(const macro_vm_t *vm)
+{
+	return vm->b_running;
+}
+
+void macro_step(macro_vm_t *vm, const macro_sink_t *sink)
+{
+	if (!vm->b_running) {
+		return;
+	}
+	if (vm->delay_ms && --vm->delay_ms) {
+		return;
+	}
+
+	for (uint8_t ops = 0; ops < MACRO_STEP_MAX_OPS; ++ops) {
+		uint8_t op, arg;
+		uint16_t size;
+
+		if (vm->pc >= vm->len) {
+			break;
+		}
+		op = vm->code[vm->pc];
+		size = macro_op_size(vm->code, vm->len, vm->pc);
+		if (op == MACRO_OP_END || !size) {
+			// End of the macro, or bytecode that does not parse
+			vm->pc = vm->len;
+			break;
+		}
+		arg = (size > 1) ? vm->code[vm->pc + 1] : 0;
+
+		switch (op) {
+		case MACRO_OP_KEY_DOWN:
+			if (!sink->key_down(arg)) {
+				return;
+			}
+			vm->keys_held[arg / 32] |= 1ul << (arg % 32);
+			break;
+		case MACRO_OP_KEY_UP:
+			if (!sink->key_up(arg)) {
+				return;
+			}
+			vm->keys_held[arg / 32] &= ~(1ul << (arg % 32));
+			break;
+		case MACRO_OP_MOD_DOWN:
+			if (!sink->modifier_down(arg)) {
+				return;
+			}
+			vm->mods_held |= arg;
+			break;
+		case MACRO_OP_MOD_UP:
+			if (!sink->modifier_up(arg)) {
+				return;
+			}
+			vm->mods_held &= ~arg;
+			break;
+		case MACRO_OP_DELAY:
+			vm->delay_ms = arg | (vm->code[vm->pc + 2] << 8);
+			vm->pc += size;
+			if (vm->delay_ms) {
+				return;
+			}
+			continue;
+		case MACRO_OP_REPEAT:
+			if (vm->depth == MACRO_REPEAT_DEPTH) {
+				vm->pc = vm->len;
+				continue;
+			}
+			vm->loops[vm->depth].start = vm->pc + size;
+			vm->loops[vm->depth].count = arg;
+			vm->depth++;
+			break;
+		case MACRO_OP_REPEAT_END:
+			if (vm->depth) {
+				bool b_again;
+				if (vm->loops[vm->depth - 1].count) {
+					b_again = --vm->loops[vm->depth - 1].count != 0;
+				} else {
+					b_again = vm->b_held;
+				}
+				if (b_again) {
+					vm->pc = vm->loops[vm->depth - 1].start;
+					continue;
+				}
+				vm->depth--;
+			}
+			break;
+		case MACRO_OP_WAIT_RELEASE:
+			if (vm->b_held) {
+				return;
+			}
+			break;
+		case MACRO_OP_TYPE:
+			if (vm->type_pos < arg) {
+				// One character per opcode of the budget
+				uint8_t c = vm->code[vm->pc + 2 + vm->type_pos];
+				uint8_t usage = c & MACRO_TYPE_USAGE_MASK;
+				uint8_t shift = (c & MACRO_TYPE_SHIFT) ? MACRO_TYPE_SHIFT_MODIFIER : 0;
+
+				// The release of the previous character shares the report of the next press,
+				// unless the usage repeats: the report queue then sends the release on its own
+				if (vm->type_usage) {
+					if (!sink->key_up(vm->type_usage)) {
+						return;
+					}
+					vm->keys_held[vm->type_usage / 32] &= ~(1ul << (vm->type_usage % 32));
+					vm->type_usage = 0;
+				}
+				if (shift != (vm->mods_held & MACRO_TYPE_SHIFT_MODIFIER)) {
+					if (shift ? !sink->modifier_down(shift)
+							: !sink->modifier_up(MACRO_TYPE_SHIFT_MODIFIER)) {
+						return;
+					}
+					vm->mods_held ^= MACRO_TYPE_SHIFT_MODIFIER;
+				}
+				if (!sink->key_down(usage)) {
+					return;
+				}
+				vm->keys_held[usage / 32] |= 1ul << (usage % 32);
+				vm->type_usage = usage;
+				vm->type_pos++;
+				continue;
+			}
+			// Text typed, release the last character and shift
+			if (vm->type_usage) {
+				if (!sink->key_up(vm->type_usage)) {
+					return;
+				}
+				vm->keys_held[vm->type_usage / 32] &= ~(1ul << (vm->type_usage % 32));
+				vm->type_usage = 0;
+			}
+			if (vm->mods_held & MACRO_TYPE_SHIFT_MODIFIER) {
+				if (!sink->modifier_up(MACRO_TYPE_SHIFT_MODIFIER)) {
+					return;
+				}
+				vm->mods_held &= ~MACRO_TYPE_SHIFT_MODIFIER;
+			}
+			vm->type_pos = 0;
+			break;
+		}
+		vm->pc += size;
+	}
+
+	if (vm->pc >= vm->len && macro_release_all(vm, sink)) {
+		vm->b_running = false;
+	}
+}
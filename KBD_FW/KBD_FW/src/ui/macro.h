@@ -0,0 +1,77 @@
+/*
+ * macro.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+
+#ifndef MACRO_H_
+#define MACRO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "macro_ops.h"
+
+/**
+ * Interpreter for the bytecode described in macro_ops.h.
+ *
+ * The interpreter never allocates. Each call to macro_step() is one 1 ms tick
+ * and runs at most MACRO_STEP_MAX_OPS opcodes, so a macro cannot stall the
+ * caller. Key output goes through a sink, which lets the same macro drive the
+ * HID keyboard interface or a mock.
+ */
+
+//! Maximum number of opcodes run by one macro_step()
+#ifndef MACRO_STEP_MAX_OPS
+#define MACRO_STEP_MAX_OPS		16
+#endif
+
+//! Key output of the interpreter. A function returning false is retried on the next step.
+typedef struct macro_sink {
+	bool (*key_down)(uint8_t usage);
+	bool (*key_up)(uint8_t usage);
+	bool (*modifier_down)(uint8_t mask);
+	bool (*modifier_up)(uint8_t mask);
+} macro_sink_t;
+
+typedef struct macro_vm {
+	const uint8_t *code;
+	uint16_t len;
+	uint16_t pc;
+	uint16_t delay_ms;           //!< Ticks left in the current MACRO_OP_DELAY
+	bool b_running;
+	bool b_held;                 //!< Key that started the macro is still pressed
+	uint8_t depth;               //!< Number of open MACRO_OP_REPEAT blocks
+	struct {
+		uint16_t start;          //!< First opcode of the block
+		uint8_t count;           //!< Runs left, 0 repeats while held
+	} loops[MACRO_REPEAT_DEPTH];
+	uint8_t type_pos;            //!< Characters of the current MACRO_OP_TYPE already pressed
+	uint8_t type_usage;          //!< Character pressed by MACRO_OP_TYPE, 0 for none
+	uint8_t mods_held;           //!< Modifiers pressed by the macro
+	uint32_t keys_held[8];       //!< Usages pressed by the macro, one bit each
+} macro_vm_t;
+
+// Checks that code only holds known opcodes with all their operands, usages the keyboard report
+// holds (KEY_USAGE_IS_VALID) and balanced repeat blocks.
+bool macro_validate(const uint8_t *code, uint16_t len);
+
+// Starts running code, the key that started it is considered held.
+// code must stay valid until the macro ends.
+void macro_start(macro_vm_t *vm, const uint8_t *code, uint16_t len);
+
+// Signals that the key that started the macro was released.
+void macro_release(macro_vm_t *vm);
+
+// Stops running the macro code and releases every key and modifier the macro still holds.
+// Returns false if the sink refused a release: the macro then stays running, without running code,
+// until macro_step() has released everything. Starting another macro meanwhile would lose the keys held.
+bool macro_stop(macro_vm_t *vm, const macro_sink_t *sink);
+
+bool macro_is_running(const macro_vm_t *vm);
+
+// Runs the macro for one 1 ms tick. Keys still held when the macro ends are released.
+void macro_step(macro_vm_t *vm, const macro_sink_t *sink);
+
+#endif /* MACRO_H_ */
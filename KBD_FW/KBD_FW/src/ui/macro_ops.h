@@ -0,0 +1,79 @@
+/*
+ * macro_ops.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+
+#ifndef MACRO_OPS_H_
+#define MACRO_OPS_H_
+
+/**
+ * Macro bytecode. A macro is a sequence of one-byte opcodes, each followed by
+ * its operands. Multi-byte operands are little-endian.
+ *
+ * This header only uses the preprocessor so host tools can include it to
+ * produce the same bytecode as the firmware tables.
+ */
+
+//! Ends the macro. Running past the last byte has the same effect.
+#define MACRO_OP_END			0x00
+//! Presses a key: <usage>
+#define MACRO_OP_KEY_DOWN		0x01
+//! Releases a key: <usage>
+#define MACRO_OP_KEY_UP			0x02
+//! Presses modifiers: <HID_MODIFIER_xxx mask>
+#define MACRO_OP_MOD_DOWN		0x03
+//! Releases modifiers: <HID_MODIFIER_xxx mask>
+#define MACRO_OP_MOD_UP			0x04
+//! Waits before the next opcode: <ms low> <ms high>
+#define MACRO_OP_DELAY			0x05
+//! Runs the opcodes up to the matching MACRO_OP_REPEAT_END <count> times: <count>
+//! A count of 0 repeats while the key that started the macro is held.
+#define MACRO_OP_REPEAT			0x06
+//! Closes the innermost MACRO_OP_REPEAT block
+#define MACRO_OP_REPEAT_END		0x07
+//! Waits until the key that started the macro is released
+#define MACRO_OP_WAIT_RELEASE	0x08
+//! Types characters: <count> <char>... with each char a usage, ORed with MACRO_TYPE_SHIFT if shifted.
+//! Each character is pressed as the previous one is released, in the same report unless the
+//! usage repeats, so text is typed at one character per report.
+#define MACRO_OP_TYPE			0x09
+
+//! Number of opcodes, every byte at an opcode position must be below this value
+#define MACRO_OP_COUNT			0x0A
+
+//! Flag of a MACRO_OP_TYPE character typed with shift
+#define MACRO_TYPE_SHIFT		0x80
+//! Usage bits of a MACRO_OP_TYPE character
+#define MACRO_TYPE_USAGE_MASK	0x7F
+//! Modifier pressed for MACRO_TYPE_SHIFT characters (left shift in the HID keyboard report)
+#define MACRO_TYPE_SHIFT_MODIFIER	0x02
+
+//! Size in bytes of an opcode and its fixed operands, 0 for an unknown opcode.
+//! MACRO_OP_TYPE is followed by <count> more bytes.
+#define MACRO_OP_SIZE(op) \
+	(((op) == MACRO_OP_DELAY) ? 3 : \
+	 ((op) == MACRO_OP_END || (op) == MACRO_OP_REPEAT_END || (op) == MACRO_OP_WAIT_RELEASE) ? 1 : \
+	 ((op) < MACRO_OP_COUNT) ? 2 : 0)
+
+//! Maximum nesting of MACRO_OP_REPEAT blocks
+#define MACRO_REPEAT_DEPTH		4
+
+//! \name Helpers to write macro tables
+//! @{
+#define MACRO_KEY_DOWN(usage)	MACRO_OP_KEY_DOWN, (usage)
+#define MACRO_KEY_UP(usage)		MACRO_OP_KEY_UP, (usage)
+#define MACRO_TAP(usage)		MACRO_OP_KEY_DOWN, (usage), MACRO_OP_KEY_UP, (usage)
+#define MACRO_MOD_DOWN(mask)	MACRO_OP_MOD_DOWN, (mask)
+#define MACRO_MOD_UP(mask)		MACRO_OP_MOD_UP, (mask)
+#define MACRO_DELAY(ms)			MACRO_OP_DELAY, ((ms) & 0xFF), (((ms) >> 8) & 0xFF)
+#define MACRO_REPEAT(count)		MACRO_OP_REPEAT, (count)
+#define MACRO_REPEAT_END()		MACRO_OP_REPEAT_END
+#define MACRO_WAIT_RELEASE()	MACRO_OP_WAIT_RELEASE
+#define MACRO_TYPE(count)		MACRO_OP_TYPE, (count)
+#define MACRO_END()				MACRO_OP_END
+//! @}
+
+#endif /* MACRO_OPS_H_ */
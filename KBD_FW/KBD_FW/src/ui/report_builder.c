@@ -0,0 +1,159 @@
+/*
+ * report_builder.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */ 
+
+#include <asf.h>
+#include <string.h>
+#include "report_builder.h"
+#include "scan_scheduler.h"
+#include "ui.h"
+
+static event_ring_t *report_event_ring;
+
+// Key state accepted by the HID keyboard interface: bit n = key n down
+static uint32_t report_key_state = 0;
+
+// Transitions of each key consumed from the ring but not accepted by the HID keyboard interface
+// yet, in order: each one toggles the accepted state. Not folded into a level, so a press
+// refused and then released is still sent.
+static uint8_t report_pending_edges[KEY_COUNT];
+
+// Pending transitions of a key before a press and release are given up, only reached if the
+// interface refuses keys for a long time
+#define REPORT_PENDING_EDGES_MAX	254
+
+// Scan time of the oldest pending transitions of each key, in order. Later transitions are
+// stamped with the time of the transition accepted before them, which overstates their latency.
+#define REPORT_EDGE_TIMES			4
+
+static uint32_t report_edge_time_us[KEY_COUNT][REPORT_EDGE_TIMES];
+static uint8_t report_edge_time_head[KEY_COUNT];
+static uint8_t report_edge_time_count[KEY_COUNT];
+static uint32_t report_accepted_time_us[KEY_COUNT];
+
+static uint32_t report_last_latency_us = 0;
+static uint32_t report_max_latency_us = 0;
+static uint32_t report_latency_histogram[REPORT_LATENCY_BUCKETS];
+
+static void report_edge_time_push(uint8_t key_idx, uint32_t time_us)
+{
+	if (report_edge_time_count[key_idx] < REPORT_EDGE_TIMES) {
+		uint8_t tail = (report_edge_time_head[key_idx] + report_edge_time_count[key_idx]) % REPORT_EDGE_TIMES;
+		
+		report_edge_time_us[key_idx][tail] = time_us;
+		report_edge_time_count[key_idx]++;
+	}
+}
+
+static void report_edge_time_drop(uint8_t key_idx)
+{
+	report_accepted_time_us[key_idx] = report_edge_time_us[key_idx][report_edge_time_head[key_idx]];
+	report_edge_time_head[key_idx] = (report_edge_time_head[key_idx] + 1) % REPORT_EDGE_TIMES;
+	report_edge_time_count[key_idx]--;
+}
+
+// Latency of the transition of a key the interface just accepted
+static void report_edge_accepted(uint8_t key_idx, uint32_t now_us)
+{
+	uint8_t bucket = 0;
+	
+	if (report_edge_time_count[key_idx]) {
+		report_edge_time_drop(key_idx);
+	}
+	report_last_latency_us = KEY_EVENT_TIME_DIFF_US(now_us, report_accepted_time_us[key_idx]);
+	if (report_last_latency_us > report_max_latency_us) {
+		report_max_latency_us = report_last_latency_us;
+	}
+	while (bucket < REPORT_LATENCY_BUCKETS - 1
+			&& report_last_latency_us >= ((uint32_t)REPORT_LATENCY_BUCKET_US << bucket)) {
+		bucket++;
+	}
+	report_latency_histogram[bucket]++;
+}
+
+void report_builder_init(event_ring_t *ring)
+{
+	report_event_ring = ring;
+	report_key_state = 0;
+	memset(report_pending_edges, 0, sizeof(report_pending_edges));
+	memset(report_edge_time_head, 0, sizeof(report_edge_time_head));
+	memset(report_edge_time_count, 0, sizeof(report_edge_time_count));
+	memset(report_accepted_time_us, 0, sizeof(report_accepted_time_us));
+	report_last_latency_us = 0;
+	report_max_latency_us = 0;
+	memset(report_latency_histogram, 0, sizeof(report_latency_histogram));
+}
+
+void report_builder_process(void)
+{
+	uint32_t now_us = scan_scheduler_get_time_us();
+	uint32_t event;
+	
+	// Queue every pending event as a transition of its key
+	while (event_ring_peek(report_event_ring, &event)) {
+		uint8_t key_idx = KEY_EVENT_KEY(event);
+		
+		if (key_idx < KEY_COUNT) {
+			uint8_t *pending = &report_pending_edges[key_idx];
+			// State of the key once its pending transitions are accepted
+			bool b_down = ((report_key_state >> key_idx) & 1) ^ (*pending & 1);
+			
+			// A repeated state is not a transition
+			if (KEY_EVENT_IS_DOWN(event) != b_down) {
+				if (*pending == REPORT_PENDING_EDGES_MAX) {
+					// Give up the oldest press and release, the order of the others is kept
+					*pending -= 2;
+					for (uint8_t i = 0; i < 2 && report_edge_time_count[key_idx]; i++) {
+						report_edge_time_drop(key_idx);
+					}
+				}
+				if (report_edge_time_count[key_idx] == *pending) {
+					// The transitions before this one all have their time
+					report_edge_time_push(key_idx, KEY_EVENT_TIME_US(event));
+				}
+				(*pending)++;
+			}
+		}
+		
+		event_ring_drop(report_event_ring);
+	}
+	
+	// Apply one transition per key to the HID report, so a press and release never collapse into
+	// the same report. Transitions the interface refused stay pending for the next interval.
+	for (uint8_t key_idx = 0; key_idx < KEY_COUNT; key_idx++) {
+		uint32_t key_bit = 1u << key_idx;
+		bool success;
+		
+		if (!report_pending_edges[key_idx]) {
+			continue;
+		}
+		if (report_key_state & key_bit) {
+			success = ui_key_up(key_idx);
+		} else {
+			success = ui_key_down(key_idx);
+		}
+		if (success) {
+			report_key_state ^= key_bit;
+			report_pending_edges[key_idx]--;
+			report_edge_accepted(key_idx, now_us);
+		}
+	}
+}
+
+uint32_t report_builder_get_last_latency_us(void)
+{
+	return report_last_latency_us;
+}
+
+uint32_t report_builder_get_max_latency_us(void)
+{
+	return report_max_latency_us;
+}
+
+const uint32_t *report_builder_get_latency_histogram(void)
+{
+	return report_latency_histogram;
+}
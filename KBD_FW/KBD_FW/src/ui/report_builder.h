@@ -0,0 +1,36 @@
+/*
+ * report_builder.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */ 
+
+
+#ifndef REPORT_BUILDER_H_
+#define REPORT_BUILDER_H_
+
+#include "event_ring.h"
+
+// Starts building HID reports from the key events queued in ring.
+void report_builder_init(event_ring_t *ring);
+
+// Drains every pending key event into the HID keyboard state. Called once per report interval.
+// Each key changes at most once per interval, so a press and release never collapse into the
+// same report: its further transitions, and the ones the interface refused, are kept in order
+// for the next intervals.
+void report_builder_process(void);
+
+// Latency histogram: bucket n counts the latencies below REPORT_LATENCY_BUCKET_US << n and not in
+// a lower bucket, the last bucket also counts everything above.
+#define REPORT_LATENCY_BUCKETS		8
+#define REPORT_LATENCY_BUCKET_US	250
+
+// Latency between the scan that saw a transition and the report interval where the HID keyboard
+// interface accepted it.
+uint32_t report_builder_get_last_latency_us(void);
+uint32_t report_builder_get_max_latency_us(void);
+
+// Number of transitions accepted in each latency bucket, REPORT_LATENCY_BUCKETS entries.
+const uint32_t *report_builder_get_latency_histogram(void);
+
+#endif /* REPORT_BUILDER_H_ */
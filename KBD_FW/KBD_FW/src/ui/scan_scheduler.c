@@ -0,0 +1,81 @@
+/*
+ * scan_scheduler.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */ 
+
+#include <asf.h>
+#include "scan_scheduler.h"
+#include "key_reader.h"
+#include "ui.h"
+
+static event_ring_t *scan_event_ring;
+static uint32_t scan_rate_hz;
+
+// Tick length is 1000000 / tick rate, the remainder is carried so the time base does not drift.
+static uint32_t scan_tick_hz;
+static uint32_t scan_tick_us;
+static uint32_t scan_tick_us_rem;
+static uint32_t scan_tick_rem_acc;
+
+static volatile uint32_t scan_time_us = 0;
+static volatile uint32_t scan_time_ms = 0;
+static uint32_t scan_time_ms_acc_us = 0;
+
+void scan_scheduler_init(event_ring_t *ring, uint32_t rate_hz)
+{
+	scan_event_ring = ring;
+	scan_scheduler_set_rate(rate_hz);
+}
+
+void scan_scheduler_set_rate(uint32_t rate_hz)
+{
+	Assert(rate_hz > 0);
+	
+	// Stop the tick while the period is changed
+	SysTick->CTRL = 0;
+	
+	scan_rate_hz = rate_hz;
+	scan_tick_hz = rate_hz * KEY_COL_NUM;
+	scan_tick_us = 1000000UL / scan_tick_hz;
+	scan_tick_us_rem = 1000000UL % scan_tick_hz;
+	scan_tick_rem_acc = 0;
+	
+	SysTick_Config(sysclk_get_cpu_hz() / scan_tick_hz);
+}
+
+uint32_t scan_scheduler_get_rate(void)
+{
+	return scan_rate_hz;
+}
+
+uint32_t scan_scheduler_get_time_us(void)
+{
+	return scan_time_us;
+}
+
+uint32_t scan_scheduler_get_time_ms(void)
+{
+	return scan_time_ms;
+}
+
+void SysTick_Handler(void)
+{
+	// Advance the time base
+	uint32_t tick_us = scan_tick_us;
+	scan_tick_rem_acc += scan_tick_us_rem;
+	if (scan_tick_rem_acc >= scan_tick_hz) {
+		scan_tick_rem_acc -= scan_tick_hz;
+		tick_us++;
+	}
+	scan_time_us += tick_us;
+	scan_time_ms_acc_us += tick_us;
+	while (scan_time_ms_acc_us >= 1000) {
+		scan_time_ms_acc_us -= 1000;
+		scan_time_ms++;
+	}
+	
+	// Sample the column driven on the previous tick and drive the next one
+	keyboard_scan_step(scan_event_ring, scan_time_us);
+}
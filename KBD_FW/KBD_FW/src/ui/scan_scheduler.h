@@ -0,0 +1,28 @@
+/*
+ * scan_scheduler.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */ 
+
+
+#ifndef SCAN_SCHEDULER_H_
+#define SCAN_SCHEDULER_H_
+
+#include "event_ring.h"
+
+// Starts the SysTick time base stepping the key matrix scan into the given event ring.
+// rate_hz is the number of full matrix scans per second, one column is stepped per tick.
+void scan_scheduler_init(event_ring_t *ring, uint32_t rate_hz);
+
+// Changes the full matrix scan rate, e.g. to a lower rate while the USB bus is suspended.
+void scan_scheduler_set_rate(uint32_t rate_hz);
+
+// Gets the current full matrix scan rate.
+uint32_t scan_scheduler_get_rate(void);
+
+// Free running time base, advanced by the scan ticks. Independent of the USB frame number.
+uint32_t scan_scheduler_get_time_us(void);
+uint32_t scan_scheduler_get_time_ms(void);
+
+#endif /* SCAN_SCHEDULER_H_ */
@@ -45,10 +45,25 @@
  */
 
 #include <asf.h>
+#include <string.h>
 #include "ui.h"
 #include "key_reader.h"
-#include "fifo.h"
+#include "scan_scheduler.h"
+#include "report_builder.h"
+#include "conf_keyboard.h"
+#include "event_ring.h"
+#include "macro.h"
 #include "Bitmaps.h"
+#include "crc16.h"
+
+#if KEY_ICON_THRES_BLACK != ITC_THRES_BLACK
+#  error KEY_ICON_THRES_BLACK must match the threshold of the panel driver
+#endif
+
+#if KEY_USAGE_COUNT != UDI_HID_KBD_KEY_COUNT || KEY_USAGE_MODIFIER_FIRST != UDI_HID_KBD_MODIFIER_USAGE_MIN \
+		|| KEY_USAGE_MODIFIER_LAST != UDI_HID_KBD_MODIFIER_USAGE_MAX
+#  error The key usages must match the keyboard report
+#endif
 
 static struct {
 	gfx_coord_t x;
@@ -79,117 +94,42 @@ key_info_t keys[KEY_ROW_NUM][KEY_COL_NUM];
 #define  MOVE_DOWN   2
 #define  MOVE_LEFT   3
 
-//! Sequence process running each \c SEQUENCE_PERIOD ms
-#define SEQUENCE_PERIOD 150
-
-static struct {
-	bool b_modifier;
-	bool b_down;
-	uint8_t u8_value;
-} ui_sequence[] = {
+// Macro started by the push button: opens notepad on Windows and types a message
+static const uint8_t ui_demo_macro[] = {
 	// Display windows menu
-	{true,true,HID_MODIFIER_LEFT_UI},
+	MACRO_MOD_DOWN(HID_MODIFIER_LEFT_UI),
 	// Launch Windows Command line
-	{false,true,HID_R},
-	{false,false,HID_R},
+	MACRO_TAP(HID_R),
 	// Clear modifier
-	{true,false,HID_MODIFIER_LEFT_UI},
+	MACRO_MOD_UP(HID_MODIFIER_LEFT_UI),
+	// Delay to wait the command line dialog
+	MACRO_DELAY(150),
 	// Tape sequence "notepad" + return
-	{false,true,HID_N},
-	{false,false,HID_N},
-	{false,true,HID_O},
-	{false,false,HID_O},
-	{false,true,HID_T},
-	{false,false,HID_T},
-	{false,true,HID_E},
-	{false,false,HID_E},
-	{false,true,HID_P},
-	{false,false,HID_P},
-	{false,true,HID_A},
-	{false,false,HID_A},
-	{false,true,HID_D},
-	{false,false,HID_D},
-	{false,true,HID_ENTER},
-	{false,false,HID_ENTER},
+	MACRO_TYPE(8),
+	HID_N, HID_O, HID_T, HID_E, HID_P, HID_A, HID_D, HID_ENTER,
 	// Delay to wait "notepad" focus
-	{false,false,0}, // No key (= SEQUENCE_PERIOD delay)
-	{false,false,0}, // No key (= SEQUENCE_PERIOD delay)
-	{false,false,0}, // No key (= SEQUENCE_PERIOD delay)
-	{false,false,0}, // No key (= SEQUENCE_PERIOD delay)
-	{false,false,0}, // No key (= SEQUENCE_PERIOD delay)
-	{false,false,0}, // No key (= SEQUENCE_PERIOD delay)
-	{false,false,0}, // No key (= SEQUENCE_PERIOD delay)
+	MACRO_DELAY(1050),
 	// Display "Adjustable keyboard, coming soon!"
-	{true,true,HID_MODIFIER_RIGHT_SHIFT}, // Enable Maj
-	{false,true,HID_A},
-	{false,false,HID_A},
-	{true,false,HID_MODIFIER_RIGHT_SHIFT}, // Disable Maj
-	{false,true,HID_D},
-	{false,false,HID_D},
-	{false,true,HID_J},
-	{false,false,HID_J},
-	{false,true,HID_U},
-	{false,false,HID_U},
-	{false,true,HID_S},
-	{false,false,HID_S},
-	{false,true,HID_T},
-	{false,false,HID_T},
-	{false,true,HID_A},
-	{false,false,HID_A},
-	{false,true,HID_B},
-	{false,false,HID_B},
-	{false,true,HID_L},
-	{false,false,HID_L},
-	{false,true,HID_E},
-	{false,false,HID_E},
-	{false,true,HID_SPACEBAR},
-	{false,false,HID_SPACEBAR},
-	{false,true,HID_K},
-	{false,false,HID_K},
-	{false,true,HID_E},
-	{false,false,HID_E},
-	{false,true,HID_Y},
-	{false,false,HID_Y},
-	{false,true,HID_B},
-	{false,false,HID_B},
-	{false,true,HID_O},
-	{false,false,HID_O},
-	{false,true,HID_A},
-	{false,false,HID_A},
-	{false,true,HID_R},
-	{false,false,HID_R},
-	{false,true,HID_D},
-	{false,false,HID_D},
-	{false,true,HID_COMMA},
-	{false,false,HID_COMMA},
-	{false,true,HID_SPACEBAR},
-	{false,false,HID_SPACEBAR},
-	{false,true,HID_C},
-	{false,false,HID_C},
-	{false,true,HID_O},
-	{false,false,HID_O},
-	{false,true,HID_M},
-	{false,false,HID_M},
-	{false,true,HID_I},
-	{false,false,HID_I},
-	{false,true,HID_N},
-	{false,false,HID_N},
-	{false,true,HID_G},
-	{false,false,HID_G},
-	{false,true,HID_SPACEBAR},
-	{false,false,HID_SPACEBAR},
-	{false,true,HID_S},
-	{false,false,HID_S},
-	{false,true,HID_O},
-	{false,false,HID_O},
-	{false,true,HID_O},
-	{false,false,HID_O},
-	{false,true,HID_N},
-	{false,false,HID_N},
-	{true,true,HID_MODIFIER_RIGHT_SHIFT}, // Enable Maj
-	{false,true,HID_1},
-	{false,false,HID_1},
-	{true,false,HID_MODIFIER_RIGHT_SHIFT}, // Disable Maj
+	MACRO_TYPE(33),
+	HID_A | MACRO_TYPE_SHIFT, HID_D, HID_J, HID_U, HID_S, HID_T, HID_A, HID_B, HID_L, HID_E, HID_SPACEBAR,
+	HID_K, HID_E, HID_Y, HID_B, HID_O, HID_A, HID_R, HID_D, HID_COMMA, HID_SPACEBAR,
+	HID_C, HID_O, HID_M, HID_I, HID_N, HID_G, HID_SPACEBAR,
+	HID_S, HID_O, HID_O, HID_N, HID_1 | MACRO_TYPE_SHIFT,
+	MACRO_END()
+};
+
+// Trigger of the running macro: a key index, or the push button
+#define UI_MACRO_TRIGGER_BUTTON 0xFF
+
+static macro_vm_t ui_macro_vm;
+static uint8_t ui_macro_trigger;
+
+// Macros type on the HID keyboard interface
+static const macro_sink_t ui_macro_sink = {
+	.key_down = udi_hid_kbd_down,
+	.key_up = udi_hid_kbd_up,
+	.modifier_down = udi_hid_kbd_modifier_down,
+	.modifier_up = udi_hid_kbd_modifier_up,
 };
 
 // Wakeup pin is PA15 (fast wakeup 14)
@@ -200,10 +140,10 @@ static struct {
 #define  WAKEUP_PIO_MASK (PIO_PA15)
 #define  WAKEUP_PIO_ATTR (PIO_INPUT | PIO_PULLUP | PIO_DEBOUNCE | PIO_IT_LOW_LEVEL)
 
-// Key event FIFO
-#define KEY_EVENT_FIFO_SIZE 512
-fifo_desc_t key_event_fifo_desc;
-uint8_t     key_event_buf[KEY_EVENT_FIFO_SIZE];
+// Key event queue, filled by the scan interrupt. Must be a power of 2.
+#define KEY_EVENT_RING_SIZE 64
+event_ring_t key_event_ring;
+uint32_t     key_event_buf[KEY_EVENT_RING_SIZE];
 
 // "Dirty bit" to signal that the ui should update the screen
 bool ui_screen_needs_update = false;
@@ -234,8 +174,9 @@ void ui_init(void)
 	LED_On(LED0_GPIO);
 	LED_Off(LED1_GPIO);
 	
-	// Initialize the key even FIFO queue
-	fifo_init(&key_event_fifo_desc, key_event_buf, KEY_EVENT_FIFO_SIZE);
+	// Initialize the key event queue
+	event_ring_init(&key_event_ring, key_event_buf, KEY_EVENT_RING_SIZE);
+	report_builder_init(&key_event_ring);
 	
 	// Initialize Graphics Driver
 	gfx_init();
@@ -250,20 +191,36 @@ void ui_init(void)
 			key_info_t *key = malloc(sizeof(key_info_t));
 			key->key_id = idx;
 			key->key_code = HID_A+idx;
+			key->macro = NULL;
+			key->macro_len = 0;
+			key->icon_width = 0;
+			key->icon_height = 0;
 			key->centre_x = key_loc_array[row][col].x;
 			key->centre_y = key_loc_array[row][col].y;
 			key->max_dim = KEY_ICON_MAX_DIM;
-			key->pressed = false;
 			keys[row][col] = *key;
 			ui_set_key_icon(idx, &testText);
 		}
 	}
 	ui_set_needs_refresh();
+	
+	// Start the key matrix scan on its own time base
+	keyboard_scan_init();
+	scan_scheduler_init(&key_event_ring, KEYBOARD_SCAN_RATE_HZ);
 }
 
 void ui_refresh_screen() {
-	itc_refresh_screen();
+	// Cleared first: a change made during the refresh asks for another one
 	ui_screen_needs_update = false;
+	itc_refresh_screen_async(NULL);
+}
+
+void ui_refresh_process() {
+	itc_refresh_process();
+}
+
+bool ui_refresh_in_progress() {
+	return itc_refresh_in_progress();
 }
 
 void ui_set_key_icon(uint8_t index, struct gfx_bitmap* bmp) {
@@ -273,10 +230,99 @@ void ui_set_key_icon(uint8_t index, struct gfx_bitmap* bmp) {
 	gfx_draw_bitmap(bmp, adjusted_x, adjusted_y);
 }
 
+void ui_set_key_icon_row(uint8_t index, gfx_coord_t width, gfx_coord_t height, gfx_coord_t row,
+		const gfx_color_t *pixels) {
+	key_info_t *key = &keys[IDX_TO_ROW(index)][IDX_TO_COL(index)];
+	struct gfx_bitmap bmp = {.width = width,
+								.height = 1,
+								.type = GFX_BITMAP_RAM,
+								.data.pixmap = (gfx_color_t *) pixels};
+	gfx_coord_t adjusted_x = ((key->max_dim) - width)/2 + (key->centre_x);
+	gfx_coord_t adjusted_y = ((key->max_dim) - height)/2 + (key->centre_y);
+	gfx_draw_bitmap(&bmp, adjusted_x, adjusted_y + row);
+	
+	// Keep the row's CRC, so the host can tell which icons differ from its own
+	if (width > KEY_ICON_MAX_DIM || height > KEY_ICON_MAX_DIM || row >= height) {
+		return;
+	}
+	if (key->icon_width != width || key->icon_height != height) {
+		key->icon_width = width;
+		key->icon_height = height;
+		memset(key->icon_row_crc, 0, sizeof(key->icon_row_crc));
+	}
+	key->icon_row_crc[row] = crc16_update(CRC16_INIT, pixels, width * sizeof(gfx_color_t));
+}
+
+uint16_t ui_get_key_icon_hash(uint8_t index) {
+	key_info_t *key = &keys[IDX_TO_ROW(index)][IDX_TO_COL(index)];
+	uint8_t bytes[2] = {key->icon_width, key->icon_height};
+	uint16_t crc = crc16_update(CRC16_INIT, bytes, sizeof(bytes));
+	
+	for (uint8_t row = 0; row < key->icon_height; ++row) {
+		bytes[0] = key->icon_row_crc[row] >> 8;
+		bytes[1] = key->icon_row_crc[row];
+		crc = crc16_update(crc, bytes, sizeof(bytes));
+	}
+	return crc;
+}
+
 void ui_set_key_scancode(uint8_t index, uint8_t scancode) {
 	keys[IDX_TO_ROW(index)][IDX_TO_COL(index)].key_code = scancode;
 }
 
+uint8_t ui_get_key_scancode(uint8_t index) {
+	return keys[IDX_TO_ROW(index)][IDX_TO_COL(index)].key_code;
+}
+
+void ui_set_key_macro(uint8_t index, const uint8_t *code, uint16_t len) {
+	key_info_t *key = &keys[IDX_TO_ROW(index)][IDX_TO_COL(index)];
+	// Called from the main loop: the SOF interrupt must not start or step the macro in between
+	irqflags_t flags = cpu_irq_save();
+	if (macro_is_running(&ui_macro_vm) && ui_macro_trigger == index) {
+		// What the sink refuses is released by the next macro_step()
+		macro_stop(&ui_macro_vm, &ui_macro_sink);
+	}
+	key->macro = code;
+	key->macro_len = code ? len : 0;
+	cpu_irq_restore(flags);
+}
+
+const uint8_t *ui_get_key_macro(uint8_t index, uint16_t *len) {
+	key_info_t *key = &keys[IDX_TO_ROW(index)][IDX_TO_COL(index)];
+	*len = key->macro_len;
+	return key->macro;
+}
+
+// Returns false while the previous macro still holds keys the HID interface could not release yet.
+static bool ui_start_macro(uint8_t trigger, const uint8_t *code, uint16_t len) {
+	// A new macro replaces the running one
+	if (!macro_stop(&ui_macro_vm, &ui_macro_sink)) {
+		return false;
+	}
+	macro_start(&ui_macro_vm, code, len);
+	ui_macro_trigger = trigger;
+	return true;
+}
+
+bool ui_key_down(uint8_t index) {
+	key_info_t *key = &keys[IDX_TO_ROW(index)][IDX_TO_COL(index)];
+	if (key->macro) {
+		return ui_start_macro(index, key->macro, key->macro_len);
+	}
+	return udi_hid_kbd_down(key->key_code);
+}
+
+bool ui_key_up(uint8_t index) {
+	key_info_t *key = &keys[IDX_TO_ROW(index)][IDX_TO_COL(index)];
+	if (key->macro) {
+		if (ui_macro_trigger == index) {
+			macro_release(&ui_macro_vm);
+		}
+		return true;
+	}
+	return udi_hid_kbd_up(key->key_code);
+}
+
 void ui_set_needs_refresh() {
 	ui_screen_needs_update = true;
 }
@@ -289,6 +335,9 @@ void ui_powerdown(void)
 {
 	LED_Off(LED0_GPIO);
 	LED_Off(LED1_GPIO);
+	// The panel may stay powered between refreshes, not while suspended.
+	// Called from the suspend interrupt: ui_refresh_process() powers it off.
+	itc_power_down();
 }
 
 void ui_wakeup_enable(void)
@@ -370,43 +419,11 @@ void ui_stop_write(void)
 
 void ui_process(uint16_t framenumber)
 {
-	bool b_btn_state, sucess, success;	
+	bool b_btn_state;
 	static bool btn_last_state = false;
-	static bool sequence_running = false;
-	static uint8_t u8_sequence_pos = 0;
-	uint8_t u8_value;
-	static uint16_t cpt_sof = 0;
 	
-	if (framenumber % 20 == 0) {
-		
-		// Check for a key press
-		keyboard_read(&key_event_fifo_desc, keys);
-		
-		// If the key event queue has elements in it, send the first event.
-		if (!fifo_is_empty(&key_event_fifo_desc)) {
-			// Read the direction and key_id for the event.
-			uint8_t direction;
-			fifo_pull_uint8(&key_event_fifo_desc, &direction);
-			uint8_t key_id;
-			fifo_pull_uint8(&key_event_fifo_desc, &key_id);
-			// Convert the key_id to row/col index
-			int row_idx = IDX_TO_ROW(key_id);
-			int col_idx = IDX_TO_COL(key_id);
-			
-			if (direction == key_event_up) {
-				success = udi_hid_kbd_up(keys[row_idx][col_idx].key_code);
-			} else if (direction == key_event_down) {
-				success = udi_hid_kbd_down(keys[row_idx][col_idx].key_code);
-			}
-			
-			// If it didn't work, re-add the event to the queue to try again
-			if (!success) {
-				fifo_push_uint8(&key_event_fifo_desc, direction);
-				fifo_push_uint8(&key_event_fifo_desc, key_id);
-				printf("Failed key event.");
-			}
-		}
-	}
+	// Send every key event queued since the last frame
+	report_builder_process();
 
 	if ((framenumber % 1000) == 0) {
 		LED_On(LED0_GPIO);
@@ -414,54 +431,25 @@ void ui_process(uint16_t framenumber)
 	if ((framenumber % 1000) == 500) {
 		LED_Off(LED0_GPIO);
 	}
-	// Scan process running each 2ms
-	cpt_sof++;
-	if ((cpt_sof % 2) == 0) {
-		return;
-	}
 
 	// Button down to send keys sequence
 	b_btn_state = (!gpio_pin_is_high(GPIO_PUSH_BUTTON_1));
 	if (b_btn_state != btn_last_state) {
-		btn_last_state = b_btn_state;
-		sequence_running = true;
-	}
-
-	// Sequence process running each period
-	if (SEQUENCE_PERIOD > cpt_sof) {
-		return;
-	}
-	cpt_sof = 0;
-
-	if (sequence_running) {
-		// Send next key
-		u8_value = ui_sequence[u8_sequence_pos].u8_value;
-		if (u8_value!=0) {
-			if (ui_sequence[u8_sequence_pos].b_modifier) {
-				if (ui_sequence[u8_sequence_pos].b_down) {
-					sucess = udi_hid_kbd_modifier_down(u8_value);
-				} else {
-					sucess = udi_hid_kbd_modifier_up(u8_value);
-				}
-			} else {
-				if (ui_sequence[u8_sequence_pos].b_down) {
-					sucess = udi_hid_kbd_down(u8_value);
-				} else {
-					sucess = udi_hid_kbd_up(u8_value);
-				}
+		if (b_btn_state) {
+			// Tried again on the next frame if the previous macro is still releasing its keys
+			if (ui_start_macro(UI_MACRO_TRIGGER_BUTTON, ui_demo_macro, sizeof(ui_demo_macro))) {
+				btn_last_state = b_btn_state;
 			}
-			if (!sucess) {
-				return; // Retry it on next schedule
+		} else {
+			btn_last_state = b_btn_state;
+			if (ui_macro_trigger == UI_MACRO_TRIGGER_BUTTON) {
+				macro_release(&ui_macro_vm);
 			}
 		}
-		// Valid sequence position
-		u8_sequence_pos++;
-		if (u8_sequence_pos >=
-			sizeof(ui_sequence) / sizeof(ui_sequence[0])) {
-			u8_sequence_pos = 0;
-			sequence_running = false;
-		}
 	}
+
+	// Macros run one tick per frame
+	macro_step(&ui_macro_vm, &ui_macro_sink);
 }
 
 void ui_kbd_led(uint8_t value)
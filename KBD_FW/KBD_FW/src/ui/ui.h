@@ -48,11 +48,7 @@
 #define _UI_H_
 
 #include "gfx.h"
-
-#define KEY_ROW_NUM		4
-#define KEY_COL_NUM		3
-#define KEY_COUNT		KEY_ROW_NUM*KEY_COL_NUM
-#define KEY_ICON_MAX_DIM  50
+#include "key_layout.h"
 
 #define ROW_COL_TO_IDX(ROW, COL)	COL+(KEY_ROW_NUM-1-ROW)*KEY_COL_NUM //ROW+COL*KEY_ROW_NUM
 #define IDX_TO_ROW(IDX)				KEY_ROW_NUM-1-(IDX/KEY_COL_NUM) //IDX%KEY_ROW_NUM
@@ -64,21 +60,54 @@ typedef struct key_info {
 	gfx_coord_t centre_x;
 	gfx_coord_t centre_y;
 	gfx_coord_t max_dim;
-	bool pressed;
+	const uint8_t *macro;		// Bytecode run instead of key_code, NULL for a plain key
+	uint16_t macro_len;
+	uint8_t icon_width;			// Size of the last icon drawn row by row, 0 if none
+	uint8_t icon_height;
+	uint16_t icon_row_crc[KEY_ICON_MAX_DIM];	// CRC of each row drawn, see ui_get_key_icon_hash()
 	} key_info_t;
 
 //! \brief Initializes the user interface
 void ui_init(void);
 
-// Refreshes the ui's screen. Clears the flag indicating an update is required.
+// Starts refreshing the ui's screen and returns. Clears the flag indicating an update is required.
 void ui_refresh_screen(void);
 
+// Advances the screen refresh, to be called from the main loop.
+void ui_refresh_process(void);
+
+// Whether a screen refresh is running, a new one cannot start until it is done.
+bool ui_refresh_in_progress(void);
+
 // Sets a key icon - should this be in a separate place?
 void ui_set_key_icon(uint8_t index, struct gfx_bitmap* bmp);
 
+// Draws one row of a key icon, placed like ui_set_key_icon() places a width x height bitmap.
+void ui_set_key_icon_row(uint8_t index, gfx_coord_t width, gfx_coord_t height, gfx_coord_t row,
+		const gfx_color_t *pixels);
+
+// Get a hash of the icon drawn row by row on the key at the given index: the CRC of
+// <width> <height> and the CRC of each row, big endian. Rows not drawn count as 0.
+uint16_t ui_get_key_icon_hash(uint8_t index);
+
 // Set the scancode for a key at the given index.
 void ui_set_key_scancode(uint8_t index, uint8_t scancode);
 
+// Get the scancode for a key at the given index.
+uint8_t ui_get_key_scancode(uint8_t index);
+
+// Bind a macro (see macro_ops.h) to the key at the given index, NULL to unbind.
+// code must stay valid while bound.
+void ui_set_key_macro(uint8_t index, const uint8_t *code, uint16_t len);
+
+// Get the macro bound to the key at the given index, NULL if none.
+const uint8_t *ui_get_key_macro(uint8_t index, uint16_t *len);
+
+// Press or release the key at the given index: sends its scancode or runs its macro.
+// Returns false if the HID interface could not take the scancode yet.
+bool ui_key_down(uint8_t index);
+bool ui_key_up(uint8_t index);
+
 // Set the internal flag for the ui to update the screen
 void ui_set_needs_refresh(void);
 
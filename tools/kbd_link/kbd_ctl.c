@@ -0,0 +1,349 @@
+/*
+ * kbd_ctl.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host tool changing single keys of a running keyboard over the configuration
+ * protocol (see link_protocol.h), without uploading a whole profile.
+ *
+ * Build:  cc -O2 -I KBD_FW/KBD_FW/src/comm -I KBD_FW/KBD_FW/src/ui -o kbd_ctl tools/kbd_link/kbd_ctl.c tools/kbd_link/kbd_link.c \
+ *             KBD_FW/KBD_FW/src/comm/cobs.c KBD_FW/KBD_FW/src/comm/crc16.c
+ * Usage:  kbd_ctl <tty> stats
+ *         kbd_ctl <tty> display
+ *         kbd_ctl <tty> get <index>
+ *         kbd_ctl <tty> set <index> <usage>
+ *         kbd_ctl <tty> icon <index> <file.pgm>
+ *         kbd_ctl <tty> update <profile.bin>
+ *
+ * update compares the scancode and icon of each key with a profile compiled by
+ * kbd_profile, and only sends the keys that differ. Macros are not compared,
+ * upload the profile over XMODEM to change them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "comm.h"
+#include "crc16.h"
+#include "kbd_link.h"
+#include "key_layout.h"
+
+#define PROFILE_MAX_SIZE				(256 * 1024)
+
+typedef struct {
+	int b_present;
+	uint8_t scancode;
+	uint8_t width;
+	uint8_t height;
+	const uint8_t *pixels;
+	//! Run-length icons expanded like the keyboard does
+	uint8_t expanded[KEY_ICON_MAX_DIM * KEY_ICON_MAX_DIM];
+} profile_key_t;
+
+static long parse_number(const char *tok, long min, long max)
+{
+	char *end;
+	long value = strtol(tok, &end, 0);
+
+	if (*end || value < min || value > max) {
+		fprintf(stderr, "'%s' is not a number from %ld to %ld\n", tok, min, max);
+		exit(2);
+	}
+	return value;
+}
+
+static uint32_t get_u32(const uint8_t *src)
+{
+	return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+}
+
+static int check(int status, const char *what)
+{
+	if (status < 0) {
+		fprintf(stderr, "%s: the keyboard does not answer\n", what);
+	} else if (status) {
+		fprintf(stderr, "%s: refused with status %d\n", what, status);
+	}
+	return status ? 1 : 0;
+}
+
+// Queues the icon a few rows per request, all pipelined
+static int submit_icon(kbd_link_t *link, uint8_t key_id, int w, int h, const uint8_t *pixels)
+{
+	uint8_t payload[LINK_PAYLOAD_MAX];
+	int rows_per_request = (LINK_PAYLOAD_MAX - 5) / w;
+
+	for (int row = 0; row < h; row += rows_per_request) {
+		int rows = (h - row < rows_per_request) ? h - row : rows_per_request;
+
+		payload[0] = key_id;
+		payload[1] = (uint8_t)w;
+		payload[2] = (uint8_t)h;
+		payload[3] = (uint8_t)row;
+		payload[4] = (uint8_t)rows;
+		memcpy(&payload[5], &pixels[row * w], (size_t)(rows * w));
+		if (kbd_link_submit(link, LINK_CMD_SET_ICON_ROWS, payload, 5 + (size_t)(rows * w)) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int send_icon(kbd_link_t *link, uint8_t key_id, const char *path)
+{
+	uint8_t pixels[KEY_ICON_MAX_DIM * KEY_ICON_MAX_DIM];
+	int w, h, maxval;
+	FILE *f = fopen(path, "rb");
+
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+	if (fscanf(f, "P5 %d %d %d", &w, &h, &maxval) != 3 || maxval != 255 || fgetc(f) == EOF
+			|| w <= 0 || h <= 0 || w > KEY_ICON_MAX_DIM || h > KEY_ICON_MAX_DIM
+			|| fread(pixels, 1, (size_t)(w * h), f) != (size_t)(w * h)) {
+		fprintf(stderr, "%s: not an 8-bit binary PGM of at most %dx%d\n", path,
+				KEY_ICON_MAX_DIM, KEY_ICON_MAX_DIM);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+
+	if (submit_icon(link, key_id, w, h, pixels) < 0) {
+		return check(-1, "icon");
+	}
+	return check(kbd_link_flush(link), "icon");
+}
+
+// Same hash as ui_get_key_icon_hash()
+static uint16_t icon_hash(uint8_t width, uint8_t height, const uint8_t *pixels)
+{
+	uint8_t bytes[2] = {width, height};
+	uint16_t crc = crc16_update(CRC16_INIT, bytes, sizeof(bytes));
+
+	for (int row = 0; row < height; row++) {
+		uint16_t row_crc = crc16_update(CRC16_INIT, &pixels[row * width], width);
+		bytes[0] = (uint8_t)(row_crc >> 8);
+		bytes[1] = (uint8_t)row_crc;
+		crc = crc16_update(crc, bytes, sizeof(bytes));
+	}
+	return crc;
+}
+
+// Expands the runs of a run-length icon. Returns the bytes of runs, 0 if truncated.
+static size_t rle_expand(const uint8_t *data, size_t len, uint8_t *pixels, size_t count)
+{
+	uint8_t color = FILE_RLE_WHITE;
+	size_t idx = 0;
+
+	while (count) {
+		size_t run;
+
+		if (idx == len) {
+			return 0;
+		}
+		run = (data[idx] < count) ? data[idx] : count;
+		memset(pixels, color, run);
+		pixels += run;
+		count -= run;
+		color = (color == FILE_RLE_WHITE) ? FILE_RLE_BLACK : FILE_RLE_WHITE;
+		idx++;
+	}
+	return idx;
+}
+
+// Finds the key sections of a profile, the last one of each key wins
+static int read_profile(const uint8_t *data, size_t len, profile_key_t *keys)
+{
+	size_t pos = 0;
+
+	while (pos + 2 <= len) {
+		unsigned identifier = (data[pos] << 8) | data[pos + 1];
+
+		if (identifier == FILE_SECTION_IDENTIFIER && pos + 6 <= len) {
+			profile_key_t *key;
+			uint8_t key_id = data[pos + 2];
+			size_t size = (size_t)data[pos + 4] * data[pos + 5];
+
+			if (key_id >= KEY_COUNT || pos + 6 + size > len) {
+				return -1;
+			}
+			key = &keys[key_id];
+			key->b_present = 1;
+			key->scancode = data[pos + 3];
+			if (size) {
+				key->width = data[pos + 4];
+				key->height = data[pos + 5];
+				key->pixels = &data[pos + 6];
+			}
+			pos += 6 + size;
+		} else if (identifier == FILE_RLE_SECTION_IDENTIFIER && pos + 6 <= len) {
+			profile_key_t *key;
+			uint8_t key_id = data[pos + 2];
+			uint8_t width = data[pos + 4];
+			uint8_t height = data[pos + 5];
+			size_t size = 0;
+
+			if (key_id >= KEY_COUNT || width > KEY_ICON_MAX_DIM || height > KEY_ICON_MAX_DIM) {
+				return -1;
+			}
+			key = &keys[key_id];
+			key->b_present = 1;
+			key->scancode = data[pos + 3];
+			if (width && height) {
+				size = rle_expand(&data[pos + 6], len - pos - 6, key->expanded, (size_t)width * height);
+				if (!size) {
+					return -1;
+				}
+				key->width = width;
+				key->height = height;
+				key->pixels = key->expanded;
+			}
+			pos += 6 + size;
+		} else if (identifier == FILE_MACRO_SECTION_IDENTIFIER && pos + 5 <= len) {
+			pos += 5 + (size_t)((data[pos + 3] << 8) | data[pos + 4]);
+		} else {
+			// End of the sections, XMODEM padding may follow
+			break;
+		}
+	}
+	return 0;
+}
+
+// Sends the keys of a profile that differ from what the keyboard holds
+static int update(kbd_link_t *link, const char *path)
+{
+	static uint8_t data[PROFILE_MAX_SIZE];
+	profile_key_t keys[KEY_COUNT] = {{0}};
+	uint8_t hashes[LINK_RESPONSE_PAYLOAD_MAX];
+	size_t hashes_len;
+	unsigned changed = 0;
+	size_t len;
+	FILE *f = fopen(path, "rb");
+
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+	len = fread(data, 1, sizeof(data), f);
+	fclose(f);
+	if (read_profile(data, len, keys) < 0) {
+		fprintf(stderr, "%s: not a keyboard profile\n", path);
+		return 1;
+	}
+
+	if (check(kbd_link_transact(link, LINK_CMD_GET_KEY_HASHES, NULL, 0, hashes, &hashes_len), "hashes")) {
+		return 1;
+	}
+	if (hashes_len < 3 * KEY_COUNT) {
+		fprintf(stderr, "hashes: short response\n");
+		return 1;
+	}
+	for (uint8_t key_id = 0; key_id < KEY_COUNT; key_id++) {
+		profile_key_t *key = &keys[key_id];
+		uint8_t payload[2] = {key_id, key->scancode};
+		int b_changed = 0;
+
+		if (!key->b_present) {
+			continue;
+		}
+		if (hashes[3 * key_id] != key->scancode) {
+			b_changed = 1;
+			if (kbd_link_submit(link, LINK_CMD_SET_SCANCODE, payload, sizeof(payload)) < 0) {
+				return check(-1, "update");
+			}
+		}
+		if (key->pixels && (key->width > KEY_ICON_MAX_DIM || key->height > KEY_ICON_MAX_DIM)) {
+			fprintf(stderr, "key %u: icon larger than %dx%d, not sent\n", key_id,
+					KEY_ICON_MAX_DIM, KEY_ICON_MAX_DIM);
+		} else if (key->pixels && ((hashes[3 * key_id + 1] << 8) | hashes[3 * key_id + 2])
+				!= icon_hash(key->width, key->height, key->pixels)) {
+			b_changed = 1;
+			if (submit_icon(link, key_id, key->width, key->height, key->pixels) < 0) {
+				return check(-1, "update");
+			}
+		}
+		changed += b_changed;
+	}
+	if (check(kbd_link_flush(link), "update")) {
+		return 1;
+	}
+	printf("%u keys changed, %lu bytes sent, %lu received\n", changed, link->bytes_sent, link->bytes_received);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	kbd_link_t link;
+	uint8_t payload[2];
+	uint8_t response[LINK_RESPONSE_PAYLOAD_MAX];
+	size_t response_len;
+	int result = 0;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <tty> stats\n"
+				"       %s <tty> display\n"
+				"       %s <tty> get <index>\n"
+				"       %s <tty> set <index> <usage>\n"
+				"       %s <tty> icon <index> <file.pgm>\n"
+				"       %s <tty> update <profile.bin>\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+		return 2;
+	}
+	if (kbd_link_open(&link, argv[1]) < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (check(kbd_link_sync(&link), "sync")) {
+		return 1;
+	}
+
+	if (argc == 3 && !strcmp(argv[2], "stats")) {
+		result = check(kbd_link_transact(&link, LINK_CMD_STATS, NULL, 0, response, &response_len), "stats");
+		if (!result && response_len >= 17) {
+			printf("frames %u, CRC errors %u, sequence errors %u\n",
+					get_u32(&response[0]), get_u32(&response[4]), get_u32(&response[8]));
+			printf("HID missed frames %u, report queue high water %u\n",
+					get_u32(&response[12]), response[16]);
+		}
+	} else if (argc == 3 && !strcmp(argv[2], "display")) {
+		result = check(kbd_link_transact(&link, LINK_CMD_DISPLAY_STATS, NULL, 0, response, &response_len),
+				"display");
+		if (!result && response_len >= 40) {
+			printf("refreshes %u, controller inits %u, skipped %u\n", get_u32(&response[0]),
+					get_u32(&response[4]), get_u32(&response[36]));
+			printf("last refresh %u ms: reset %u, init %u, data %u, power on %u, refresh %u, power off %u\n",
+					get_u32(&response[32]), get_u32(&response[8]), get_u32(&response[12]),
+					get_u32(&response[16]), get_u32(&response[20]), get_u32(&response[24]),
+					get_u32(&response[28]));
+		}
+	} else if (argc == 4 && !strcmp(argv[2], "get")) {
+		payload[0] = (uint8_t)parse_number(argv[3], 0, KEY_COUNT - 1);
+		result = check(kbd_link_transact(&link, LINK_CMD_GET_KEY, payload, 1, response, &response_len), "get");
+		if (!result && response_len >= 3) {
+			printf("key %u: usage 0x%02X, macro %u bytes\n", payload[0], response[0],
+					(response[1] << 8) | response[2]);
+		}
+	} else if (argc == 5 && !strcmp(argv[2], "set")) {
+		payload[0] = (uint8_t)parse_number(argv[3], 0, KEY_COUNT - 1);
+		payload[1] = (uint8_t)parse_number(argv[4], 0, 0xFF);
+		if (!KEY_USAGE_IS_VALID(payload[1])) {
+			fprintf(stderr, "usage 0x%02X is not in the keyboard report\n", payload[1]);
+			exit(2);
+		}
+		result = check(kbd_link_transact(&link, LINK_CMD_SET_SCANCODE, payload, 2, NULL, NULL), "set");
+	} else if (argc == 5 && !strcmp(argv[2], "icon")) {
+		result = send_icon(&link, (uint8_t)parse_number(argv[3], 0, KEY_COUNT - 1), argv[4]);
+	} else if (argc == 4 && !strcmp(argv[2], "update")) {
+		result = update(&link, argv[3]);
+	} else {
+		fprintf(stderr, "unknown command '%s'\n", argv[2]);
+		result = 2;
+	}
+
+	if (link.retransmits) {
+		fprintf(stderr, "%lu frames sent again\n", link.retransmits);
+	}
+	kbd_link_close(&link);
+	return result;
+}
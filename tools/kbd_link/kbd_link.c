@@ -0,0 +1,248 @@
+/*
+ * kbd_link.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "crc16.h"
+#include "kbd_link.h"
+
+int kbd_link_open(kbd_link_t *link, const char *path)
+{
+	struct termios tio;
+	int fd = open(path, O_RDWR | O_NOCTTY);
+
+	if (fd < 0) {
+		return -1;
+	}
+	if (tcgetattr(fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+	kbd_link_attach(link, fd);
+	return 0;
+}
+
+void kbd_link_attach(kbd_link_t *link, int fd)
+{
+	memset(link, 0, sizeof(*link));
+	link->fd = fd;
+}
+
+void kbd_link_close(kbd_link_t *link)
+{
+	close(link->fd);
+}
+
+static int write_all(int fd, const uint8_t *data, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+static int send_request(kbd_link_t *link, kbd_link_request_t *request)
+{
+	uint8_t frame[COBS_ENCODED_MAX(sizeof(request->frame)) + 2];
+	size_t len;
+
+	frame[0] = 0;
+	len = 1 + cobs_encode(request->frame, request->frame_len, &frame[1]);
+	frame[len++] = 0;
+	link->bytes_sent += len;
+	return write_all(link->fd, frame, len);
+}
+
+// Sends every request without a response again
+static int resend_window(kbd_link_t *link)
+{
+	link->b_resent = true;
+	for (unsigned i = 0; i < link->count; i++) {
+		kbd_link_request_t *request = &link->window[(link->head + i) % LINK_WINDOW];
+		if (!request->b_done) {
+			link->retransmits++;
+			if (send_request(link, request) < 0) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+// Retires the answered requests at the head of the window
+static void retire(kbd_link_t *link)
+{
+	while (link->count && link->window[link->head].b_done) {
+		kbd_link_request_t *request = &link->window[link->head];
+
+		if (request->status != LINK_STATUS_OK && !link->error) {
+			link->error = request->status;
+		}
+		link->status = request->status;
+		memcpy(link->response, request->response, request->response_len);
+		link->response_len = request->response_len;
+		link->head = (link->head + 1) % LINK_WINDOW;
+		link->count--;
+	}
+}
+
+static int frame_received(kbd_link_t *link)
+{
+	uint8_t frame[sizeof(link->rx)];
+	size_t len = cobs_decode(link->rx, link->rx_len, frame);
+	kbd_link_request_t *request = NULL;
+	uint16_t crc;
+
+	// Anything else on the line, such as the 'C' XMODEM sends while idle, is not a frame
+	if (len < LINK_RESPONSE_OVERHEAD) {
+		return 0;
+	}
+	crc = (uint16_t)((frame[len - 2] << 8) | frame[len - 1]);
+	if (crc != crc16_update(CRC16_INIT, frame, len - 2) || !(frame[1] & LINK_RESPONSE)) {
+		return 0;
+	}
+	for (unsigned i = 0; i < link->count; i++) {
+		kbd_link_request_t *r = &link->window[(link->head + i) % LINK_WINDOW];
+		if (r->frame[0] == frame[0] && !r->b_done) {
+			request = r;
+			break;
+		}
+	}
+	if (!request) {
+		// Response to a request sent twice
+		return 0;
+	}
+	if (frame[2] == LINK_STATUS_SEQUENCE) {
+		// The requests following a lost one all get this response, only the first one matters.
+		// Responses come in order: once another one arrives, the ones to the first sending are over.
+		return link->b_resent ? 0 : resend_window(link);
+	}
+	link->b_resent = false;
+	request->b_done = true;
+	request->status = frame[2];
+	request->response_len = len - LINK_RESPONSE_OVERHEAD;
+	memcpy(request->response, &frame[3], request->response_len);
+	retire(link);
+	return 0;
+}
+
+// Reads responses until fewer than max_pending requests are unanswered
+static int wait_pending(kbd_link_t *link, unsigned max_pending)
+{
+	unsigned retries = 0;
+
+	while (link->count > max_pending) {
+		struct pollfd pfd = {.fd = link->fd, .events = POLLIN};
+		uint8_t buf[256];
+		ssize_t n;
+		int ready = poll(&pfd, 1, KBD_LINK_TIMEOUT_MS);
+
+		if (ready < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ready <= 0) {
+			if (ready < 0 || ++retries > KBD_LINK_MAX_RETRIES || resend_window(link) < 0) {
+				return -1;
+			}
+			continue;
+		}
+		n = read(link->fd, buf, sizeof(buf));
+		if (n <= 0) {
+			return -1;
+		}
+		retries = 0;
+		link->bytes_received += (unsigned long)n;
+		for (ssize_t i = 0; i < n; i++) {
+			if (buf[i]) {
+				if (link->rx_len < sizeof(link->rx)) {
+					link->rx[link->rx_len++] = buf[i];
+				} else {
+					link->b_rx_overflow = true;
+				}
+				continue;
+			}
+			// Each 0x00 ends a frame and starts the next one
+			if (link->rx_len && !link->b_rx_overflow && frame_received(link) < 0) {
+				return -1;
+			}
+			link->rx_len = 0;
+			link->b_rx_overflow = false;
+		}
+	}
+	return 0;
+}
+
+int kbd_link_submit(kbd_link_t *link, uint8_t command, const uint8_t *payload, size_t len)
+{
+	kbd_link_request_t *request;
+	uint16_t crc;
+
+	if (len > LINK_PAYLOAD_MAX) {
+		return LINK_STATUS_ARGUMENT;
+	}
+	if (wait_pending(link, LINK_WINDOW - 1) < 0) {
+		return -1;
+	}
+	request = &link->window[(link->head + link->count) % LINK_WINDOW];
+	request->frame[0] = link->next_seq++;
+	request->frame[1] = command;
+	if (len) {
+		memcpy(&request->frame[2], payload, len);
+	}
+	crc = crc16_update(CRC16_INIT, request->frame, 2 + len);
+	request->frame[2 + len] = (uint8_t)(crc >> 8);
+	request->frame[3 + len] = (uint8_t)crc;
+	request->frame_len = LINK_REQUEST_OVERHEAD + len;
+	request->b_done = false;
+	link->count++;
+	return send_request(link, request);
+}
+
+int kbd_link_flush(kbd_link_t *link)
+{
+	int error;
+
+	if (wait_pending(link, 0) < 0) {
+		return -1;
+	}
+	error = link->error;
+	link->error = 0;
+	return error;
+}
+
+int kbd_link_sync(kbd_link_t *link)
+{
+	return kbd_link_transact(link, LINK_CMD_SYNC, NULL, 0, NULL, NULL);
+}
+
+int kbd_link_transact(kbd_link_t *link, uint8_t command, const uint8_t *payload, size_t len,
+		uint8_t *response, size_t *response_len)
+{
+	int error = kbd_link_submit(link, command, payload, len);
+
+	if (!error) {
+		error = kbd_link_flush(link);
+	}
+	if (error >= 0 && response) {
+		// The request was the last one submitted, so the last one to complete
+		memcpy(response, link->response, link->response_len);
+		*response_len = link->response_len;
+	}
+	return error;
+}
@@ -0,0 +1,87 @@
+/*
+ * kbd_link.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host side of the configuration protocol described in link_protocol.h.
+ * Requests are pipelined: up to LINK_WINDOW of them are sent before waiting
+ * for the responses, and lost frames are sent again from the first one the
+ * keyboard did not answer (go-back-N).
+ */
+
+#ifndef KBD_LINK_H_
+#define KBD_LINK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cobs.h"
+#include "link_protocol.h"
+
+//! Silence before the unanswered requests are sent again
+#define KBD_LINK_TIMEOUT_MS		200
+//! Timeouts in a row before giving up
+#define KBD_LINK_MAX_RETRIES	10
+
+typedef struct {
+	uint8_t frame[LINK_REQUEST_OVERHEAD + LINK_PAYLOAD_MAX];	//!< Decoded request, kept to send again
+	size_t frame_len;
+	bool b_done;
+	uint8_t status;
+	uint8_t response[LINK_RESPONSE_PAYLOAD_MAX];
+	size_t response_len;
+} kbd_link_request_t;
+
+typedef struct {
+	int fd;
+	uint8_t next_seq;
+	//! Requests without a response, oldest first
+	kbd_link_request_t window[LINK_WINDOW];
+	unsigned head;
+	unsigned count;
+	//! Window sent again, the LINK_STATUS_SEQUENCE responses to the first sending are ignored
+	bool b_resent;
+	//! Received bytes of the current frame, longer ones are dropped
+	uint8_t rx[COBS_ENCODED_MAX(LINK_RESPONSE_OVERHEAD + LINK_RESPONSE_PAYLOAD_MAX)];
+	size_t rx_len;
+	bool b_rx_overflow;
+	//! First failed status since the last kbd_link_flush()
+	uint8_t error;
+	//! Last request to complete
+	uint8_t status;
+	uint8_t response[LINK_RESPONSE_PAYLOAD_MAX];
+	size_t response_len;
+	//! Frames sent again
+	unsigned long retransmits;
+	//! Bytes written and read, frame delimiters included
+	unsigned long bytes_sent;
+	unsigned long bytes_received;
+} kbd_link_t;
+
+// Opens a serial port in raw mode. Returns 0, or -1 with errno set.
+int kbd_link_open(kbd_link_t *link, const char *path);
+
+// Uses an already open file descriptor, a pipe or socket for instance.
+void kbd_link_attach(kbd_link_t *link, int fd);
+
+void kbd_link_close(kbd_link_t *link);
+
+// Starts the sequence numbers again, to be called first.
+// Returns 0, a LINK_STATUS_xxx, or -1 if the keyboard does not answer.
+int kbd_link_sync(kbd_link_t *link);
+
+// Queues a request, waiting only if the window is full.
+// Returns 0, or -1 if the keyboard does not answer.
+int kbd_link_submit(kbd_link_t *link, uint8_t command, const uint8_t *payload, size_t len);
+
+// Waits for all the responses.
+// Returns 0, the first failed LINK_STATUS_xxx, or -1 if the keyboard does not answer.
+int kbd_link_flush(kbd_link_t *link);
+
+// Sends a request and waits for its response, copied to response (LINK_RESPONSE_PAYLOAD_MAX bytes).
+// Returns like kbd_link_flush().
+int kbd_link_transact(kbd_link_t *link, uint8_t command, const uint8_t *payload, size_t len,
+		uint8_t *response, size_t *response_len);
+
+#endif /* KBD_LINK_H_ */
@@ -0,0 +1,571 @@
+/*
+ * kbd_profile.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host tool compiling a keyboard layout description into the binary profile
+ * uploaded to the keyboard over XMODEM (see comm.h for the section format).
+ *
+ * Build:  cc -O2 -I KBD_FW/KBD_FW/src/comm -I KBD_FW/KBD_FW/src/ui -o kbd_profile tools/kbd_profile/kbd_profile.c
+ * Usage:  kbd_profile compile <layout.txt> <profile.bin>
+ *         kbd_profile dump <profile.bin>
+ *
+ * Layout description, one statement per line, '#' starts a comment:
+ *
+ *   key <index> <usage> [icon <file.pgm>]
+ *       Sets the scancode of a key, and its icon from an 8-bit binary PGM
+ *       (the display uses one grayscale byte per pixel). The panel only shows
+ *       1 bit per pixel, so icons are sent as runs of white and black pixels
+ *       when that is smaller.
+ *
+ *   macro <index>
+ *       <statements>
+ *   end
+ *       Binds a macro to a key. Statements:
+ *         down <usage|modifier>     up <usage|modifier>     tap <usage|modifier>
+ *         type "<text>"             delay <ms>              wait_release
+ *         repeat <count|held>  ...  end
+ *       Text is translated to US layout usages here, so the keyboard only
+ *       replays packed key events.
+ *
+ * Usages are written as names (A, ENTER, F1, LEFT...) or numbers (0x04).
+ * Modifiers are LCTRL, LSHIFT, LALT, LGUI, RCTRL, RSHIFT, RALT and RGUI.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "comm.h"
+#include "key_layout.h"
+#include "macro_ops.h"
+
+#define PROFILE_MAX_SIZE				(256 * 1024)
+#define MACRO_MAX_SIZE					0xFFFF
+
+static const struct {
+	const char *name;
+	uint8_t usage;
+} usage_names[] = {
+	{"ENTER", 0x28}, {"ESC", 0x29}, {"BACKSPACE", 0x2A}, {"TAB", 0x2B}, {"SPACE", 0x2C},
+	{"MINUS", 0x2D}, {"EQUAL", 0x2E}, {"LBRACKET", 0x2F}, {"RBRACKET", 0x30},
+	{"BACKSLASH", 0x31}, {"SEMICOLON", 0x33}, {"QUOTE", 0x34}, {"GRAVE", 0x35},
+	{"COMMA", 0x36}, {"DOT", 0x37}, {"SLASH", 0x38}, {"CAPSLOCK", 0x39},
+	{"PRINTSCREEN", 0x46}, {"SCROLLLOCK", 0x47}, {"PAUSE", 0x48}, {"INSERT", 0x49},
+	{"HOME", 0x4A}, {"PAGEUP", 0x4B}, {"DELETE", 0x4C}, {"END", 0x4D}, {"PAGEDOWN", 0x4E},
+	{"RIGHT", 0x4F}, {"LEFT", 0x50}, {"DOWN", 0x51}, {"UP", 0x52},
+};
+
+static const struct {
+	const char *name;
+	uint8_t mask;
+} modifier_names[] = {
+	{"LCTRL", 0x01}, {"LSHIFT", 0x02}, {"LALT", 0x04}, {"LGUI", 0x08},
+	{"RCTRL", 0x10}, {"RSHIFT", 0x20}, {"RALT", 0x40}, {"RGUI", 0x80},
+};
+
+// US layout: usage of each printable character, ORed with MACRO_TYPE_SHIFT when shifted
+static const char ascii_unshifted_punct[] = " -=[]\\;'`,./";
+static const uint8_t ascii_unshifted_usage[] = {0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38};
+static const char ascii_shifted_punct[] = "!@#$%^&*()_+{}|:\"~<>?";
+static const uint8_t ascii_shifted_usage[] = {0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+		0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38};
+
+static const char *src_name;
+static int src_line;
+
+static void fail(const char *fmt, const char *arg)
+{
+	fprintf(stderr, "%s:%d: ", src_name, src_line);
+	fprintf(stderr, fmt, arg);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+typedef struct {
+	uint8_t *data;
+	size_t len;
+	size_t cap;
+} buf_t;
+
+static void buf_put(buf_t *buf, uint8_t byte)
+{
+	if (buf->len == buf->cap) {
+		buf->cap = buf->cap ? buf->cap * 2 : 256;
+		buf->data = realloc(buf->data, buf->cap);
+		if (!buf->data) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	buf->data[buf->len++] = byte;
+}
+
+//! Character translated to a MACRO_OP_TYPE character, or -1
+static int ascii_to_type_char(char c)
+{
+	const char *p;
+
+	if (c >= 'a' && c <= 'z') {
+		return 0x04 + (c - 'a');
+	}
+	if (c >= 'A' && c <= 'Z') {
+		return (0x04 + (c - 'A')) | MACRO_TYPE_SHIFT;
+	}
+	if (c >= '1' && c <= '9') {
+		return 0x1E + (c - '1');
+	}
+	if (c == '0') {
+		return 0x27;
+	}
+	if (c == '\n') {
+		return 0x28;
+	}
+	if (c == '\t') {
+		return 0x2B;
+	}
+	if (c && (p = strchr(ascii_unshifted_punct, c))) {
+		return ascii_unshifted_usage[p - ascii_unshifted_punct];
+	}
+	if (c && (p = strchr(ascii_shifted_punct, c))) {
+		return ascii_shifted_usage[p - ascii_shifted_punct] | MACRO_TYPE_SHIFT;
+	}
+	return -1;
+}
+
+static long parse_number(const char *tok, long min, long max)
+{
+	char *end;
+	long value;
+
+	errno = 0;
+	value = strtol(tok, &end, 0);
+	if (errno || *end || end == tok || value < min || value > max) {
+		fail("invalid number '%s'", tok);
+	}
+	return value;
+}
+
+//! Modifier mask of a name, 0 if it is not a modifier
+static uint8_t parse_modifier(const char *tok)
+{
+	for (size_t i = 0; i < sizeof(modifier_names) / sizeof(modifier_names[0]); i++) {
+		if (!strcmp(tok, modifier_names[i].name)) {
+			return modifier_names[i].mask;
+		}
+	}
+	return 0;
+}
+
+static uint8_t parse_usage(const char *tok)
+{
+	if (!tok) {
+		fail("missing usage%s", "");
+	}
+	if (isdigit((unsigned char)tok[0]) && tok[1]) {
+		// Numeric usage, a single digit is the key of that digit
+		long usage = parse_number(tok, 0, 0xFF);
+
+		if (!KEY_USAGE_IS_VALID(usage)) {
+			fail("usage '%s' is not in the keyboard report", tok);
+		}
+		return (uint8_t)usage;
+	}
+	if (!tok[1] && isalnum((unsigned char)tok[0])) {
+		return ascii_to_type_char((char)tolower((unsigned char)tok[0])) & MACRO_TYPE_USAGE_MASK;
+	}
+	if (tok[0] == 'F' && isdigit((unsigned char)tok[1])) {
+		long n = parse_number(tok + 1, 1, 12);
+		return (uint8_t)(0x3A + n - 1);
+	}
+	for (size_t i = 0; i < sizeof(usage_names) / sizeof(usage_names[0]); i++) {
+		if (!strcmp(tok, usage_names[i].name)) {
+			return usage_names[i].usage;
+		}
+	}
+	fail("unknown usage '%s'", tok);
+	return 0;
+}
+
+//! Splits a line into tokens. A double-quoted token keeps its spaces and C escapes.
+static int tokenize(char *line, char **tok, int max_tok)
+{
+	int n = 0;
+	char *p = line;
+
+	while (*p) {
+		while (isspace((unsigned char)*p)) {
+			p++;
+		}
+		if (!*p || *p == '#') {
+			break;
+		}
+		if (n == max_tok) {
+			fail("too many words%s", "");
+		}
+		if (*p == '"') {
+			// Keep the opening quote as a marker, the text is unescaped after it
+			char *out = p + 1;
+			tok[n++] = p++;
+			while (*p != '"') {
+				if (!*p) {
+					fail("unterminated string%s", "");
+				}
+				if (*p == '\\') {
+					p++;
+					switch (*p) {
+					case 'n': *out++ = '\n'; break;
+					case 't': *out++ = '\t'; break;
+					case '\\': *out++ = '\\'; break;
+					case '"': *out++ = '"'; break;
+					default: fail("unknown escape in string%s", ""); break;
+					}
+					p++;
+				} else {
+					*out++ = *p++;
+				}
+			}
+			*out = '\0';
+			p++;
+		} else {
+			tok[n++] = p;
+			while (*p && !isspace((unsigned char)*p)) {
+				p++;
+			}
+			if (*p) {
+				*p++ = '\0';
+			}
+		}
+	}
+	return n;
+}
+
+static void emit_type(buf_t *code, const char *text)
+{
+	size_t len = strlen(text);
+
+	while (len) {
+		size_t chunk = len > 255 ? 255 : len;
+		buf_put(code, MACRO_OP_TYPE);
+		buf_put(code, (uint8_t)chunk);
+		for (size_t i = 0; i < chunk; i++) {
+			int c = ascii_to_type_char(text[i]);
+			if (c < 0) {
+				char bad[2] = {text[i], '\0'};
+				fail("character '%s' cannot be typed", bad);
+			}
+			buf_put(code, (uint8_t)c);
+		}
+		text += chunk;
+		len -= chunk;
+	}
+}
+
+static void emit_key_op(buf_t *code, const char *verb, const char *arg)
+{
+	uint8_t mask = arg ? parse_modifier(arg) : 0;
+	uint8_t value = mask ? mask : parse_usage(arg);
+	uint8_t op_down = mask ? MACRO_OP_MOD_DOWN : MACRO_OP_KEY_DOWN;
+	uint8_t op_up = mask ? MACRO_OP_MOD_UP : MACRO_OP_KEY_UP;
+
+	if (!strcmp(verb, "down") || !strcmp(verb, "tap")) {
+		buf_put(code, op_down);
+		buf_put(code, value);
+	}
+	if (!strcmp(verb, "up") || !strcmp(verb, "tap")) {
+		buf_put(code, op_up);
+		buf_put(code, value);
+	}
+}
+
+static void load_pgm(const char *path, buf_t *out, uint8_t *width, uint8_t *height)
+{
+	FILE *f = fopen(path, "rb");
+	int w, h, maxval;
+
+	if (!f) {
+		fail("cannot open icon '%s'", path);
+	}
+	if (fscanf(f, "P5 %d %d %d", &w, &h, &maxval) != 3 || maxval != 255 || fgetc(f) == EOF) {
+		fail("icon '%s' is not an 8-bit binary PGM", path);
+	}
+	if (w <= 0 || h <= 0 || w > KEY_ICON_MAX_DIM || h > KEY_ICON_MAX_DIM) {
+		fail("icon '%s' is larger than the key", path);
+	}
+	for (int i = 0; i < w * h; i++) {
+		int c = fgetc(f);
+		if (c == EOF) {
+			fail("icon '%s' is truncated", path);
+		}
+		buf_put(out, (uint8_t)c);
+	}
+	fclose(f);
+	*width = (uint8_t)w;
+	*height = (uint8_t)h;
+}
+
+// Encodes pixels as lengths of alternating white and black runs, starting with white
+static void rle_encode(const buf_t *pixels, buf_t *out)
+{
+	int b_white = 1;
+	size_t i = 0;
+
+	while (i < pixels->len) {
+		size_t run = 0;
+
+		while (i < pixels->len && (pixels->data[i] > KEY_ICON_THRES_BLACK) == b_white) {
+			run++;
+			i++;
+		}
+		while (run > 255) {
+			buf_put(out, 255);
+			buf_put(out, 0);
+			run -= 255;
+		}
+		buf_put(out, (uint8_t)run);
+		b_white = !b_white;
+	}
+}
+
+// Bytes of the runs covering count pixels, 0 if truncated
+static size_t rle_size(const uint8_t *data, size_t len, size_t count)
+{
+	size_t idx = 0;
+
+	while (count) {
+		if (idx == len) {
+			return 0;
+		}
+		count -= (data[idx] < count) ? data[idx] : count;
+		idx++;
+	}
+	return idx;
+}
+
+static int compile(const char *in_path, const char *out_path)
+{
+	FILE *in = fopen(in_path, "r");
+	FILE *out;
+	char line[1024];
+	buf_t profile = {0}, code = {0};
+	int macro_key = -1;
+	int depth = 0;
+
+	if (!in) {
+		perror(in_path);
+		return 1;
+	}
+	src_name = in_path;
+	while (fgets(line, sizeof(line), in)) {
+		char *tok[8];
+		int n;
+
+		src_line++;
+		n = tokenize(line, tok, 8);
+		if (!n) {
+			continue;
+		}
+
+		if (macro_key < 0) {
+			if (!strcmp(tok[0], "key") && (n == 3 || (n == 5 && !strcmp(tok[3], "icon")))) {
+				buf_t pixels = {0};
+				buf_t runs = {0};
+				uint8_t width = 0, height = 0;
+				uint16_t identifier = FILE_SECTION_IDENTIFIER;
+
+				if (n == 5) {
+					load_pgm(tok[4], &pixels, &width, &height);
+					rle_encode(&pixels, &runs);
+					if (runs.len < pixels.len) {
+						identifier = FILE_RLE_SECTION_IDENTIFIER;
+					}
+				}
+				buf_put(&profile, identifier >> 8);
+				buf_put(&profile, identifier & 0xFF);
+				buf_put(&profile, (uint8_t)parse_number(tok[1], 0, KEY_COUNT - 1));
+				buf_put(&profile, parse_usage(tok[2]));
+				buf_put(&profile, width);
+				buf_put(&profile, height);
+				if (identifier == FILE_RLE_SECTION_IDENTIFIER) {
+					for (size_t i = 0; i < runs.len; i++) {
+						buf_put(&profile, runs.data[i]);
+					}
+				} else {
+					for (size_t i = 0; i < pixels.len; i++) {
+						buf_put(&profile, pixels.data[i]);
+					}
+				}
+				free(pixels.data);
+				free(runs.data);
+			} else if (!strcmp(tok[0], "macro") && n == 2) {
+				macro_key = (int)parse_number(tok[1], 0, KEY_COUNT - 1);
+				code.len = 0;
+			} else {
+				fail("expected 'key' or 'macro', got '%s'", tok[0]);
+			}
+			continue;
+		}
+
+		if (!strcmp(tok[0], "end") && n == 1) {
+			if (depth) {
+				buf_put(&code, MACRO_OP_REPEAT_END);
+				depth--;
+				continue;
+			}
+			buf_put(&code, MACRO_OP_END);
+			if (code.len > MACRO_MAX_SIZE) {
+				fail("macro is too long%s", "");
+			}
+			buf_put(&profile, FILE_MACRO_SECTION_IDENTIFIER >> 8);
+			buf_put(&profile, FILE_MACRO_SECTION_IDENTIFIER & 0xFF);
+			buf_put(&profile, (uint8_t)macro_key);
+			buf_put(&profile, (uint8_t)(code.len >> 8));
+			buf_put(&profile, (uint8_t)code.len);
+			for (size_t i = 0; i < code.len; i++) {
+				buf_put(&profile, code.data[i]);
+			}
+			macro_key = -1;
+		} else if ((!strcmp(tok[0], "down") || !strcmp(tok[0], "up") || !strcmp(tok[0], "tap")) && n == 2) {
+			emit_key_op(&code, tok[0], tok[1]);
+		} else if (!strcmp(tok[0], "type") && n == 2 && tok[1][0] == '"') {
+			emit_type(&code, tok[1] + 1);
+		} else if (!strcmp(tok[0], "delay") && n == 2) {
+			long ms = parse_number(tok[1], 0, 0xFFFF);
+			buf_put(&code, MACRO_OP_DELAY);
+			buf_put(&code, (uint8_t)ms);
+			buf_put(&code, (uint8_t)(ms >> 8));
+		} else if (!strcmp(tok[0], "repeat") && n == 2) {
+			if (++depth > MACRO_REPEAT_DEPTH) {
+				fail("repeat blocks nested too deep%s", "");
+			}
+			buf_put(&code, MACRO_OP_REPEAT);
+			buf_put(&code, !strcmp(tok[1], "held") ? 0 : (uint8_t)parse_number(tok[1], 1, 255));
+		} else if (!strcmp(tok[0], "wait_release") && n == 1) {
+			buf_put(&code, MACRO_OP_WAIT_RELEASE);
+		} else {
+			fail("unknown macro statement '%s'", tok[0]);
+		}
+	}
+	fclose(in);
+	if (macro_key >= 0) {
+		fail("missing 'end' of macro%s", "");
+	}
+	if (profile.len > PROFILE_MAX_SIZE) {
+		fail("profile is too large%s", "");
+	}
+
+	out = fopen(out_path, "wb");
+	if (!out || fwrite(profile.data, 1, profile.len, out) != profile.len || fclose(out)) {
+		perror(out_path);
+		return 1;
+	}
+	printf("%s: %zu bytes\n", out_path, profile.len);
+	free(profile.data);
+	free(code.data);
+	return 0;
+}
+
+static void dump_macro(const uint8_t *code, size_t len)
+{
+	size_t pc = 0;
+
+	while (pc < len) {
+		uint8_t op = code[pc];
+		size_t size = MACRO_OP_SIZE(op);
+
+		if (op == MACRO_OP_TYPE && pc + 1 < len) {
+			size += code[pc + 1];
+		}
+		if (!size || pc + size > len) {
+			printf("    <invalid opcode 0x%02X>\n", op);
+			return;
+		}
+		switch (op) {
+		case MACRO_OP_END: printf("    end\n"); break;
+		case MACRO_OP_KEY_DOWN: printf("    key down 0x%02X\n", code[pc + 1]); break;
+		case MACRO_OP_KEY_UP: printf("    key up 0x%02X\n", code[pc + 1]); break;
+		case MACRO_OP_MOD_DOWN: printf("    modifier down 0x%02X\n", code[pc + 1]); break;
+		case MACRO_OP_MOD_UP: printf("    modifier up 0x%02X\n", code[pc + 1]); break;
+		case MACRO_OP_DELAY: printf("    delay %u\n", code[pc + 1] | (code[pc + 2] << 8)); break;
+		case MACRO_OP_REPEAT: printf("    repeat %u\n", code[pc + 1]); break;
+		case MACRO_OP_REPEAT_END: printf("    repeat end\n"); break;
+		case MACRO_OP_WAIT_RELEASE: printf("    wait release\n"); break;
+		case MACRO_OP_TYPE:
+			printf("    type %u:", code[pc + 1]);
+			for (size_t i = 0; i < code[pc + 1]; i++) {
+				uint8_t c = code[pc + 2 + i];
+				printf(" %s%02X", (c & MACRO_TYPE_SHIFT) ? "S+" : "", c & MACRO_TYPE_USAGE_MASK);
+			}
+			printf("\n");
+			break;
+		}
+		pc += size;
+	}
+}
+
+static int dump(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	static uint8_t data[PROFILE_MAX_SIZE];
+	size_t len, idx = 0;
+
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+	len = fread(data, 1, sizeof(data), f);
+	fclose(f);
+
+	while (idx + 2 <= len) {
+		uint16_t identifier = (data[idx] << 8) | data[idx + 1];
+
+		if (identifier == FILE_SECTION_IDENTIFIER && idx + 6 <= len) {
+			size_t pixels = (size_t)data[idx + 4] * data[idx + 5];
+			printf("key %u: scancode 0x%02X, icon %ux%u\n", data[idx + 2], data[idx + 3],
+					data[idx + 4], data[idx + 5]);
+			idx += 6 + pixels;
+		} else if (identifier == FILE_RLE_SECTION_IDENTIFIER && idx + 6 <= len) {
+			size_t pixels = (size_t)data[idx + 4] * data[idx + 5];
+			size_t size = rle_size(&data[idx + 6], len - idx - 6, pixels);
+			if (pixels && !size) {
+				printf("key %u: <truncated icon>\n", data[idx + 2]);
+				return 1;
+			}
+			printf("key %u: scancode 0x%02X, icon %ux%u, %zu bytes of runs\n", data[idx + 2],
+					data[idx + 3], data[idx + 4], data[idx + 5], size);
+			idx += 6 + size;
+		} else if (identifier == FILE_MACRO_SECTION_IDENTIFIER && idx + 5 <= len) {
+			size_t code_len = (data[idx + 3] << 8) | data[idx + 4];
+			printf("macro %u: %zu bytes\n", data[idx + 2], code_len);
+			if (idx + 5 + code_len > len) {
+				printf("    <truncated>\n");
+				return 1;
+			}
+			dump_macro(&data[idx + 5], code_len);
+			idx += 5 + code_len;
+		} else {
+			break;
+		}
+	}
+	if (idx > len) {
+		printf("<truncated section>\n");
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 4 && !strcmp(argv[1], "compile")) {
+		return compile(argv[2], argv[3]);
+	}
+	if (argc == 3 && !strcmp(argv[1], "dump")) {
+		return dump(argv[2]);
+	}
+	fprintf(stderr, "usage: %s compile <layout.txt> <profile.bin>\n"
+			"       %s dump <profile.bin>\n", argv[0], argv[0]);
+	return 2;
+}
@@ -0,0 +1,218 @@
+/*
+ * cdc_rx_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test and benchmark of the CDC receive path (udi_cdc.c) against a fake
+ * USB device driver. The test plays the host: it fills the bank armed on the
+ * data OUT endpoint and calls back the class, as the driver does at the end
+ * of a transfer. The stream is read with udi_cdc_getc(), one byte at a time
+ * as the XMODEM receiver did, and with udi_cdc_get_rx_buffer() and
+ * udi_cdc_rx_consume(), one copy per bank as it does now. Both must read the
+ * stream sent, in full banks and in random fragments.
+ *
+ * The time per byte received is printed for each way of reading, in
+ * nanoseconds and, on x86, in time stamp counter cycles. The time of the fake
+ * driver filling the banks is included in both.
+ *
+ * Build:  make -C tools/tests cdc_rx_test
+ * Usage:  cdc_rx_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#  define HAS_TSC			1
+#else
+#  define HAS_TSC			0
+#endif
+#include "udd.h"
+#include "udi_cdc.h"
+
+// Bytes of the profile on the wire, XMODEM framing included
+#define STREAM_SIZE			(30 * 1024)
+#define BANK_SIZE			UDI_CDC_DATA_EPS_FS_SIZE
+#define FRAGMENT_ROUNDS		20
+#define BENCH_ROUNDS		200
+
+typedef enum {
+	READ_GETC,
+	READ_BUFFER,
+} read_mode_t;
+
+udd_ctrl_request_t udd_g_ctrlreq;
+
+// Transfer armed on the data OUT endpoint, filled by host_send()
+static uint8_t *out_buf;
+static iram_size_t out_size;
+static udd_callback_trans_t out_callback;
+
+static uint8_t stream[STREAM_SIZE];
+static uint8_t received[STREAM_SIZE];
+
+static unsigned failures;
+
+bool udd_is_high_speed(void)
+{
+	return false;
+}
+
+uint16_t udd_get_frame_number(void)
+{
+	return 0;
+}
+
+uint16_t udd_get_micro_frame_number(void)
+{
+	return 0;
+}
+
+bool udd_ep_run(udd_ep_id_t ep, bool b_shortpacket, uint8_t *buf, iram_size_t buf_size,
+		udd_callback_trans_t callback)
+{
+	(void)b_shortpacket;
+	// The IN endpoints are not polled by this host
+	if (ep == UDI_CDC_DATA_EP_OUT_0) {
+		out_buf = buf;
+		out_size = buf_size;
+		out_callback = callback;
+	}
+	return true;
+}
+
+static void expect(const char *test, const char *what, bool b_ok)
+{
+	if (!b_ok) {
+		printf("%s: %s\n", test, what);
+		failures++;
+	}
+}
+
+static double seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t cycles(void)
+{
+#if HAS_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// Ends the transfer armed on the data OUT endpoint with len bytes, false if none is armed
+static bool host_send(const uint8_t *data, iram_size_t len)
+{
+	udd_callback_trans_t callback = out_callback;
+
+	if (!callback || len > out_size) {
+		return false;
+	}
+	memcpy(out_buf, data, len);
+	out_callback = NULL;
+	callback(UDD_EP_TRANSFER_OK, len, UDI_CDC_DATA_EP_OUT_0);
+	return true;
+}
+
+// Reads what the class holds, returns the bytes read
+static iram_size_t device_read(read_mode_t mode, uint8_t *dest)
+{
+	iram_size_t len = 0;
+
+	if (mode == READ_GETC) {
+		while (udi_cdc_is_rx_ready()) {
+			dest[len++] = udi_cdc_getc();
+		}
+	} else {
+		const uint8_t *buf;
+		iram_size_t size;
+
+		while ((buf = udi_cdc_get_rx_buffer(&size)) != NULL) {
+			memcpy(&dest[len], buf, size);
+			udi_cdc_rx_consume(size);
+			len += size;
+		}
+	}
+	return len;
+}
+
+// Sends the stream in fragments of up to max_fragment bytes, random if b_random, and reads it
+static void transfer(const char *test, read_mode_t mode, iram_size_t max_fragment, bool b_random)
+{
+	uint32_t sent = 0, read = 0;
+
+	while (read < STREAM_SIZE) {
+		iram_size_t len = b_random ? 1 + (iram_size_t)rand() % max_fragment : max_fragment;
+		iram_size_t len_read;
+
+		len = len < STREAM_SIZE - sent ? len : STREAM_SIZE - sent;
+		if (!len || !host_send(&stream[sent], len)) {
+			len = 0;
+		}
+		sent += len;
+		len_read = device_read(mode, &received[read]);
+		read += len_read;
+		if (!len && !len_read) {
+			expect(test, "stream stops short", false);
+			return;
+		}
+	}
+	expect(test, "stream differs", sent == STREAM_SIZE && read == STREAM_SIZE
+			&& !memcmp(received, stream, STREAM_SIZE));
+	expect(test, "bytes left in the class", !udi_cdc_is_rx_ready());
+}
+
+int main(void)
+{
+	static const char *const mode_names[] = {"udi_cdc_getc", "udi_cdc_get_rx_buffer"};
+
+	srand(1);
+	for (uint32_t i = 0; i < STREAM_SIZE; ++i) {
+		stream[i] = rand();
+	}
+	expect("enable", "comm interface refused", udi_api_cdc_comm.enable());
+	expect("enable", "data interface refused", udi_api_cdc_data.enable());
+	expect("enable", "no transfer armed on the data OUT endpoint", out_callback != NULL);
+
+	for (int mode = READ_GETC; mode <= READ_BUFFER; ++mode) {
+		char test[48];
+		double start, s;
+		uint64_t start_cycles, bench_cycles;
+
+		snprintf(test, sizeof(test), "%s, full banks", mode_names[mode]);
+		transfer(test, mode, BANK_SIZE, false);
+		snprintf(test, sizeof(test), "%s, fragments", mode_names[mode]);
+		for (int round = 0; round < FRAGMENT_ROUNDS; ++round) {
+			transfer(test, mode, BANK_SIZE, true);
+		}
+
+		snprintf(test, sizeof(test), "%s, benchmark", mode_names[mode]);
+		start = seconds();
+		start_cycles = cycles();
+		for (int round = 0; round < BENCH_ROUNDS; ++round) {
+			transfer(test, mode, BANK_SIZE, false);
+		}
+		bench_cycles = cycles() - start_cycles;
+		s = seconds() - start;
+		printf("cdc_rx_test (%s): %.2f ns per byte", mode_names[mode],
+				s / BENCH_ROUNDS / STREAM_SIZE * 1e9);
+		if (HAS_TSC) {
+			printf(", %.2f cycles per byte", (double)bench_cycles / BENCH_ROUNDS / STREAM_SIZE);
+		}
+		printf("\n");
+	}
+
+	udi_api_cdc_data.disable();
+	udi_api_cdc_comm.disable();
+	printf("cdc_rx_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
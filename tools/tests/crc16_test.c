@@ -0,0 +1,106 @@
+/*
+ * crc16_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test of comm/crc16.c against the CRC-16/XMODEM check values and the
+ * bitwise loop it replaced, followed by a throughput comparison of the two.
+ * The Makefile builds it once for each CRC16_TABLE_BITS.
+ *
+ * Build:  make -C tools/tests crc16_test crc16_nibble_test
+ * Usage:  crc16_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "crc16.h"
+
+#define BENCH_SIZE			(1024 * 1024)
+#define BENCH_ROUNDS		20
+
+// Keeps the benchmark loops
+static volatile uint16_t sink;
+
+static const struct {
+	const char *data;
+	uint16_t crc;
+} check_values[] = {
+	{"", 0x0000},
+	{"A", 0x58E5},
+	{"123456789", 0x31C3},
+	{"The quick brown fox jumps over the lazy dog", 0xF0C8},
+};
+
+// The loop xmodem.c used before the table, one bit at a time
+static uint16_t crc16_bitwise(uint16_t crc, const uint8_t *data, uint32_t len)
+{
+	while (len--) {
+		crc ^= *data++ << 8;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+static double seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+	static uint8_t data[BENCH_SIZE];
+	unsigned failures = 0;
+	double start, bitwise_s, table_s;
+
+	for (size_t i = 0; i < sizeof(check_values) / sizeof(check_values[0]); ++i) {
+		uint16_t crc = crc16_update(CRC16_INIT, (const uint8_t *) check_values[i].data,
+				strlen(check_values[i].data));
+		if (crc != check_values[i].crc) {
+			printf("\"%s\": 0x%04X instead of 0x%04X\n", check_values[i].data, crc, check_values[i].crc);
+			failures++;
+		}
+	}
+
+	srand(1);
+	for (size_t i = 0; i < sizeof(data); ++i) {
+		data[i] = rand();
+	}
+	for (int it = 0; it < 1000; ++it) {
+		// Random length, passed in two pieces
+		uint32_t len = rand() % 2048;
+		uint32_t split = len ? rand() % len : 0;
+		const uint8_t *p = &data[rand() % (sizeof(data) - len)];
+		uint16_t crc = crc16_update(CRC16_INIT, p, split);
+
+		crc = crc16_update(crc, &p[split], len - split);
+		if (crc != crc16_bitwise(CRC16_INIT, p, len)) {
+			printf("%u bytes split at %u: 0x%04X instead of 0x%04X\n", len, split, crc,
+					crc16_bitwise(CRC16_INIT, p, len));
+			failures++;
+		}
+	}
+
+	start = seconds();
+	for (int round = 0; round < BENCH_ROUNDS; ++round) {
+		sink = crc16_bitwise(CRC16_INIT, data, sizeof(data));
+	}
+	bitwise_s = seconds() - start;
+	start = seconds();
+	for (int round = 0; round < BENCH_ROUNDS; ++round) {
+		sink = crc16_update(CRC16_INIT, data, sizeof(data));
+	}
+	table_s = seconds() - start;
+
+	printf("crc16_test (%d-bit table): bitwise %.0f MB/s, table %.0f MB/s\n", CRC16_TABLE_BITS,
+			BENCH_ROUNDS * sizeof(data) / bitwise_s / 1e6, BENCH_ROUNDS * sizeof(data) / table_s / 1e6);
+	printf("crc16_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
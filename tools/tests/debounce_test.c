@@ -0,0 +1,226 @@
+/*
+ * debounce_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test of the debounce modes (ui/debounce.c) on bounce traces, one
+ * sample of every key per scan. The traces are made from a model of the
+ * switches: each edge bounces for up to BOUNCE_MAX_SCANS, and the noisy set
+ * also glitches for a sample or two while a key is held. For each mode the
+ * test reports the latency added to the edges and the rate of false events,
+ * debounced edges that are not in the trace.
+ *
+ * With a debounce time above the bounce, no mode may add a false event on the
+ * bouncing edges or miss one. The eager mode reports each edge on its first
+ * sample. The deferred and integrator modes must also filter the glitches,
+ * and add no more than their debounce time after the bounce. The eager mode
+ * reports the glitches, its results on the noisy set are only printed.
+ *
+ * Build:  make -C tools/tests debounce_test
+ * Usage:  debounce_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "conf_keyboard.h"
+#include "key_layout.h"
+#include "debounce.h"
+
+#define TRACE_SCANS			100000
+#define EDGE_MAX			(TRACE_SCANS / HOLD_MIN_SCANS + 1)
+// A key stays up or down this long after its bounce, in scans
+#define HOLD_MIN_SCANS		20
+#define HOLD_MAX_SCANS		200
+#define BOUNCE_MAX_SCANS	4
+// Glitches of the noisy traces: one in GLITCH_ODDS held scans, away from the edges
+#define GLITCH_ODDS			50
+#define GLITCH_MAX_SCANS	2
+#define GLITCH_MARGIN_SCANS	10
+// Samples the integrator takes to accept a change
+#define INTEGRATOR_SCANS	4
+
+typedef struct {
+	uint32_t scan;
+	bool b_down;
+} edge_t;
+
+typedef struct {
+	debounce_mode_t mode;
+	const char *name;
+	//! Samples after the bounce the mode may take to report an edge
+	uint32_t latency_max_scans;
+	bool b_filters_glitches;
+} mode_test_t;
+
+static const mode_test_t modes[] = {
+	{DEBOUNCE_MODE_EAGER, "eager", 0, false},
+	{DEBOUNCE_MODE_DEFER, "deferred", KEYBOARD_DEBOUNCE_SCANS, true},
+	{DEBOUNCE_MODE_INTEGRATOR, "integrator", INTEGRATOR_SCANS, true},
+	{DEBOUNCE_MODE_NONE, "none", 0, false},
+};
+
+// Raw samples, bit n for key n, and the edges of each key with the scan their bounce starts
+static uint32_t samples[TRACE_SCANS];
+static edge_t edges[KEY_COUNT][EDGE_MAX];
+static unsigned edge_counts[KEY_COUNT];
+static edge_t debounced[KEY_COUNT][TRACE_SCANS / 2];
+static unsigned debounced_counts[KEY_COUNT];
+
+static unsigned failures;
+
+static void expect(const char *test, const char *what, bool b_ok)
+{
+	if (!b_ok) {
+		printf("%s: %s\n", test, what);
+		failures++;
+	}
+}
+
+static void set_sample(uint32_t scan, uint8_t key, bool b_down)
+{
+	if (b_down) {
+		samples[scan] |= 1u << key;
+	} else {
+		samples[scan] &= ~(1u << key);
+	}
+}
+
+// Holds and bouncing edges of every key, with glitches while held if b_noisy
+static void make_traces(bool b_noisy)
+{
+	memset(samples, 0, sizeof(samples));
+	for (uint8_t key = 0; key < KEY_COUNT; ++key) {
+		uint32_t scan = 0;
+		bool b_down = false;
+
+		edge_counts[key] = 0;
+		while (true) {
+			uint32_t hold = HOLD_MIN_SCANS + rand() % (HOLD_MAX_SCANS - HOLD_MIN_SCANS);
+			uint32_t bounce = rand() % (BOUNCE_MAX_SCANS + 1);
+
+			for (uint32_t i = 0; i < hold && scan + i < TRACE_SCANS; ++i) {
+				set_sample(scan + i, key, b_down);
+			}
+			// Glitches away from the edges, with a sample held between two of them
+			for (uint32_t i = GLITCH_MARGIN_SCANS; b_noisy && i + GLITCH_MARGIN_SCANS < hold; ++i) {
+				if (rand() % GLITCH_ODDS == 0 && scan + i + GLITCH_MAX_SCANS < TRACE_SCANS) {
+					for (uint32_t n = 1 + rand() % GLITCH_MAX_SCANS; n; --n, ++i) {
+						set_sample(scan + i, key, !b_down);
+					}
+				}
+			}
+			scan = scan + hold < TRACE_SCANS ? scan + hold : TRACE_SCANS;
+			if (scan + bounce + HOLD_MIN_SCANS >= TRACE_SCANS) {
+				break;
+			}
+			// The contact closes or opens on the first sample, then chatters
+			b_down = !b_down;
+			edges[key][edge_counts[key]++] = (edge_t){scan, b_down};
+			for (uint32_t i = 0; i < bounce; ++i, ++scan) {
+				set_sample(scan, key, i == 0 ? b_down : rand() & 1);
+			}
+		}
+		for (; scan < TRACE_SCANS; ++scan) {
+			set_sample(scan, key, b_down);
+		}
+	}
+}
+
+// Feeds the traces to the mode and records the debounced edges
+static void run(debounce_mode_t mode)
+{
+	uint32_t state = 0;
+
+	debounce_init(mode, KEYBOARD_DEBOUNCE_SCANS);
+	memset(debounced_counts, 0, sizeof(debounced_counts));
+	for (uint32_t scan = 0; scan < TRACE_SCANS; ++scan) {
+		uint32_t next = debounce_update(samples[scan], (1u << KEY_COUNT) - 1);
+		uint32_t changed = state ^ next;
+
+		state = next;
+		while (changed) {
+			uint8_t key = __builtin_ctz(changed);
+
+			changed &= changed - 1;
+			debounced[key][debounced_counts[key]++] = (edge_t){scan, (state >> key) & 1};
+		}
+	}
+}
+
+// Matches the debounced edges with the edges of the trace, between two edges of the trace
+static void check(const mode_test_t *test, const char *traces, bool b_noisy)
+{
+	char name[40];
+	unsigned total_edges = 0, missed = 0, false_events = 0;
+	uint64_t latency_total = 0;
+	uint32_t latency_max = 0;
+
+	snprintf(name, sizeof(name), "%s, %s", test->name, traces);
+	for (uint8_t key = 0; key < KEY_COUNT; ++key) {
+		unsigned d = 0;
+
+		// Before the first edge of the trace
+		while (d < debounced_counts[key]
+				&& (edge_counts[key] == 0 || debounced[key][d].scan < edges[key][0].scan)) {
+			false_events++;
+			d++;
+		}
+		for (unsigned e = 0; e < edge_counts[key]; ++e) {
+			uint32_t end = e + 1 < edge_counts[key] ? edges[key][e + 1].scan : TRACE_SCANS;
+			unsigned first = d;
+
+			while (d < debounced_counts[key] && debounced[key][d].scan < end) {
+				d++;
+			}
+			if (first == d || debounced[key][first].b_down != edges[key][e].b_down) {
+				missed++;
+				false_events += d - first;
+				continue;
+			}
+			false_events += d - first - 1;
+			latency_total += debounced[key][first].scan - edges[key][e].scan;
+			if (debounced[key][first].scan - edges[key][e].scan > latency_max) {
+				latency_max = debounced[key][first].scan - edges[key][e].scan;
+			}
+		}
+		total_edges += edge_counts[key];
+	}
+	printf("debounce_test (%s): %u edges, latency %.2f scans mean, %lu max, %.2f%% false events, %u missed\n",
+			name, total_edges, (double)latency_total / (total_edges - missed), (unsigned long)latency_max,
+			100.0 * false_events / total_edges, missed);
+
+	if (test->mode == DEBOUNCE_MODE_NONE) {
+		// The reference: the bounce comes through
+		expect(name, "bounce filtered without debounce", false_events > 0);
+		return;
+	}
+	// A mode that reports the glitches is only measured on them
+	if (b_noisy && !test->b_filters_glitches) {
+		return;
+	}
+	expect(name, "false events", false_events == 0);
+	expect(name, "edges missed", missed == 0);
+	expect(name, "latency", latency_max <= (test->mode == DEBOUNCE_MODE_EAGER ? 0 : BOUNCE_MAX_SCANS)
+			+ test->latency_max_scans);
+}
+
+int main(void)
+{
+	srand(1);
+	make_traces(false);
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+		run(modes[i].mode);
+		check(&modes[i], "bouncing", false);
+	}
+
+	make_traces(true);
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+		run(modes[i].mode);
+		check(&modes[i], "noisy", true);
+	}
+
+	printf("debounce_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
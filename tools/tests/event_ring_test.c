@@ -0,0 +1,107 @@
+/*
+ * event_ring_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Stress test of the key event ring (FIFO/event_ring.c) with the producer and
+ * the consumer on two threads, like the scan interrupt and the report task.
+ * The producer pushes numbered events, packed with KEY_EVENT_PACK(), and
+ * retries the ones refused while the ring is full. The consumer takes them
+ * with event_ring_pop(), or with event_ring_peek() then event_ring_drop(),
+ * and each must come out once and in order. The indexes start just below
+ * their wrap around, and the ring sizes go down to 2.
+ *
+ * Build:  make -C tools/tests event_ring_test
+ * Usage:  event_ring_test
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include "event_ring.h"
+
+#define EVENTS				500000
+#define RING_SIZE_MAX		512
+// Indexes this far below their wrap around at the start
+#define WRAP_MARGIN			(EVENTS / 2)
+
+static event_ring_t ring;
+static uint32_t buffer[RING_SIZE_MAX];
+static unsigned failures;
+
+// Event number n: key n % 128, edge and timestamp from the rest
+static uint32_t event_of(uint32_t n)
+{
+	return KEY_EVENT_PACK(n & 0x7F, (n >> 7) & 1, n >> 8);
+}
+
+static void *produce(void *arg)
+{
+	(void)arg;
+	for (uint32_t n = 0; n < EVENTS; ++n) {
+		while (!event_ring_push(&ring, event_of(n))) {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void *consume(void *arg)
+{
+	uint32_t errors = 0;
+
+	(void)arg;
+	for (uint32_t n = 0; n < EVENTS; ++n) {
+		uint32_t event;
+
+		// Both ways of taking an event, in turn
+		if (n & 1) {
+			while (!event_ring_pop(&ring, &event)) {
+				sched_yield();
+			}
+		} else {
+			while (!event_ring_peek(&ring, &event)) {
+				sched_yield();
+			}
+			event_ring_drop(&ring);
+		}
+		if (event != event_of(n) || KEY_EVENT_KEY(event) != (n & 0x7F)
+				|| KEY_EVENT_IS_DOWN(event) != ((n >> 7) & 1) || KEY_EVENT_TIME_US(event) != (n >> 8)) {
+			if (errors++ < 10) {
+				printf("event %lu: 0x%08lX\n", (unsigned long)n, (unsigned long)event);
+			}
+		}
+	}
+	return (void *)(uintptr_t)errors;
+}
+
+static void test_size(uint32_t size)
+{
+	pthread_t producer, consumer;
+	void *errors;
+
+	event_ring_init(&ring, buffer, size);
+	ring.head = ring.tail = (uint32_t)-WRAP_MARGIN;
+	pthread_create(&consumer, NULL, consume, NULL);
+	pthread_create(&producer, NULL, produce, NULL);
+	pthread_join(producer, NULL);
+	pthread_join(consumer, &errors);
+
+	printf("event_ring_test (ring of %lu): %lu pushes refused while full\n", (unsigned long)size,
+			(unsigned long)ring.dropped);
+	if ((uintptr_t)errors || !event_ring_is_empty(&ring) || event_ring_get_used_size(&ring) != 0) {
+		printf("event_ring_test (ring of %lu): %lu events out of order, ring %s\n", (unsigned long)size,
+				(unsigned long)(uintptr_t)errors, event_ring_is_empty(&ring) ? "empty" : "not empty");
+		failures++;
+	}
+}
+
+int main(void)
+{
+	for (uint32_t size = 2; size <= RING_SIZE_MAX; size *= 16) {
+		test_size(size);
+	}
+	printf("event_ring_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,316 @@
+/*
+ * icon_rle_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Benchmark of the run-length icon sections on a corpus of sample icons. The
+ * icons are compiled by kbd_profile, which sends the runs when they are
+ * smaller than the pixels, and decoded by the firmware profile parser
+ * (comm/profile_parser.c). Each row decoded must be the source icon with the
+ * threshold of the panel applied.
+ *
+ * The bytes of each icon section are printed against the raw section, with
+ * the ratio for the whole profile. The decode time of the profile, per pixel
+ * in nanoseconds and, on x86, in time stamp counter cycles, is printed next to
+ * the same icons sent as raw sections.
+ *
+ * Build:  make -C tools/tests icon_rle_test
+ * Usage:  icon_rle_test [kbd_profile]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#  define HAS_TSC			1
+#else
+#  define HAS_TSC			0
+#endif
+#include "comm.h"
+#include "key_layout.h"
+#include "profile_parser.h"
+
+#define ICON_DIM			KEY_ICON_MAX_DIM
+#define ICON_SIZE			(ICON_DIM * ICON_DIM)
+#define PROFILE_MAX_SIZE	(KEY_COUNT * (6 + ICON_SIZE))
+#define BENCH_ROUNDS		2000
+
+#define LAYOUT_PATH			"icon_rle_test.txt"
+#define PROFILE_PATH		"icon_rle_test.bin"
+#define ICON_PATH			"icon_rle_test_%u.pgm"
+
+// One icon per key
+static const char *const icon_names[KEY_COUNT] = {
+	"ring", "disc", "square outline", "diagonal stripes", "cross", "arrow",
+	"text lines", "checkerboard", "anti-aliased disc", "blank", "vertical hairlines", "dithered photo",
+};
+
+static uint8_t icons[KEY_COUNT][ICON_SIZE];
+
+// What the parser decoded
+static uint8_t decoded[KEY_COUNT][ICON_SIZE];
+static unsigned decoded_rows;
+
+static uint8_t profile[PROFILE_MAX_SIZE];
+static size_t profile_len;
+static uint8_t raw_profile[PROFILE_MAX_SIZE];
+static size_t raw_profile_len;
+
+static unsigned failures;
+
+static void expect(const char *test, const char *what, bool b_ok)
+{
+	if (!b_ok) {
+		printf("%s: %s\n", test, what);
+		failures++;
+	}
+}
+
+static double seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t cycles(void)
+{
+#if HAS_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// Grayscale pixel of a sample icon, 0 is black
+static uint8_t draw(unsigned icon, int x, int y)
+{
+	int dx = x - ICON_DIM / 2, dy = y - ICON_DIM / 2;
+	double r = sqrt(dx * dx + dy * dy);
+
+	switch (icon) {
+	case 0:
+		return (r >= 17 && r < 21) ? 0x00 : 0xFF;
+	case 1:
+		return r < 20 ? 0x00 : 0xFF;
+	case 2:
+		return (x >= 5 && x < 45 && y >= 5 && y < 45 && (x < 8 || x >= 42 || y < 8 || y >= 42)) ? 0x00 : 0xFF;
+	case 3:
+		return ((x + y) % 10 < 2) ? 0x00 : 0xFF;
+	case 4:
+		return (abs(dx) < 3 || abs(dy) < 3) && r < 22 ? 0x00 : 0xFF;
+	case 5:
+		// Pointing right: a triangle on a shaft
+		return (x >= 25 && x < 45 && abs(dy) < 45 - x) || (x >= 5 && x < 25 && abs(dy) < 4) ? 0x00 : 0xFF;
+	case 6:
+		// Words on lines 7 pixels apart
+		return (y % 7 < 3 && y >= 4 && y < 46 && x >= 3 && x < 3 + (y * 37) % 44 && (x * 7 + y) % 11 != 0)
+				? 0x00 : 0xFF;
+	case 7:
+		return ((x / 5) + (y / 5)) % 2 ? 0x00 : 0xFF;
+	case 8:
+		// Gray edge, three pixels wide, on both sides of the threshold
+		return r < 18 ? 0x00 : r >= 21 ? 0xFF : (uint8_t)((r - 18) / 3 * 0xFF);
+	case 9:
+		return 0xFF;
+	case 10:
+		return x % 2 ? 0x00 : 0xFF;
+	default:
+		return rand() % 2 ? 0x00 : 0xFF;
+	}
+}
+
+static uint8_t threshold(uint8_t pixel)
+{
+	return pixel > KEY_ICON_THRES_BLACK ? FILE_RLE_WHITE : FILE_RLE_BLACK;
+}
+
+// Writes the icons and the layout, and compiles them into profile
+static void compile(const char *compiler)
+{
+	char path[32], command[512];
+	FILE *layout = fopen(LAYOUT_PATH, "w");
+	FILE *f;
+
+	if (!layout) {
+		perror(LAYOUT_PATH);
+		exit(1);
+	}
+	for (unsigned key = 0; key < KEY_COUNT; ++key) {
+		snprintf(path, sizeof(path), ICON_PATH, key);
+		f = fopen(path, "wb");
+		if (!f) {
+			perror(path);
+			exit(1);
+		}
+		fprintf(f, "P5\n%u %u\n255\n", ICON_DIM, ICON_DIM);
+		fwrite(icons[key], 1, ICON_SIZE, f);
+		fclose(f);
+		fprintf(layout, "key %u 0x%02X icon %s\n", key, 0x04 + key, path);
+	}
+	fclose(layout);
+
+	snprintf(command, sizeof(command), "%s compile %s %s >/dev/null 2>&1", compiler, LAYOUT_PATH, PROFILE_PATH);
+	if (system(command) != 0 || (f = fopen(PROFILE_PATH, "rb")) == NULL) {
+		printf("%s: layout not compiled\n", compiler);
+		exit(1);
+	}
+	profile_len = fread(profile, 1, sizeof(profile), f);
+	fclose(f);
+
+	remove(LAYOUT_PATH);
+	remove(PROFILE_PATH);
+	for (unsigned key = 0; key < KEY_COUNT; ++key) {
+		snprintf(path, sizeof(path), ICON_PATH, key);
+		remove(path);
+	}
+}
+
+// The same icons as raw sections, thresholded as the runs are
+static void make_raw_profile(void)
+{
+	for (unsigned key = 0; key < KEY_COUNT; ++key) {
+		uint8_t *section = &raw_profile[raw_profile_len];
+
+		section[0] = FILE_SECTION_IDENTIFIER >> 8;
+		section[1] = FILE_SECTION_IDENTIFIER & 0xFF;
+		section[2] = key;
+		section[3] = 0x04 + key;
+		section[4] = ICON_DIM;
+		section[5] = ICON_DIM;
+		for (unsigned i = 0; i < ICON_SIZE; ++i) {
+			section[6 + i] = threshold(icons[key][i]);
+		}
+		raw_profile_len += 6 + ICON_SIZE;
+	}
+}
+
+// Prints the size of each icon section of the compiled profile
+static void print_sections(void)
+{
+	size_t pos = 0;
+
+	for (unsigned key = 0; key < KEY_COUNT; ++key) {
+		uint16_t identifier;
+		size_t size = 0, pixels = 0;
+
+		if (pos + 6 > profile_len) {
+			expect("profile", "sections missing", false);
+			return;
+		}
+		identifier = (profile[pos] << 8) | profile[pos + 1];
+		if (identifier == FILE_RLE_SECTION_IDENTIFIER) {
+			while (pixels < ICON_SIZE && pos + 6 + size < profile_len) {
+				pixels += profile[pos + 6 + size++];
+			}
+		} else {
+			size = ICON_SIZE;
+		}
+		expect(icon_names[key], "section of another key", profile[pos + 2] == key);
+		printf("icon_rle_test (%s): %u -> %zu bytes, %.1fx%s\n", icon_names[key], 6 + ICON_SIZE, 6 + size,
+				(6.0 + ICON_SIZE) / (6 + size), identifier == FILE_RLE_SECTION_IDENTIFIER ? "" : " (raw)");
+		pos += 6 + size;
+	}
+	printf("icon_rle_test (profile): %zu -> %zu bytes, %.1fx\n", raw_profile_len, profile_len,
+			(double)raw_profile_len / profile_len);
+}
+
+static void key_received(uint8_t key_id, uint8_t scancode, uint8_t width, uint8_t height)
+{
+	(void)key_id;
+	(void)scancode;
+	(void)width;
+	(void)height;
+}
+
+static void icon_row_received(uint8_t key_id, uint8_t width, uint8_t height, uint8_t row,
+		const uint8_t *pixels)
+{
+	(void)height;
+	if (key_id < KEY_COUNT && width == ICON_DIM && row < ICON_DIM) {
+		memcpy(&decoded[key_id][row * ICON_DIM], pixels, ICON_DIM);
+	}
+	decoded_rows++;
+}
+
+static void macro_received(uint8_t key_id, const uint8_t *code, uint16_t len)
+{
+	(void)key_id;
+	(void)code;
+	(void)len;
+}
+
+static const profile_parser_callbacks_t callbacks = {
+	.key = key_received,
+	.icon_row = icon_row_received,
+	.macro = macro_received,
+};
+
+// Parses data as one fragment, rounds times, returns the seconds taken
+static double decode(const char *test, const uint8_t *data, size_t len, int rounds, uint64_t *cycles_taken)
+{
+	static uint8_t pool[COMM_MACRO_POOL_SIZE];
+	profile_parser_t parser;
+	uint64_t start_cycles = cycles();
+	double start = seconds(), elapsed_s;
+
+	for (int round = 0; round < rounds; ++round) {
+		decoded_rows = 0;
+		profile_parser_init(&parser, &callbacks, pool, sizeof(pool));
+		profile_parser_feed(&parser, data, len);
+	}
+	*cycles_taken = cycles() - start_cycles;
+	elapsed_s = seconds() - start;
+
+	expect(test, "profile not complete", profile_parser_is_complete(&parser));
+	expect(test, "rows missing", decoded_rows == KEY_COUNT * ICON_DIM);
+	for (unsigned key = 0; key < KEY_COUNT; ++key) {
+		bool b_match = true;
+
+		for (unsigned i = 0; i < ICON_SIZE; ++i) {
+			b_match &= decoded[key][i] == threshold(icons[key][i]);
+		}
+		expect(icon_names[key], "icon decoded differs from the source", b_match);
+	}
+	return elapsed_s;
+}
+
+int main(int argc, char **argv)
+{
+	const char *compiler = argc > 1 ? argv[1] : "./kbd_profile";
+	static const char *const tests[] = {"run-length sections", "raw sections"};
+	const uint8_t *const data[] = {profile, raw_profile};
+	const size_t *const lens[] = {&profile_len, &raw_profile_len};
+
+	srand(1);
+	for (unsigned key = 0; key < KEY_COUNT; ++key) {
+		for (int y = 0; y < ICON_DIM; ++y) {
+			for (int x = 0; x < ICON_DIM; ++x) {
+				icons[key][y * ICON_DIM + x] = draw(key, x, y);
+			}
+		}
+	}
+	compile(compiler);
+	make_raw_profile();
+	print_sections();
+
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+		uint64_t cycles_taken;
+		double s = decode(tests[i], data[i], *lens[i], BENCH_ROUNDS, &cycles_taken);
+
+		printf("icon_rle_test (decode, %s): %.2f ns per pixel", tests[i],
+				s / BENCH_ROUNDS / (KEY_COUNT * ICON_SIZE) * 1e9);
+		if (HAS_TSC) {
+			printf(", %.2f cycles per pixel", (double)cycles_taken / BENCH_ROUNDS / (KEY_COUNT * ICON_SIZE));
+		}
+		printf("\n");
+	}
+
+	printf("icon_rle_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
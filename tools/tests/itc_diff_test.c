@@ -0,0 +1,177 @@
+/*
+ * itc_diff_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test and benchmark of the check the display driver (Display/iTC.c)
+ * runs before a refresh, on the simulated hardware of itc_sim.c. With
+ * CONF_ITC_SHADOW_BUFFER the image buffer is diffed word per word against the
+ * frame last sent. The Makefile also builds it with ITC_TEST_ROW_HASH, for
+ * the builds short of RAM that hash the drawn rows instead.
+ *
+ * A refresh that would not change the screen is skipped without a byte on the
+ * bus, and a key icon partly drawn again only sends the rows that changed. The
+ * time of the check on the 15000-byte image buffer is then printed, for
+ * nothing drawn and for the whole screen drawn again unchanged.
+ *
+ * Build:  make -C tools/tests itc_diff_test itc_row_hash_test
+ * Usage:  itc_diff_test
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "itc_sim.h"
+#include "key_layout.h"
+
+#define BENCH_ROUNDS		2000
+// Time the rest of the main loop takes between two itc_refresh_process()
+#define LOOP_US				100
+// Icon of the key at row 1, column 1 in ui.c
+#define KEY_X0				152
+#define KEY_Y0				142
+#define KEY_X1				(KEY_X0 + KEY_ICON_MAX_DIM - 1)
+#define KEY_Y1				(KEY_Y0 + KEY_ICON_MAX_DIM - 1)
+#define KEY_Y_HALF			(KEY_Y0 + KEY_ICON_MAX_DIM / 2)
+
+#if defined(ITC_TEST_ROW_HASH)
+#  define TEST_NAME			"itc_diff_test (row hash)"
+#else
+#  define TEST_NAME			"itc_diff_test (shadow buffer)"
+#endif
+
+static unsigned failures;
+static unsigned done_calls;
+
+static void expect(const char *test, const char *what, bool b_ok)
+{
+	if (!b_ok) {
+		printf("%s: %s\n", test, what);
+		failures++;
+	}
+}
+
+static void refresh_done(void)
+{
+	done_calls++;
+}
+
+static double seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void draw(itc_coord_t x0, itc_coord_t y0, itc_coord_t x1, itc_coord_t y1, itc_color_t color)
+{
+	itc_set_limits(x0, y0, x1, y1);
+	itc_duplicate_pixel(color, (uint32_t)(x1 - x0 + 1) * (y1 - y0 + 1));
+}
+
+static uint32_t bus_bytes(void)
+{
+	const itc_sim_stats_t *stats = itc_sim_get_stats();
+
+	return stats->command_bytes + stats->param_bytes + stats->black_bytes + stats->red_bytes;
+}
+
+// Runs a refresh from the main loop to the end, returns the bytes it sent
+static uint32_t refresh(const char *test)
+{
+	uint32_t bytes = bus_bytes();
+
+	done_calls = 0;
+	itc_refresh_screen_async(refresh_done);
+	while (itc_refresh_in_progress()) {
+		itc_refresh_process();
+		itc_sim_run(LOOP_US);
+	}
+	expect(test, "not done", done_calls == 1);
+	expect(test, "screen differs", !memcmp(itc_sim_get_screen(), image_data_buffer, ITC_SCREEN_BUFFER_SIZE));
+	expect(test, "protocol errors", itc_sim_get_stats()->errors == 0);
+	return bus_bytes() - bytes;
+}
+
+// A refresh that would not change the screen is skipped, and done called at once
+static void expect_skipped(const char *test)
+{
+	const itc_refresh_stats_t *stats = itc_get_refresh_stats();
+	uint32_t skipped = stats->skipped;
+	uint32_t bytes = bus_bytes();
+
+	done_calls = 0;
+	itc_refresh_screen_async(refresh_done);
+	expect(test, "not skipped", !itc_refresh_in_progress() && stats->skipped == skipped + 1);
+	expect(test, "bytes sent", bus_bytes() == bytes);
+	expect(test, "done not called", done_calls == 1);
+	// Not stuck in progress, a test failing above must not hold the next ones
+	refresh(test);
+}
+
+static void test_skip(void)
+{
+	const itc_sim_stats_t *stats = itc_sim_get_stats();
+	uint32_t black_bytes;
+
+	draw(0, 0, 399, 299, ITC_WHITE);
+	refresh("first refresh");
+	expect_skipped("nothing drawn");
+
+	draw(0, 0, 399, 299, ITC_WHITE);
+	expect_skipped("screen drawn again");
+
+	draw(KEY_X0, KEY_Y0, KEY_X1, KEY_Y1, ITC_BLACK);
+	refresh("key drawn");
+	draw(KEY_X0, KEY_Y0, KEY_X1, KEY_Y1, ITC_BLACK);
+	expect_skipped("key drawn again");
+
+	// The top half of the icon stays the same
+	draw(KEY_X0, KEY_Y0, KEY_X1, KEY_Y_HALF - 1, ITC_BLACK);
+	draw(KEY_X0, KEY_Y_HALF, KEY_X1, KEY_Y1, ITC_WHITE);
+	black_bytes = stats->black_bytes;
+	refresh("half key changed");
+	expect("half key changed", "unchanged rows sent",
+			stats->black_bytes - black_bytes == (KEY_X1 / 8 - KEY_X0 / 8 + 1) * (KEY_Y1 - KEY_Y_HALF + 1));
+}
+
+// Time of the check before a refresh that is then skipped, in us
+static double bench_check(bool b_draw)
+{
+	double check_s = 0;
+
+	for (int round = 0; round < BENCH_ROUNDS; ++round) {
+		double start;
+
+		if (b_draw) {
+			draw(0, 0, 399, 299, ITC_WHITE);
+		}
+		start = seconds();
+		itc_refresh_screen_async(NULL);
+		check_s += seconds() - start;
+	}
+	expect("benchmark", "not skipped", !itc_refresh_in_progress());
+	return check_s / BENCH_ROUNDS * 1e6;
+}
+
+int main(void)
+{
+	double nothing_us, drawn_us;
+
+	itc_sim_reset();
+	itc_init();
+
+	test_skip();
+
+	// The screen as the benchmark draws it again
+	draw(0, 0, 399, 299, ITC_WHITE);
+	refresh("benchmark");
+	nothing_us = bench_check(false);
+	drawn_us = bench_check(true);
+	printf("%s: check of the %u-byte frame, nothing drawn %.2f us, screen drawn again %.2f us\n",
+			TEST_NAME, ITC_SCREEN_BUFFER_SIZE, nothing_us, drawn_us);
+	printf("%s: %u failures\n", TEST_NAME, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,539 @@
+/*
+ * itc_sim.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Simulated display hardware, see itc_sim.h.
+ *
+ * The PDC addresses are 32 bits like on the target: the tests using it are
+ * linked without PIE, so the buffers of the driver have 32-bit addresses.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "delay.h"
+#include "gpio.h"
+#include "pdc.h"
+#include "spi_master.h"
+#include "iTC_regs.h"
+#include "itc_sim.h"
+
+#define PIN_COUNT			64
+#define ROW_BYTES			(ITC_DEFAULT_WIDTH / 8)
+// Frame memory of the controller after a power loss
+#define RAM_LOST			0x55
+#define PARAM_MAX			16
+#define ERRORS_PRINTED		10
+// Records of the byte stream: a command or data byte, and the controller deselected
+#define RECORD_COMMAND		'C'
+#define RECORD_DATA			'D'
+#define RECORD_DESELECT		'S'
+
+struct spi_sim {
+	uint32_t imr;
+};
+
+struct pdc_sim {
+	const uint8_t *tpr;
+	uint32_t tcr;
+	const uint8_t *tnpr;
+	uint32_t tncr;
+	bool b_enabled;
+	//! Set when TCR reaches 0, cleared by writing TCR or TNCR
+	bool b_endtx;
+};
+
+Spi spi_sim;
+static Pdc pdc_sim;
+
+static uint64_t sim_us;
+static bool pins[PIN_COUNT];
+// End of the byte on the bus
+static uint64_t shift_end_us;
+static bool b_in_handler;
+
+// Controller: powered and out of reset, and its frame memory
+static bool b_ready;
+static uint8_t ram[ITC_SCREEN_BUFFER_SIZE];
+static uint8_t screen[ITC_SCREEN_BUFFER_SIZE];
+static uint8_t command;
+static uint8_t params[PARAM_MAX];
+static uint32_t param_count;
+static uint32_t data_pos;
+static bool b_partial;
+static uint16_t window_x0, window_x1, window_y0, window_y1;
+static uint64_t busy_end_us;
+static bool b_busy_held;
+// The next busy period lasts until released
+static bool b_busy_hold_next;
+// A busy period ended and no command came yet
+static bool b_busy_latency;
+
+static itc_sim_stats_t stats;
+static FILE *record;
+
+static void record_write(uint8_t type, uint8_t value)
+{
+	if (record) {
+		fputc(type, record);
+		fputc(value, record);
+	}
+}
+
+static void sim_error(const char *what)
+{
+	if (stats.errors++ < ERRORS_PRINTED) {
+		printf("display: %s at %llu us\n", what, (unsigned long long)sim_us);
+	}
+}
+
+static bool is_busy(void)
+{
+	return b_busy_held || sim_us < busy_end_us;
+}
+
+static void start_busy(uint32_t ms)
+{
+	busy_end_us = sim_us + 1000ULL * ms;
+	b_busy_latency = true;
+	if (b_busy_hold_next) {
+		b_busy_hold_next = false;
+		b_busy_held = true;
+	}
+}
+
+static void set_full_window(void)
+{
+	window_x0 = 0;
+	window_x1 = ITC_DEFAULT_WIDTH - 1;
+	window_y0 = 0;
+	window_y1 = ITC_DEFAULT_HEIGHT - 1;
+}
+
+static void set_partial_window(void)
+{
+	window_x0 = (params[0] << 8) | params[1];
+	window_x1 = (params[2] << 8) | params[3];
+	window_y0 = (params[4] << 8) | params[5];
+	window_y1 = (params[6] << 8) | params[7];
+	if (window_x0 % 8 || window_x1 % 8 != 7 || window_x0 > window_x1 || window_y0 > window_y1
+			|| window_x1 >= ITC_DEFAULT_WIDTH || window_y1 >= ITC_DEFAULT_HEIGHT) {
+		sim_error("bad partial window");
+		set_full_window();
+	}
+}
+
+// Copies the frame memory in the window to the screen
+static void refresh(void)
+{
+	for (uint32_t y = window_y0; y <= window_y1; y++) {
+		memcpy(&screen[y * ROW_BYTES + window_x0 / 8], &ram[y * ROW_BYTES + window_x0 / 8],
+				(window_x1 - window_x0 + 1) / 8);
+	}
+	stats.refreshes++;
+}
+
+static void command_received(uint8_t c)
+{
+	if (is_busy()) {
+		sim_error("command while BUSY is low");
+	} else if (b_busy_latency) {
+		b_busy_latency = false;
+		if (sim_us - busy_end_us > stats.busy_latency_max_us) {
+			stats.busy_latency_max_us = (uint32_t)(sim_us - busy_end_us);
+		}
+	}
+	stats.command_bytes++;
+	command = c;
+	param_count = 0;
+	data_pos = 0;
+	switch (c) {
+	case ITC_CMD_POWER_ON:
+		start_busy(ITC_SIM_POWER_ON_MS);
+		break;
+	case ITC_CMD_REFRESH:
+		if (!b_partial) {
+			set_full_window();
+		}
+		refresh();
+		start_busy(b_partial ? ITC_SIM_PARTIAL_REFRESH_MS : ITC_SIM_REFRESH_MS);
+		break;
+	case ITC_CMD_DC_TOGGLE:
+		start_busy(ITC_SIM_POWER_OFF_MS);
+		break;
+	case ITC_CMD_PARTIAL_IN:
+		b_partial = true;
+		break;
+	case ITC_CMD_PARTIAL_OUT:
+		b_partial = false;
+		break;
+	default:
+		break;
+	}
+}
+
+static void data_received(uint8_t data)
+{
+	uint32_t width, row;
+
+	switch (command) {
+	case ITC_CMD_BLACK_FRAME_DATA:
+	case ITC_CMD_RED_FRAME_DATA:
+		if (!b_partial) {
+			set_full_window();
+		}
+		width = (window_x1 - window_x0 + 1) / 8;
+		row = window_y0 + data_pos / width;
+		if (row > window_y1) {
+			sim_error("frame data past the window");
+		} else if (command == ITC_CMD_BLACK_FRAME_DATA) {
+			ram[row * ROW_BYTES + window_x0 / 8 + data_pos % width] = data;
+		} else if (data) {
+			sim_error("red pixels");
+		}
+		data_pos++;
+		if (command == ITC_CMD_BLACK_FRAME_DATA) {
+			stats.black_bytes++;
+		} else {
+			stats.red_bytes++;
+		}
+		break;
+
+	default:
+		stats.param_bytes++;
+		if (param_count < PARAM_MAX) {
+			params[param_count++] = data;
+		}
+		if (command == ITC_CMD_PARTIAL_WINDOW && param_count == ITC_PARTIAL_WINDOW_SIZE) {
+			set_partial_window();
+		}
+		break;
+	}
+}
+
+// Puts a byte on the bus, the controller takes it if selected
+static void start_byte(uint8_t data)
+{
+	shift_end_us = sim_us + ITC_SIM_BYTE_US;
+	if (pins[DISPLAY_CS]) {
+		return;
+	}
+	if (!b_ready) {
+		sim_error("byte while the controller is off or in reset");
+	} else if (pins[DISPLAY_DC]) {
+		record_write(RECORD_DATA, data);
+		data_received(data);
+	} else {
+		record_write(RECORD_COMMAND, data);
+		command_received(data);
+	}
+}
+
+// The driver has no SPI interrupt without the PDC
+__attribute__((weak)) void SPI_Handler(void)
+{
+	sim_error("SPI interrupt without a handler");
+	spi_sim.imr = 0;
+}
+
+void itc_sim_reset(void)
+{
+	memset(&spi_sim, 0, sizeof(spi_sim));
+	memset(&pdc_sim, 0, sizeof(pdc_sim));
+	memset(&stats, 0, sizeof(stats));
+	memset(pins, 0, sizeof(pins));
+	memset(ram, RAM_LOST, sizeof(ram));
+	memset(screen, 0, sizeof(screen));
+	sim_us = 0;
+	shift_end_us = 0;
+	b_ready = false;
+	b_partial = false;
+	b_busy_held = false;
+	b_busy_hold_next = false;
+	b_busy_latency = false;
+	busy_end_us = 0;
+	command = 0;
+	// Levels set by the board initialization
+	pins[DISPLAY_CS] = true;
+	pins[DISPLAY_DC] = true;
+	pins[DISPLAY_PANEL_ON] = true;
+	pins[DISPLAY_DISCHARGE] = true;
+	if ((uintptr_t)image_data_buffer > UINT32_MAX) {
+		sim_error("buffers above 4 GB, link without PIE");
+	}
+}
+
+void itc_sim_run(uint32_t us)
+{
+	for (uint32_t i = 0; i < us; i++) {
+		sim_us++;
+		if (pdc_sim.b_enabled && pdc_sim.tcr && sim_us >= shift_end_us) {
+			start_byte(*pdc_sim.tpr++);
+			if (--pdc_sim.tcr == 0) {
+				pdc_sim.b_endtx = true;
+				if (pdc_sim.tncr) {
+					pdc_sim.tpr = pdc_sim.tnpr;
+					pdc_sim.tcr = pdc_sim.tncr;
+					pdc_sim.tncr = 0;
+				}
+			}
+		}
+		if (!b_in_handler && (spi_read_status(SPI) & spi_sim.imr)) {
+			b_in_handler = true;
+			SPI_Handler();
+			b_in_handler = false;
+		}
+	}
+}
+
+uint64_t itc_sim_get_time_us(void)
+{
+	return sim_us;
+}
+
+itc_sim_stats_t *itc_sim_get_stats(void)
+{
+	return &stats;
+}
+
+const uint8_t *itc_sim_get_screen(void)
+{
+	return screen;
+}
+
+bool itc_sim_is_panel_on(void)
+{
+	return pins[DISPLAY_PANEL_ON];
+}
+
+bool itc_sim_record(const char *path)
+{
+	if (record) {
+		fclose(record);
+	}
+	record = fopen(path, "wb");
+	return record != NULL;
+}
+
+void itc_sim_hold_busy(void)
+{
+	b_busy_hold_next = true;
+}
+
+void itc_sim_release_busy(void)
+{
+	b_busy_hold_next = false;
+	b_busy_held = false;
+	if (busy_end_us < sim_us) {
+		busy_end_us = sim_us;
+	}
+}
+
+// Reading the clock or BUSY takes a microsecond, so a driver polling them sees the time pass
+uint32_t main_get_time_ms(void)
+{
+	itc_sim_run(1);
+	return (uint32_t)(sim_us / 1000);
+}
+
+void delay_us(uint32_t us)
+{
+	stats.cpu_wait_us += us;
+	itc_sim_run(us);
+}
+
+void ioport_set_pin_level(ioport_pin_t pin, bool level)
+{
+	bool b_shifting = sim_us < shift_end_us;
+
+	if (pin == DISPLAY_CS && level && !pins[pin]) {
+		if (b_shifting) {
+			sim_error("deselected before the last byte was out");
+		}
+		record_write(RECORD_DESELECT, 0);
+	}
+	if (pin == DISPLAY_DC && level != pins[pin] && !pins[DISPLAY_CS] && b_shifting) {
+		sim_error("D/C changed during a byte");
+	}
+	if (pin == DISPLAY_PANEL_ON && !level && pins[pin]) {
+		// The controller loses its frame and registers
+		memset(ram, RAM_LOST, sizeof(ram));
+		b_ready = false;
+	}
+	if (pin == DISPLAY_RST && level != pins[pin]) {
+		b_ready = level && pins[DISPLAY_PANEL_ON];
+		if (b_ready) {
+			stats.resets++;
+			b_partial = false;
+			command = 0;
+		}
+	}
+	pins[pin] = level;
+}
+
+bool ioport_get_pin_level(ioport_pin_t pin)
+{
+	if (pin == DISPLAY_BUSY) {
+		itc_sim_run(1);
+		return !is_busy();
+	}
+	return pins[pin];
+}
+
+void gpio_configure_pin(uint32_t pin, uint32_t flags)
+{
+	(void)pin;
+	(void)flags;
+}
+
+void gpio_set_pin_high(uint32_t pin)
+{
+	pins[pin] = true;
+}
+
+void gpio_set_pin_low(uint32_t pin)
+{
+	pins[pin] = false;
+}
+
+void spi_master_init(Spi *p_spi)
+{
+	p_spi->imr = 0;
+}
+
+void spi_master_setup_device(Spi *p_spi, struct spi_device *device, spi_flags_t flags,
+		uint32_t baud_rate, board_spi_select_id_t sel_id)
+{
+	(void)p_spi;
+	(void)device;
+	(void)flags;
+	(void)sel_id;
+	if (baud_rate != 1000000UL * 8 / ITC_SIM_BYTE_US) {
+		sim_error("SPI clock not simulated");
+	}
+}
+
+void spi_enable(Spi *p_spi)
+{
+	(void)p_spi;
+}
+
+void spi_write_single(Spi *p_spi, uint8_t data)
+{
+	(void)p_spi;
+	if (sim_us < shift_end_us || (pdc_sim.b_enabled && pdc_sim.tcr)) {
+		sim_error("byte written while the bus is busy");
+	}
+	start_byte(data);
+}
+
+void spi_read_single(Spi *p_spi, uint8_t *data)
+{
+	(void)p_spi;
+	*data = 0xFF;
+}
+
+uint32_t spi_read_status(Spi *p_spi)
+{
+	bool b_shifting = sim_us < shift_end_us;
+	uint32_t status = SPI_SR_RDRF;
+
+	(void)p_spi;
+	if (!b_shifting) {
+		status |= SPI_SR_TDRE;
+		if (!pdc_sim.b_enabled || !pdc_sim.tcr) {
+			status |= SPI_SR_TXEMPTY;
+		}
+	}
+	if (pdc_sim.b_endtx) {
+		status |= SPI_SR_ENDTX;
+	}
+	if (!pdc_sim.tcr && !pdc_sim.tncr) {
+		status |= SPI_SR_TXBUFE;
+	}
+	return status;
+}
+
+// Polled by the driver: the CPU waits a microsecond each time
+static bool spi_poll(uint32_t flag)
+{
+	if (spi_read_status(SPI) & flag) {
+		return true;
+	}
+	stats.cpu_wait_us++;
+	itc_sim_run(1);
+	return false;
+}
+
+bool spi_is_tx_empty(Spi *p_spi)
+{
+	(void)p_spi;
+	return spi_poll(SPI_SR_TXEMPTY);
+}
+
+bool spi_is_tx_ok(Spi *p_spi)
+{
+	(void)p_spi;
+	return spi_poll(SPI_SR_TDRE);
+}
+
+bool spi_is_rx_full(Spi *p_spi)
+{
+	(void)p_spi;
+	return true;
+}
+
+uint32_t spi_read_interrupt_mask(Spi *p_spi)
+{
+	return p_spi->imr;
+}
+
+void spi_enable_interrupt(Spi *p_spi, uint32_t ul_sources)
+{
+	p_spi->imr |= ul_sources;
+}
+
+void spi_disable_interrupt(Spi *p_spi, uint32_t ul_sources)
+{
+	p_spi->imr &= ~ul_sources;
+}
+
+Pdc *spi_get_pdc_base(Spi *p_spi)
+{
+	(void)p_spi;
+	return &pdc_sim;
+}
+
+void pdc_tx_init(Pdc *p_pdc, pdc_packet_t *p_packet, pdc_packet_t *p_next_packet)
+{
+	if (p_packet) {
+		p_pdc->tpr = (const uint8_t *)(uintptr_t)p_packet->ul_addr;
+		p_pdc->tcr = p_packet->ul_size;
+		p_pdc->b_endtx = false;
+	}
+	if (p_next_packet) {
+		p_pdc->tnpr = (const uint8_t *)(uintptr_t)p_next_packet->ul_addr;
+		p_pdc->tncr = p_next_packet->ul_size;
+		p_pdc->b_endtx = false;
+	}
+	if (!p_pdc->tcr && p_pdc->tncr) {
+		p_pdc->tpr = p_pdc->tnpr;
+		p_pdc->tcr = p_pdc->tncr;
+		p_pdc->tncr = 0;
+	}
+}
+
+void pdc_enable_transfer(Pdc *p_pdc, uint32_t ul_controls)
+{
+	if (ul_controls & PERIPH_PTCR_TXTEN) {
+		p_pdc->b_enabled = true;
+	}
+}
+
+void pdc_disable_transfer(Pdc *p_pdc, uint32_t ul_controls)
+{
+	if (ul_controls & PERIPH_PTCR_TXTDIS) {
+		p_pdc->b_enabled = false;
+	}
+}
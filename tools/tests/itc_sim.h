@@ -0,0 +1,82 @@
+/*
+ * itc_sim.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Simulated display hardware for the host tests of the display driver
+ * (Display/iTC.c): the SPI with its PDC channel, the pins, and a model of the
+ * e-paper controller. Time only passes in itc_sim_run(), which the driver
+ * calls through its busy waits, and the tests between two main loop passes.
+ *
+ * The controller keeps the frame sent, copies it to the screen on a refresh,
+ * and holds BUSY low for the time its operations take. Whatever the driver
+ * does against the protocol, such as a command while BUSY is low, is printed
+ * and counted in the errors.
+ *
+ * The bytes taken by the controller can be recorded, to compare the stream of
+ * two builds of the driver.
+ */
+
+#ifndef ITC_SIM_H_
+#define ITC_SIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "iTC.h"
+
+//! One byte per 8 us at CONF_ITC_CLOCK_SPEED
+#define ITC_SIM_BYTE_US				8
+
+//! Time BUSY stays low after each operation of the controller
+#define ITC_SIM_POWER_ON_MS			80
+#define ITC_SIM_REFRESH_MS			4000
+#define ITC_SIM_PARTIAL_REFRESH_MS	1200
+#define ITC_SIM_POWER_OFF_MS		30
+
+typedef struct {
+	//! Protocol errors of the driver
+	uint32_t errors;
+	//! Bytes on the bus: command bytes, their parameters, and the black and red frame data
+	uint32_t command_bytes;
+	uint32_t param_bytes;
+	uint32_t black_bytes;
+	uint32_t red_bytes;
+	//! Refresh commands, and the controller resets
+	uint32_t refreshes;
+	uint32_t resets;
+	//! Longest time from BUSY going high to the next command
+	uint32_t busy_latency_max_us;
+	//! Time the CPU spent waiting in the driver, polling the SPI or in delay_us()
+	uint64_t cpu_wait_us;
+} itc_sim_stats_t;
+
+// Image buffer of the driver
+extern uint8_t image_data_buffer[ITC_SCREEN_BUFFER_SIZE];
+
+// Starts the simulated hardware as the board initialization leaves it, the controller in reset.
+void itc_sim_reset(void);
+
+// Runs the hardware for us microseconds: the PDC, the controller and the SPI interrupt.
+void itc_sim_run(uint32_t us);
+
+// Simulated time, from itc_sim_reset()
+uint64_t itc_sim_get_time_us(void);
+
+itc_sim_stats_t *itc_sim_get_stats(void);
+
+// Frame the panel shows, in the layout of image_data_buffer
+const uint8_t *itc_sim_get_screen(void);
+
+bool itc_sim_is_panel_on(void);
+
+// Writes every byte the controller takes to the file at path, with its D/C level, and a mark
+// where the controller is deselected. Returns false when the file cannot be created.
+bool itc_sim_record(const char *path);
+
+// Keeps BUSY low from the next operation of the controller until itc_sim_release_busy(),
+// like a controller that stopped answering
+void itc_sim_hold_busy(void);
+void itc_sim_release_busy(void);
+
+#endif /* ITC_SIM_H_ */
@@ -0,0 +1,347 @@
+/*
+ * itc_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test of the display refresh (Display/iTC.c) on the simulated hardware
+ * of itc_sim.c. A refresh runs from the main loop without blocking it: every
+ * call into the driver returns within CALL_MAX_US, and the next step runs
+ * once BUSY goes high or its delay is over. The completion callback comes
+ * once, when the controller is done, and the screen then shows the image
+ * buffer. A controller that never releases BUSY must not stop the main loop.
+ * The time of each refresh phase is printed and checked against the simulated
+ * controller, and the registers are only sent when the controller lost them.
+ * A single key icon must take a fraction of the bytes of the whole screen.
+ *
+ * The Makefile builds it with the PDC and with ITC_TEST_POLLED, which sends
+ * the frame data byte per byte. Given a file, the test records the bytes the
+ * controller took: both builds must send the same stream.
+ *
+ * Build:  make -C tools/tests itc_test itc_polled_test
+ * Usage:  itc_test [stream file]
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "itc_sim.h"
+#include "key_layout.h"
+
+// Time the other tasks of the main loop take between two itc_refresh_process()
+#define LOOP_US				100
+// Longest a call into the driver may hold the main loop
+#if defined(ITC_TEST_POLLED)
+// Byte per byte, the black and red frames go out in one call
+#  define CALL_MAX_US		(2000 + 2 * ITC_SCREEN_BUFFER_SIZE * ITC_SIM_BYTE_US)
+#else
+#  define CALL_MAX_US		2000
+#endif
+// Longest refresh: the controller busy times, the reset delays and both frames on the bus
+#define BUSY_MS				(ITC_SIM_POWER_ON_MS + ITC_SIM_REFRESH_MS + ITC_SIM_POWER_OFF_MS)
+#define REFRESH_MAX_MS		(BUSY_MS + 21 + 2 * ITC_SCREEN_BUFFER_SIZE * ITC_SIM_BYTE_US / 1000 + 50)
+// BUSY stuck low for this long
+#define STUCK_MS			10000
+// Controller reset delays of the driver, and the slack on the time of a phase: the waits of the
+// driver, the millisecond time base and the main loop passes
+#define RESET_MS			21
+#define PHASE_SLACK_MS		5
+// Phase the refresh must skip
+#define PHASE_SKIPPED		UINT32_MAX
+// Both frames on the bus, of the whole screen or of a rectangle
+#define FRAMES_MS			(2 * ITC_SCREEN_BUFFER_SIZE * ITC_SIM_BYTE_US / 1000)
+#define RECT_BYTES(x0, y0, x1, y1)		(((x1) / 8 - (x0) / 8 + 1) * ((y1) - (y0) + 1))
+#define RECT_FRAMES_MS(x0, y0, x1, y1)	(2 * RECT_BYTES(x0, y0, x1, y1) * ITC_SIM_BYTE_US / 1000)
+// Icon of the key at row 1, column 1 in ui.c
+#define KEY_X0				152
+#define KEY_Y0				142
+#define KEY_X1				(KEY_X0 + KEY_ICON_MAX_DIM - 1)
+#define KEY_Y1				(KEY_Y0 + KEY_ICON_MAX_DIM - 1)
+
+static unsigned failures;
+static unsigned done_calls;
+static unsigned other_done_calls;
+static uint64_t done_us;
+static uint32_t call_max_us;
+
+static const char *const phase_names[ITC_PHASE_COUNT] = {
+	"reset", "init", "data", "power on", "refresh", "power off",
+};
+
+static void expect(const char *test, const char *what, bool b_ok)
+{
+	if (!b_ok) {
+		printf("%s: %s\n", test, what);
+		failures++;
+	}
+}
+
+static void refresh_done(void)
+{
+	done_calls++;
+	done_us = itc_sim_get_time_us();
+}
+
+static void other_refresh_done(void)
+{
+	other_done_calls++;
+}
+
+// Runs the display part of one main loop pass, then the rest of the loop
+static void loop_pass(void)
+{
+	uint64_t start_us = itc_sim_get_time_us();
+
+	itc_refresh_process();
+	if (itc_sim_get_time_us() - start_us > call_max_us) {
+		call_max_us = (uint32_t)(itc_sim_get_time_us() - start_us);
+	}
+	itc_sim_run(LOOP_US);
+}
+
+static void start_refresh(void)
+{
+	uint64_t start_us = itc_sim_get_time_us();
+
+	done_calls = 0;
+	call_max_us = 0;
+	itc_refresh_screen_async(refresh_done);
+	call_max_us = (uint32_t)(itc_sim_get_time_us() - start_us);
+}
+
+// Runs the main loop until the refresh is done, returns the time it took in us
+static uint64_t finish_refresh(const char *test, uint64_t start_us)
+{
+	uint64_t loop_start_us = itc_sim_get_time_us();
+	unsigned passes = 0;
+
+	while (itc_refresh_in_progress() && passes < REFRESH_MAX_MS * 1000 / LOOP_US) {
+		loop_pass();
+		passes++;
+	}
+	expect(test, "not done", !itc_refresh_in_progress() && done_calls == 1);
+	expect(test, "main loop held", call_max_us <= CALL_MAX_US);
+	// Most of the time goes to the rest of the main loop
+	expect(test, "main loop starved", (uint64_t)passes * LOOP_US * 10 >= (done_us - loop_start_us) * 9);
+	expect(test, "screen differs", !memcmp(itc_sim_get_screen(), image_data_buffer, ITC_SCREEN_BUFFER_SIZE));
+	expect(test, "protocol errors", itc_sim_get_stats()->errors == 0);
+	return done_us - start_us;
+}
+
+static uint64_t run_refresh(const char *test)
+{
+	uint64_t start_us = itc_sim_get_time_us();
+
+	start_refresh();
+	return finish_refresh(test, start_us);
+}
+
+static void draw(itc_coord_t x0, itc_coord_t y0, itc_coord_t x1, itc_coord_t y1, itc_color_t color)
+{
+	itc_set_limits(x0, y0, x1, y1);
+	itc_duplicate_pixel(color, (uint32_t)(x1 - x0 + 1) * (y1 - y0 + 1));
+}
+
+static void test_refresh(void)
+{
+	itc_sim_stats_t *stats = itc_sim_get_stats();
+	uint64_t time_us;
+
+	draw(10, 20, 109, 119, ITC_BLACK);
+	time_us = run_refresh("first refresh");
+	expect("first refresh", "controller not reset", stats->resets == 1);
+	expect("first refresh", "BUSY not waited for", time_us >= BUSY_MS * 1000ULL);
+	expect("first refresh", "too long", time_us <= REFRESH_MAX_MS * 1000ULL);
+	// The step after BUSY goes high runs on the next pass
+	expect("first refresh", "BUSY edge missed", stats->busy_latency_max_us <= LOOP_US + CALL_MAX_US);
+
+	draw(200, 100, 299, 199, ITC_BLACK);
+	run_refresh("second refresh");
+	expect("second refresh", "controller reset again", stats->resets == 1);
+}
+
+// Refresh asked for while one is in progress: ignored
+static void test_refresh_in_progress(void)
+{
+	unsigned refreshes = itc_sim_get_stats()->refreshes;
+	uint64_t start_us = itc_sim_get_time_us();
+
+	draw(0, 0, 49, 49, ITC_BLACK);
+	start_refresh();
+	for (int i = 0; i < 100; ++i) {
+		loop_pass();
+	}
+	other_done_calls = 0;
+	draw(0, 0, 49, 49, ITC_WHITE);
+	itc_refresh_screen_async(other_refresh_done);
+	draw(0, 0, 49, 49, ITC_BLACK);
+	finish_refresh("refresh in progress", start_us);
+	expect("refresh in progress", "restarted", itc_sim_get_stats()->refreshes == refreshes + 1);
+	expect("refresh in progress", "second callback", other_done_calls == 0);
+}
+
+// A controller that keeps BUSY low
+static void test_busy_stuck(void)
+{
+	draw(100, 0, 199, 99, ITC_BLACK);
+	itc_sim_hold_busy();
+	start_refresh();
+	for (unsigned i = 0; i < STUCK_MS * 1000 / LOOP_US; ++i) {
+		loop_pass();
+	}
+	expect("BUSY stuck", "main loop held", call_max_us <= CALL_MAX_US);
+	expect("BUSY stuck", "done", itc_refresh_in_progress() && done_calls == 0);
+	expect("BUSY stuck", "protocol errors", itc_sim_get_stats()->errors == 0);
+	itc_sim_release_busy();
+	finish_refresh("BUSY released", itc_sim_get_time_us());
+}
+
+// Prints the time of each phase of the last refresh, and checks it against the simulated one
+static void expect_phases(const char *test, const uint32_t min_ms[ITC_PHASE_COUNT])
+{
+	const itc_refresh_stats_t *stats = itc_get_refresh_stats();
+	uint32_t total_ms = 0;
+	char what[40];
+
+	printf("%s:", test);
+	for (int phase = 0; phase < ITC_PHASE_COUNT; ++phase) {
+		printf(" %s %lu%s", phase_names[phase], (unsigned long)stats->phase_ms[phase],
+				phase < ITC_PHASE_COUNT - 1 ? "," : " ms\n");
+	}
+	for (int phase = 0; phase < ITC_PHASE_COUNT; ++phase) {
+		total_ms += stats->phase_ms[phase];
+		snprintf(what, sizeof(what), "%s time", phase_names[phase]);
+		if (min_ms[phase] == PHASE_SKIPPED) {
+			expect(test, what, stats->phase_ms[phase] == 0);
+		} else {
+			expect(test, what, stats->phase_ms[phase] >= min_ms[phase]
+					&& stats->phase_ms[phase] <= min_ms[phase] + PHASE_SLACK_MS);
+		}
+	}
+	expect(test, "total time", stats->total_ms == total_ms);
+}
+
+// The registers are only sent again after a power loss, a temperature change or a reset
+static void test_phases(void)
+{
+	const itc_refresh_stats_t *stats = itc_get_refresh_stats();
+	static const uint32_t full_ms[ITC_PHASE_COUNT] = {
+		PHASE_SKIPPED, PHASE_SKIPPED, FRAMES_MS,
+		ITC_SIM_POWER_ON_MS, ITC_SIM_REFRESH_MS, ITC_SIM_POWER_OFF_MS,
+	};
+	static const uint32_t cold_ms[ITC_PHASE_COUNT] = {
+		RESET_MS, 0, FRAMES_MS,
+		ITC_SIM_POWER_ON_MS, ITC_SIM_REFRESH_MS, ITC_SIM_POWER_OFF_MS,
+	};
+	static const uint32_t partial_ms[ITC_PHASE_COUNT] = {
+		PHASE_SKIPPED, PHASE_SKIPPED, RECT_FRAMES_MS(50, 50, 149, 149),
+		ITC_SIM_POWER_ON_MS, ITC_SIM_PARTIAL_REFRESH_MS, ITC_SIM_POWER_OFF_MS,
+	};
+	uint32_t inits = stats->inits;
+
+	draw(0, 0, 399, 299, ITC_BLACK);
+	run_refresh("full refresh");
+	expect("full refresh", "registers sent", stats->inits == inits);
+	expect_phases("full refresh", full_ms);
+
+	itc_set_temperature(10);
+	draw(0, 0, 399, 299, ITC_WHITE);
+	run_refresh("temperature change");
+	expect("temperature change", "registers not sent", stats->inits == inits + 1);
+	expect_phases("temperature change", cold_ms);
+
+	itc_set_temperature(10);
+	draw(50, 50, 149, 149, ITC_BLACK);
+	run_refresh("same temperature");
+	expect("same temperature", "registers sent", stats->inits == inits + 1);
+	expect_phases("same temperature", partial_ms);
+
+	itc_reset_controller();
+	draw(50, 50, 149, 149, ITC_WHITE);
+	run_refresh("controller reset");
+	expect("controller reset", "registers not sent", stats->inits == inits + 2);
+	expect_phases("controller reset", cold_ms);
+}
+
+static uint32_t bus_bytes(void)
+{
+	const itc_sim_stats_t *stats = itc_sim_get_stats();
+
+	return stats->command_bytes + stats->param_bytes + stats->black_bytes + stats->red_bytes;
+}
+
+// Bytes on the bus for one key icon against the whole screen, and rectangles one row high
+static void test_bytes(void)
+{
+	const itc_sim_stats_t *stats = itc_sim_get_stats();
+	uint32_t bytes, black_bytes, full_bytes, key_bytes;
+
+	draw(0, 0, 399, 299, ITC_BLACK);
+	bytes = bus_bytes();
+	black_bytes = stats->black_bytes;
+	run_refresh("full screen");
+	full_bytes = bus_bytes() - bytes;
+	expect("full screen", "frame bytes", stats->black_bytes - black_bytes == ITC_SCREEN_BUFFER_SIZE);
+
+	draw(KEY_X0, KEY_Y0, KEY_X1, KEY_Y1, ITC_WHITE);
+	bytes = bus_bytes();
+	black_bytes = stats->black_bytes;
+	run_refresh("one key");
+	key_bytes = bus_bytes() - bytes;
+	expect("one key", "frame bytes",
+			stats->black_bytes - black_bytes == RECT_BYTES(KEY_X0, KEY_Y0, KEY_X1, KEY_Y1));
+	expect("one key", "more than a tenth of the full screen", key_bytes * 10 < full_bytes);
+	printf("SPI bytes: full screen %lu, one key %lu\n", (unsigned long)full_bytes, (unsigned long)key_bytes);
+
+	// The PDC is given two rows at once
+	draw(0, 10, 399, 10, ITC_WHITE);
+	run_refresh("one row");
+	draw(8, 20, 15, 20, ITC_WHITE);
+	run_refresh("one byte");
+}
+
+// Power down asked for during a refresh, e.g. on a USB suspend
+static void test_power_down(void)
+{
+	itc_sim_stats_t *stats = itc_sim_get_stats();
+	uint32_t resets = stats->resets;
+	uint64_t start_us = itc_sim_get_time_us();
+
+	draw(300, 200, 399, 299, ITC_WHITE);
+	start_refresh();
+	for (int i = 0; i < 1000; ++i) {
+		loop_pass();
+	}
+	itc_power_down();
+	finish_refresh("power down", start_us);
+	expect("power down", "panel still on", !itc_sim_is_panel_on());
+
+	draw(300, 200, 399, 299, ITC_BLACK);
+	run_refresh("after power down");
+	expect("after power down", "controller not reset", stats->resets == resets + 1);
+}
+
+int main(int argc, char *argv[])
+{
+	itc_sim_reset();
+	if (argc > 1 && !itc_sim_record(argv[1])) {
+		printf("itc_test: cannot create %s\n", argv[1]);
+		return 1;
+	}
+	itc_init();
+
+	test_refresh();
+	test_refresh_in_progress();
+	test_busy_stuck();
+	test_phases();
+	test_bytes();
+	test_power_down();
+
+	printf("itc_test (%s): %u failures\n",
+#if defined(ITC_TEST_POLLED)
+			"polled",
+#else
+			"PDC",
+#endif
+			failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,382 @@
+/*
+ * key_reader_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test of the key matrix scan (ui/key_reader.c) replaying key traces on a
+ * simulated matrix. The test plays the scan interrupt: it calls
+ * keyboard_scan_step() once per column tick, and sets PIO_PDSR from the keys
+ * pressed in the column driven low. A row only follows a column once it has
+ * been driven for SETTLE_US, so a scan reading the column it just drove sees
+ * nothing. Every edge of the trace must come out of the event ring once, in
+ * order, within a full matrix scan. No step may busy wait, and the time spent
+ * in keyboard_scan_step() is reported.
+ *
+ * A benchmark then times a full matrix scan against the loop keyboard_read()
+ * ran before the packed bitmap, one gpio_pin_is_high() and key_info_t per key,
+ * without its settle waits.
+ *
+ * Build:  make -C tools/tests key_reader_test
+ * Usage:  key_reader_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "conf_keyboard.h"
+#include "key_layout.h"
+#include "key_reader.h"
+
+#define TICK_US				(1000000 / (KEYBOARD_SCAN_RATE_HZ * KEY_COL_NUM))
+#define SCAN_US				(TICK_US * KEY_COL_NUM)
+// Time the rows take to follow a column driven low
+#define SETTLE_US			10
+#define RING_SIZE			64
+#define TRACE_MAX			8192
+// Random trace: a key stays up or down this long, above the debounce time
+#define RANDOM_HOLD_MIN_US	10000
+#define RANDOM_HOLD_MAX_US	60000
+#define RANDOM_TIME_US		20000000
+#define BENCH_SCANS			1000000
+// Scans between two changes of the rows in the benchmark
+#define BENCH_CHANGE_SCANS	16
+
+typedef struct {
+	uint32_t time_us;
+	uint8_t key;
+	bool b_down;
+} trace_edge_t;
+
+static const uint8_t row_pins[KEY_ROW_NUM] = {GPIO_ROW_0, GPIO_ROW_1, GPIO_ROW_2, GPIO_ROW_3};
+static const uint8_t col_pins[KEY_COL_NUM] = {GPIO_COL_0, GPIO_COL_1, GPIO_COL_2};
+
+static Pio pioa, piob;
+Pio *PIOA = &pioa;
+Pio *PIOB = &piob;
+
+// Simulated matrix: output levels and the time each column was last driven low
+static bool pin_levels[64];
+static uint32_t col_low_us[KEY_COL_NUM];
+static bool b_pressed[KEY_COUNT];
+static uint32_t now_us;
+static unsigned delay_calls;
+
+static trace_edge_t trace[TRACE_MAX];
+static unsigned trace_len;
+static uint32_t event_buffer[RING_SIZE];
+static event_ring_t ring;
+
+// State of the loop keyboard_read() ran before the bitmap, as in the key_info_t of ui.h
+typedef struct {
+	uint8_t key_id;
+	uint8_t key_code;
+	int16_t centre_x;
+	int16_t centre_y;
+	int16_t max_dim;
+	bool pressed;
+} old_key_info_t;
+
+static old_key_info_t old_keys[KEY_ROW_NUM][KEY_COL_NUM];
+static uint8_t old_fifo[4 * KEY_COUNT];
+static unsigned old_fifo_len;
+
+static unsigned failures;
+static uint32_t latency_max_us;
+static double step_max_s, step_total_s;
+static unsigned steps;
+
+static void expect(const char *test, const char *what, bool b_ok)
+{
+	if (!b_ok) {
+		printf("%s: %s\n", test, what);
+		failures++;
+	}
+}
+
+static double seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Not inlined in the old loop of the benchmark, key_reader.c calls them too
+__attribute__((noinline)) void gpio_set_pin_high(uint32_t pin)
+{
+	pin_levels[pin] = true;
+}
+
+__attribute__((noinline)) void gpio_set_pin_low(uint32_t pin)
+{
+	for (int col = 0; col < KEY_COL_NUM; ++col) {
+		if (col_pins[col] == pin && pin_levels[pin]) {
+			col_low_us[col] = now_us;
+		}
+	}
+	pin_levels[pin] = false;
+}
+
+void gpio_configure_pin(uint32_t pin, uint32_t flags)
+{
+	(void)pin;
+	(void)flags;
+}
+
+// A scan step must not wait for the rows
+void delay_us(uint32_t us)
+{
+	(void)us;
+	delay_calls++;
+}
+
+// Rows pulled low by the pressed keys of the settled low columns, the others pulled up
+static void update_ports(void)
+{
+	uint32_t levels[2] = {0xFFFFFFFF, 0xFFFFFFFF};
+
+	for (int row = 0; row < KEY_ROW_NUM; ++row) {
+		for (int col = 0; col < KEY_COL_NUM; ++col) {
+			if (!pin_levels[col_pins[col]] && now_us - col_low_us[col] >= SETTLE_US
+					&& b_pressed[ROW_COL_TO_IDX(row, col)]) {
+				levels[row_pins[row] >> 5] &= ~(1u << (row_pins[row] & 0x1F));
+			}
+		}
+	}
+	pioa.PIO_PDSR = levels[0];
+	piob.PIO_PDSR = levels[1];
+}
+
+static void reset(void)
+{
+	for (int pin = 0; pin < 64; ++pin) {
+		pin_levels[pin] = true;
+	}
+	for (int key = 0; key < KEY_COUNT; ++key) {
+		b_pressed[key] = false;
+	}
+	now_us = 0;
+	trace_len = 0;
+	event_ring_init(&ring, event_buffer, RING_SIZE);
+	keyboard_scan_init();
+	// An edge is reported on its first sample
+	debounce_init(DEBOUNCE_MODE_EAGER, KEYBOARD_DEBOUNCE_SCANS);
+}
+
+static void add_edge(uint32_t time_us, uint8_t key, bool b_down)
+{
+	if (trace_len < TRACE_MAX) {
+		trace[trace_len++] = (trace_edge_t){time_us, key, b_down};
+	}
+}
+
+static int edge_compare(const void *a, const void *b)
+{
+	const trace_edge_t *ea = a, *eb = b;
+
+	return ea->time_us < eb->time_us ? -1 : ea->time_us > eb->time_us;
+}
+
+// Replays the trace tick by tick, and matches the events of each key with its edges
+static void replay(const char *test)
+{
+	unsigned next = 0;
+	unsigned key_next[KEY_COUNT] = {0};
+	unsigned key_edges[KEY_COUNT] = {0};
+	uint32_t end_us;
+
+	qsort(trace, trace_len, sizeof(trace[0]), edge_compare);
+	for (unsigned i = 0; i < trace_len; ++i) {
+		key_edges[trace[i].key]++;
+	}
+	end_us = trace_len ? trace[trace_len - 1].time_us + 2 * SCAN_US : 0;
+	for (; now_us <= end_us; now_us += TICK_US) {
+		uint32_t event;
+		double start;
+
+		while (next < trace_len && trace[next].time_us <= now_us) {
+			b_pressed[trace[next].key] = trace[next].b_down;
+			next++;
+		}
+		update_ports();
+		start = seconds();
+		keyboard_scan_step(&ring, now_us);
+		start = seconds() - start;
+		step_total_s += start;
+		if (start > step_max_s) {
+			step_max_s = start;
+		}
+		steps++;
+
+		// The report task drains the ring
+		while (event_ring_pop(&ring, &event)) {
+			uint8_t key = KEY_EVENT_KEY(event);
+			const trace_edge_t *edge = NULL;
+			unsigned i;
+
+			if (key >= KEY_COUNT) {
+				expect(test, "event of no key", false);
+				continue;
+			}
+			// The next edge of this key in the trace
+			for (i = key_next[key]; i < trace_len && edge == NULL; ++i) {
+				if (trace[i].key == key) {
+					edge = &trace[i];
+				}
+			}
+			key_next[key] = i;
+			if (edge == NULL) {
+				expect(test, "event without an edge", false);
+				continue;
+			}
+			expect(test, "wrong edge", KEY_EVENT_IS_DOWN(event) == edge->b_down);
+			expect(test, "event before the edge or after a full scan",
+					KEY_EVENT_TIME_US(event) == (now_us & 0x00FFFFFF)
+					&& now_us >= edge->time_us && now_us - edge->time_us <= SCAN_US);
+			if (now_us - edge->time_us > latency_max_us) {
+				latency_max_us = now_us - edge->time_us;
+			}
+			key_edges[key]--;
+		}
+	}
+	for (int key = 0; key < KEY_COUNT; ++key) {
+		expect(test, "edge without an event", key_edges[key] == 0);
+	}
+	expect(test, "events dropped", ring.dropped == 0);
+	expect(test, "busy wait", delay_calls == 0);
+	expect(test, "keys still down", keyboard_get_key_state() == 0);
+}
+
+// Keys of one column, of one row, and the whole matrix together
+static void test_chords(void)
+{
+	uint32_t t = 10000;
+
+	reset();
+	for (int row = 0; row < KEY_ROW_NUM; ++row) {
+		add_edge(t, ROW_COL_TO_IDX(row, 1), true);
+		add_edge(t + 20000, ROW_COL_TO_IDX(row, 1), false);
+	}
+	t += 40000;
+	for (int col = 0; col < KEY_COL_NUM; ++col) {
+		add_edge(t + col * 100, ROW_COL_TO_IDX(2, col), true);
+		add_edge(t + 20000 + col * 100, ROW_COL_TO_IDX(2, col), false);
+	}
+	t += 40000;
+	for (int key = 0; key < KEY_COUNT; ++key) {
+		add_edge(t + key * 7, key, true);
+		add_edge(t + 30000, key, false);
+	}
+	// An edge just before and just after a sample
+	t += 40000;
+	add_edge(t - t % SCAN_US - 1, 0, true);
+	add_edge(t - t % SCAN_US + 20001, 0, false);
+	replay("chords");
+}
+
+// Every key pressed and released at random, with holds above the debounce time
+static void test_random(void)
+{
+	reset();
+	srand(1);
+	for (int key = 0; key < KEY_COUNT; ++key) {
+		uint32_t t = rand() % RANDOM_HOLD_MAX_US;
+		bool b_down = true;
+
+		while (t < RANDOM_TIME_US) {
+			add_edge(t, key, b_down);
+			b_down = !b_down;
+			t += RANDOM_HOLD_MIN_US + rand() % (RANDOM_HOLD_MAX_US - RANDOM_HOLD_MIN_US);
+		}
+		if (!b_down) {
+			add_edge(t, key, false);
+		}
+	}
+	replay("random");
+}
+
+// Reads one pin, like the ASF service
+__attribute__((noinline)) static bool gpio_pin_is_high(uint32_t pin)
+{
+	const Pio *pio = (pin >> 5) ? PIOB : PIOA;
+
+	return (pio->PIO_PDSR >> (pin & 0x1F)) & 1;
+}
+
+// keyboard_read() before the bitmap, without delay_us() after driving each column
+static void old_keyboard_read(void)
+{
+	for (int i = 0; i < KEY_COL_NUM; i++) {
+		gpio_set_pin_high(col_pins[i]);
+	}
+	for (int col_idx = 0; col_idx < KEY_COL_NUM; col_idx++) {
+		gpio_set_pin_low(col_pins[col_idx]);
+		for (int row_idx = 0; row_idx < KEY_ROW_NUM; row_idx++) {
+			int key_status_idx = ROW_COL_TO_IDX(row_idx, col_idx);
+			bool row_status = gpio_pin_is_high(row_pins[row_idx]);
+
+			if (row_status ^ old_keys[row_idx][col_idx].pressed) {
+				old_fifo[old_fifo_len++] = row_status;
+				old_fifo[old_fifo_len++] = key_status_idx;
+				old_keys[row_idx][col_idx].pressed = !old_keys[row_idx][col_idx].pressed;
+			}
+			gpio_set_pin_high(col_pins[col_idx]);
+		}
+	}
+}
+
+// Random rows every BENCH_CHANGE_SCANS scans, the same for both loops
+static void bench_ports(unsigned scan)
+{
+	if (scan % BENCH_CHANGE_SCANS == 0) {
+		pioa.PIO_PDSR = rand() ^ ((uint32_t)rand() << 16);
+		piob.PIO_PDSR = rand() ^ ((uint32_t)rand() << 16);
+	}
+}
+
+// Time of a full matrix scan in ns: the old loop, then KEY_COL_NUM steps with the given debounce
+static double bench_scan(int mode)
+{
+	uint32_t event;
+	double start;
+
+	reset();
+	srand(2);
+	start = seconds();
+	for (unsigned scan = 0; scan < BENCH_SCANS; ++scan) {
+		bench_ports(scan);
+		if (mode < 0) {
+			old_keyboard_read();
+			old_fifo_len = 0;
+		} else {
+			if (scan == 0) {
+				debounce_init(mode, KEYBOARD_DEBOUNCE_SCANS);
+			}
+			for (int col = 0; col < KEY_COL_NUM; ++col) {
+				keyboard_scan_step(&ring, scan);
+			}
+			while (event_ring_pop(&ring, &event)) {
+			}
+		}
+	}
+	return (seconds() - start) / BENCH_SCANS * 1e9;
+}
+
+int main(void)
+{
+	double old_ns, none_ns, eager_ns;
+
+	test_chords();
+	test_random();
+
+	printf("key_reader_test: %u steps, latency up to %lu us, step %.0f ns mean, %.0f ns max\n",
+			steps, (unsigned long)latency_max_us, step_total_s / steps * 1e9, step_max_s * 1e9);
+	old_ns = bench_scan(-1);
+	none_ns = bench_scan(DEBOUNCE_MODE_NONE);
+	eager_ns = bench_scan(DEBOUNCE_MODE_EAGER);
+	printf("key_reader_test: matrix scan, old loop %.1f ns, bitmap %.1f ns, with eager debounce %.1f ns\n",
+			old_ns, none_ns, eager_ns);
+	printf("key_reader_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,598 @@
+/*
+ * link_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Loopback test of the configuration protocol: the firmware side (comm/link.c)
+ * runs in a child process behind one end of a socket pair, the host library
+ * (tools/kbd_link) drives the other end. A first session runs on a clean
+ * channel, the next ones drop whole frames and corrupt bytes in both
+ * directions. Every key set through pipelined requests must read back the
+ * same, and malformed requests must get their error status.
+ *
+ * A last session runs a sequence of edits with kbd_ctl update on a
+ * pseudo-terminal: each layout is compiled by kbd_profile, and kbd_ctl must
+ * only send the keys that differ from the keyboard. The bytes it sends and
+ * receives are printed next to the size of the profile an XMODEM upload
+ * would send, and the keys must read back as in the layout.
+ *
+ * Build:  make -C tools/tests link_test
+ * Usage:  link_test [kbd_ctl] [kbd_profile]
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "asf.h"
+#include "crc16.h"
+#include "kbd_link.h"
+#include "link.h"
+#include "scan_scheduler.h"
+#include "ui.h"
+
+// Returned by the HID stand-ins, read back through LINK_CMD_STATS
+#define TEST_MISSED_FRAMES		7
+#define TEST_QUEUE_HIGH_WATER	3
+
+#define RX_BUFFER_SIZE			4096
+
+#define UPDATE_LAYOUT_PATH		"link_test.txt"
+#define UPDATE_PROFILE_PATH		"link_test.bin"
+#define UPDATE_ICON_PATH		"link_test_%u.pgm"
+
+/*
+ * Firmware side, in the child process
+ */
+
+static int device_fd;
+static uint8_t device_rx[RX_BUFFER_SIZE];
+static unsigned device_rx_head;
+static unsigned device_rx_tail;
+
+// Frames dropped, in percent, and bytes corrupted, per 100000
+static unsigned drop_percent;
+static unsigned corrupt_rate;
+
+static uint8_t key_scancode[KEY_COUNT];
+static uint8_t key_icon_width[KEY_COUNT];
+static uint8_t key_icon_height[KEY_COUNT];
+static uint16_t key_icon_row_crc[KEY_COUNT][KEY_ICON_MAX_DIM];
+static itc_refresh_stats_t refresh_stats;
+
+static uint8_t corrupt(uint8_t value)
+{
+	return ((unsigned) rand() % 100000 < corrupt_rate) ? value ^ (1 << (rand() % 8)) : value;
+}
+
+bool udi_cdc_is_rx_ready(void)
+{
+	return device_rx_head != device_rx_tail;
+}
+
+bool udi_cdc_is_tx_ready(void)
+{
+	return true;
+}
+
+int udi_cdc_putc(int value)
+{
+	uint8_t byte = value;
+
+	return udi_cdc_write_buf(&byte, 1) == 0;
+}
+
+const uint8_t* udi_cdc_get_rx_buffer(iram_size_t* size)
+{
+	// One USB bank at most
+	*size = device_rx_head - device_rx_tail;
+	if (*size > UDI_CDC_DATA_EPS_FS_SIZE) {
+		*size = UDI_CDC_DATA_EPS_FS_SIZE;
+	}
+	return *size ? &device_rx[device_rx_tail] : NULL;
+}
+
+void udi_cdc_rx_consume(iram_size_t size)
+{
+	device_rx_tail += size;
+	if (device_rx_tail == device_rx_head) {
+		device_rx_tail = 0;
+		device_rx_head = 0;
+	}
+}
+
+iram_size_t udi_cdc_get_free_tx_buffer(void)
+{
+	return UDI_CDC_DATA_EPS_FS_SIZE;
+}
+
+iram_size_t udi_cdc_write_buf(const void* buf, iram_size_t size)
+{
+	uint8_t frame[UDI_CDC_DATA_EPS_FS_SIZE];
+
+	// link.c writes each response at once
+	if ((unsigned) rand() % 100 < drop_percent) {
+		return 0;
+	}
+	for (iram_size_t i = 0; i < size; ++i) {
+		frame[i] = corrupt(((const uint8_t *) buf)[i]);
+	}
+	if (write(device_fd, frame, size) != (ssize_t) size) {
+		exit(1);
+	}
+	return 0;
+}
+
+uint32_t udi_hid_kbd_get_missed_frames(void)
+{
+	return TEST_MISSED_FRAMES;
+}
+
+uint8_t udi_hid_kbd_get_queue_high_water(void)
+{
+	return TEST_QUEUE_HIGH_WATER;
+}
+
+uint32_t scan_scheduler_get_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+const itc_refresh_stats_t *itc_get_refresh_stats(void)
+{
+	return &refresh_stats;
+}
+
+void ui_set_key_icon_row(uint8_t index, gfx_coord_t width, gfx_coord_t height, gfx_coord_t row,
+		const gfx_color_t *pixels)
+{
+	if (key_icon_width[index] != width || key_icon_height[index] != height) {
+		key_icon_width[index] = width;
+		key_icon_height[index] = height;
+		memset(key_icon_row_crc[index], 0, sizeof(key_icon_row_crc[index]));
+	}
+	key_icon_row_crc[index][row] = crc16_update(CRC16_INIT, pixels, width);
+}
+
+static uint16_t icon_hash(uint8_t width, uint8_t height, const uint16_t *row_crc)
+{
+	uint8_t bytes[2] = {width, height};
+	uint16_t hash = crc16_update(CRC16_INIT, bytes, sizeof(bytes));
+
+	for (uint8_t row = 0; row < height; ++row) {
+		bytes[0] = row_crc[row] >> 8;
+		bytes[1] = row_crc[row];
+		hash = crc16_update(hash, bytes, sizeof(bytes));
+	}
+	return hash;
+}
+
+uint16_t ui_get_key_icon_hash(uint8_t index)
+{
+	return icon_hash(key_icon_width[index], key_icon_height[index], key_icon_row_crc[index]);
+}
+
+void ui_set_key_scancode(uint8_t index, uint8_t scancode)
+{
+	key_scancode[index] = scancode;
+}
+
+uint8_t ui_get_key_scancode(uint8_t index)
+{
+	return key_scancode[index];
+}
+
+const uint8_t *ui_get_key_macro(uint8_t index, uint16_t *len)
+{
+	(void) index;
+	*len = 0;
+	return NULL;
+}
+
+void ui_set_needs_refresh(void)
+{
+}
+
+// Main loop of the keyboard: link_process() on what the host sent, until it hangs up
+static void device_run(int fd)
+{
+	bool b_in_frame = false;
+	bool b_dropping = false;
+	iram_size_t size;
+
+	device_fd = fd;
+	link_init();
+	for (;;) {
+		struct pollfd pfd = {.fd = fd, .events = POLLIN};
+		uint8_t buf[512];
+		ssize_t n;
+
+		if (poll(&pfd, 1, 1) > 0) {
+			n = read(fd, buf, sizeof(buf));
+			if (n <= 0) {
+				break;
+			}
+			for (ssize_t i = 0; i < n; ++i) {
+				uint8_t c = buf[i];
+
+				if (b_dropping) {
+					// Up to the delimiter ending the frame
+					if (c == 0) {
+						b_dropping = false;
+						b_in_frame = false;
+					}
+					continue;
+				}
+				if (c == 0) {
+					b_in_frame = !b_in_frame;
+					if (b_in_frame && (unsigned) rand() % 100 < drop_percent) {
+						b_in_frame = false;
+						b_dropping = true;
+						continue;
+					}
+				}
+				if (device_rx_head == sizeof(device_rx)) {
+					exit(1);
+				}
+				device_rx[device_rx_head++] = corrupt(c);
+			}
+		}
+		// Bytes outside a frame go to XMODEM in comm_process(), which drops them between transfers
+		if (!link_process() && udi_cdc_get_rx_buffer(&size)) {
+			udi_cdc_rx_consume(1);
+		}
+	}
+	exit(0);
+}
+
+/*
+ * Host side
+ */
+
+static unsigned failures;
+
+static void expect(bool b_ok, const char *session, const char *what)
+{
+	if (!b_ok) {
+		printf("%s: %s\n", session, what);
+		failures++;
+	}
+}
+
+static void run_session(const char *session, unsigned drop, unsigned corrupt_per_100000, unsigned seed)
+{
+	static uint8_t pixels[KEY_ICON_MAX_DIM * KEY_ICON_MAX_DIM];
+	uint8_t scancodes[KEY_COUNT];
+	uint16_t hashes[KEY_COUNT];
+	uint8_t payload[LINK_PAYLOAD_MAX];
+	uint8_t response[LINK_RESPONSE_PAYLOAD_MAX];
+	size_t response_len;
+	kbd_link_t link;
+	int sockets[2];
+	pid_t pid;
+	int status;
+	bool b_match;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+	drop_percent = drop;
+	corrupt_rate = corrupt_per_100000;
+	// The child would print the buffered output again
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0) {
+		close(sockets[0]);
+		srand(seed + 1);
+		device_run(sockets[1]);
+	}
+	close(sockets[1]);
+	srand(seed);
+	kbd_link_attach(&link, sockets[0]);
+
+	expect(kbd_link_sync(&link) == 0, session, "sync failed");
+
+	// Every scancode, pipelined
+	for (uint8_t key_id = 0; key_id < KEY_COUNT; ++key_id) {
+		scancodes[key_id] = 0x04 + rand() % 0x60;
+		payload[0] = key_id;
+		payload[1] = scancodes[key_id];
+		expect(kbd_link_submit(&link, LINK_CMD_SET_SCANCODE, payload, 2) == 0, session, "scancode not sent");
+	}
+	expect(kbd_link_flush(&link) == 0, session, "scancodes failed");
+
+	// Every icon, as many rows per request as fit
+	for (uint8_t key_id = 0; key_id < KEY_COUNT; ++key_id) {
+		uint8_t width = 1 + rand() % KEY_ICON_MAX_DIM;
+		uint8_t height = 1 + rand() % KEY_ICON_MAX_DIM;
+		uint8_t rows_per_request = (LINK_PAYLOAD_MAX - 5) / width;
+		uint16_t row_crc[KEY_ICON_MAX_DIM];
+
+		for (unsigned i = 0; i < (unsigned) width * height; ++i) {
+			pixels[i] = rand();
+		}
+		for (uint8_t row = 0; row < height; row += rows_per_request) {
+			uint8_t rows = (height - row < rows_per_request) ? height - row : rows_per_request;
+
+			payload[0] = key_id;
+			payload[1] = width;
+			payload[2] = height;
+			payload[3] = row;
+			payload[4] = rows;
+			memcpy(&payload[5], &pixels[row * width], rows * width);
+			expect(kbd_link_submit(&link, LINK_CMD_SET_ICON_ROWS, payload, 5 + rows * width) == 0,
+					session, "icon rows not sent");
+		}
+		for (uint8_t row = 0; row < height; ++row) {
+			row_crc[row] = crc16_update(CRC16_INIT, &pixels[row * width], width);
+		}
+		hashes[key_id] = icon_hash(width, height, row_crc);
+	}
+	expect(kbd_link_flush(&link) == 0, session, "icons failed");
+
+	// Read back
+	expect(kbd_link_transact(&link, LINK_CMD_GET_KEY_HASHES, NULL, 0, response, &response_len) == 0
+			&& response_len == 3 * KEY_COUNT, session, "no key hashes");
+	b_match = true;
+	for (uint8_t key_id = 0; key_id < KEY_COUNT; ++key_id) {
+		b_match &= response[3 * key_id] == scancodes[key_id];
+		b_match &= ((response[3 * key_id + 1] << 8) | response[3 * key_id + 2]) == hashes[key_id];
+	}
+	expect(b_match, session, "keys differ from what was sent");
+	payload[0] = 5;
+	expect(kbd_link_transact(&link, LINK_CMD_GET_KEY, payload, 1, response, &response_len) == 0
+			&& response_len == 3 && response[0] == scancodes[5], session, "wrong key read back");
+
+	// Errors
+	payload[0] = KEY_COUNT;
+	expect(kbd_link_transact(&link, LINK_CMD_GET_KEY, payload, 1, response, &response_len)
+			== LINK_STATUS_ARGUMENT, session, "key out of range accepted");
+	expect(kbd_link_transact(&link, LINK_CMD_SET_SCANCODE, payload, 1, response, &response_len)
+			== LINK_STATUS_ARGUMENT, session, "short payload accepted");
+	payload[0] = 5;
+	payload[1] = 0xF0;
+	expect(kbd_link_transact(&link, LINK_CMD_SET_SCANCODE, payload, 2, response, &response_len)
+			== LINK_STATUS_ARGUMENT, session, "usage outside the keyboard report accepted");
+	expect(kbd_link_transact(&link, LINK_CMD_COUNT, NULL, 0, response, &response_len)
+			== LINK_STATUS_COMMAND, session, "unknown command accepted");
+
+	expect(kbd_link_transact(&link, LINK_CMD_STATS, NULL, 0, response, &response_len) == 0
+			&& response_len == 17 && response[15] == TEST_MISSED_FRAMES && response[16] == TEST_QUEUE_HIGH_WATER,
+			session, "wrong stats");
+	printf("%s: %u frames, %u CRC errors, %u sequence errors, %lu frames sent again\n", session,
+			(response[0] << 24) | (response[1] << 16) | (response[2] << 8) | response[3],
+			(response[4] << 24) | (response[5] << 16) | (response[6] << 8) | response[7],
+			(response[8] << 24) | (response[9] << 16) | (response[10] << 8) | response[11],
+			link.retransmits);
+	if (drop) {
+		expect(link.retransmits > 0, session, "nothing was lost");
+	}
+
+	kbd_link_close(&link);
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+		expect(false, session, "keyboard side failed");
+	}
+}
+
+/*
+ * Edit sequence, kbd_ctl on a pseudo-terminal
+ */
+
+static const struct {
+	const char *name;
+	int icon_key;			// Key whose icon changes, -1 for none
+	int scancode_key;		// Key whose scancode changes, -1 for none
+	unsigned keys_changed;
+} edits[] = {
+	{"full profile", -1, -1, KEY_COUNT},
+	{"same profile again", -1, -1, 0},
+	{"one icon changed", 5, -1, 1},
+	{"one scancode changed", -1, 7, 1},
+	{"icon and scancode of a key changed", 2, 2, 1},
+};
+
+// Layout of the edit sequence: a black disc on white for each key
+static uint8_t update_scancodes[KEY_COUNT];
+static uint8_t update_radius[KEY_COUNT];
+
+static void disc_icon(uint8_t radius, uint8_t *pixels)
+{
+	for (int y = 0; y < KEY_ICON_MAX_DIM; ++y) {
+		for (int x = 0; x < KEY_ICON_MAX_DIM; ++x) {
+			int dx = x - KEY_ICON_MAX_DIM / 2, dy = y - KEY_ICON_MAX_DIM / 2;
+
+			pixels[y * KEY_ICON_MAX_DIM + x] = (dx * dx + dy * dy < radius * radius) ? 0x00 : 0xFF;
+		}
+	}
+}
+
+// Writes the layout and its icons, and compiles them. Returns the size of the profile, 0 if not compiled.
+static long compile_layout(const char *compiler)
+{
+	uint8_t pixels[KEY_ICON_MAX_DIM * KEY_ICON_MAX_DIM];
+	char path[32], command[512];
+	FILE *layout = fopen(UPDATE_LAYOUT_PATH, "w");
+	FILE *f;
+	long size = 0;
+
+	if (!layout) {
+		perror(UPDATE_LAYOUT_PATH);
+		exit(1);
+	}
+	for (uint8_t key_id = 0; key_id < KEY_COUNT; ++key_id) {
+		snprintf(path, sizeof(path), UPDATE_ICON_PATH, key_id);
+		f = fopen(path, "wb");
+		if (!f) {
+			perror(path);
+			exit(1);
+		}
+		disc_icon(update_radius[key_id], pixels);
+		fprintf(f, "P5\n%u %u\n255\n", KEY_ICON_MAX_DIM, KEY_ICON_MAX_DIM);
+		fwrite(pixels, 1, sizeof(pixels), f);
+		fclose(f);
+		fprintf(layout, "key %u 0x%02X icon %s\n", key_id, update_scancodes[key_id], path);
+	}
+	fclose(layout);
+
+	snprintf(command, sizeof(command), "%s compile %s %s >/dev/null 2>&1", compiler, UPDATE_LAYOUT_PATH,
+			UPDATE_PROFILE_PATH);
+	if (system(command) == 0 && (f = fopen(UPDATE_PROFILE_PATH, "rb")) != NULL) {
+		fseek(f, 0, SEEK_END);
+		size = ftell(f);
+		fclose(f);
+	}
+	remove(UPDATE_LAYOUT_PATH);
+	for (uint8_t key_id = 0; key_id < KEY_COUNT; ++key_id) {
+		snprintf(path, sizeof(path), UPDATE_ICON_PATH, key_id);
+		remove(path);
+	}
+	return size;
+}
+
+// Reads the keys back and compares them with the layout
+static void check_keys(const char *session, const char *tty)
+{
+	uint8_t pixels[KEY_ICON_MAX_DIM * KEY_ICON_MAX_DIM];
+	uint8_t response[LINK_RESPONSE_PAYLOAD_MAX];
+	size_t response_len;
+	kbd_link_t link;
+	bool b_match = true;
+
+	if (kbd_link_open(&link, tty) < 0) {
+		perror(tty);
+		exit(1);
+	}
+	expect(kbd_link_sync(&link) == 0
+			&& kbd_link_transact(&link, LINK_CMD_GET_KEY_HASHES, NULL, 0, response, &response_len) == 0
+			&& response_len == 3 * KEY_COUNT, session, "no key hashes");
+	for (uint8_t key_id = 0; key_id < KEY_COUNT; ++key_id) {
+		uint16_t row_crc[KEY_ICON_MAX_DIM];
+
+		disc_icon(update_radius[key_id], pixels);
+		for (uint8_t row = 0; row < KEY_ICON_MAX_DIM; ++row) {
+			row_crc[row] = crc16_update(CRC16_INIT, &pixels[row * KEY_ICON_MAX_DIM], KEY_ICON_MAX_DIM);
+		}
+		b_match &= response[3 * key_id] == update_scancodes[key_id];
+		b_match &= ((response[3 * key_id + 1] << 8) | response[3 * key_id + 2])
+				== icon_hash(KEY_ICON_MAX_DIM, KEY_ICON_MAX_DIM, row_crc);
+	}
+	expect(b_match, session, "keys differ from the layout");
+	kbd_link_close(&link);
+}
+
+static void run_updates(const char *ctl, const char *compiler)
+{
+	struct termios tio;
+	int master, slave;
+	const char *tty;
+	pid_t pid;
+	int status;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master)) {
+		perror("posix_openpt");
+		exit(1);
+	}
+	tty = ptsname(master);
+	// Held open between the kbd_ctl runs, the keyboard side stops once it is closed
+	slave = open(tty, O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		perror(tty);
+		exit(1);
+	}
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+	drop_percent = 0;
+	corrupt_rate = 0;
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0) {
+		close(slave);
+		device_run(master);
+	}
+
+	for (uint8_t key_id = 0; key_id < KEY_COUNT; ++key_id) {
+		update_scancodes[key_id] = 0x04 + key_id;
+		update_radius[key_id] = 8 + key_id;
+	}
+	for (size_t i = 0; i < sizeof(edits) / sizeof(edits[0]); ++i) {
+		char session[64], command[512], output[256] = "";
+		unsigned changed = 0;
+		unsigned long sent = 0, received = 0;
+		long profile_size;
+		FILE *p;
+
+		snprintf(session, sizeof(session), "edit sequence (%s)", edits[i].name);
+		if (edits[i].icon_key >= 0) {
+			update_radius[edits[i].icon_key] += 3;
+		}
+		if (edits[i].scancode_key >= 0) {
+			update_scancodes[edits[i].scancode_key]++;
+		}
+		profile_size = compile_layout(compiler);
+		expect(profile_size > 0, session, "layout not compiled");
+
+		snprintf(command, sizeof(command), "%s %s update %s 2>&1", ctl, tty, UPDATE_PROFILE_PATH);
+		p = popen(command, "r");
+		if (!p) {
+			perror(command);
+			exit(1);
+		}
+		while (fgets(output, sizeof(output), p)
+				&& sscanf(output, "%u keys changed, %lu bytes sent, %lu received", &changed, &sent, &received) != 3) {
+		}
+		if (pclose(p) != 0 || sent == 0) {
+			printf("%s: %s", session, output);
+			failures++;
+		}
+		expect(changed == edits[i].keys_changed, session, "wrong number of keys sent");
+		check_keys(session, tty);
+		printf("%s: %u keys changed, %lu bytes sent, %lu received, profile of %ld bytes\n", session,
+				changed, sent, received, profile_size);
+	}
+	remove(UPDATE_PROFILE_PATH);
+
+	close(slave);
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+		expect(false, "edit sequence", "keyboard side failed");
+	}
+	close(master);
+}
+
+int main(int argc, char **argv)
+{
+	const char *ctl = argc > 1 ? argv[1] : "./kbd_ctl";
+	const char *compiler = argc > 2 ? argv[2] : "./kbd_profile";
+	char session[32];
+
+	run_session("clean channel", 0, 0, 1);
+	for (unsigned seed = 2; seed < 6; ++seed) {
+		snprintf(session, sizeof(session), "noisy channel %u", seed - 1);
+		run_session(session, 5, 20, seed);
+	}
+	run_updates(ctl, compiler);
+
+	printf("link_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
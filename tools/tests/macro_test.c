@@ -0,0 +1,410 @@
+/*
+ * macro_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test of the macro interpreter (ui/macro.c) against a mock HID sink.
+ * The sink writes each key and modifier it takes to a trace, "D04 U04 M02
+ * m02", with a '|' at the end of each 1 ms step, and can refuse calls as a
+ * full HID queue does. The cases check the output and timing of each opcode,
+ * that a step runs at most MACRO_STEP_MAX_OPS opcodes, that refused calls
+ * are retried without losing or repeating an event, and that every key is
+ * released when a macro ends or is stopped. macro_validate() must accept the
+ * usages the keyboard report holds and reject the rest, unknown opcodes,
+ * truncated operands and unbalanced repeat blocks.
+ *
+ * Build:  make -C tools/tests macro_test
+ * Usage:  macro_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "key_layout.h"
+#include "macro.h"
+
+#define TRACE_MAX_SIZE		8192
+#define STEPS_MAX			10000
+#define RANDOM_MACROS		500
+#define RANDOM_MAX_SIZE		64
+#define REFUSE_PERCENT		30
+
+#define MOD_LEFT_CTRL		0x01
+#define MOD_LEFT_SHIFT		0x02
+
+// Sink calls taken, as "D04 U04 M02 m02 |", one '|' per step
+static char trace[TRACE_MAX_SIZE];
+// Sink calls taken in the current step
+static unsigned step_calls;
+// Percent of the calls refused, as by a full HID queue
+static unsigned refuse_percent;
+static bool b_refuse_all;
+// Keys and modifiers the mock host sees pressed
+static bool b_key_down[256];
+static uint8_t mods_down;
+
+static unsigned failures;
+
+static void expect(const char *test, const char *what, bool b_ok)
+{
+	if (!b_ok) {
+		printf("%s: %s\n", test, what);
+		failures++;
+	}
+}
+
+static bool take(char c, uint8_t arg)
+{
+	if (b_refuse_all || (unsigned)rand() % 100 < refuse_percent) {
+		return false;
+	}
+	if (strlen(trace) + 5 < sizeof(trace)) {
+		sprintf(trace + strlen(trace), "%c%02X ", c, arg);
+	}
+	step_calls++;
+	return true;
+}
+
+static bool sink_key_down(uint8_t usage)
+{
+	if (!take('D', usage)) {
+		return false;
+	}
+	b_key_down[usage] = true;
+	return true;
+}
+
+static bool sink_key_up(uint8_t usage)
+{
+	if (!take('U', usage)) {
+		return false;
+	}
+	b_key_down[usage] = false;
+	return true;
+}
+
+static bool sink_modifier_down(uint8_t mask)
+{
+	if (!take('M', mask)) {
+		return false;
+	}
+	mods_down |= mask;
+	return true;
+}
+
+static bool sink_modifier_up(uint8_t mask)
+{
+	if (!take('m', mask)) {
+		return false;
+	}
+	mods_down &= ~mask;
+	return true;
+}
+
+static const macro_sink_t sink = {
+	sink_key_down, sink_key_up, sink_modifier_down, sink_modifier_up,
+};
+
+static void reset_host(void)
+{
+	trace[0] = '\0';
+	memset(b_key_down, 0, sizeof(b_key_down));
+	mods_down = 0;
+	refuse_percent = 0;
+	b_refuse_all = false;
+}
+
+static bool host_keys_up(void)
+{
+	for (unsigned usage = 0; usage < 256; ++usage) {
+		if (b_key_down[usage]) {
+			return false;
+		}
+	}
+	return mods_down == 0;
+}
+
+// Runs one step, checks its budget of opcodes
+static void step(const char *test, macro_vm_t *vm)
+{
+	step_calls = 0;
+	macro_step(vm, &sink);
+	// A MACRO_OP_TYPE character can take four calls, its release and shift change included
+	expect(test, "too many calls in a step", step_calls <= 4 * MACRO_STEP_MAX_OPS);
+	if (strlen(trace) + 1 < sizeof(trace)) {
+		strcat(trace, "|");
+	}
+}
+
+// Runs code to its end, with the starting key released after release_steps, returns the steps
+static unsigned run(const char *test, const uint8_t *code, uint16_t len, unsigned release_steps)
+{
+	macro_vm_t vm;
+	unsigned steps = 0;
+
+	macro_start(&vm, code, len);
+	while (macro_is_running(&vm) && steps < STEPS_MAX) {
+		if (steps == release_steps) {
+			macro_release(&vm);
+		}
+		step(test, &vm);
+		steps++;
+	}
+	expect(test, "macro does not end", !macro_is_running(&vm));
+	expect(test, "keys left pressed", host_keys_up());
+	return steps;
+}
+
+static void expect_trace(const char *test, const char *expected)
+{
+	if (strcmp(trace, expected)) {
+		printf("%s: trace \"%s\", expected \"%s\"\n", test, trace, expected);
+		failures++;
+	}
+}
+
+#define RUN(test, release_steps, expected, ...) \
+	do { \
+		static const uint8_t code[] = {__VA_ARGS__}; \
+		reset_host(); \
+		run(test, code, sizeof(code), release_steps); \
+		expect_trace(test, expected); \
+	} while (0)
+
+static void test_opcodes(void)
+{
+	RUN("tap", 0, "D04 U04 |", MACRO_TAP(0x04));
+	RUN("modifiers", 0, "M03 D04 U04 m01 m02 |",
+			MACRO_MOD_DOWN(MOD_LEFT_CTRL | MOD_LEFT_SHIFT), MACRO_TAP(0x04), MACRO_MOD_UP(MOD_LEFT_CTRL));
+	RUN("end", 0, "D04 U04 |", MACRO_KEY_DOWN(0x04), MACRO_END(), MACRO_TAP(0x05));
+	RUN("empty", 0, "|", MACRO_END());
+	RUN("delay", 0, "D04 |||U04 |", MACRO_KEY_DOWN(0x04), MACRO_DELAY(3), MACRO_KEY_UP(0x04));
+	RUN("delay 0", 0, "D04 U04 |", MACRO_KEY_DOWN(0x04), MACRO_DELAY(0), MACRO_KEY_UP(0x04));
+	RUN("delay 1", 0, "D04 U04 |D05 U05 |", MACRO_TAP(0x04), MACRO_DELAY(1), MACRO_TAP(0x05));
+	RUN("repeat", 0, "D04 U04 D04 U04 D04 U04 D05 U05 |",
+			MACRO_REPEAT(3), MACRO_TAP(0x04), MACRO_REPEAT_END(), MACRO_TAP(0x05));
+	// 17 opcodes, the last tap goes out on the next step
+	RUN("nested repeat", 0, "D04 U04 D05 U05 D05 U05 D04 U04 D05 U05 |D05 U05 |",
+			MACRO_REPEAT(2), MACRO_TAP(0x04), MACRO_REPEAT(2), MACRO_TAP(0x05), MACRO_REPEAT_END(),
+			MACRO_REPEAT_END());
+	RUN("wait release", 2, "D04 ||U04 |", MACRO_KEY_DOWN(0x04), MACRO_WAIT_RELEASE(), MACRO_KEY_UP(0x04));
+	RUN("released before wait", 0, "D04 U04 |", MACRO_KEY_DOWN(0x04), MACRO_WAIT_RELEASE(), MACRO_KEY_UP(0x04));
+	RUN("repeat while held", 3, "D04 U04 |D04 U04 |D04 U04 ||",
+			MACRO_REPEAT(0), MACRO_TAP(0x04), MACRO_DELAY(1), MACRO_REPEAT_END());
+	RUN("keys held at the end", 0, "D04 M02 m02 U04 |", MACRO_KEY_DOWN(0x04), MACRO_MOD_DOWN(MOD_LEFT_SHIFT));
+	// "Ab": shift only around the capital, each release just before the next press
+	RUN("type", 0, "M02 D04 U04 m02 D05 U05 |", MACRO_TYPE(2), 0x04 | MACRO_TYPE_SHIFT, 0x05);
+	RUN("type repeated usage", 0, "D12 U12 D12 U12 |", MACRO_TYPE(2), 0x12, 0x12);
+	RUN("type nothing", 0, "D04 U04 |", MACRO_TYPE(0), MACRO_TAP(0x04));
+}
+
+static void test_budget(void)
+{
+	static const uint8_t taps[] = {
+		MACRO_REPEAT(100), MACRO_TAP(0x04), MACRO_REPEAT_END(),
+	};
+	static const uint8_t spin[] = {
+		MACRO_REPEAT(0), MACRO_REPEAT_END(),
+	};
+	macro_vm_t vm;
+	unsigned steps;
+
+	// 300 opcodes: the step stops at its budget and goes on at the next
+	reset_host();
+	steps = run("budget", taps, sizeof(taps), 0);
+	expect("budget", "steps", steps == (3 * 100 + MACRO_STEP_MAX_OPS - 1) / MACRO_STEP_MAX_OPS);
+
+	// A loop without output nor delay returns at each step until the key is released
+	reset_host();
+	macro_start(&vm, spin, sizeof(spin));
+	for (int i = 0; i < 100; ++i) {
+		step("empty loop", &vm);
+	}
+	expect("empty loop", "ended while held", macro_is_running(&vm));
+	macro_release(&vm);
+	step("empty loop", &vm);
+	expect("empty loop", "not ended after release", !macro_is_running(&vm));
+}
+
+static void test_stop(void)
+{
+	static const uint8_t code[] = {
+		MACRO_MOD_DOWN(MOD_LEFT_SHIFT), MACRO_KEY_DOWN(0x04), MACRO_WAIT_RELEASE(), MACRO_TAP(0x05),
+	};
+	macro_vm_t vm;
+
+	reset_host();
+	macro_start(&vm, code, sizeof(code));
+	expect("stop", "not stopped", macro_stop(&vm, &sink) && !macro_is_running(&vm));
+	expect_trace("stop", "");
+
+	// Stopped with the keys held, the releases refused then taken by the steps
+	reset_host();
+	macro_start(&vm, code, sizeof(code));
+	step("stop held", &vm);
+	b_refuse_all = true;
+	expect("stop held", "stopped with a release refused", !macro_stop(&vm, &sink) && macro_is_running(&vm));
+	step("stop held", &vm);
+	expect("stop held", "stopped with a release refused", macro_is_running(&vm));
+	b_refuse_all = false;
+	macro_release(&vm);
+	step("stop held", &vm);
+	expect("stop held", "not stopped", !macro_is_running(&vm));
+	// The code after the wait must not run once stopped
+	expect_trace("stop held", "M02 D04 ||m02 U04 |");
+	expect("stop held", "keys left pressed", host_keys_up());
+
+	reset_host();
+	macro_start(&vm, code, sizeof(code));
+	step("stop", &vm);
+	expect("stop", "not stopped", macro_stop(&vm, &sink) && !macro_is_running(&vm));
+	expect_trace("stop", "M02 D04 |m02 U04 ");
+}
+
+// Random valid macro, without delays nor repeats while held
+static uint16_t random_macro(uint8_t *code)
+{
+	uint16_t len = 0;
+	uint8_t depth = 0;
+
+	while (len + 8 < RANDOM_MAX_SIZE) {
+		uint8_t usage = rand() % 4 == 0 ? KEY_USAGE_MODIFIER_FIRST + rand() % 8 : 0x04 + rand() % 8;
+
+		switch (rand() % 6) {
+		case 0:
+			code[len++] = MACRO_OP_KEY_DOWN;
+			code[len++] = usage;
+			break;
+		case 1:
+			code[len++] = MACRO_OP_KEY_UP;
+			code[len++] = usage;
+			break;
+		case 2:
+			code[len++] = rand() & 1 ? MACRO_OP_MOD_DOWN : MACRO_OP_MOD_UP;
+			code[len++] = 1 << (rand() % 8);
+			break;
+		case 3:
+			code[len++] = MACRO_OP_TYPE;
+			code[len++] = 3;
+			for (int i = 0; i < 3; ++i) {
+				code[len++] = (0x04 + rand() % 4) | (rand() & 1 ? MACRO_TYPE_SHIFT : 0);
+			}
+			break;
+		case 4:
+			if (depth < MACRO_REPEAT_DEPTH) {
+				code[len++] = MACRO_OP_REPEAT;
+				code[len++] = 1 + rand() % 3;
+				depth++;
+			}
+			break;
+		case 5:
+			if (depth) {
+				code[len++] = MACRO_OP_REPEAT_END;
+				depth--;
+			}
+			break;
+		}
+	}
+	while (depth--) {
+		code[len++] = MACRO_OP_REPEAT_END;
+	}
+	return len;
+}
+
+// Drops the '|' of a trace, the order of the calls taken is what must not change
+static void strip_steps(char *s)
+{
+	char *out = s;
+
+	for (; *s; ++s) {
+		if (*s != '|') {
+			*out++ = *s;
+		}
+	}
+	*out = '\0';
+}
+
+static void test_refused(void)
+{
+	static char expected[TRACE_MAX_SIZE];
+	uint8_t code[RANDOM_MAX_SIZE];
+	unsigned differ = 0;
+
+	for (int n = 0; n < RANDOM_MACROS; ++n) {
+		uint16_t len = random_macro(code);
+
+		expect("random macro", "not valid", macro_validate(code, len));
+		reset_host();
+		run("random macro", code, len, 0);
+		strip_steps(trace);
+		strcpy(expected, trace);
+
+		reset_host();
+		refuse_percent = REFUSE_PERCENT;
+		run("random macro refused", code, len, 0);
+		strip_steps(trace);
+		differ += strcmp(trace, expected) != 0;
+	}
+	expect("random macro refused", "calls lost or repeated", differ == 0);
+}
+
+static void test_validate(void)
+{
+	static const struct {
+		const char *name;
+		bool b_valid;
+		uint16_t len;
+		uint8_t code[16];
+	} cases[] = {
+		{"empty", true, 0, {0}},
+		{"tap", true, 4, {MACRO_TAP(0x04)}},
+		{"last key usage", true, 2, {MACRO_KEY_DOWN(KEY_USAGE_COUNT - 1)}},
+		{"left control", true, 2, {MACRO_KEY_DOWN(KEY_USAGE_MODIFIER_FIRST)}},
+		{"right GUI", true, 2, {MACRO_KEY_UP(KEY_USAGE_MODIFIER_LAST)}},
+		{"usage past the report", false, 2, {MACRO_KEY_DOWN(KEY_USAGE_COUNT)}},
+		{"usage before the modifiers", false, 2, {MACRO_KEY_UP(KEY_USAGE_MODIFIER_FIRST - 1)}},
+		{"usage past the modifiers", false, 2, {MACRO_KEY_DOWN(KEY_USAGE_MODIFIER_LAST + 1)}},
+		{"usage 0xFF", false, 2, {MACRO_KEY_UP(0xFF)}},
+		{"type shifted", true, 4, {MACRO_TYPE(2), 0x04 | MACRO_TYPE_SHIFT, KEY_USAGE_COUNT - 1}},
+		{"type past the report", false, 3, {MACRO_TYPE(1), KEY_USAGE_COUNT}},
+		{"type shifted past the report", false, 3, {MACRO_TYPE(1), KEY_USAGE_COUNT | MACRO_TYPE_SHIFT}},
+		{"type count past the end", false, 4, {MACRO_TYPE(3), 0x04, 0x05}},
+		{"type without count", false, 1, {MACRO_OP_TYPE}},
+		{"unknown opcode", false, 1, {MACRO_OP_COUNT}},
+		{"opcode 0xFF", false, 2, {0xFF, 0x04}},
+		{"key without usage", false, 1, {MACRO_OP_KEY_DOWN}},
+		{"truncated delay", false, 2, {MACRO_OP_DELAY, 0x10}},
+		{"delay", true, 3, {MACRO_DELAY(0x1234)}},
+		{"repeat not closed", false, 2, {MACRO_REPEAT(2)}},
+		{"repeat end alone", false, 1, {MACRO_REPEAT_END()}},
+		{"repeat ended before", false, 3, {MACRO_REPEAT_END(), MACRO_REPEAT(2)}},
+		{"repeat deepest", true, 12, {MACRO_REPEAT(2), MACRO_REPEAT(2), MACRO_REPEAT(2), MACRO_REPEAT(2),
+				MACRO_REPEAT_END(), MACRO_REPEAT_END(), MACRO_REPEAT_END(), MACRO_REPEAT_END()}},
+		{"repeat too deep", false, 15, {MACRO_REPEAT(2), MACRO_REPEAT(2), MACRO_REPEAT(2), MACRO_REPEAT(2),
+				MACRO_REPEAT(2), MACRO_REPEAT_END(), MACRO_REPEAT_END(), MACRO_REPEAT_END(), MACRO_REPEAT_END(),
+				MACRO_REPEAT_END()}},
+	};
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		bool b_valid = macro_validate(cases[i].code, cases[i].len);
+
+		if (b_valid != cases[i].b_valid) {
+			printf("validate %s: %s\n", cases[i].name, b_valid ? "accepted" : "rejected");
+			failures++;
+		}
+	}
+}
+
+int main(void)
+{
+	srand(1);
+	test_opcodes();
+	test_budget();
+	test_stop();
+	test_refused();
+	test_validate();
+
+	printf("macro_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,259 @@
+/*
+ * macro_type_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test and benchmark of macro text typing: MACRO_OP_TYPE run by the macro
+ * interpreter (ui/macro.c) through the HID keyboard interface (udi_hid_kbd.c)
+ * and its report queue, one step and one flush per frame as in
+ * main_sof_action(). The test plays a US layout host that polls the endpoint
+ * every UDI_HID_KBD_INTERVAL frames and types the character of each usage
+ * pressed, shifted or not. The text it reconstructs must be the text of the
+ * macro, also when the host skips polls. A report may press a single new
+ * key, the host would otherwise type them in usage order.
+ *
+ * The characters per second at the host polling rate are printed, with the
+ * reports per character, against the 300 ms per action of the former
+ * sequence table.
+ *
+ * Build:  make -C tools/tests macro_type_test
+ * Usage:  macro_type_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "macro.h"
+#include "udd.h"
+#include "udi_hid.h"
+#include "udi_hid_kbd.h"
+
+#define USAGE_MAP_SIZE		(256 / 8)
+#define TEXT_MAX_SIZE		1024
+#define CODE_MAX_SIZE		(TEXT_MAX_SIZE + TEXT_MAX_SIZE / 255 * 2 + 2)
+#define FRAMES_MAX			100000
+#define SKIP_PERCENT		30
+#define BENCH_ROUNDS		200
+
+#define MOD_SHIFT			(0x02 | 0x20)
+// Former sequence table: one action each SEQUENCE_PERIOD of 150 counted frames, every other SOF
+#define SEQUENCE_ACTION_MS	300
+
+// Characters of the usages 0x04 to 0x38 on a US layout, unshifted and shifted
+#define KEYMAP_FIRST		0x04
+#define KEYMAP_SIZE			(0x38 - KEYMAP_FIRST + 1)
+static const char keymap[2][KEYMAP_SIZE + 1] = {
+	"abcdefghijklmnopqrstuvwxyz1234567890\n\0\0\t -=[]\\\0;'`,./",
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZ!@#$%^&*()\n\0\0\t _+{}|\0:\"~<>?",
+};
+
+static const char *const texts[] = {
+	// Typed by the push button demo macro
+	"Adjustable keyboard, coming soon!",
+	// Repeated letters each need a release report, shift changes do not
+	"Committee bookkeeper Mississippi: 1000 balloons, aaaa AAAA aAaA.\n"
+	"The quick brown fox jumps over the lazy dog; THE QUICK BROWN FOX (again) @ 10:00?\n",
+};
+
+udd_ctrl_request_t udd_g_ctrlreq;
+
+// Transfer armed on the endpoint, taken by host_poll()
+static bool b_ep_armed;
+static const uint8_t *ep_buf;
+static iram_size_t ep_size;
+static udd_callback_trans_t ep_callback;
+
+// Usages the host sees pressed, and the text it typed
+static uint8_t host_usages[USAGE_MAP_SIZE];
+static char host_text[TEXT_MAX_SIZE + 1];
+static size_t host_len;
+static unsigned host_reports;
+static bool b_keys_together;
+
+static const macro_sink_t sink = {
+	udi_hid_kbd_down, udi_hid_kbd_up, udi_hid_kbd_modifier_down, udi_hid_kbd_modifier_up,
+};
+
+static unsigned failures;
+
+bool udi_hid_setup(uint8_t *rate, uint8_t *protocol, uint8_t *report_desc, bool (*setup_report)(void))
+{
+	(void)rate;
+	(void)protocol;
+	(void)report_desc;
+	(void)setup_report;
+	return true;
+}
+
+bool udd_ep_run(udd_ep_id_t ep, bool b_shortpacket, uint8_t *buf, iram_size_t buf_size,
+		udd_callback_trans_t callback)
+{
+	(void)ep;
+	(void)b_shortpacket;
+	b_ep_armed = true;
+	ep_buf = buf;
+	ep_size = buf_size;
+	ep_callback = callback;
+	return true;
+}
+
+static void expect(const char *test, const char *what, bool b_ok)
+{
+	if (!b_ok) {
+		printf("%s: %s\n", test, what);
+		failures++;
+	}
+}
+
+static double seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Macro typing text, 0 if a character is not on the keymap
+static uint16_t make_macro(const char *text, uint8_t *code)
+{
+	size_t len = strlen(text);
+	uint16_t size = 0;
+
+	for (size_t start = 0; start < len; start += 255) {
+		size_t count = len - start < 255 ? len - start : 255;
+
+		code[size++] = MACRO_OP_TYPE;
+		code[size++] = count;
+		for (size_t i = start; i < start + count; ++i) {
+			const char *c = memchr(keymap[0], text[i], KEYMAP_SIZE);
+			uint8_t shift = 0;
+
+			if (!c || !text[i]) {
+				c = memchr(keymap[1], text[i], KEYMAP_SIZE);
+				shift = MACRO_TYPE_SHIFT;
+			}
+			if (!c || !text[i]) {
+				return 0;
+			}
+			code[size++] = (KEYMAP_FIRST + (c - keymap[shift ? 1 : 0])) | shift;
+		}
+	}
+	code[size++] = MACRO_OP_END;
+	return size;
+}
+
+// Types the keys pressed by the report of the next frame, if one is armed
+static void host_poll(void)
+{
+	uint8_t usages[USAGE_MAP_SIZE];
+	unsigned pressed = 0;
+
+	if (!b_ep_armed) {
+		return;
+	}
+	// N-key rollover report: the modifiers, then one bit per usage
+	memset(usages, 0, sizeof(usages));
+	memcpy(usages, &ep_buf[1], ep_size - 1);
+	usages[UDI_HID_KBD_MODIFIER_USAGE_MIN / 8] = ep_buf[0];
+	for (unsigned usage = KEYMAP_FIRST; usage < KEYMAP_FIRST + KEYMAP_SIZE; ++usage) {
+		bool b_shift = ep_buf[0] & MOD_SHIFT;
+
+		if ((usages[usage / 8] & ~host_usages[usage / 8]) & (1 << (usage % 8))) {
+			if (++pressed > 1) {
+				b_keys_together = true;
+			}
+			if (host_len < TEXT_MAX_SIZE) {
+				host_text[host_len++] = keymap[b_shift][usage - KEYMAP_FIRST];
+			}
+		}
+	}
+	memcpy(host_usages, usages, sizeof(host_usages));
+	host_reports++;
+
+	b_ep_armed = false;
+	ep_callback(UDD_EP_TRANSFER_OK, ep_size, UDI_HID_KBD_EP_IN);
+}
+
+static bool host_keys_up(void)
+{
+	for (size_t i = 0; i < sizeof(host_usages); ++i) {
+		if (host_usages[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Types text with the host polling all but skip_percent of its intervals, returns the frames taken
+static unsigned type(const char *test, const char *text, unsigned skip_percent)
+{
+	static uint8_t code[CODE_MAX_SIZE];
+	uint16_t size = make_macro(text, code);
+	macro_vm_t vm;
+	unsigned frame;
+
+	expect(test, "text not on the keymap", size != 0);
+	expect(test, "macro not valid", macro_validate(code, size));
+	host_len = 0;
+	host_reports = 0;
+	b_keys_together = false;
+	macro_start(&vm, code, size);
+	macro_release(&vm);
+	for (frame = 1; frame < FRAMES_MAX; ++frame) {
+		macro_step(&vm, &sink);
+		udi_hid_kbd_report_flush();
+		if (frame % UDI_HID_KBD_INTERVAL == 0 && (unsigned)rand() % 100 >= skip_percent) {
+			host_poll();
+		}
+		if (!macro_is_running(&vm) && !b_ep_armed && host_keys_up()) {
+			break;
+		}
+	}
+	host_text[host_len] = '\0';
+	expect(test, "macro does not end", frame < FRAMES_MAX);
+	expect(test, "keys pressed in the same report", !b_keys_together);
+	if (strcmp(host_text, text)) {
+		printf("%s: host typed \"%s\"\n", test, host_text);
+		failures++;
+	}
+	return frame;
+}
+
+int main(void)
+{
+	char test[32];
+
+	srand(1);
+	udi_api_hid_kbd.setup();
+	expect("enable", "refused", udi_api_hid_kbd.enable());
+
+	for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); ++i) {
+		size_t len = strlen(texts[i]);
+		unsigned frames;
+		double start, cpu_s;
+
+		snprintf(test, sizeof(test), "text %zu", i);
+		frames = type(test, texts[i], 0);
+		printf("macro_type_test (text %zu): %zu chars in %u frames, %.0f chars/s, %.2f reports per char"
+				" (sequence table: %.1f chars/s)\n", i, len, frames, len * 1000.0 / frames,
+				(double)host_reports / len, 1000.0 / (2 * SEQUENCE_ACTION_MS));
+
+		snprintf(test, sizeof(test), "text %zu, polls skipped", i);
+		type(test, texts[i], SKIP_PERCENT);
+
+		// Time of the interpreter and the interface on this host
+		snprintf(test, sizeof(test), "text %zu, benchmark", i);
+		start = seconds();
+		for (int round = 0; round < BENCH_ROUNDS; ++round) {
+			type(test, texts[i], 0);
+		}
+		cpu_s = seconds() - start;
+		printf("macro_type_test (text %zu): %.3f us per char on this host\n", i,
+				cpu_s / BENCH_ROUNDS / len * 1e6);
+	}
+
+	printf("macro_type_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,281 @@
+/*
+ * profile_parser_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test of the streaming profile parser (comm/profile_parser.c). Random
+ * profiles mixing key (0xDEAD), macro (0xDEAE) and run-length key (0xDEAF)
+ * sections are parsed whole by a batch parser written from the format in
+ * comm.c, then fed to the streaming parser in random fragments. Both must
+ * report the same keys, icon rows and macros, in the same order.
+ *
+ * Build:  make -C tools/tests profile_parser_test
+ * Usage:  profile_parser_test [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "comm.h"
+#include "profile_parser.h"
+
+#define PROFILE_MAX_SIZE		(64 * 1024)
+#define LOG_MAX_SIZE			(256 * 1024)
+#define TEST_POOL_SIZE			1024
+#define TEST_ICON_MAX_DIM		60
+#define TEST_KEY_COUNT			16
+
+typedef struct {
+	uint8_t data[LOG_MAX_SIZE];
+	size_t len;
+} event_log_t;
+
+// Log the callbacks write to
+static event_log_t *current_log;
+
+static uint8_t profile[PROFILE_MAX_SIZE];
+static size_t profile_len;
+
+static void log_put(event_log_t *log, const uint8_t *data, size_t len)
+{
+	if (log->len + len > sizeof(log->data)) {
+		fprintf(stderr, "event log full\n");
+		exit(1);
+	}
+	memcpy(&log->data[log->len], data, len);
+	log->len += len;
+}
+
+static void log_key(event_log_t *log, uint8_t key_id, uint8_t scancode, uint8_t width, uint8_t height)
+{
+	uint8_t event[5] = {'K', key_id, scancode, width, height};
+
+	log_put(log, event, sizeof(event));
+}
+
+static void log_icon_row(event_log_t *log, uint8_t key_id, uint8_t width, uint8_t height, uint8_t row,
+		const uint8_t *pixels)
+{
+	uint8_t event[5] = {'R', key_id, width, height, row};
+
+	log_put(log, event, sizeof(event));
+	log_put(log, pixels, width);
+}
+
+static void log_macro(event_log_t *log, uint8_t key_id, const uint8_t *code, uint16_t len)
+{
+	uint8_t event[4] = {'M', key_id, len >> 8, len};
+
+	log_put(log, event, sizeof(event));
+	log_put(log, code, len);
+}
+
+static void stream_key(uint8_t key_id, uint8_t scancode, uint8_t width, uint8_t height)
+{
+	log_key(current_log, key_id, scancode, width, height);
+}
+
+static void stream_icon_row(uint8_t key_id, uint8_t width, uint8_t height, uint8_t row,
+		const uint8_t *pixels)
+{
+	log_icon_row(current_log, key_id, width, height, row, pixels);
+}
+
+static void stream_macro(uint8_t key_id, const uint8_t *code, uint16_t len)
+{
+	log_macro(current_log, key_id, code, len);
+}
+
+static const profile_parser_callbacks_t stream_callbacks = {
+	.key = stream_key,
+	.icon_row = stream_icon_row,
+	.macro = stream_macro,
+};
+
+static void put(uint8_t byte)
+{
+	if (profile_len == sizeof(profile)) {
+		fprintf(stderr, "profile full\n");
+		exit(1);
+	}
+	profile[profile_len++] = byte;
+}
+
+static void put_identifier(uint16_t identifier)
+{
+	put(identifier >> 8);
+	put(identifier);
+}
+
+// Writes a random profile to profile[]. Macros fit in a pool of TEST_POOL_SIZE bytes.
+static void generate_profile(void)
+{
+	unsigned sections = rand() % 16;
+	unsigned pool_used = 0;
+
+	profile_len = 0;
+	for (unsigned section = 0; section < sections; ++section) {
+		unsigned kind = rand() % 3;
+		uint8_t width = rand() % TEST_ICON_MAX_DIM;
+		uint8_t height = rand() % TEST_ICON_MAX_DIM;
+
+		if (rand() % 8 == 0) {
+			// Keys without an icon keep the current one
+			width = (rand() % 2) ? 0 : width;
+			height = width ? 0 : height;
+		}
+
+		if (kind == 0) {
+			put_identifier(FILE_SECTION_IDENTIFIER);
+			put(rand() % TEST_KEY_COUNT);
+			put(rand());
+			put(width);
+			put(height);
+			for (unsigned i = 0; i < (unsigned) width * height; ++i) {
+				put(rand());
+			}
+		} else if (kind == 1) {
+			uint16_t len = rand() % 200;
+
+			if (pool_used + len > TEST_POOL_SIZE) {
+				len = 0;
+			}
+			pool_used += len;
+			put_identifier(FILE_MACRO_SECTION_IDENTIFIER);
+			put(rand() % TEST_KEY_COUNT);
+			put(len >> 8);
+			put(len);
+			for (unsigned i = 0; i < len; ++i) {
+				put(rand());
+			}
+		} else {
+			unsigned left = (unsigned) width * height;
+
+			put_identifier(FILE_RLE_SECTION_IDENTIFIER);
+			put(rand() % TEST_KEY_COUNT);
+			put(rand());
+			put(width);
+			put(height);
+			while (left) {
+				// Mostly short runs, some long ones split as 255, 0, rest
+				unsigned run = (rand() % 4) ? rand() % 40 : rand() % 700;
+
+				if (run > left) {
+					run = left;
+				}
+				left -= run;
+				while (run > 255) {
+					put(255);
+					put(0);
+					run -= 255;
+				}
+				put(run);
+			}
+		}
+	}
+	if (rand() % 2) {
+		// Padding after the last section, as XMODEM leaves it
+		for (unsigned i = 2 + rand() % 126; i; --i) {
+			put(0x1A);
+		}
+	}
+}
+
+// Parses the whole of profile[] at once, as comm_process() did before the streaming parser
+static void batch_parse(event_log_t *log)
+{
+	uint8_t row_buf[256];
+	size_t idx = 0;
+
+	while (idx + 2 <= profile_len) {
+		uint16_t identifier = (profile[idx] << 8) | profile[idx + 1];
+		idx += 2;
+
+		if (identifier == FILE_MACRO_SECTION_IDENTIFIER) {
+			uint8_t key_id = profile[idx];
+			uint16_t len = (profile[idx + 1] << 8) | profile[idx + 2];
+			idx += 3;
+			log_macro(log, key_id, &profile[idx], len);
+			idx += len;
+		} else if (identifier == FILE_SECTION_IDENTIFIER) {
+			uint8_t key_id = profile[idx];
+			uint8_t width = profile[idx + 2];
+			uint8_t height = profile[idx + 3];
+			log_key(log, key_id, profile[idx + 1], width, height);
+			idx += 4;
+			if (!width || !height) {
+				continue;
+			}
+			for (uint8_t row = 0; row < height; ++row) {
+				log_icon_row(log, key_id, width, height, row, &profile[idx]);
+				idx += width;
+			}
+		} else if (identifier == FILE_RLE_SECTION_IDENTIFIER) {
+			uint8_t key_id = profile[idx];
+			uint8_t width = profile[idx + 2];
+			uint8_t height = profile[idx + 3];
+			unsigned pixel = 0;
+			unsigned count = (unsigned) width * height;
+			uint8_t color = FILE_RLE_WHITE;
+			log_key(log, key_id, profile[idx + 1], width, height);
+			idx += 4;
+			while (pixel < count) {
+				for (uint8_t run = profile[idx++]; run; --run, ++pixel) {
+					row_buf[pixel % width] = color;
+					if (pixel % width == (unsigned) width - 1) {
+						log_icon_row(log, key_id, width, height, pixel / width, row_buf);
+					}
+				}
+				color = (color == FILE_RLE_WHITE) ? FILE_RLE_BLACK : FILE_RLE_WHITE;
+			}
+		} else {
+			break;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static event_log_t batch_log;
+	static event_log_t stream_log;
+	static uint8_t pool[TEST_POOL_SIZE];
+	unsigned iterations = (argc > 1) ? atoi(argv[1]) : 2000;
+	unsigned failures = 0;
+	profile_parser_t parser;
+
+	srand(1);
+	for (unsigned it = 0; it < iterations; ++it) {
+		size_t pos = 0;
+
+		generate_profile();
+		batch_log.len = 0;
+		batch_parse(&batch_log);
+
+		stream_log.len = 0;
+		current_log = &stream_log;
+		profile_parser_init(&parser, &stream_callbacks, pool, sizeof(pool));
+		while (pos < profile_len) {
+			// Single bytes, XMODEM packets and anything in between
+			size_t chunk = (rand() % 4) ? 1 + rand() % 16 : 1 + rand() % 1100;
+
+			if (chunk > profile_len - pos) {
+				chunk = profile_len - pos;
+			}
+			profile_parser_feed(&parser, &profile[pos], chunk);
+			pos += chunk;
+		}
+
+		if (!profile_parser_is_complete(&parser)) {
+			printf("iteration %u: profile of %zu bytes not complete\n", it, profile_len);
+			failures++;
+		} else if (stream_log.len != batch_log.len
+				|| memcmp(stream_log.data, batch_log.data, batch_log.len)) {
+			printf("iteration %u: streaming parser differs from the batch parser\n", it);
+			failures++;
+		}
+	}
+
+	printf("profile_parser_test: %u of %u profiles failed\n", failures, iterations);
+	return failures ? 1 : 0;
+}
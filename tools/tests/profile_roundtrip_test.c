@@ -0,0 +1,422 @@
+/*
+ * profile_roundtrip_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Round trip of a profile from the host compiler (tools/kbd_profile) to the
+ * firmware parser (comm/profile_parser.c). The test writes a layout and its
+ * PGM icons, compiles them with kbd_profile, and feeds the profile in random
+ * fragments to the parser, applied as comm.c does. Each key must get the
+ * scancode and icon of the layout, each macro the bytecode written here with
+ * the macro_ops.h helpers, and macro_validate() must accept it. The icons the
+ * runs pay off for are sent as run-length sections, the others as raw pixels.
+ * Layouts the keyboard could not apply must make the compiler fail.
+ *
+ * Build:  make -C tools/tests profile_roundtrip_test
+ * Usage:  profile_roundtrip_test [kbd_profile]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "comm.h"
+#include "key_layout.h"
+#include "macro.h"
+#include "profile_parser.h"
+
+#define FRAGMENT_ROUNDS		100
+#define PROFILE_MAX_SIZE	(64 * 1024)
+
+#define LAYOUT_PATH			"profile_roundtrip.txt"
+#define PROFILE_PATH		"profile_roundtrip.bin"
+#define MOD_LEFT_CTRL		0x01
+
+typedef struct {
+	const char *path;
+	uint8_t width;
+	uint8_t height;
+	uint16_t identifier;
+	uint8_t pixels[KEY_ICON_MAX_DIM * KEY_ICON_MAX_DIM];
+} icon_t;
+
+static icon_t icons[] = {
+	// A black disc on white, a few runs per row
+	{"profile_roundtrip_disc.pgm", KEY_ICON_MAX_DIM, KEY_ICON_MAX_DIM, FILE_RLE_SECTION_IDENTIFIER, {0}},
+	// Black and white pixels in turn, from row to row too: one run per pixel
+	{"profile_roundtrip_noise.pgm", 21, 30, FILE_SECTION_IDENTIFIER, {0}},
+	// All white, runs longer than 255 pixels
+	{"profile_roundtrip_white.pgm", KEY_ICON_MAX_DIM, KEY_ICON_MAX_DIM, FILE_RLE_SECTION_IDENTIFIER, {0}},
+};
+
+// Typed by the macro of key 8, longer than a MACRO_OP_TYPE
+#define LONG_TEXT \
+	"The quick brown fox jumps over the lazy dog. THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG! " \
+	"0123456789 -=[]\\\\;'`,./ _+{}|:~<>? !@#$%^&*() tab\\tand newline\\n " \
+	"The quick brown fox jumps over the lazy dog. THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG!"
+
+static const char layout[] =
+	"# Round trip test layout\n"
+	"key 0 A icon profile_roundtrip_disc.pgm\n"
+	"key 1 0x28 icon profile_roundtrip_noise.pgm   # enter\n"
+	"key 2 0xE1\n"
+	"key 3 F12 icon profile_roundtrip_white.pgm\n"
+	"key 11 PAGEDOWN\n"
+	"\n"
+	"macro 0\n"
+	"    down LCTRL\n"
+	"    tap c\n"
+	"    up LCTRL\n"
+	"    delay 300\n"
+	"    repeat 3\n"
+	"        tap ENTER\n"
+	"    end\n"
+	"    repeat held\n"
+	"        type \"Hi, \\\"there\\\"!\\n\"\n"
+	"        delay 1000\n"
+	"    end\n"
+	"    wait_release\n"
+	"end\n"
+	"macro 8\n"
+	"    type \"" LONG_TEXT "\"\n"
+	"end\n";
+
+// Characters of the usages 0x04 to 0x38 on a US layout, unshifted and shifted
+#define KEYMAP_FIRST		0x04
+#define KEYMAP_SIZE			(0x38 - KEYMAP_FIRST + 1)
+static const char keymap[2][KEYMAP_SIZE + 1] = {
+	"abcdefghijklmnopqrstuvwxyz1234567890\n\0\0\t -=[]\\\0;'`,./",
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZ!@#$%^&*()\n\0\0\t _+{}|\0:\"~<>?",
+};
+
+static const uint8_t macro0[] = {
+	MACRO_MOD_DOWN(MOD_LEFT_CTRL), MACRO_TAP(0x06), MACRO_MOD_UP(MOD_LEFT_CTRL),
+	MACRO_DELAY(300),
+	MACRO_REPEAT(3), MACRO_TAP(0x28), MACRO_REPEAT_END(),
+	MACRO_REPEAT(0),
+	MACRO_TYPE(13),
+	0x0B | MACRO_TYPE_SHIFT, 0x0C, 0x36, 0x2C, 0x34 | MACRO_TYPE_SHIFT, 0x17, 0x0B, 0x08, 0x15, 0x08,
+	0x34 | MACRO_TYPE_SHIFT, 0x1E | MACRO_TYPE_SHIFT, 0x28,
+	MACRO_DELAY(1000),
+	MACRO_REPEAT_END(),
+	MACRO_WAIT_RELEASE(),
+	MACRO_END(),
+};
+
+// Scancode of each key in the layout, 0 for none
+static const uint8_t scancodes[KEY_COUNT] = {
+	[0] = 0x04, [1] = 0x28, [2] = 0xE1, [3] = 0x45, [11] = 0x4E,
+};
+// Icon of each key in the layout, -1 for none
+static const int key_icons[KEY_COUNT] = {
+	0, 1, -1, 2, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+// What the firmware applied, as comm.c does
+static struct {
+	uint8_t scancode;
+	uint8_t width;
+	uint8_t height;
+	uint8_t rows;
+	uint8_t pixels[KEY_ICON_MAX_DIM * KEY_ICON_MAX_DIM];
+	uint8_t macro[COMM_MACRO_POOL_SIZE];
+	uint16_t macro_len;
+	bool b_macro;
+} keys[KEY_COUNT];
+static bool b_rejected;
+
+static uint8_t profile[PROFILE_MAX_SIZE];
+static size_t profile_len;
+static unsigned failures;
+
+static void expect(const char *test, const char *what, bool b_ok)
+{
+	if (!b_ok) {
+		printf("%s: %s\n", test, what);
+		failures++;
+	}
+}
+
+static void key_received(uint8_t key_id, uint8_t scancode, uint8_t width, uint8_t height)
+{
+	if (key_id >= KEY_COUNT || !KEY_USAGE_IS_VALID(scancode)) {
+		b_rejected = true;
+		return;
+	}
+	keys[key_id].scancode = scancode;
+	keys[key_id].width = width;
+	keys[key_id].height = height;
+	keys[key_id].rows = 0;
+}
+
+static void icon_row_received(uint8_t key_id, uint8_t width, uint8_t height, uint8_t row,
+		const uint8_t *pixels)
+{
+	if (key_id >= KEY_COUNT || width != keys[key_id].width || height != keys[key_id].height
+			|| row != keys[key_id].rows) {
+		b_rejected = true;
+		return;
+	}
+	memcpy(&keys[key_id].pixels[row * width], pixels, width);
+	keys[key_id].rows++;
+}
+
+static void macro_received(uint8_t key_id, const uint8_t *code, uint16_t len)
+{
+	if (key_id >= KEY_COUNT || !macro_validate(code, len)) {
+		b_rejected = true;
+		return;
+	}
+	memcpy(keys[key_id].macro, code, len);
+	keys[key_id].macro_len = len;
+	keys[key_id].b_macro = true;
+}
+
+static const profile_parser_callbacks_t callbacks = {
+	.key = key_received,
+	.icon_row = icon_row_received,
+	.macro = macro_received,
+};
+
+static void make_icons(void)
+{
+	for (size_t i = 0; i < sizeof(icons) / sizeof(icons[0]); ++i) {
+		icon_t *icon = &icons[i];
+		FILE *f;
+
+		for (int y = 0; y < icon->height; ++y) {
+			for (int x = 0; x < icon->width; ++x) {
+				int dx = x - icon->width / 2, dy = y - icon->height / 2;
+				uint8_t *pixel = &icon->pixels[y * icon->width + x];
+				uint8_t black = rand() % (KEY_ICON_THRES_BLACK + 1);
+				uint8_t white = KEY_ICON_THRES_BLACK + 1 + rand() % (0xFF - KEY_ICON_THRES_BLACK);
+
+				if (i == 0) {
+					*pixel = dx * dx + dy * dy < 20 * 20 ? black : white;
+				} else if (i == 1) {
+					*pixel = (x + y) % 2 ? white : black;
+				} else {
+					*pixel = 0xFF;
+				}
+			}
+		}
+		f = fopen(icon->path, "wb");
+		if (!f) {
+			perror(icon->path);
+			exit(1);
+		}
+		fprintf(f, "P5\n%u %u\n255\n", icon->width, icon->height);
+		fwrite(icon->pixels, 1, (size_t)icon->width * icon->height, f);
+		fclose(f);
+	}
+}
+
+// Compiles the layout text, returns the exit status of kbd_profile
+static int compile(const char *compiler, const char *text)
+{
+	char command[512];
+	FILE *f = fopen(LAYOUT_PATH, "w");
+	int status;
+
+	if (!f) {
+		perror(LAYOUT_PATH);
+		exit(1);
+	}
+	fputs(text, f);
+	fclose(f);
+	snprintf(command, sizeof(command), "%s compile %s %s >/dev/null 2>&1", compiler, LAYOUT_PATH, PROFILE_PATH);
+	status = system(command);
+	remove(LAYOUT_PATH);
+	return status;
+}
+
+// Feeds the profile to a new parser in random fragments
+static void parse(void)
+{
+	static uint8_t pool[COMM_MACRO_POOL_SIZE];
+	profile_parser_t parser;
+	size_t pos = 0;
+
+	memset(keys, 0, sizeof(keys));
+	b_rejected = false;
+	profile_parser_init(&parser, &callbacks, pool, sizeof(pool));
+	while (pos < profile_len) {
+		size_t len = 1 + rand() % (rand() % 2 ? 8 : 1024);
+
+		len = len < profile_len - pos ? len : profile_len - pos;
+		profile_parser_feed(&parser, &profile[pos], len);
+		pos += len;
+	}
+	expect("parse", "profile not complete", profile_parser_is_complete(&parser));
+}
+
+// Text typed by the MACRO_OP_TYPE opcodes of code, NULL if it holds another opcode
+static const char *macro_text(const uint8_t *code, uint16_t len, unsigned *type_ops)
+{
+	static char text[COMM_MACRO_POOL_SIZE];
+	size_t text_len = 0;
+	uint16_t pc = 0;
+
+	*type_ops = 0;
+	while (pc < len && code[pc] == MACRO_OP_TYPE && pc + 1 < len) {
+		for (uint16_t i = 0; i < code[pc + 1] && pc + 2 + i < len; ++i) {
+			uint8_t c = code[pc + 2 + i];
+			uint8_t usage = c & MACRO_TYPE_USAGE_MASK;
+
+			if (usage < KEYMAP_FIRST || usage >= KEYMAP_FIRST + KEYMAP_SIZE) {
+				return NULL;
+			}
+			text[text_len++] = keymap[(c & MACRO_TYPE_SHIFT) ? 1 : 0][usage - KEYMAP_FIRST];
+		}
+		pc += 2 + code[pc + 1];
+		(*type_ops)++;
+	}
+	if (pc + 1 != len || code[pc] != MACRO_OP_END) {
+		return NULL;
+	}
+	text[text_len] = '\0';
+	return text;
+}
+
+static void check_profile(void)
+{
+	static const char long_text[] =
+		"The quick brown fox jumps over the lazy dog. THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG! "
+		"0123456789 -=[]\\;'`,./ _+{}|:~<>? !@#$%^&*() tab\tand newline\n "
+		"The quick brown fox jumps over the lazy dog. THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG!";
+	const char *text;
+	unsigned type_ops;
+	char test[32];
+
+	expect("parse", "section rejected", !b_rejected);
+	for (uint8_t key = 0; key < KEY_COUNT; ++key) {
+		const icon_t *icon = key_icons[key] >= 0 ? &icons[key_icons[key]] : NULL;
+
+		snprintf(test, sizeof(test), "key %u", key);
+		expect(test, "scancode", keys[key].scancode == scancodes[key]);
+		if (!icon) {
+			expect(test, "icon", keys[key].width == 0 && keys[key].height == 0);
+			continue;
+		}
+		expect(test, "icon size", keys[key].width == icon->width && keys[key].height == icon->height);
+		expect(test, "icon rows", keys[key].rows == icon->height);
+		for (int i = 0; i < icon->width * icon->height; ++i) {
+			// Run-length icons are 1 bit per pixel, as the panel shows them
+			bool b_same = icon->identifier == FILE_RLE_SECTION_IDENTIFIER
+					? (keys[key].pixels[i] > KEY_ICON_THRES_BLACK) == (icon->pixels[i] > KEY_ICON_THRES_BLACK)
+					: keys[key].pixels[i] == icon->pixels[i];
+
+			if (!b_same) {
+				expect(test, "icon pixels", false);
+				break;
+			}
+		}
+	}
+
+	expect("macro 0", "bytecode", keys[0].b_macro && keys[0].macro_len == sizeof(macro0)
+			&& !memcmp(keys[0].macro, macro0, sizeof(macro0)));
+	text = macro_text(keys[8].macro, keys[8].macro_len, &type_ops);
+	expect("macro 8", "not a text", keys[8].b_macro && text);
+	expect("macro 8", "text", text && !strcmp(text, long_text));
+	expect("macro 8", "split", type_ops == (strlen(long_text) + 254) / 255);
+	for (uint8_t key = 0; key < KEY_COUNT; ++key) {
+		if (key != 0 && key != 8 && keys[key].b_macro) {
+			printf("key %u: macro not in the layout\n", key);
+			failures++;
+		}
+	}
+}
+
+// The section identifiers, in the order of the layout
+static void check_sections(void)
+{
+	size_t pos = 0;
+
+	for (uint8_t key = 0; key < KEY_COUNT; ++key) {
+		const icon_t *icon = key_icons[key] >= 0 ? &icons[key_icons[key]] : NULL;
+		uint16_t identifier;
+
+		if (!scancodes[key]) {
+			continue;
+		}
+		identifier = (profile[pos] << 8) | profile[pos + 1];
+		if (identifier != (icon ? icon->identifier : FILE_SECTION_IDENTIFIER)) {
+			printf("key %u: section 0x%04X\n", key, identifier);
+			failures++;
+		}
+		if (identifier == FILE_RLE_SECTION_IDENTIFIER) {
+			// Runs up to the last pixel, 255 0 for the longer ones
+			unsigned count = (unsigned)icon->width * icon->height;
+
+			pos += 6;
+			while (count) {
+				count -= profile[pos] < count ? profile[pos] : count;
+				pos++;
+			}
+		} else {
+			pos += 6 + (icon ? (size_t)icon->width * icon->height : 0);
+		}
+	}
+	expect("sections", "macro 0 after the keys", pos + 1 < profile_len
+			&& ((profile[pos] << 8) | profile[pos + 1]) == FILE_MACRO_SECTION_IDENTIFIER);
+}
+
+static void test_errors(const char *compiler)
+{
+	static const struct {
+		const char *name;
+		const char *layout;
+	} cases[] = {
+		{"usage past the report", "key 0 0x78\n"},
+		{"usage past the modifiers", "key 0 0xE8\n"},
+		{"unknown usage", "key 0 FOO\n"},
+		{"key past the keyboard", "key 12 A\n"},
+		{"macro key past the keyboard", "macro 12\nend\n"},
+		{"macro usage past the report", "macro 0\ntap 0xF0\nend\n"},
+		{"macro without end", "macro 0\ntap A\n"},
+		{"repeat too deep", "macro 0\nrepeat 2\nrepeat 2\nrepeat 2\nrepeat 2\nrepeat 2\nend\nend\nend\nend\nend\nend\n"},
+		{"character not on the layout", "macro 0\ntype \"\x01\"\nend\n"},
+		{"icon missing", "key 0 A icon profile_roundtrip_none.pgm\n"},
+	};
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		if (compile(compiler, cases[i].layout) == 0) {
+			printf("compile %s: accepted\n", cases[i].name);
+			failures++;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *compiler = argc > 1 ? argv[1] : "./kbd_profile";
+	FILE *f;
+
+	srand(1);
+	make_icons();
+	if (compile(compiler, layout) != 0) {
+		printf("%s: layout not compiled\n", compiler);
+		return 1;
+	}
+	f = fopen(PROFILE_PATH, "rb");
+	if (!f) {
+		perror(PROFILE_PATH);
+		return 1;
+	}
+	profile_len = fread(profile, 1, sizeof(profile), f);
+	fclose(f);
+
+	check_sections();
+	for (int round = 0; round < FRAGMENT_ROUNDS; ++round) {
+		parse();
+		check_profile();
+	}
+	test_errors(compiler);
+
+	remove(PROFILE_PATH);
+	for (size_t i = 0; i < sizeof(icons) / sizeof(icons[0]); ++i) {
+		remove(icons[i].path);
+	}
+	printf("profile_roundtrip_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
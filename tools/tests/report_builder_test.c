@@ -0,0 +1,405 @@
+/*
+ * report_builder_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test of the report builder (ui/report_builder.c): key events go through
+ * the event ring to ui_key_down() and ui_key_up(), which refuse them while the
+ * HID queue is full. Every press and release must reach the interface once, in
+ * order, with at most one transition per key in each report interval. The
+ * latency of each transition runs from its scan to the interval where the
+ * interface took it, and must land in the matching histogram bucket.
+ *
+ * The last cases drive the real HID keyboard interface (udi_hid_kbd.c), with
+ * the test playing a host that can stop polling: the report queue fills up
+ * and refuses keys, changes merge while a report waits, and a key changed
+ * twice queues the state in between. Frames where a changed state could not
+ * be armed count as missed only while the host does not poll.
+ *
+ * Build:  make -C tools/tests report_builder_test
+ * Usage:  report_builder_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "event_ring.h"
+#include "report_builder.h"
+#include "scan_scheduler.h"
+#include "ui.h"
+#include "udd.h"
+#include "udi_hid.h"
+#include "udi_hid_kbd.h"
+
+#define RING_SIZE			256
+#define TRACE_MAX_SIZE		4096
+#define RANDOM_INTERVALS	20000
+#define INTERVAL_US			1000
+
+// Usage sent by key 0 to the HID keyboard interface, the others follow
+#define HID_USAGE_KEY0		0x04
+
+static uint32_t ring_buffer[RING_SIZE];
+static event_ring_t ring;
+
+// Percent of the calls refused, as by a full HID queue
+static unsigned refuse_percent;
+static bool b_refuse_all;
+
+// Transitions taken by the interface in the current interval
+static bool b_changed[KEY_COUNT];
+static bool b_twice;
+
+// Transitions taken, as "D3 U3 | ...", one '|' per interval
+static char trace[TRACE_MAX_SIZE];
+
+// Random test: edges of each key sent, and taken
+static unsigned edges_sent[KEY_COUNT];
+static unsigned edges_taken[KEY_COUNT];
+static bool b_key_down[KEY_COUNT];
+static bool b_out_of_order;
+
+// Keys go to the HID keyboard interface, polled by the host while b_host_polling is set
+static bool b_hid;
+static bool b_host_polling;
+
+udd_ctrl_request_t udd_g_ctrlreq;
+
+// Transfer armed on the keyboard endpoint
+static bool b_ep_armed;
+static const uint8_t *ep_buf;
+static udd_callback_trans_t ep_callback;
+
+// Simulated clock, one report interval per interval() call
+static uint32_t now_us;
+
+uint32_t scan_scheduler_get_time_us(void)
+{
+	return now_us;
+}
+
+static bool key_changed(uint8_t index, bool b_down)
+{
+	if (b_refuse_all || (unsigned) rand() % 100 < refuse_percent) {
+		return false;
+	}
+	if (b_changed[index]) {
+		b_twice = true;
+	}
+	b_changed[index] = true;
+	if (b_key_down[index] == b_down) {
+		b_out_of_order = true;
+	}
+	b_key_down[index] = b_down;
+	edges_taken[index]++;
+	if (strlen(trace) + 8 < sizeof(trace)) {
+		sprintf(trace + strlen(trace), "%c%u ", b_down ? 'D' : 'U', index);
+	}
+	return true;
+}
+
+bool ui_key_down(uint8_t index)
+{
+	return b_hid ? udi_hid_kbd_down(HID_USAGE_KEY0 + index) : key_changed(index, true);
+}
+
+bool ui_key_up(uint8_t index)
+{
+	return b_hid ? udi_hid_kbd_up(HID_USAGE_KEY0 + index) : key_changed(index, false);
+}
+
+bool udi_hid_setup(uint8_t *rate, uint8_t *protocol, uint8_t *report_desc, bool (*setup_report)(void))
+{
+	(void)rate;
+	(void)protocol;
+	(void)report_desc;
+	(void)setup_report;
+	return true;
+}
+
+bool udd_ep_run(udd_ep_id_t ep, bool b_shortpacket, uint8_t *buf, iram_size_t buf_size,
+		udd_callback_trans_t callback)
+{
+	(void)ep;
+	(void)b_shortpacket;
+	(void)buf_size;
+	b_ep_armed = true;
+	ep_buf = buf;
+	ep_callback = callback;
+	return true;
+}
+
+// Takes the armed report, as "[1 2] " with the keys pressed
+static void host_poll(void)
+{
+	char *out = trace + strlen(trace);
+
+	if (!b_ep_armed) {
+		return;
+	}
+	*out++ = '[';
+	for (uint8_t key_idx = 0; key_idx < KEY_COUNT; ++key_idx) {
+		uint8_t usage = HID_USAGE_KEY0 + key_idx;
+		bool b_down = ep_buf[1 + usage / 8] & (1 << (usage % 8));
+
+		if (b_down) {
+			if (b_key_down[key_idx] != b_down) {
+				edges_taken[key_idx]++;
+			}
+			if (out[-1] != '[') {
+				*out++ = ' ';
+			}
+			out += sprintf(out, "%u", key_idx);
+		} else if (b_key_down[key_idx]) {
+			edges_taken[key_idx]++;
+		}
+		b_key_down[key_idx] = b_down;
+	}
+	strcpy(out, "] ");
+	b_ep_armed = false;
+	ep_callback(UDD_EP_TRANSFER_OK, UDI_HID_KBD_EP_SIZE, UDI_HID_KBD_EP_IN);
+}
+
+// One frame: the report interval, then the SOF arming the report, then the host
+static void frame(void)
+{
+	now_us += INTERVAL_US;
+	report_builder_process();
+	udi_hid_kbd_report_flush();
+	if (b_host_polling) {
+		host_poll();
+	}
+	if (strlen(trace) + 64 > sizeof(trace)) {
+		trace[0] = '\0';
+	}
+}
+
+static void interval(void)
+{
+	now_us += INTERVAL_US;
+	memset(b_changed, 0, sizeof(b_changed));
+	report_builder_process();
+	strcat(trace, "| ");
+}
+
+static void reset(void)
+{
+	event_ring_init(&ring, ring_buffer, RING_SIZE);
+	report_builder_init(&ring);
+	memset(b_key_down, 0, sizeof(b_key_down));
+	memset(edges_sent, 0, sizeof(edges_sent));
+	memset(edges_taken, 0, sizeof(edges_taken));
+	b_twice = false;
+	b_out_of_order = false;
+	b_refuse_all = false;
+	refuse_percent = 0;
+	trace[0] = '\0';
+	now_us = 0;
+	b_hid = false;
+}
+
+static void reset_hid(void)
+{
+	reset();
+	b_hid = true;
+	b_host_polling = true;
+	b_ep_armed = false;
+	udi_api_hid_kbd.enable();
+}
+
+static void key_event(uint8_t key_idx, bool b_down)
+{
+	event_ring_push(&ring, KEY_EVENT_PACK(key_idx, b_down, now_us));
+	edges_sent[key_idx]++;
+}
+
+static unsigned failures;
+
+static void expect_trace(const char *test, const char *expected)
+{
+	if (strcmp(trace, expected)) {
+		printf("%s: \"%s\" instead of \"%s\"\n", test, trace, expected);
+		failures++;
+	}
+}
+
+// Checks the latency histogram, and the largest latency
+static void expect_latency(const char *test, const uint32_t *expected, uint32_t max_us)
+{
+	const uint32_t *histogram = report_builder_get_latency_histogram();
+
+	if (memcmp(histogram, expected, REPORT_LATENCY_BUCKETS * sizeof(uint32_t))) {
+		printf("%s: latency histogram", test);
+		for (int i = 0; i < REPORT_LATENCY_BUCKETS; ++i) {
+			printf(" %u", histogram[i]);
+		}
+		printf("\n");
+		failures++;
+	}
+	if (report_builder_get_max_latency_us() != max_us) {
+		printf("%s: latency of %u us instead of %u us\n", test, report_builder_get_max_latency_us(), max_us);
+		failures++;
+	}
+}
+
+int main(void)
+{
+	bool b_down[KEY_COUNT] = {false};
+
+	// A press refused until its release was queued
+	reset();
+	key_event(3, true);
+	b_refuse_all = true;
+	interval();
+	key_event(3, false);
+	interval();
+	b_refuse_all = false;
+	interval();
+	interval();
+	interval();
+	expect_trace("refused press", "| | D3 | U3 | | ");
+	// Pressed at 0 and taken at 3000, released at 1000 and taken at 4000
+	expect_latency("refused press", (const uint32_t[REPORT_LATENCY_BUCKETS]) {0, 0, 0, 0, 2}, 3000);
+
+	// Taps shorter than an interval
+	reset();
+	key_event(1, true);
+	key_event(1, false);
+	key_event(1, true);
+	key_event(1, false);
+	key_event(2, true);
+	for (int i = 0; i < 5; ++i) {
+		interval();
+	}
+	expect_trace("taps", "D1 D2 | U1 | D1 | U1 | | ");
+	expect_latency("taps", (const uint32_t[REPORT_LATENCY_BUCKETS]) {0, 0, 0, 2, 2, 1}, 4000);
+
+	// More transitions than the times kept: the last two take the time of the fourth,
+	// 5.3 ms and 6.3 ms instead of 5.2 ms and 6.1 ms
+	reset();
+	for (int i = 0; i < 6; ++i) {
+		key_event(0, !(i & 1));
+		now_us += 100;
+	}
+	for (int i = 0; i < 7; ++i) {
+		interval();
+	}
+	expect_trace("time overflow", "D0 | U0 | D0 | U0 | D0 | U0 | | ");
+	expect_latency("time overflow", (const uint32_t[REPORT_LATENCY_BUCKETS]) {0, 0, 0, 1, 2, 3}, 6300);
+
+	// Random events and refusals
+	reset();
+	srand(1);
+	refuse_percent = 30;
+	for (int i = 0; i < RANDOM_INTERVALS; ++i) {
+		for (int events = rand() % 4; events; --events) {
+			uint8_t key_idx = rand() % KEY_COUNT;
+
+			b_down[key_idx] = !b_down[key_idx];
+			key_event(key_idx, b_down[key_idx]);
+		}
+		interval();
+		trace[0] = '\0';
+	}
+	refuse_percent = 0;
+	for (int i = 0; i < 1000; ++i) {
+		interval();
+	}
+	if (b_twice || b_out_of_order || memcmp(edges_sent, edges_taken, sizeof(edges_sent))) {
+		printf("random events: %s\n", b_twice ? "a key changed twice in an interval"
+				: b_out_of_order ? "a key changed to the state it had" : "transitions lost");
+		failures++;
+	} else {
+		uint32_t taken = 0, counted = 0;
+
+		for (int i = 0; i < KEY_COUNT; ++i) {
+			taken += edges_taken[i];
+		}
+		for (int i = 0; i < REPORT_LATENCY_BUCKETS; ++i) {
+			counted += report_builder_get_latency_histogram()[i];
+		}
+		if (counted != taken) {
+			printf("random events: %u latencies for %u transitions\n", counted, taken);
+			failures++;
+		}
+	}
+
+	// Host stalled while a key is tapped every interval: the queue fills up, then refuses
+	reset_hid();
+	b_host_polling = false;
+	for (int i = 0; i < 4 * UDI_HID_KBD_REPORT_QUEUE_SIZE; ++i) {
+		key_event(0, !(i & 1));
+		frame();
+	}
+	if (udi_hid_kbd_get_queue_high_water() != UDI_HID_KBD_REPORT_QUEUE_SIZE) {
+		printf("queue full: high water of %u states\n", udi_hid_kbd_get_queue_high_water());
+		failures++;
+	}
+	b_host_polling = true;
+	for (int i = 0; i < 8 * UDI_HID_KBD_REPORT_QUEUE_SIZE; ++i) {
+		frame();
+	}
+	if (memcmp(edges_sent, edges_taken, sizeof(edges_sent)) || udi_hid_kbd_get_queue_depth()) {
+		printf("queue full: %u of %u transitions reached the host\n", edges_taken[0], edges_sent[0]);
+		failures++;
+	}
+
+	// Changes of different keys merge while the host is stalled, a key changed twice
+	// queues the state before its second change
+	reset_hid();
+	b_host_polling = false;
+	key_event(1, true);
+	frame();
+	key_event(1, false);
+	key_event(2, true);
+	frame();
+	key_event(1, true);
+	frame();
+	b_host_polling = true;
+	frame();
+	frame();
+	frame();
+	frame();
+	expect_trace("coalescing", "[1] [2] [1 2] ");
+
+	// Host polling every frame: each change leaves in the frame that made it
+	reset_hid();
+	memset(b_down, 0, sizeof(b_down));
+	srand(2);
+	for (int i = 0; i < 1000; ++i) {
+		uint8_t key_idx = rand() % KEY_COUNT;
+
+		b_down[key_idx] = !b_down[key_idx];
+		key_event(key_idx, b_down[key_idx]);
+		frame();
+		if (b_ep_armed || memcmp(edges_sent, edges_taken, sizeof(edges_sent))) {
+			printf("missed frames: change of frame %d not taken by the host\n", i);
+			failures++;
+			break;
+		}
+	}
+	if (udi_hid_kbd_get_missed_frames()) {
+		printf("missed frames: %u with the host polling\n", udi_hid_kbd_get_missed_frames());
+		failures++;
+	}
+
+	// Host skipping 3 frames with a change waiting
+	key_event(0, !b_down[0]);
+	frame();
+	key_event(1, !b_down[1]);
+	b_host_polling = false;
+	frame();
+	frame();
+	frame();
+	b_host_polling = true;
+	frame();
+	frame();
+	if (udi_hid_kbd_get_missed_frames() != 3) {
+		printf("missed frames: %u instead of 3\n", udi_hid_kbd_get_missed_frames());
+		failures++;
+	}
+
+	printf("report_builder_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
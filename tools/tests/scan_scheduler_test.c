@@ -0,0 +1,179 @@
+/*
+ * scan_scheduler_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test of the scan time base (ui/scan_scheduler.c) on a simulated clock.
+ * The test plays SysTick: it counts CPU cycles and calls SysTick_Handler() each
+ * time the reload programmed by scan_scheduler_set_rate() runs out. The column
+ * steps must come at the rate asked for, and the time stamped on each one must
+ * follow the CPU clock within a microsecond, without drifting, across rate
+ * changes such as the suspend and resume of the USB bus.
+ *
+ * Build:  make -C tools/tests scan_scheduler_test
+ * Usage:  scan_scheduler_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "conf_keyboard.h"
+#include "key_layout.h"
+#include "scan_scheduler.h"
+#include "key_reader.h"
+
+#define CPU_HZ				120000000UL
+#define SYSTICK_LOAD_MAX	0x00FFFFFFUL
+#define SYSTICK_CTRL_ON		0x07
+
+// Longest error of the time base and of the scan rate, in parts per million
+#define DRIFT_MAX_PPM		50
+#define JITTER_MAX_US		1
+
+static SysTick_Type systick;
+SysTick_Type *SysTick = &systick;
+
+// Cycles per tick programmed, 0 while SysTick is stopped
+static uint32_t reload;
+
+// Simulated CPU clock, and the cycle where the current tick started
+static uint64_t cycles;
+static uint64_t tick_start;
+
+// Time base against the clock since the last rate change
+static uint64_t ref_cycles;
+static uint32_t ref_time_us;
+
+// Column steps seen by the test
+static uint64_t steps;
+static uint32_t last_time_us;
+static uint32_t max_jitter_us;
+static event_ring_t ring;
+
+static unsigned failures;
+
+uint32_t sysclk_get_cpu_hz(void)
+{
+	return CPU_HZ;
+}
+
+uint32_t SysTick_Config(uint32_t ticks)
+{
+	if (systick.CTRL) {
+		printf("SysTick reconfigured while running\n");
+		failures++;
+	}
+	if (ticks == 0 || ticks - 1 > SYSTICK_LOAD_MAX) {
+		printf("SysTick reload of %lu cycles does not fit\n", (unsigned long)ticks);
+		failures++;
+		return 1;
+	}
+	// Clearing VAL starts a new period
+	reload = ticks;
+	tick_start = cycles;
+	systick.LOAD = ticks - 1;
+	systick.VAL = 0;
+	systick.CTRL = SYSTICK_CTRL_ON;
+	return 0;
+}
+
+void keyboard_scan_step(event_ring_t *r, uint32_t time_us)
+{
+	uint64_t true_us = (cycles - ref_cycles) * 1000000ULL / CPU_HZ;
+	int64_t error = (int64_t)(uint32_t)(time_us - ref_time_us) - (int64_t)true_us;
+
+	if (r != &ring) {
+		printf("step on the wrong ring\n");
+		failures++;
+	}
+	if ((uint32_t)(error < 0 ? -error : error) > max_jitter_us) {
+		max_jitter_us = (uint32_t)(error < 0 ? -error : error);
+	}
+	last_time_us = time_us;
+	steps++;
+}
+
+// Runs the clock for duration_us, ticking SysTick when its reload runs out
+static void run(uint32_t duration_us)
+{
+	uint64_t end = cycles + (uint64_t)duration_us * CPU_HZ / 1000000ULL;
+
+	while (systick.CTRL && tick_start + reload <= end) {
+		tick_start += reload;
+		cycles = tick_start;
+		SysTick_Handler();
+	}
+	cycles = end;
+}
+
+static void expect(const char *test, bool b_ok)
+{
+	if (!b_ok) {
+		printf("%s: failed\n", test);
+		failures++;
+	}
+}
+
+// Runs one second at rate_hz and checks the rate, drift and jitter of the time base
+static void test_rate(uint32_t rate_hz)
+{
+	char test[64];
+	uint64_t first_steps = steps;
+	uint64_t elapsed_us, measured_hz_ppm, time_us;
+	int64_t drift_ppm, rate_ppm;
+
+	scan_scheduler_set_rate(rate_hz);
+	ref_cycles = cycles;
+	ref_time_us = scan_scheduler_get_time_us();
+	expect("rate read back", scan_scheduler_get_rate() == rate_hz);
+	max_jitter_us = 0;
+	run(1000000);
+
+	elapsed_us = (cycles - ref_cycles) * 1000000ULL / CPU_HZ;
+	time_us = (uint32_t)(last_time_us - ref_time_us);
+	// Scans per second, times 1e6 to keep the ppm
+	measured_hz_ppm = (steps - first_steps) * 1000000ULL * 1000000ULL / KEY_COL_NUM / elapsed_us;
+	rate_ppm = ((int64_t)measured_hz_ppm - (int64_t)rate_hz * 1000000LL) / rate_hz;
+	// The last tick stamped is up to one tick before the end of the second
+	drift_ppm = ((int64_t)time_us - (int64_t)((tick_start - ref_cycles) * 1000000ULL / CPU_HZ))
+			* 1000000LL / (int64_t)elapsed_us;
+
+	printf("%5lu Hz: %llu steps, reload %lu, rate %+lld ppm, drift %+lld ppm, jitter %lu us\n",
+			(unsigned long)rate_hz, (unsigned long long)(steps - first_steps), (unsigned long)reload,
+			(long long)rate_ppm, (long long)drift_ppm, (unsigned long)max_jitter_us);
+	sprintf(test, "%lu Hz: scan rate", (unsigned long)rate_hz);
+	expect(test, llabs(rate_ppm) <= DRIFT_MAX_PPM);
+	sprintf(test, "%lu Hz: time base drift", (unsigned long)rate_hz);
+	expect(test, llabs(drift_ppm) <= DRIFT_MAX_PPM);
+	sprintf(test, "%lu Hz: stamp jitter", (unsigned long)rate_hz);
+	expect(test, max_jitter_us <= JITTER_MAX_US);
+	sprintf(test, "%lu Hz: milliseconds", (unsigned long)rate_hz);
+	expect(test, scan_scheduler_get_time_us() / 1000 - scan_scheduler_get_time_ms() <= 1);
+}
+
+int main(void)
+{
+	uint32_t before_us;
+
+	scan_scheduler_init(&ring, KEYBOARD_SCAN_RATE_HZ);
+	expect("init", systick.CTRL == SYSTICK_CTRL_ON && steps == 0);
+
+	test_rate(KEYBOARD_SCAN_RATE_HZ);
+	// Suspend and resume of the USB bus
+	test_rate(KEYBOARD_SCAN_SUSPEND_RATE_HZ);
+	test_rate(KEYBOARD_SCAN_RATE_HZ);
+	// Tick periods that do not divide the microsecond
+	test_rate(333);
+	test_rate(8000);
+
+	// The time base goes on from where it was when the rate changes
+	before_us = scan_scheduler_get_time_us();
+	scan_scheduler_set_rate(KEYBOARD_SCAN_SUSPEND_RATE_HZ);
+	expect("rate change: time kept", scan_scheduler_get_time_us() == before_us);
+	run(1000000 / (KEYBOARD_SCAN_SUSPEND_RATE_HZ * KEY_COL_NUM) + 1);
+	expect("rate change: one suspend tick",
+			last_time_us - before_us == 1000000 / (KEYBOARD_SCAN_SUSPEND_RATE_HZ * KEY_COL_NUM));
+
+	printf("scan_scheduler_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,10 @@
+/*
+ * gpio.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the path key_reader.h includes, see the gpio.h above.
+ */
+
+#include <gpio.h>
@@ -0,0 +1,75 @@
+/*
+ * asf.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the ASF header: only what the tested modules call, which
+ * the tests implement.
+ */
+
+
+#ifndef ASF_H_
+#define ASF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint32_t iram_size_t;
+
+#define UDI_CDC_DATA_EPS_FS_SIZE	64
+
+bool udi_cdc_is_rx_ready(void);
+bool udi_cdc_is_tx_ready(void);
+int udi_cdc_putc(int value);
+const uint8_t* udi_cdc_get_rx_buffer(iram_size_t* size);
+void udi_cdc_rx_consume(iram_size_t size);
+iram_size_t udi_cdc_get_free_tx_buffer(void);
+iram_size_t udi_cdc_write_buf(const void* buf, iram_size_t size);
+
+uint32_t udi_hid_kbd_get_missed_frames(void);
+uint8_t udi_hid_kbd_get_queue_high_water(void);
+
+// Key matrix ports and scan tick
+typedef struct {
+	volatile uint32_t PIO_PDSR;
+} Pio;
+
+extern Pio *PIOA;
+extern Pio *PIOB;
+
+typedef struct {
+	volatile uint32_t CTRL;
+	volatile uint32_t LOAD;
+	volatile uint32_t VAL;
+} SysTick_Type;
+
+extern SysTick_Type *SysTick;
+
+uint32_t SysTick_Config(uint32_t ticks);
+void SysTick_Handler(void);
+uint32_t sysclk_get_cpu_hz(void);
+
+// Interrupt controller, the tests call the handlers themselves
+typedef int IRQn_Type;
+
+static inline void NVIC_ClearPendingIRQ(IRQn_Type irq)
+{
+	(void)irq;
+}
+
+static inline void NVIC_SetPriority(IRQn_Type irq, uint32_t priority)
+{
+	(void)irq;
+	(void)priority;
+}
+
+static inline void NVIC_EnableIRQ(IRQn_Type irq)
+{
+	(void)irq;
+}
+
+#include "compiler.h"
+
+#endif /* ASF_H_ */
@@ -0,0 +1,36 @@
+/*
+ * board.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the key matrix and display pins of sam4s_xplained.h, as
+ * PIO indexes: 0-31 on PIOA, 32-63 on PIOB.
+ */
+
+
+#ifndef BOARD_H_
+#define BOARD_H_
+
+// Must match sam4s_xplained.h
+#define GPIO_COL_0		34
+#define GPIO_COL_1		35
+#define GPIO_COL_2		30
+#define GPIO_ROW_0		22
+#define GPIO_ROW_1		32
+#define GPIO_ROW_2		33
+#define GPIO_ROW_3		21
+
+// Display, must match sam4s_xplained.h
+#define DISPLAY_CS			31
+#define DISPLAY_DC			16
+#define DISPLAY_RST			18
+#define DISPLAY_BUSY		15
+#define DISPLAY_PANEL_ON	2
+#define DISPLAY_DISCHARGE	11
+#define SPI_MOSI_GPIO		13
+// Peripheral function, or output forced low while the panel is off
+#define SPI_MOSI_FLAGS				1
+#define SPI_MOSI_FORCE_OUT_FLAGS	2
+
+#endif /* BOARD_H_ */
@@ -0,0 +1,58 @@
+/*
+ * compiler.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in, see asf.h.
+ */
+
+
+#ifndef COMPILER_H_
+#define COMPILER_H_
+
+#include <assert.h>
+#include "asf.h"
+#include "preprocessor.h"
+
+#define Assert(expr)	assert(expr)
+#define __DMB()			__sync_synchronize()
+
+#define UNUSED(v)				(void)(v)
+#define COMPILER_WORD_ALIGNED	__attribute__((__aligned__(4)))
+#define ctz(u)					__builtin_ctz(u)
+#define LE16(x)					(x)
+#define LE32(x)					(x)
+#define le16_to_cpu(x)			(x)
+#define cpu_to_le16(x)			(x)
+#define le32_to_cpu(x)			(x)
+#define cpu_to_le32(x)			(x)
+#define CPU_TO_LE16(x)			(x)
+#define CPU_TO_LE32(x)			(x)
+#define COMPILER_PRAGMA(arg)	_Pragma(#arg)
+#define COMPILER_PACK_SET(alignment)	COMPILER_PRAGMA(pack(alignment))
+#define COMPILER_PACK_RESET()	COMPILER_PRAGMA(pack())
+#define min(a, b)				(((a) < (b)) ? (a) : (b))
+#define max(a, b)				(((a) > (b)) ? (a) : (b))
+#ifndef __always_inline
+#  define __always_inline		inline __attribute__((__always_inline__))
+#endif
+
+// Host is little-endian like the target
+typedef uint16_t le16_t;
+typedef uint32_t le32_t;
+
+// Interrupts do not exist on the host
+typedef uint32_t irqflags_t;
+
+static inline irqflags_t cpu_irq_save(void)
+{
+	return 0;
+}
+
+static inline void cpu_irq_restore(irqflags_t flags)
+{
+	(void)flags;
+}
+
+#endif /* COMPILER_H_ */
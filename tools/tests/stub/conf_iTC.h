@@ -0,0 +1,26 @@
+/*
+ * conf_iTC.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in wrapping the display configuration of the firmware: with
+ * ITC_TEST_POLLED defined, the driver sends the frame data byte per byte
+ * instead of with the PDC. With ITC_TEST_ROW_HASH, it keeps the hashes of
+ * the rows sent instead of a shadow frame.
+ */
+
+#include_next "conf_iTC.h"
+
+#ifndef CONF_ITC_TEST_H_
+#define CONF_ITC_TEST_H_
+
+#if defined(ITC_TEST_POLLED)
+#  undef CONF_ITC_USE_PDC
+#endif
+#if defined(ITC_TEST_ROW_HASH)
+#  undef CONF_ITC_SHADOW_BUFFER
+#  define CONF_ITC_SHADOW_ROW_HASH
+#endif
+
+#endif /* CONF_ITC_TEST_H_ */
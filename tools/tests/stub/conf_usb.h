@@ -0,0 +1,43 @@
+/*
+ * conf_usb.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the USB configuration of the HID keyboard and CDC
+ * interfaces. The Makefile defines UDI_HID_KBD_NKRO for the N-key rollover
+ * build.
+ */
+
+
+#ifndef CONF_USB_H_
+#define CONF_USB_H_
+
+#include <stdbool.h>
+
+#define UDI_HID_KBD_EP_IN			(1 | USB_EP_DIR_IN)
+#define UDI_HID_KBD_IFACE_NUMBER	0
+#define UDI_HID_KBD_INTERVAL		1
+
+#define UDI_HID_KBD_ENABLE_EXT()	true
+#define UDI_HID_KBD_DISABLE_EXT()
+#define UDI_HID_KBD_CHANGE_LED(value)	(void)(value)
+
+#define UDI_CDC_PORT_NB				1
+#define UDI_CDC_ENABLE_EXT(port)	true
+#define UDI_CDC_DISABLE_EXT(port)
+#define UDI_CDC_RX_NOTIFY(port)
+#define UDI_CDC_SET_CODING_EXT(port, cfg)
+#define UDI_CDC_SET_DTR_EXT(port, set)
+#define UDI_CDC_SET_RTS_EXT(port, set)
+#define UDI_CDC_DEFAULT_RATE		115200
+#define UDI_CDC_DEFAULT_STOPBITS	CDC_STOP_BITS_1
+#define UDI_CDC_DEFAULT_PARITY		CDC_PAR_NONE
+#define UDI_CDC_DEFAULT_DATABITS	8
+#define UDI_CDC_COMM_EP_0			(4 | USB_EP_DIR_IN)
+#define UDI_CDC_DATA_EP_IN_0		(3 | USB_EP_DIR_IN)
+#define UDI_CDC_DATA_EP_OUT_0		(2 | USB_EP_DIR_OUT)
+#define UDI_CDC_COMM_IFACE_NUMBER_0	1
+#define UDI_CDC_DATA_IFACE_NUMBER_0	2
+
+#endif /* CONF_USB_H_ */
@@ -0,0 +1,18 @@
+/*
+ * delay.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the busy wait delays, which the tests implement.
+ */
+
+
+#ifndef DELAY_H_
+#define DELAY_H_
+
+#include <stdint.h>
+
+void delay_us(uint32_t us);
+
+#endif /* DELAY_H_ */
@@ -0,0 +1,21 @@
+/*
+ * gfx.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the types ui.h uses, see asf.h.
+ */
+
+
+#ifndef GFX_H_
+#define GFX_H_
+
+#include <stdint.h>
+
+typedef int16_t gfx_coord_t;
+typedef uint8_t gfx_color_t;
+
+struct gfx_bitmap;
+
+#endif /* GFX_H_ */
@@ -0,0 +1,20 @@
+/*
+ * gpio.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the GPIO service, which the tests implement.
+ */
+
+
+#ifndef GPIO_H_
+#define GPIO_H_
+
+#include <stdint.h>
+
+void gpio_set_pin_high(uint32_t pin);
+void gpio_set_pin_low(uint32_t pin);
+void gpio_configure_pin(uint32_t pin, uint32_t flags);
+
+#endif /* GPIO_H_ */
@@ -0,0 +1,22 @@
+/*
+ * ioport.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the IOPORT service, which the tests implement.
+ */
+
+
+#ifndef IOPORT_H_
+#define IOPORT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint32_t ioport_pin_t;
+
+void ioport_set_pin_level(ioport_pin_t pin, bool level);
+bool ioport_get_pin_level(ioport_pin_t pin);
+
+#endif /* IOPORT_H_ */
@@ -0,0 +1,33 @@
+/*
+ * pdc.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the PDC driver, which the tests implement.
+ */
+
+
+#ifndef PDC_H_
+#define PDC_H_
+
+#include <stdint.h>
+
+typedef struct pdc_sim Pdc;
+
+typedef struct pdc_packet {
+	uint32_t ul_addr;
+	uint32_t ul_size;
+} pdc_packet_t;
+
+#define PERIPH_PTCR_RXTEN	(1u << 0)
+#define PERIPH_PTCR_RXTDIS	(1u << 1)
+#define PERIPH_PTCR_TXTEN	(1u << 8)
+#define PERIPH_PTCR_TXTDIS	(1u << 9)
+
+// A NULL packet leaves the current or next buffer as it is
+void pdc_tx_init(Pdc *p_pdc, pdc_packet_t *p_packet, pdc_packet_t *p_next_packet);
+void pdc_enable_transfer(Pdc *p_pdc, uint32_t ul_controls);
+void pdc_disable_transfer(Pdc *p_pdc, uint32_t ul_controls);
+
+#endif /* PDC_H_ */
@@ -0,0 +1,19 @@
+/*
+ * scan_scheduler.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in, the tests run their own clock.
+ */
+
+
+#ifndef SCAN_SCHEDULER_H_
+#define SCAN_SCHEDULER_H_
+
+#include <stdint.h>
+
+uint32_t scan_scheduler_get_time_us(void);
+uint32_t scan_scheduler_get_time_ms(void);
+
+#endif /* SCAN_SCHEDULER_H_ */
@@ -0,0 +1,16 @@
+/*
+ * serial.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in, see asf.h.
+ */
+
+
+#ifndef SERIAL_H_
+#define SERIAL_H_
+
+#include "asf.h"
+
+#endif /* SERIAL_H_ */
@@ -0,0 +1,62 @@
+/*
+ * spi_master.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the SPI master service and driver, which the tests
+ * implement. Only the status bits the display driver reads are defined.
+ */
+
+
+#ifndef SPI_MASTER_H_
+#define SPI_MASTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "pdc.h"
+
+typedef struct spi_sim Spi;
+
+extern Spi spi_sim;
+#define SPI					(&spi_sim)
+#define SPI_IRQn			21
+
+#define SPI_SR_RDRF			(1u << 0)
+#define SPI_SR_TDRE			(1u << 1)
+#define SPI_SR_ENDTX		(1u << 5)
+#define SPI_SR_TXBUFE		(1u << 7)
+#define SPI_SR_TXEMPTY		(1u << 9)
+#define SPI_IER_ENDTX		SPI_SR_ENDTX
+#define SPI_IER_TXEMPTY		SPI_SR_TXEMPTY
+#define SPI_IDR_ENDTX		SPI_SR_ENDTX
+#define SPI_IDR_TXEMPTY		SPI_SR_TXEMPTY
+
+typedef uint8_t spi_flags_t;
+typedef uint32_t board_spi_select_id_t;
+
+#define SPI_MODE_0			0
+
+struct spi_device {
+	uint32_t id;
+};
+
+void spi_master_init(Spi *p_spi);
+void spi_master_setup_device(Spi *p_spi, struct spi_device *device, spi_flags_t flags,
+		uint32_t baud_rate, board_spi_select_id_t sel_id);
+void spi_enable(Spi *p_spi);
+void spi_write_single(Spi *p_spi, uint8_t data);
+void spi_read_single(Spi *p_spi, uint8_t *data);
+bool spi_is_tx_empty(Spi *p_spi);
+bool spi_is_tx_ok(Spi *p_spi);
+bool spi_is_rx_full(Spi *p_spi);
+uint32_t spi_read_status(Spi *p_spi);
+uint32_t spi_read_interrupt_mask(Spi *p_spi);
+void spi_enable_interrupt(Spi *p_spi, uint32_t ul_sources);
+void spi_disable_interrupt(Spi *p_spi, uint32_t ul_sources);
+Pdc *spi_get_pdc_base(Spi *p_spi);
+
+// Interrupt handler of the SPI, called by the test when an enabled status is set
+void SPI_Handler(void);
+
+#endif /* SPI_MASTER_H_ */
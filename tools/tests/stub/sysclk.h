@@ -0,0 +1,16 @@
+/*
+ * sysclk.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in, see asf.h.
+ */
+
+
+#ifndef SYSCLK_H_
+#define SYSCLK_H_
+
+#include "asf.h"
+
+#endif /* SYSCLK_H_ */
@@ -0,0 +1,16 @@
+/*
+ * udc.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in, see conf_usb.h.
+ */
+
+
+#ifndef UDC_H_
+#define UDC_H_
+
+#include "udd.h"
+
+#endif /* UDC_H_ */
@@ -0,0 +1,16 @@
+/*
+ * udc_desc.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in, see conf_usb.h.
+ */
+
+
+#ifndef UDC_DESC_H_
+#define UDC_DESC_H_
+
+#define UDC_DESC_STORAGE
+
+#endif /* UDC_DESC_H_ */
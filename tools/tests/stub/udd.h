@@ -0,0 +1,53 @@
+/*
+ * udd.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the USB device driver: the tests implement udd_ep_run()
+ * and play the host, see conf_usb.h.
+ */
+
+
+#ifndef UDD_H_
+#define UDD_H_
+
+#include "compiler.h"
+
+typedef uint8_t udd_ep_id_t;
+
+typedef enum {
+	UDD_EP_TRANSFER_OK = 0,
+	UDD_EP_TRANSFER_ABORT = 1,
+} udd_ep_status_t;
+
+typedef void (*udd_callback_trans_t)(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep);
+
+typedef struct {
+	struct {
+		uint8_t bmRequestType;
+		uint8_t bRequest;
+		uint16_t wValue;
+		uint16_t wIndex;
+		uint16_t wLength;
+	} req;
+	uint8_t *payload;
+	uint16_t payload_size;
+	void (*callback)(void);
+	bool (*over_under_run)(void);
+} udd_ctrl_request_t;
+
+extern udd_ctrl_request_t udd_g_ctrlreq;
+
+#define Udd_setup_is_in()	(USB_REQ_DIR_IN == (udd_g_ctrlreq.req.bmRequestType & USB_REQ_DIR_MASK))
+#define Udd_setup_is_out()	(USB_REQ_DIR_OUT == (udd_g_ctrlreq.req.bmRequestType & USB_REQ_DIR_MASK))
+#define Udd_setup_type()	(udd_g_ctrlreq.req.bmRequestType & USB_REQ_TYPE_MASK)
+
+bool udd_is_high_speed(void);
+uint16_t udd_get_frame_number(void);
+uint16_t udd_get_micro_frame_number(void);
+
+bool udd_ep_run(udd_ep_id_t ep, bool b_shortpacket, uint8_t *buf, iram_size_t buf_size,
+		udd_callback_trans_t callback);
+
+#endif /* UDD_H_ */
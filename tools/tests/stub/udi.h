@@ -0,0 +1,25 @@
+/*
+ * udi.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the interface API of the USB device core, see conf_usb.h.
+ */
+
+
+#ifndef UDI_H_
+#define UDI_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+	bool (*enable)(void);
+	void (*disable)(void);
+	bool (*setup)(void);
+	uint8_t (*getsetting)(void);
+	void (*sof_notify)(void);
+} udi_api_t;
+
+#endif /* UDI_H_ */
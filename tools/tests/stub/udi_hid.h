@@ -0,0 +1,19 @@
+/*
+ * udi_hid.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the common HID class requests, which the tests implement.
+ */
+
+
+#ifndef UDI_HID_H_
+#define UDI_HID_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool udi_hid_setup(uint8_t *rate, uint8_t *protocol, uint8_t *report_desc, bool (*setup_report)(void));
+
+#endif /* UDI_HID_H_ */
@@ -0,0 +1,50 @@
+/*
+ * ui.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for ui.h and the iTC.h parts it brings in, see asf.h.
+ */
+
+
+#ifndef UI_H_
+#define UI_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "key_layout.h"
+
+typedef uint8_t gfx_color_t;
+typedef int16_t gfx_coord_t;
+
+// Must match iTC.h
+typedef enum {
+	ITC_PHASE_RESET,
+	ITC_PHASE_INIT,
+	ITC_PHASE_DATA,
+	ITC_PHASE_POWER_ON,
+	ITC_PHASE_REFRESH,
+	ITC_PHASE_POWER_OFF,
+	ITC_PHASE_COUNT,
+} itc_refresh_phase_t;
+
+typedef struct {
+	uint32_t refreshes;
+	uint32_t inits;
+	uint32_t phase_ms[ITC_PHASE_COUNT];
+	uint32_t total_ms;
+	uint32_t skipped;
+} itc_refresh_stats_t;
+
+const itc_refresh_stats_t *itc_get_refresh_stats(void);
+
+void ui_set_key_icon_row(uint8_t index, gfx_coord_t width, gfx_coord_t height, gfx_coord_t row,
+		const gfx_color_t *pixels);
+uint16_t ui_get_key_icon_hash(uint8_t index);
+void ui_set_key_scancode(uint8_t index, uint8_t scancode);
+uint8_t ui_get_key_scancode(uint8_t index);
+const uint8_t *ui_get_key_macro(uint8_t index, uint16_t *len);
+void ui_set_needs_refresh(void);
+
+#endif /* UI_H_ */
@@ -0,0 +1,47 @@
+/*
+ * usb_protocol.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the USB descriptor types, see conf_usb.h.
+ */
+
+
+#ifndef USB_PROTOCOL_H_
+#define USB_PROTOCOL_H_
+
+#include <stdint.h>
+
+#define USB_EP_DIR_IN		0x80
+#define USB_EP_DIR_OUT		0x00
+
+#define USB_REQ_DIR_OUT			(0 << 7)
+#define USB_REQ_DIR_IN			(1 << 7)
+#define USB_REQ_DIR_MASK		(1 << 7)
+#define USB_REQ_TYPE_CLASS		(1 << 5)
+#define USB_REQ_TYPE_MASK		(3 << 5)
+#define USB_REQ_RECIP_INTERFACE	(1 << 0)
+
+typedef struct {
+	uint8_t bLength;
+	uint8_t bDescriptorType;
+	uint8_t bInterfaceNumber;
+	uint8_t bAlternateSetting;
+	uint8_t bNumEndpoints;
+	uint8_t bInterfaceClass;
+	uint8_t bInterfaceSubClass;
+	uint8_t bInterfaceProtocol;
+	uint8_t iInterface;
+} usb_iface_desc_t;
+
+typedef struct {
+	uint8_t bLength;
+	uint8_t bDescriptorType;
+	uint8_t bEndpointAddress;
+	uint8_t bmAttributes;
+	uint16_t wMaxPacketSize;
+	uint8_t bInterval;
+} usb_ep_desc_t;
+
+#endif /* USB_PROTOCOL_H_ */
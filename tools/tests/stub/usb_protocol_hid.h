@@ -0,0 +1,30 @@
+/*
+ * usb_protocol_hid.h
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host stand-in for the HID class definitions, see conf_usb.h.
+ */
+
+
+#ifndef USB_PROTOCOL_HID_H_
+#define USB_PROTOCOL_HID_H_
+
+#include <stdint.h>
+
+#define HID_SUB_CLASS_NOBOOT			0
+#define HID_SUB_CLASS_BOOT				1
+#define USB_HID_REPORT_TYPE_OUTPUT		2
+
+typedef struct {
+	uint8_t bLength;
+	uint8_t bDescriptorType;
+	uint16_t bcdHID;
+	uint8_t bCountryCode;
+	uint8_t bNumDescriptors;
+	uint8_t bRDescriptorType;
+	uint16_t wDescriptorLength;
+} usb_hid_descriptor_t;
+
+#endif /* USB_PROTOCOL_HID_H_ */
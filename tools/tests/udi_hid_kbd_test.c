@@ -0,0 +1,333 @@
+/*
+ * udi_hid_kbd_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test of the HID keyboard interface (udi_hid_kbd.c). The test plays the
+ * USB host: it parses the report descriptor, takes the reports armed on the
+ * endpoint and decodes them back to the usages pressed. It checks the mapping
+ * of the modifier usages 0xE0-0xE7, every key usage, the usages dropped, and
+ * the rollover of the boot report. The Makefile builds it with and without
+ * UDI_HID_KBD_NKRO.
+ *
+ * Build:  make -C tools/tests udi_hid_kbd_test udi_hid_kbd_6kro_test
+ * Usage:  udi_hid_kbd_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "udd.h"
+#include "udi_hid.h"
+#include "udi_hid_kbd.h"
+
+#define USAGE_MAP_SIZE		(256 / 8)
+
+// Report descriptor items used by the interface
+#define ITEM_INPUT			0x80
+#define ITEM_OUTPUT			0x90
+#define ITEM_COLLECTION		0xA0
+#define ITEM_END_COLLECTION	0xC0
+#define ITEM_REPORT_SIZE	0x74
+#define ITEM_REPORT_COUNT	0x94
+#define ITEM_LOGICAL_MAX	0x24
+#define ITEM_USAGE_MAX		0x28
+
+#define ERROR_ROLLOVER		0x01
+
+extern udi_hid_kbd_report_desc_t udi_hid_kbd_report_desc;
+
+udd_ctrl_request_t udd_g_ctrlreq;
+
+// Protocol selected by SET_PROTOCOL, owned by the interface
+static uint8_t *hid_protocol;
+
+// Transfer armed on the endpoint, taken by host_poll()
+static bool b_ep_armed;
+static const uint8_t *ep_buf;
+static iram_size_t ep_size;
+static udd_callback_trans_t ep_callback;
+
+static unsigned failures;
+
+bool udi_hid_setup(uint8_t *rate, uint8_t *protocol, uint8_t *report_desc, bool (*setup_report)(void))
+{
+	(void)rate;
+	(void)report_desc;
+	(void)setup_report;
+	hid_protocol = protocol;
+	return true;
+}
+
+bool udd_ep_run(udd_ep_id_t ep, bool b_shortpacket, uint8_t *buf, iram_size_t buf_size,
+		udd_callback_trans_t callback)
+{
+	(void)ep;
+	(void)b_shortpacket;
+	if (b_ep_armed) {
+		printf("endpoint armed twice\n");
+		failures++;
+	}
+	b_ep_armed = true;
+	ep_buf = buf;
+	ep_size = buf_size;
+	ep_callback = callback;
+	return true;
+}
+
+// Takes the report of the next frame, false if none is armed
+static bool host_poll(uint8_t *report, size_t *size)
+{
+	udi_hid_kbd_report_flush();
+	if (!b_ep_armed) {
+		return false;
+	}
+	memcpy(report, ep_buf, ep_size);
+	*size = ep_size;
+	b_ep_armed = false;
+	ep_callback(UDD_EP_TRANSFER_OK, ep_size, UDI_HID_KBD_EP_IN);
+	return true;
+}
+
+static bool is_boot_protocol(void)
+{
+	return *hid_protocol == 0;
+}
+
+// Usages pressed in a report, one bit each. Returns false for an ErrorRollOver report.
+static bool decode_report(const uint8_t *report, size_t size, uint8_t *usages)
+{
+	memset(usages, 0, USAGE_MAP_SIZE);
+	usages[UDI_HID_KBD_MODIFIER_USAGE_MIN / 8] = report[0];
+	if (size == 8) {
+		for (size_t i = 2; i < 8; ++i) {
+			if (report[i] == ERROR_ROLLOVER) {
+				return false;
+			}
+			usages[report[i] / 8] |= 1 << (report[i] % 8);
+		}
+		usages[0] &= ~1;
+	} else {
+		memcpy(usages, &report[1], size - 1);
+	}
+	return true;
+}
+
+static void expect_report(const char *test, const uint8_t *expected)
+{
+	uint8_t report[UDI_HID_KBD_EP_SIZE];
+	uint8_t usages[USAGE_MAP_SIZE];
+	size_t size;
+
+	if (!host_poll(report, &size)) {
+		printf("%s: no report\n", test);
+		failures++;
+	} else if (size != (is_boot_protocol() ? 8 : UDI_HID_KBD_EP_SIZE)) {
+		printf("%s: report of %zu bytes\n", test, size);
+		failures++;
+	} else if (!decode_report(report, size, usages) || memcmp(usages, expected, USAGE_MAP_SIZE)) {
+		printf("%s: wrong usages in the report\n", test);
+		failures++;
+	}
+}
+
+static void expect_no_report(const char *test)
+{
+	uint8_t report[UDI_HID_KBD_EP_SIZE];
+	size_t size;
+
+	if (host_poll(report, &size)) {
+		printf("%s: unexpected report\n", test);
+		failures++;
+	}
+}
+
+static void expect(const char *test, bool b_ok)
+{
+	if (!b_ok) {
+		printf("%s: failed\n", test);
+		failures++;
+	}
+}
+
+// Checks the sizes and ranges declared by the report descriptor
+static void test_descriptor(void)
+{
+	const uint8_t *desc = udi_hid_kbd_report_desc.array;
+	unsigned report_size = 0, report_count = 0, input_bits = 0, output_bits = 0;
+	int depth = 0, logical_max = 0, usage_max = 0;
+	int array_max = -1, bitmap_max = -1;
+	size_t pos = 0;
+
+	while (pos < sizeof(udi_hid_kbd_report_desc.array)) {
+		uint8_t item = desc[pos] & 0xFC;
+		uint8_t len = (desc[pos] & 3) == 3 ? 4 : desc[pos] & 3;
+		int value = 0;
+
+		if (pos + 1 + len > sizeof(udi_hid_kbd_report_desc.array)) {
+			printf("descriptor: item at %zu truncated\n", pos);
+			failures++;
+			return;
+		}
+		for (uint8_t i = 0; i < len; ++i) {
+			value |= desc[pos + 1 + i] << (8 * i);
+		}
+		switch (item) {
+		case ITEM_REPORT_SIZE:
+			report_size = value;
+			break;
+		case ITEM_REPORT_COUNT:
+			report_count = value;
+			break;
+		case ITEM_LOGICAL_MAX:
+			logical_max = value;
+			break;
+		case ITEM_USAGE_MAX:
+			usage_max = value;
+			break;
+		case ITEM_INPUT:
+			input_bits += report_size * report_count;
+			if (!(value & 0x03)) {
+				// Data, Array
+				array_max = logical_max;
+				expect("descriptor: array usages", usage_max == logical_max);
+			} else if (report_count == UDI_HID_KBD_KEY_COUNT) {
+				bitmap_max = usage_max;
+			}
+			break;
+		case ITEM_OUTPUT:
+			output_bits += report_size * report_count;
+			break;
+		case ITEM_COLLECTION:
+			depth++;
+			break;
+		case ITEM_END_COLLECTION:
+			depth--;
+			break;
+		}
+		pos += 1 + len;
+	}
+
+	expect("descriptor: collections", depth == 0);
+	expect("descriptor: LED report", output_bits == 8);
+#ifdef UDI_HID_KBD_NKRO
+	expect("descriptor: input report", input_bits == 8 * UDI_HID_KBD_EP_SIZE);
+	expect("descriptor: key bitmap", array_max < 0 && bitmap_max == UDI_HID_KBD_KEY_COUNT - 1);
+#else
+	expect("descriptor: input report", input_bits == 64 && UDI_HID_KBD_EP_SIZE == 8);
+	expect("descriptor: key array", array_max == UDI_HID_KBD_KEY_COUNT - 1 && bitmap_max < 0);
+#endif
+}
+
+// Presses and releases each usage alone
+static void test_usages(void)
+{
+	uint8_t expected[USAGE_MAP_SIZE] = {0};
+	char test[64];
+
+	// Usages 1 to 3 are the error codes of the boot report
+	for (unsigned usage = 4; usage < 256; ++usage) {
+		if (!UDI_HID_KBD_USAGE_IS_VALID(usage)) {
+			continue;
+		}
+		sprintf(test, "usage 0x%02X down", usage);
+		expect(test, udi_hid_kbd_down(usage));
+		expected[usage / 8] = 1 << (usage % 8);
+		expect_report(test, expected);
+		sprintf(test, "usage 0x%02X up", usage);
+		expect(test, udi_hid_kbd_up(usage));
+		expected[usage / 8] = 0;
+		expect_report(test, expected);
+	}
+
+	// Modifier usages and masks change the same bits, left shift twice in one frame
+	expect("modifier mask", udi_hid_kbd_modifier_down(0x22));
+	expect("modifier usage", udi_hid_kbd_up(0xE1));
+	expected[UDI_HID_KBD_MODIFIER_USAGE_MIN / 8] = 0x22;
+	expect_report("modifier mask", expected);
+	expected[UDI_HID_KBD_MODIFIER_USAGE_MIN / 8] = 0x20;
+	expect_report("modifier usage", expected);
+	expect("modifier usage", udi_hid_kbd_up(0xE5));
+	expected[UDI_HID_KBD_MODIFIER_USAGE_MIN / 8] = 0;
+	expect_report("modifier usage up", expected);
+
+	// Usages the report cannot hold are dropped, and never block the caller
+	expect("usage 0", udi_hid_kbd_down(0));
+	expect("usage 0x78", udi_hid_kbd_down(UDI_HID_KBD_KEY_COUNT));
+	expect("usage 0xE8", udi_hid_kbd_down(0xE8));
+	expect("usage 0xFF", udi_hid_kbd_down(0xFF));
+	expect("usage 0xFF up", udi_hid_kbd_up(0xFF));
+	expect_no_report("dropped usages");
+}
+
+// Presses more keys than the boot report holds
+static void test_rollover(void)
+{
+	uint8_t expected[USAGE_MAP_SIZE] = {0};
+	uint8_t report[UDI_HID_KBD_EP_SIZE];
+	size_t size;
+#ifdef UDI_HID_KBD_NKRO
+	uint8_t usages[USAGE_MAP_SIZE];
+#endif
+
+	for (uint8_t usage = 4; usage < 10; ++usage) {
+		expect("6 keys", udi_hid_kbd_down(usage));
+		expected[usage / 8] |= 1 << (usage % 8);
+	}
+	expect_report("6 keys", expected);
+
+#ifdef UDI_HID_KBD_NKRO
+	for (uint8_t usage = 10; usage < 20; ++usage) {
+		expect("16 keys", udi_hid_kbd_down(usage));
+		expected[usage / 8] |= 1 << (usage % 8);
+	}
+	expect_report("16 keys", expected);
+
+	// Boot protocol: every slot holds ErrorRollOver, the modifiers still count
+	*hid_protocol = 0;
+	expect("boot protocol", udi_hid_kbd_modifier_down(0x01));
+	if (!host_poll(report, &size) || size != 8 || decode_report(report, size, usages) || report[0] != 0x01) {
+		printf("boot protocol: no ErrorRollOver report\n");
+		failures++;
+	}
+	for (uint8_t usage = 10; usage < 20; ++usage) {
+		udi_hid_kbd_up(usage);
+		expected[usage / 8] &= ~(1 << (usage % 8));
+	}
+	expected[UDI_HID_KBD_MODIFIER_USAGE_MIN / 8] = 0x01;
+	expect_report("boot protocol, 6 keys", expected);
+	*hid_protocol = 1;
+#else
+	// The seventh key waits for a free slot
+	expect("seventh key", !udi_hid_kbd_down(10));
+	expect_no_report("seventh key");
+	expect("free slot", udi_hid_kbd_up(6));
+	expect("seventh key", udi_hid_kbd_down(10));
+	expected[6 / 8] &= ~(1 << 6);
+	expected[10 / 8] |= 1 << (10 % 8);
+	if (!host_poll(report, &size) || memcmp(report, "\0\0\x04\x05\x07\x08\x09\x0A", 8)) {
+		printf("key array: keys out of order\n");
+		failures++;
+	}
+#endif
+}
+
+int main(void)
+{
+	udi_api_hid_kbd.setup();
+	expect("enable", udi_api_hid_kbd.enable());
+
+	test_descriptor();
+	test_usages();
+	test_rollover();
+
+	printf("udi_hid_kbd_test (%s): %u failures\n",
+#ifdef UDI_HID_KBD_NKRO
+			"N-key rollover",
+#else
+			"6-key rollover",
+#endif
+			failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,347 @@
+/*
+ * xmodem_pty_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Throughput benchmark of the XMODEM receiver (comm/xmodem.c) with 128-byte
+ * and 1K packets, over a pseudo-terminal loopback. The receiver reads the
+ * terminal side in banks of at most 64 bytes, like the CDC endpoint, and a
+ * sender in the same loop writes the profile to the master side. Each file
+ * received must match the one sent.
+ *
+ * For each packet size the test prints the round trips, each packet waiting
+ * for its ACK, and the throughput on the loopback. The loopback has next to
+ * no latency: the time the round trips take over USB full speed is printed
+ * too, at USB_ROUND_TRIP_MS each.
+ *
+ * Build:  make -C tools/tests xmodem_pty_test
+ * Usage:  xmodem_pty_test
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "asf.h"
+#include "crc16.h"
+#include "scan_scheduler.h"
+#include "xmodem.h"
+
+// Must match xmodem.c
+#define XMDM_SOH			0x01
+#define XMDM_STX			0x02
+#define XMDM_EOT			0x04
+#define XMDM_ACK			0x06
+#define XMDM_NAK			0x15
+
+// A full profile of 12 keys with 50x50 icons
+#define FILE_SIZE			(30 * 1024)
+#define BANK_SIZE			UDI_CDC_DATA_EPS_FS_SIZE
+#define ROUNDS				5
+#define SENDER_TIMEOUT_MS	1500
+#define TEST_TIMEOUT_MS		(60 * 1000)
+// A packet goes out in a frame, its ACK leaves on the next SOF and the host sends on in the frame after
+#define USB_ROUND_TRIP_MS	2
+
+typedef enum {
+	SENDER_START,		// Waiting for 'C'
+	SENDER_DATA,
+	SENDER_EOT,
+	SENDER_DONE,
+} sender_state_t;
+
+// Receiver on the terminal side, sender on the master side
+static int receiver_fd;
+static int sender_fd;
+
+// Bank read from the terminal, handed to the receiver
+static uint8_t bank[BANK_SIZE];
+static iram_size_t bank_len;
+static iram_size_t bank_pos;
+
+static uint8_t file[FILE_SIZE];
+static uint8_t stored[FILE_SIZE + 1024];
+static uint32_t stored_len;
+
+static struct {
+	sender_state_t state;
+	uint32_t packet_len;
+	uint32_t offset;
+	uint8_t sno;
+	uint32_t last_ms;
+	unsigned packets;
+	unsigned resent;
+} sender;
+
+static unsigned failures;
+
+uint32_t scan_scheduler_get_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+const uint8_t* udi_cdc_get_rx_buffer(iram_size_t* size)
+{
+	if (bank_pos == bank_len) {
+		ssize_t len = read(receiver_fd, bank, sizeof(bank));
+
+		bank_len = len > 0 ? len : 0;
+		bank_pos = 0;
+	}
+	*size = bank_len - bank_pos;
+	return *size ? &bank[bank_pos] : NULL;
+}
+
+void udi_cdc_rx_consume(iram_size_t size)
+{
+	bank_pos += size;
+}
+
+bool udi_cdc_is_rx_ready(void)
+{
+	iram_size_t size;
+
+	return udi_cdc_get_rx_buffer(&size) != NULL;
+}
+
+bool udi_cdc_is_tx_ready(void)
+{
+	return true;
+}
+
+iram_size_t udi_cdc_get_free_tx_buffer(void)
+{
+	return 2 * BANK_SIZE;
+}
+
+// Returns the bytes not written, as the CDC class does
+iram_size_t udi_cdc_write_buf(const void* buf, iram_size_t size)
+{
+	ssize_t len = write(receiver_fd, buf, size);
+
+	return len > 0 ? size - len : size;
+}
+
+int udi_cdc_putc(int value)
+{
+	uint8_t byte = value;
+
+	printf("udi_cdc_putc() waits on the host\n");
+	failures++;
+	return write(receiver_fd, &byte, 1) == 1;
+}
+
+static void store(uint8_t *data, uint32_t len, uint32_t offset)
+{
+	if (offset != stored_len || offset + len > sizeof(stored)) {
+		printf("packet stored at %u after %u bytes\n", offset, stored_len);
+		failures++;
+		return;
+	}
+	memcpy(&stored[offset], data, len);
+	stored_len += len;
+}
+
+static void send_all(const uint8_t *data, size_t len)
+{
+	while (len) {
+		ssize_t sent = write(sender_fd, data, len);
+
+		if (sent < 0 && errno != EAGAIN) {
+			perror("write");
+			exit(1);
+		}
+		if (sent > 0) {
+			data += sent;
+			len -= sent;
+		} else {
+			// The terminal buffer is full: let the receiver read
+			xmodem_receive_process();
+		}
+	}
+	sender.last_ms = scan_scheduler_get_time_ms();
+}
+
+static void send_packet(void)
+{
+	uint8_t packet[3 + 1024 + 2];
+	uint32_t len = FILE_SIZE - sender.offset;
+	uint16_t crc;
+
+	len = len < sender.packet_len ? len : sender.packet_len;
+	packet[0] = (sender.packet_len == 1024) ? XMDM_STX : XMDM_SOH;
+	packet[1] = sender.sno;
+	packet[2] = ~sender.sno;
+	memset(&packet[3], 0x1A, sender.packet_len);
+	memcpy(&packet[3], &file[sender.offset], len);
+	crc = crc16_update(CRC16_INIT, &packet[3], sender.packet_len);
+	packet[3 + sender.packet_len] = crc >> 8;
+	packet[4 + sender.packet_len] = crc;
+	send_all(packet, sender.packet_len + 5);
+	sender.packets++;
+}
+
+static void send_next(void)
+{
+	static const uint8_t eot = XMDM_EOT;
+
+	if (sender.offset >= FILE_SIZE) {
+		sender.state = SENDER_EOT;
+		send_all(&eot, 1);
+	} else {
+		sender.state = SENDER_DATA;
+		send_packet();
+	}
+}
+
+// Runs the sender on what the receiver sent back
+static void sender_process(void)
+{
+	uint8_t replies[16];
+	ssize_t len = read(sender_fd, replies, sizeof(replies));
+
+	if (len <= 0 && scan_scheduler_get_time_ms() - sender.last_ms >= SENDER_TIMEOUT_MS) {
+		// A timeout acts like a NAK
+		replies[0] = XMDM_NAK;
+		len = 1;
+	}
+	for (ssize_t i = 0; i < len; ++i) {
+		switch (sender.state) {
+		case SENDER_START:
+			if (replies[i] == 'C') {
+				send_next();
+			}
+			break;
+		case SENDER_DATA:
+			if (replies[i] == XMDM_ACK) {
+				sender.offset += sender.packet_len;
+				sender.sno++;
+				send_next();
+			} else if (replies[i] == XMDM_NAK) {
+				sender.resent++;
+				send_packet();
+			}
+			break;
+		case SENDER_EOT:
+			if (replies[i] == XMDM_ACK) {
+				sender.state = SENDER_DONE;
+			} else if (replies[i] == XMDM_NAK) {
+				send_next();
+			}
+			break;
+		case SENDER_DONE:
+			break;
+		}
+	}
+}
+
+static void open_loopback(void)
+{
+	struct termios tio;
+
+	sender_fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (sender_fd < 0 || grantpt(sender_fd) || unlockpt(sender_fd)) {
+		perror("posix_openpt");
+		exit(1);
+	}
+	receiver_fd = open(ptsname(sender_fd), O_RDWR | O_NOCTTY);
+	if (receiver_fd < 0) {
+		perror("ptsname");
+		exit(1);
+	}
+	// Bytes as they are, like the CDC data interface
+	tcgetattr(receiver_fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(receiver_fd, TCSANOW, &tio);
+	fcntl(receiver_fd, F_SETFL, fcntl(receiver_fd, F_GETFL) | O_NONBLOCK);
+	fcntl(sender_fd, F_SETFL, fcntl(sender_fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Transfers the file once, returns the seconds taken
+static double transfer(const char *test, uint32_t packet_len)
+{
+	uint32_t start_ms = scan_scheduler_get_time_ms();
+	xmodem_status_t status = XMODEM_IDLE;
+	double start;
+
+	memset(&sender, 0, sizeof(sender));
+	sender.packet_len = packet_len;
+	sender.sno = 1;
+	sender.last_ms = start_ms;
+	stored_len = 0;
+	bank_len = bank_pos = 0;
+	tcflush(receiver_fd, TCIOFLUSH);
+
+	start = seconds();
+	xmodem_receive_init(store);
+	while (scan_scheduler_get_time_ms() - start_ms < TEST_TIMEOUT_MS) {
+		status = xmodem_receive_process();
+		if (status == XMODEM_DONE || status == XMODEM_ERROR) {
+			break;
+		}
+		sender_process();
+	}
+	// The ACK of the EOT
+	while (sender.state != SENDER_DONE && status == XMODEM_DONE
+			&& scan_scheduler_get_time_ms() - start_ms < TEST_TIMEOUT_MS) {
+		xmodem_receive_process();
+		sender_process();
+	}
+	if (status != XMODEM_DONE || sender.state != SENDER_DONE) {
+		printf("%s: transfer not done\n", test);
+		failures++;
+	} else if (stored_len != (FILE_SIZE + packet_len - 1) / packet_len * packet_len
+			|| memcmp(stored, file, FILE_SIZE)) {
+		printf("%s: file differs\n", test);
+		failures++;
+	}
+	return seconds() - start;
+}
+
+int main(void)
+{
+	static const uint32_t packet_lens[] = {128, 1024};
+
+	srand(1);
+	for (uint32_t i = 0; i < FILE_SIZE; ++i) {
+		file[i] = rand();
+	}
+	open_loopback();
+
+	for (size_t i = 0; i < sizeof(packet_lens) / sizeof(packet_lens[0]); ++i) {
+		char test[32];
+		double best_s = 1e9;
+
+		snprintf(test, sizeof(test), "%u-byte packets", packet_lens[i]);
+		for (int round = 0; round < ROUNDS; ++round) {
+			double s = transfer(test, packet_lens[i]);
+
+			best_s = s < best_s ? s : best_s;
+		}
+		printf("xmodem_pty_test (%s): %u bytes, %u round trips, %u resent, loopback %.0f KB/s,"
+				" USB full speed %u ms\n", test, FILE_SIZE, sender.packets + 1, sender.resent,
+				FILE_SIZE / 1024.0 / best_s, (sender.packets + 1) * USB_ROUND_TRIP_MS);
+	}
+
+	close(receiver_fd);
+	close(sender_fd);
+	printf("xmodem_pty_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,605 @@
+/*
+ * xmodem_test.c
+ *
+ * Created: 10/17/2026
+ *  Author: David Ma
+ *
+ * Host test of the XMODEM receiver (comm/xmodem.c). A simulated sender
+ * transfers files with XMODEM, XMODEM-1K and YMODEM batches through a model
+ * of the CDC interface, which hands the bytes over in banks of at most 64
+ * bytes like the USB endpoint. Bytes are dropped or corrupted in both
+ * directions, and the file stored must still match. On a channel too noisy
+ * for the transfer to finish, it must be cancelled rather than end with a
+ * wrong file. Protocol errors must cancel the transfer.
+ *
+ * The replies must never wait for the host: a host that stops reading holds
+ * them back, without udi_cdc_putc(), and the transfer carries on when it
+ * reads again, or is dropped if it never does.
+ *
+ * Build:  make -C tools/tests xmodem_test
+ * Usage:  xmodem_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asf.h"
+#include "crc16.h"
+#include "scan_scheduler.h"
+#include "xmodem.h"
+
+// Must match xmodem.c
+#define XMDM_SOH			0x01
+#define XMDM_STX			0x02
+#define XMDM_EOT			0x04
+#define XMDM_ACK			0x06
+#define XMDM_NAK			0x15
+#define XMDM_CAN			0x18
+
+#define FIFO_SIZE			(1 << 16)
+#define FILE_MAX_SIZE		(64 * 1024)
+#define BANK_SIZE			UDI_CDC_DATA_EPS_FS_SIZE
+
+// Sender silence before it sends again, longer than the receiver timeout
+#define SENDER_TIMEOUT_MS	1500
+// Host not reading for less than the sender timeout, then for longer than the receiver gives it
+#define SHORT_STALL_MS		1000
+#define LONG_STALL_MS		(20 * 1000)
+#define TEST_TIMEOUT_MS		(10 * 60 * 1000)
+// Runs over noisy channels, each with different errors
+#define NOISY_ROUNDS		10
+
+typedef enum {
+	PROTOCOL_XMODEM,
+	PROTOCOL_XMODEM_1K,
+	PROTOCOL_YMODEM,
+} protocol_t;
+
+typedef enum {
+	SENDER_START,		// Waiting for 'C'
+	SENDER_HEADER,		// YMODEM block 0 sent
+	SENDER_HEADER_C,	// Block 0 acknowledged, waiting for 'C'
+	SENDER_DATA,
+	SENDER_EOT,
+	SENDER_EOT2,		// YMODEM: first EOT NAKed, second EOT sent
+	SENDER_END_C,		// YMODEM: waiting for 'C' before the empty block 0
+	SENDER_END,
+	SENDER_DONE,
+} sender_state_t;
+
+typedef struct {
+	uint8_t data[FIFO_SIZE];
+	// Last byte of a USB transfer: banks do not go past it
+	bool b_end[FIFO_SIZE];
+	unsigned head;
+	unsigned tail;
+	// End of the bank being read, tail when none
+	unsigned bank_end;
+} fifo_t;
+
+// Sender to receiver, and back
+static fifo_t to_receiver;
+static fifo_t to_sender;
+static uint32_t now_ms;
+// The host does not read: nothing fits in the CDC transmit buffer
+static bool b_host_stalled;
+static unsigned putc_calls;
+
+// Per 100000 bytes, in both directions
+static unsigned drop_rate;
+static unsigned corrupt_rate;
+
+static uint8_t file[FILE_MAX_SIZE];
+static uint8_t stored[FILE_MAX_SIZE];
+static uint32_t stored_len;
+static bool b_store_error;
+
+static struct {
+	protocol_t protocol;
+	sender_state_t state;
+	uint32_t file_len;
+	uint32_t offset;
+	uint8_t sno;
+	uint32_t last_ms;
+	// Every packet sent with a wrong CRC
+	bool b_bad_crc;
+	// The second packet sent with the sequence number of the third
+	bool b_skip;
+} sender;
+
+bool udi_cdc_is_rx_ready(void)
+{
+	return to_receiver.head != to_receiver.tail;
+}
+
+bool udi_cdc_is_tx_ready(void)
+{
+	return !b_host_stalled;
+}
+
+static bool channel_loses(void)
+{
+	return (unsigned) rand() % 100000 < drop_rate;
+}
+
+static uint8_t channel_corrupts(uint8_t value)
+{
+	return ((unsigned) rand() % 100000 < corrupt_rate) ? value ^ (1 << (rand() % 8)) : value;
+}
+
+// Writes one USB transfer
+static void fifo_write(fifo_t *fifo, const uint8_t *data, unsigned len)
+{
+	for (unsigned i = 0; i < len; ++i) {
+		if (channel_loses()) {
+			continue;
+		}
+		fifo->data[fifo->head % FIFO_SIZE] = channel_corrupts(data[i]);
+		fifo->b_end[fifo->head % FIFO_SIZE] = false;
+		fifo->head++;
+	}
+	if (fifo->head != fifo->tail) {
+		fifo->b_end[(fifo->head - 1) % FIFO_SIZE] = true;
+	}
+}
+
+// Waits for the host on the target, the receiver must not call it
+int udi_cdc_putc(int value)
+{
+	uint8_t byte = value;
+
+	putc_calls++;
+	fifo_write(&to_sender, &byte, 1);
+	return 1;
+}
+
+const uint8_t* udi_cdc_get_rx_buffer(iram_size_t* size)
+{
+	fifo_t *fifo = &to_receiver;
+
+	if (fifo->bank_end == fifo->tail) {
+		// Next bank: up to 64 bytes of one transfer
+		while (fifo->bank_end != fifo->head && fifo->bank_end - fifo->tail < BANK_SIZE
+				&& (fifo->bank_end % FIFO_SIZE) != FIFO_SIZE - 1
+				&& !fifo->b_end[fifo->bank_end % FIFO_SIZE]) {
+			fifo->bank_end++;
+		}
+		if (fifo->bank_end != fifo->head) {
+			fifo->bank_end++;
+		}
+	}
+	*size = fifo->bank_end - fifo->tail;
+	return *size ? &fifo->data[fifo->tail % FIFO_SIZE] : NULL;
+}
+
+void udi_cdc_rx_consume(iram_size_t size)
+{
+	to_receiver.tail += size;
+}
+
+iram_size_t udi_cdc_get_free_tx_buffer(void)
+{
+	return b_host_stalled ? 0 : FIFO_SIZE - (to_sender.head - to_sender.tail);
+}
+
+iram_size_t udi_cdc_write_buf(const void* buf, iram_size_t size)
+{
+	if (b_host_stalled) {
+		// Waits on the target
+		printf("write while the host does not read\n");
+		putc_calls++;
+		return size;
+	}
+	fifo_write(&to_sender, buf, size);
+	return 0;
+}
+
+uint32_t scan_scheduler_get_time_ms(void)
+{
+	return now_ms;
+}
+
+static void store(uint8_t *data, uint32_t len, uint32_t offset)
+{
+	if (offset != stored_len || offset + len > sizeof(stored)) {
+		printf("packet stored at %u after %u bytes\n", offset, stored_len);
+		b_store_error = true;
+		return;
+	}
+	memcpy(&stored[offset], data, len);
+	stored_len += len;
+}
+
+static void send_block(uint8_t sno, const uint8_t *data, uint32_t data_len, uint32_t packet_len)
+{
+	uint8_t packet[3 + 1024 + 2];
+	uint16_t crc;
+
+	packet[0] = (packet_len == 1024) ? XMDM_STX : XMDM_SOH;
+	packet[1] = sno;
+	packet[2] = ~sno;
+	memset(&packet[3], 0x1A, packet_len);
+	memcpy(&packet[3], data, data_len);
+	crc = crc16_update(CRC16_INIT, &packet[3], packet_len);
+	if (sender.b_bad_crc) {
+		crc ^= 1;
+	}
+	packet[3 + packet_len] = crc >> 8;
+	packet[4 + packet_len] = crc;
+	fifo_write(&to_receiver, packet, packet_len + 5);
+	sender.last_ms = now_ms;
+}
+
+static void send_byte(uint8_t value)
+{
+	fifo_write(&to_receiver, &value, 1);
+	sender.last_ms = now_ms;
+}
+
+static void send_header(bool b_last)
+{
+	uint8_t header[128];
+	int len = 0;
+
+	memset(header, 0, sizeof(header));
+	if (!b_last) {
+		len = sprintf((char *) header, "profile.bin");
+		sprintf((char *) &header[len + 1], "%u 13335573044 100644", sender.file_len);
+	}
+	send_block(0, header, sizeof(header), 128);
+}
+
+static void send_data(void)
+{
+	uint32_t packet_len = (sender.protocol == PROTOCOL_XMODEM) ? 128 : 1024;
+	uint32_t len = sender.file_len - sender.offset;
+	uint8_t sno = sender.sno;
+
+	if (len > packet_len) {
+		len = packet_len;
+	}
+	if (sender.b_skip && sno == 2) {
+		sno = 3;
+	}
+	send_block(sno, &file[sender.offset], len, packet_len);
+}
+
+static void send_next(void)
+{
+	if (sender.offset >= sender.file_len) {
+		sender.state = SENDER_EOT;
+		send_byte(XMDM_EOT);
+	} else {
+		sender.state = SENDER_DATA;
+		send_data();
+	}
+}
+
+// Runs the sender on what the receiver sent back
+static void sender_process(void)
+{
+	bool b_timeout = now_ms - sender.last_ms >= SENDER_TIMEOUT_MS;
+
+	while (to_sender.tail != to_sender.head || b_timeout) {
+		// A timeout acts like a NAK
+		uint8_t c = XMDM_NAK;
+		bool b_ack, b_nak, b_start;
+
+		if (to_sender.tail != to_sender.head) {
+			c = to_sender.data[to_sender.tail++ % FIFO_SIZE];
+		}
+		b_timeout = false;
+		b_ack = (c == XMDM_ACK);
+		b_nak = (c == XMDM_NAK);
+		b_start = (c == 'C');
+
+		switch (sender.state) {
+		case SENDER_START:
+			if (b_start && sender.protocol == PROTOCOL_YMODEM) {
+				sender.state = SENDER_HEADER;
+				send_header(false);
+			} else if (b_start) {
+				send_next();
+			}
+			break;
+
+		case SENDER_HEADER:
+			if (b_ack) {
+				sender.state = SENDER_HEADER_C;
+			} else if (b_nak) {
+				send_header(false);
+			}
+			break;
+
+		case SENDER_HEADER_C:
+			// After a lost 'C' the receiver times out with a NAK
+			if (b_start || b_nak) {
+				send_next();
+			}
+			break;
+
+		case SENDER_DATA:
+			if (b_ack) {
+				sender.offset += (sender.protocol == PROTOCOL_XMODEM) ? 128 : 1024;
+				sender.sno++;
+				send_next();
+			} else if (b_nak || (b_start && sender.sno == 1)) {
+				send_data();
+			}
+			break;
+
+		case SENDER_EOT:
+			if (b_ack && sender.protocol == PROTOCOL_YMODEM) {
+				// The NAK to the first EOT was lost, the EOT sent again was the second
+				sender.state = SENDER_END_C;
+			} else if (b_ack) {
+				sender.state = SENDER_DONE;
+			} else if (b_nak && sender.protocol == PROTOCOL_YMODEM) {
+				sender.state = SENDER_EOT2;
+				send_byte(XMDM_EOT);
+			} else if (b_nak) {
+				send_byte(XMDM_EOT);
+			}
+			break;
+
+		case SENDER_EOT2:
+			if (b_ack) {
+				sender.state = SENDER_END_C;
+			} else if (b_nak) {
+				send_byte(XMDM_EOT);
+			}
+			break;
+
+		case SENDER_END_C:
+		case SENDER_END:
+			if (b_start || b_nak) {
+				sender.state = SENDER_END;
+				send_header(true);
+			} else if (b_ack && sender.state == SENDER_END) {
+				sender.state = SENDER_DONE;
+			}
+			break;
+
+		case SENDER_DONE:
+		default:
+			break;
+		}
+	}
+}
+
+static void reset(protocol_t protocol, uint32_t file_len)
+{
+	memset(&to_receiver, 0, sizeof(to_receiver));
+	memset(&to_sender, 0, sizeof(to_sender));
+	memset(&sender, 0, sizeof(sender));
+	sender.protocol = protocol;
+	sender.state = SENDER_START;
+	sender.file_len = file_len;
+	sender.sno = 1;
+	sender.last_ms = now_ms;
+	for (uint32_t i = 0; i < file_len; ++i) {
+		file[i] = rand();
+	}
+	stored_len = 0;
+	b_store_error = false;
+	xmodem_receive_init(store);
+}
+
+// Runs the transfer until the receiver is done or gives up
+static xmodem_status_t run(void)
+{
+	uint32_t start_ms = now_ms;
+	xmodem_status_t status = XMODEM_IDLE;
+
+	while (now_ms - start_ms < TEST_TIMEOUT_MS) {
+		status = xmodem_receive_process();
+		if (status == XMODEM_DONE || status == XMODEM_ERROR) {
+			break;
+		}
+		sender_process();
+		now_ms++;
+	}
+	return status;
+}
+
+static unsigned failures;
+
+static void expect(bool b_ok, const char *test, const char *what)
+{
+	if (!b_ok) {
+		printf("%s: %s\n", test, what);
+		failures++;
+	}
+}
+
+// A transfer may only give up when b_may_fail: too many packets in a row were damaged
+static void test_transfer(const char *test, protocol_t protocol, uint32_t file_len, bool b_may_fail)
+{
+	uint32_t packet_len = (protocol == PROTOCOL_XMODEM) ? 128 : 1024;
+	// XMODEM keeps the padding of the last packet, YMODEM gives the exact length
+	uint32_t expected_len = (protocol == PROTOCOL_YMODEM) ? file_len
+			: (file_len + packet_len - 1) / packet_len * packet_len;
+
+	reset(protocol, file_len);
+	if (run() != XMODEM_DONE) {
+		expect(b_may_fail, test, "transfer not done");
+		return;
+	}
+	expect(!b_store_error, test, "packets stored out of order");
+	expect(xmodem_get_size() == expected_len && stored_len == expected_len, test, "wrong size");
+	expect(!memcmp(stored, file, file_len), test, "file differs");
+	expect(protocol != PROTOCOL_YMODEM || !strcmp(xmodem_get_file_name(), "profile.bin"), test,
+			"wrong file name");
+	expect(!xmodem_is_receiving(), test, "still receiving");
+}
+
+static void test_transfers(const char *channel, bool b_may_fail)
+{
+	static const uint32_t lengths[] = {1, 127, 128, 129, 1023, 1024, 3000, 30 * 1024};
+	static const char *protocol_names[] = {"XMODEM", "XMODEM-1K", "YMODEM"};
+	char test[80];
+
+	for (protocol_t protocol = PROTOCOL_XMODEM; protocol <= PROTOCOL_YMODEM; ++protocol) {
+		for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+			snprintf(test, sizeof(test), "%s, %s, %u bytes", protocol_names[protocol], channel, lengths[i]);
+			test_transfer(test, protocol, lengths[i], b_may_fail);
+		}
+	}
+}
+
+static void test_errors(void)
+{
+	uint32_t start_ms;
+
+	// A packet that never gets through: NAKed until the receiver cancels
+	reset(PROTOCOL_XMODEM, 1024);
+	sender.b_bad_crc = true;
+	expect(run() == XMODEM_ERROR, "bad CRC", "not cancelled");
+	expect(stored_len == 0, "bad CRC", "packet stored");
+	expect(memchr(to_sender.data, XMDM_CAN, to_sender.head) != NULL, "bad CRC", "no CAN sent");
+
+	// A packet missing from the sequence
+	reset(PROTOCOL_XMODEM, 1024);
+	sender.b_skip = true;
+	expect(run() == XMODEM_ERROR, "wrong sequence", "not cancelled");
+	expect(stored_len == 128, "wrong sequence", "only the first packet is stored");
+
+	// The sender cancels
+	reset(PROTOCOL_XMODEM_1K, 4096);
+	start_ms = now_ms;
+	while (stored_len < 2048 && now_ms - start_ms < TEST_TIMEOUT_MS) {
+		xmodem_receive_process();
+		sender_process();
+		now_ms++;
+	}
+	sender.state = SENDER_DONE;
+	send_byte(XMDM_CAN);
+	send_byte(XMDM_CAN);
+	expect(run() == XMODEM_ERROR, "sender cancel", "not cancelled");
+	expect(!xmodem_is_receiving(), "sender cancel", "still receiving");
+
+	// The sender goes silent in a transfer: NAKs until the receiver gives up
+	reset(PROTOCOL_XMODEM, 1024);
+	start_ms = now_ms;
+	while (stored_len < 256 && now_ms - start_ms < TEST_TIMEOUT_MS) {
+		xmodem_receive_process();
+		sender_process();
+		now_ms++;
+	}
+	sender.state = SENDER_DONE;
+	to_sender.tail = to_sender.head;
+	expect(run() == XMODEM_ERROR, "silent sender", "not cancelled");
+}
+
+// Runs the transfer until stored_len bytes are stored, then the host stops reading for stall_ms
+static xmodem_status_t stall(uint32_t stored_len_min, uint32_t stall_ms)
+{
+	uint32_t start_ms = now_ms;
+	xmodem_status_t status = XMODEM_RECEIVING;
+
+	while (stored_len < stored_len_min && now_ms - start_ms < TEST_TIMEOUT_MS) {
+		xmodem_receive_process();
+		sender_process();
+		now_ms++;
+	}
+	b_host_stalled = true;
+	for (start_ms = now_ms; now_ms - start_ms < stall_ms; now_ms++) {
+		status = xmodem_receive_process();
+		if (status == XMODEM_ERROR) {
+			break;
+		}
+		sender_process();
+	}
+	b_host_stalled = false;
+	return status;
+}
+
+static void test_stalled_host(void)
+{
+	// Shorter than the sender timeout: the ACK waits, then the transfer goes on
+	reset(PROTOCOL_XMODEM_1K, 8192);
+	expect(stall(2048, SHORT_STALL_MS) == XMODEM_RECEIVING, "short stall", "transfer dropped");
+	expect(stored_len <= 3072, "short stall", "input read while the reply waits");
+	expect(run() == XMODEM_DONE && stored_len == 8192 && !memcmp(stored, file, 8192), "short stall",
+			"transfer not done");
+
+	// At the end of a YMODEM batch
+	reset(PROTOCOL_YMODEM, 3000);
+	expect(stall(3000, SHORT_STALL_MS) == XMODEM_RECEIVING, "stall at the end", "transfer dropped");
+	expect(run() == XMODEM_DONE && stored_len == 3000, "stall at the end", "transfer not done");
+
+	// Never reads again: the transfer is dropped
+	reset(PROTOCOL_XMODEM, 1024);
+	expect(stall(256, LONG_STALL_MS) == XMODEM_ERROR, "long stall", "not dropped");
+	expect(!xmodem_is_receiving(), "long stall", "still receiving");
+
+	// Idle: no 'C' while the host does not read
+	reset(PROTOCOL_XMODEM, 1024);
+	sender.state = SENDER_DONE;
+	b_host_stalled = true;
+	for (int i = 0; i < 5000; ++i) {
+		expect(xmodem_receive_process() == XMODEM_IDLE, "idle stall", "not idle");
+		now_ms++;
+	}
+	b_host_stalled = false;
+	expect(to_sender.head == 0, "idle stall", "'C' sent");
+
+	expect(putc_calls == 0, "stalled host", "the receiver waited on the host");
+}
+
+// Bytes that are not a sender, then a link frame: the receiver must stop at its 0x00
+static void test_link_frame(const char *test, bool b_one_transfer)
+{
+	static const uint8_t noise[] = {'a', XMDM_SOH, 0x55, XMDM_STX};
+	static const uint8_t frame[] = {0x00, 0x03, 0x01, 0x05, 0x02, 0x6C, 0x00};
+	uint8_t bytes[sizeof(noise) + sizeof(frame)];
+	unsigned frame_start;
+
+	reset(PROTOCOL_XMODEM, 1024);
+	frame_start = to_receiver.head + sizeof(noise);
+	if (b_one_transfer) {
+		memcpy(bytes, noise, sizeof(noise));
+		memcpy(&bytes[sizeof(noise)], frame, sizeof(frame));
+		fifo_write(&to_receiver, bytes, sizeof(bytes));
+	} else {
+		fifo_write(&to_receiver, noise, sizeof(noise));
+		fifo_write(&to_receiver, frame, sizeof(frame));
+	}
+	for (int i = 0; i < 10; ++i) {
+		xmodem_receive_process();
+		now_ms++;
+	}
+	expect(to_receiver.tail == frame_start, test, "the link frame was consumed");
+	expect(!xmodem_is_receiving(), test, "receiving");
+
+	// The link reads its frame, then a sender starts
+	to_receiver.tail = to_receiver.head;
+	to_receiver.bank_end = to_receiver.tail;
+	to_sender.tail = to_sender.head;
+	expect(run() == XMODEM_DONE && !memcmp(stored, file, 1024), test, "no transfer after the frame");
+}
+
+int main(void)
+{
+	srand(1);
+
+	test_transfers("clean channel", false);
+	for (int round = 0; round < NOISY_ROUNDS; ++round) {
+		drop_rate = 30;
+		corrupt_rate = 30;
+		test_transfers("noisy channel", false);
+		// Most 1K packets are damaged: no wrong file may be reported as done
+		drop_rate = 200;
+		corrupt_rate = 200;
+		test_transfers("very noisy channel", true);
+	}
+	drop_rate = 0;
+	corrupt_rate = 0;
+	test_errors();
+	test_stalled_host();
+	test_link_frame("link frame after noise", false);
+	test_link_frame("link frame after noise, same bank", true);
+
+	printf("xmodem_test: %u failures\n", failures);
+	return failures ? 1 : 0;
+}